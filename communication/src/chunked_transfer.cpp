@@ -27,6 +27,7 @@ ProtocolError ChunkedTransfer::handle_update_begin(
 		token_t token, Message& message, MessageChannel& channel)
 {
 	uint8_t flags = 0;
+	bool has_crc = false;
 	int actual_len = message.length();
 	uint8_t* queue = message.buf();
 	message_id_t msg_id = CoAP::message_id(queue);
@@ -36,23 +37,50 @@ ProtocolError ChunkedTransfer::handle_update_begin(
 		file.chunk_size = decode_uint16(queue + 9);
 		file.file_length = decode_uint32(queue + 11);
 		file.store = FileTransfer::Store::Enum(decode_uint8(queue + 15));
+		file.flags = (flags & 0x2) ? FileTransfer::Flags::COMPRESSED : 0;
 		file.file_address = decode_uint32(queue + 16);
 		file.chunk_address = file.file_address;
+		// the CRC of the complete file is optional
+		has_crc = actual_len >= 24;
+		file_crc = has_crc ? decode_uint32(queue + 20) : 0;
 	}
 	else
 	{
 		file.chunk_size = 0;
 		file.file_length = 0;
 		file.store = FileTransfer::Store::FIRMWARE;
+		file.flags = 0;
 		file.file_address = 0;
 		file.chunk_address = 0;
+		file_crc = 0;
 	}
+	// a compressed file is expanded as it is received, so is sent in order rather than with fast OTA
+	if (file.flags & FileTransfer::Flags::COMPRESSED)
+		flags &= ~0x1;
+
 	// check the parameters only
 	bool success = !callbacks->prepare_for_firmware_update(file, 1, NULL);
 	if (success)
 	{
 		success = file.chunk_count(file.chunk_size) < MAX_CHUNKS;
 	}
+
+	// The dry run gives the chunk size and address used, so the file can be matched against the
+	// progress saved from an interrupted transfer. Progress is kept only for fast OTA, where each
+	// chunk gives its index.
+	resumable = success && has_crc && (flags & 0x1) && file.chunk_size &&
+			file.chunk_count(file.chunk_size) <= TransferPersistBitmapSize*8;
+	TransferPersistData progress;
+	bool resume = false;
+	if (resumable)
+	{
+		TransferPersistData expected;
+		chunk_size = file.chunk_size;
+		describe_progress(expected);
+		resume = callbacks->restore_transfer_progress(progress) && expected.same_transfer(progress);
+	}
+	if (resume)
+		file.flags |= FileTransfer::Flags::RESUME;
 	Message response;
 	channel.response(message, response, 16);
 	size_t size = Messages::coded_ack(response.buf(),
@@ -65,6 +93,9 @@ ProtocolError ChunkedTransfer::handle_update_begin(
 
 	if (success)
 	{
+		// the storage is erased unless resuming, so progress saved previously no longer applies
+		if (!resume)
+			discard_progress();
 		if (!callbacks->prepare_for_firmware_update(file, 0, NULL))
 		{
 			DEBUG("starting file length %d chunks %d chunk_size %d",
@@ -85,14 +116,30 @@ ProtocolError ChunkedTransfer::handle_update_begin(
 			// know the correct size of the bitmap.
 			set_chunks_received(flags & 1 ? 0 : 0xFF);
 
+			// when resuming, tell the server the chunks received already if there's room alongside the bitmap
+			size_t received_length = 0;
+			if (resume)
+			{
+				memcpy(bitmap, progress.bitmap, chunk_bitmap_size());
+				INFO("resuming transfer, next missing chunk %d", next_chunk_missing(0));
+				if (size_t(offset) >= 16 + chunk_bitmap_size())
+					received_length = chunk_bitmap_size();
+			}
+
 			// send update_reaady - use fast OTA if available
-			size_t size = Messages::update_ready(updateReady.buf(), 0, token, (flags & 0x1), channel.is_unreliable());
+			size_t size = Messages::update_ready(updateReady.buf(), 0, token, (flags & 0x1) | (resume ? 0x2 : 0),
+					channel.is_unreliable(), bitmap, received_length);
 			updateReady.set_length(size);
 			updateReady.set_confirm_received(true);
 			error = channel.send(updateReady);
 			if (error)
 				DEBUG("error sending updateReady");
 		}
+		else if (resume)
+		{
+			// the storage can't be resumed, so the next attempt starts afresh rather than failing again
+			discard_progress();
+		}
 	}
 	return error;
 }
@@ -168,21 +215,38 @@ ProtocolError ChunkedTransfer::handle_chunk(token_t token, Message& message,
 				crc_valid, fast_ota, updating);
 		if (crc_valid)
 		{
-			callbacks->save_firmware_chunk(file, chunk, NULL);
+			// a resumed transfer may be sent chunks already received
+			bool received = fast_ota && is_chunk_received(chunk_index);
+			if (!received && callbacks->save_firmware_chunk(file, chunk, NULL))
+			{
+				// the file can't be stored, so the update fails now rather than once all of it is sent
+				WARN("chunk %d could not be saved - aborting transfer", chunk_index);
+				reset_updating();
+				discard_progress();
+				callbacks->finish_firmware_update(file, 0, NULL);
+				if (!fast_ota)
+				{
+					response_size = Messages::chunk_received(response.buf(), 0, token, ChunkReceivedCode::BAD, channel.is_unreliable());
+					response.set_length(response_size);
+					return channel.send(response);
+				}
+				return NO_ERROR;
+			}
 			if (!fast_ota)
 			{
 				// message is confirmable for regular OTA or when
 				response_size = Messages::chunk_received(response.buf(), 0, token, ChunkReceivedCode::OK, channel.is_unreliable());
 			}
 			flag_chunk_received(chunk_index);
+			if (!received && resumable)
+				save_progress();
 			if (updating == 2)
 			{            // clearing up missed chunks at the end of fast OTA
 				chunk_index_t next_missed = next_chunk_missing(0);
 				if (next_missed == NO_CHUNKS_MISSING)
 				{
 					INFO("received all chunks");
-					reset_updating();
-					callbacks->finish_firmware_update(file, 1, NULL);
+					finish_update();
 					response_size = Messages::update_done(response.buf(), 0, channel.is_unreliable());
 				}
 				else
@@ -251,8 +315,7 @@ ProtocolError ChunkedTransfer::handle_update_done(token_t token, Message& messag
 	if (!missing)
 	{
 		DEBUG("update done - all done!");
-		reset_updating();
-		callbacks->finish_firmware_update(file, 1, NULL);
+		finish_update();
 	}
 	else
 	{
@@ -343,12 +406,49 @@ void ChunkedTransfer::cancel()
 {
 	if (is_updating())
 	{
-		// was updating but had an error, inform the client
+		// was updating but had an error, inform the client. Any progress saved is kept
+		// so the transfer can be resumed.
 		WARN("handle received message failed - aborting transfer");
 		callbacks->finish_firmware_update(file, 0, NULL);
 	}
 }
 
+void ChunkedTransfer::finish_update()
+{
+	reset_updating();
+	discard_progress();
+	callbacks->finish_firmware_update(file, 1, NULL);
+}
+
+/**
+ * Fills out the progress record for the current file, with no chunks received.
+ */
+void ChunkedTransfer::describe_progress(TransferPersistData& progress)
+{
+	memset(&progress, 0, sizeof(progress));
+	progress.size = sizeof(progress);
+	progress.chunk_size = chunk_size;
+	progress.file_length = file.file_length;
+	progress.file_address = file.file_address;
+	progress.file_crc = file_crc;
+	progress.store = file.store;
+}
+
+void ChunkedTransfer::save_progress()
+{
+	TransferPersistData progress;
+	describe_progress(progress);
+	memcpy(progress.bitmap, chunk_bitmap(), chunk_bitmap_size());
+	callbacks->save_transfer_progress(progress);
+}
+
+void ChunkedTransfer::discard_progress()
+{
+	TransferPersistData progress;
+	memset(&progress, 0, sizeof(progress));
+	callbacks->save_transfer_progress(progress);
+}
+
 
 chunk_index_t ChunkedTransfer::next_chunk_missing(chunk_index_t start)
 {
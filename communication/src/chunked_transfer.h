@@ -24,12 +24,46 @@
 #include "message_channel.h"
 #include "system_tick_hal.h"
 #include "messages.h"
+#include "dtls_session_persist.h"
 
 namespace particle
 {
 namespace protocol
 {
 
+/**
+ * The progress of a transfer, persisted so that a transfer interrupted by a reset
+ * or the loss of the connection continues from where it stopped.
+ */
+struct __attribute__((packed)) TransferPersistData
+{
+	/**
+	 * sizeof(TransferPersistData) when there is a transfer to resume, 0 otherwise.
+	 */
+	uint16_t size;
+	uint16_t chunk_size;
+	uint32_t file_length;
+	uint32_t file_address;
+	/**
+	 * The CRC of the complete file, which identifies the file when the transfer
+	 * is begun again.
+	 */
+	uint32_t file_crc;
+	uint8_t store;
+	uint8_t reserved[3];
+	uint8_t bitmap[TransferPersistBitmapSize];
+
+	bool same_transfer(const TransferPersistData& other) const
+	{
+		return size==sizeof(*this) && other.size==sizeof(*this) &&
+				chunk_size==other.chunk_size && file_length==other.file_length &&
+				file_address==other.file_address && file_crc==other.file_crc &&
+				store==other.store;
+	}
+};
+
+static_assert(sizeof(TransferPersistData)==sizeof(TransferPersistDataOpaque), "transfer persist data and the opaque version should be the same size.");
+
 class ChunkedTransfer
 {
 
@@ -64,6 +98,19 @@ public:
 		  virtual uint32_t calculate_crc(const unsigned char *buf, uint32_t buflen)=0;
 
 		  virtual system_tick_t millis()=0;
+
+		  /**
+		   * Persists the progress of the current transfer. A record with size 0
+		   * discards the progress saved previously.
+		   * @return 0 on success
+		   */
+		  virtual int save_transfer_progress(const TransferPersistData& progress)=0;
+
+		  /**
+		   * Retrieves the progress last saved.
+		   * @return true if there is progress to resume.
+		   */
+		  virtual bool restore_transfer_progress(TransferPersistData& progress)=0;
 	};
 
 private:
@@ -80,6 +127,13 @@ private:
 
 	uint8_t* bitmap;
 
+	/**
+	 * The CRC of the file given with UpdateBegin. The progress of a transfer is
+	 * persisted only when this is given.
+	 */
+	uint32_t file_crc;
+	bool resumable;
+
 	Callbacks* callbacks;
 
 protected:
@@ -107,10 +161,15 @@ protected:
 
 	chunk_index_t next_chunk_missing(chunk_index_t start);
 	void set_chunks_received(uint8_t value);
+
+	void describe_progress(TransferPersistData& progress);
+	void save_progress();
+	void discard_progress();
+	void finish_update();
 public:
 
 	ChunkedTransfer() :
-			updating(false), callbacks(nullptr)
+			updating(false), file_crc(0), resumable(false), callbacks(nullptr)
 	{
 	}
 
@@ -36,11 +36,41 @@ typedef struct __attribute__((packed)) SessionPersistDataOpaque
 	uint8_t data[SessionPersistBaseSize-sizeof(uint16_t)+SessionPersistVariableSize];
 } SessionPersistDataOpaque;
 
+/**
+ * An opaque version of KeepAlivePersistData, stored after the session.
+ */
+typedef struct __attribute__((packed)) KeepAlivePersistDataOpaque
+{
+	uint16_t size;
+	uint8_t data[14];
+} KeepAlivePersistDataOpaque;
+
+// The offset of the keep-alive data in the backup storage
+#define KeepAlivePersistOffset (sizeof(SessionPersistDataOpaque))
+
+// The size of the transfer progress, excluding the bitmap of received chunks
+#define TransferPersistBaseSize 20
+
+// Chunks are tracked for files of up to this many bytes * 8 chunks
+#define TransferPersistBitmapSize 256
+
+/**
+ * An opaque version of TransferPersistData, stored after the keep-alive.
+ */
+typedef struct __attribute__((packed)) TransferPersistDataOpaque
+{
+	uint16_t size;
+	uint8_t data[TransferPersistBaseSize-sizeof(uint16_t)+TransferPersistBitmapSize];
+} TransferPersistDataOpaque;
+
+// The offset of the transfer progress in the backup storage
+#define TransferPersistOffset (KeepAlivePersistOffset+sizeof(KeepAlivePersistDataOpaque))
 
 
 #ifdef __cplusplus
 #include "coap.h"
 #include "spark_protocol_functions.h"	// for SparkCallbacks
+#include "ping.h"						// for KeepAlivePersistData
 
 #ifdef MBEDTLS_SSL_H
 #include "dtls_message_channel.h"
@@ -256,6 +286,7 @@ static_assert(sizeof(SessionPersist)==sizeof(SessionPersistDataOpaque), "Session
 // it must be binary compatible with previous releases
 static_assert(offsetof(SessionPersistData, connection)==4, "internal layout of public member has changed.");
 static_assert((sizeof(SessionPersistData)==sizeof(SessionPersistDataOpaque)), "session persist data and the subclass should be the same size.");
+static_assert(sizeof(KeepAlivePersistData)==sizeof(KeepAlivePersistDataOpaque), "keep-alive persist data and the opaque version should be the same size.");
 
 }}
 
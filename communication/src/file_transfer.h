@@ -32,6 +32,28 @@ namespace FileTransfer {
         };
     };
 
+    namespace Flags {
+        enum __attribute__ ((__packed__)) Enum {
+            /**
+             * The file is compressed (see lzss.h) and is expanded as it is saved.
+             * Compressed files are received in order.
+             */
+            COMPRESSED = 0x01,
+
+            /**
+             * The transfer continues one that was interrupted. The chunks received
+             * previously are kept, so the storage is not erased.
+             */
+            RESUME = 0x02,
+
+            /**
+             * The file may be sent without waiting for each chunk to be acknowledged,
+             * for links that don't lose data, e.g. YMODEM-G over USB serial.
+             */
+            STREAMING = 0x04,
+        };
+    };
+
     struct __attribute__((packed)) Chunk
     {
         uint16_t size;
@@ -54,14 +76,18 @@ namespace FileTransfer {
          * 2 means application-provided storage
          */
         Store::Enum store;
-        uint8_t reserved;       // padding
+
+        /**
+         * A combination of Flags.
+         */
+        uint8_t flags;
     };
 
     STATIC_ASSERT(Chunk_size, sizeof(Chunk)==12);
 
     struct Descriptor : public Chunk
     {
-        Descriptor() { size = sizeof(*this); }
+        Descriptor() { size = sizeof(*this); flags = 0; }
 
         /**
          * The length of the file data.
@@ -134,9 +134,20 @@ public:
     }
 
 
-    static inline size_t update_ready(unsigned char *buf, message_id_t message_id, token_t token, uint8_t flags, bool confirmable)
+    /**
+     * @param received  When resuming a transfer, the bitmap of the chunks received already,
+     *  which follows the flags in the payload. It may be in the same buffer.
+     */
+    static inline size_t update_ready(unsigned char *buf, message_id_t message_id, token_t token, uint8_t flags, bool confirmable,
+            const uint8_t* received=nullptr, size_t received_length=0)
     {
-        return separate_response_with_payload(buf, message_id, token, 0x44, &flags, 1, confirmable);
+        size_t size = separate_response_with_payload(buf, message_id, token, 0x44, &flags, 1, confirmable);
+        if (received_length)
+        {
+            memmove(buf+size, received, received_length);
+            size += received_length;
+        }
+        return size;
     }
 
     static inline size_t chunk_received(unsigned char *buf, message_id_t message_id, token_t token, ChunkReceivedCode::Enum code, bool confirmable)
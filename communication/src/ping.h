@@ -4,14 +4,84 @@
 
 namespace particle { namespace protocol {
 
+/**
+ * The keep-alive intervals learned on a network, persisted so they
+ * survive a reset.
+ */
+struct __attribute__((packed)) KeepAlivePersistData
+{
+	uint16_t size;
+	uint16_t reserved;
+
+	/**
+	 * Identifies the network the intervals were learned on. Maintained by the system.
+	 */
+	uint32_t network;
+
+	/**
+	 * The longest interval that has kept the session.
+	 */
+	uint32_t safe;
+
+	/**
+	 * The shortest interval that has lost the session, 0 when not known.
+	 */
+	uint32_t limit;
+};
+
 class Pinger
 {
 	bool expecting_ping_ack;
 	system_tick_t ping_interval;
 	system_tick_t ping_timeout;
 
+	/**
+	 * The longest interval probed by the adaptive keep-alive, 0 when the interval is fixed.
+	 */
+	system_tick_t max_interval;
+
+	/**
+	 * The interval of the ping awaiting a response, 0 when none.
+	 */
+	system_tick_t probe;
+
+	/**
+	 * The longest interval known to keep the session and the shortest one known to lose it.
+	 */
+	system_tick_t safe;
+	system_tick_t limit;
+
+	/**
+	 * Set when the learned intervals change and should be persisted.
+	 */
+	bool learned;
+
+	/**
+	 * The safe interval, no shorter than the configured interval.
+	 */
+	system_tick_t safe_interval() const
+	{
+		return safe > ping_interval ? safe : ping_interval;
+	}
+
+	void learn(system_tick_t safe, system_tick_t limit)
+	{
+		if (safe!=this->safe || limit!=this->limit)
+		{
+			this->safe = safe;
+			this->limit = limit;
+			learned = true;
+		}
+	}
+
 public:
-	Pinger() : expecting_ping_ack(false), ping_interval(0), ping_timeout(10000) {}
+	/**
+	 * The probing stops when the safe interval is within this fraction of the interval that failed.
+	 */
+	static const unsigned ADAPTIVE_RESOLUTION = 8;
+
+	Pinger() : expecting_ping_ack(false), ping_interval(0), ping_timeout(10000),
+			max_interval(0), probe(0), safe(0), limit(0), learned(false) {}
 
 	/**
 	 * Sets the ping interval that the client will send pings to the server, and the expected maximum response time.
@@ -22,14 +92,49 @@ public:
 		this->ping_timeout = timeout;
 	}
 
+	/**
+	 * Sets a fixed ping interval.
+	 */
 	void set_interval(system_tick_t interval)
 	{
 		this->ping_interval = interval;
+		this->max_interval = 0;
+	}
+
+	/**
+	 * Lets the ping interval grow from the configured interval up to a maximum.
+	 * Longer intervals are probed until the longest one that keeps the session,
+	 * typically until the carrier's NAT drops the mapping, is known.
+	 * @param max	The longest interval to probe, 0 for a fixed interval.
+	 */
+	void set_adaptive(system_tick_t max)
+	{
+		this->max_interval = max > ping_interval ? max : 0;
+	}
+
+	bool is_adaptive() const { return max_interval; }
+
+	/**
+	 * The interval after which the next ping is sent.
+	 */
+	system_tick_t interval() const
+	{
+		if (!max_interval || !ping_interval)
+			return ping_interval;
+		system_tick_t safe = safe_interval();
+		if (safe >= max_interval)
+			return max_interval;
+		if (!limit)
+			return (safe*2 < max_interval) ? safe*2 : max_interval;
+		if (limit <= safe || limit - safe <= safe / ADAPTIVE_RESOLUTION)
+			return safe;
+		return safe + (limit - safe) / 2;
 	}
 
 	void reset()
 	{
 		expecting_ping_ack = false;
+		probe = 0;
 	}
 
 	/**
@@ -51,9 +156,12 @@ public:
 		}
 		else
 		{
-			if (ping_interval && ping_interval < millis_since_last_message)
+			system_tick_t interval = this->interval();
+			if (interval && interval < millis_since_last_message)
 			{
 				expecting_ping_ack = true;
+				if (max_interval)
+					probe = interval;
 				return ping();
 			}
 		}
@@ -62,7 +170,59 @@ public:
 
 	bool is_expecting_ping_ack() const { return expecting_ping_ack; }
 
-	void message_received() { expecting_ping_ack = false; }
+	void message_received()
+	{
+		expecting_ping_ack = false;
+		// the server reached us after the ping, so the session survived the interval
+		if (probe && probe > safe_interval())
+			learn(probe, (limit && limit <= probe) ? 0 : limit);
+		probe = 0;
+	}
+
+	/**
+	 * Notes that the connection failed. When a ping was awaiting a response,
+	 * its interval is taken to be too long.
+	 */
+	void connection_lost()
+	{
+		if (probe && probe > ping_interval)
+		{
+			system_tick_t safe = safe_interval();
+			if (probe > safe)
+				learn(safe, probe);
+			else
+				// an interval that used to be safe failed, so the network has changed - search again
+				learn(ping_interval, safe);
+		}
+		probe = 0;
+	}
+
+	/**
+	 * Determines if the learned intervals changed since the last call.
+	 */
+	bool take_learned()
+	{
+		bool result = learned;
+		learned = false;
+		return result;
+	}
+
+	void save(KeepAlivePersistData& data) const
+	{
+		data.size = sizeof(data);
+		data.reserved = 0;
+		data.safe = safe;
+		data.limit = limit;
+	}
+
+	void restore(const KeepAlivePersistData& data)
+	{
+		if (data.size==sizeof(data))
+		{
+			safe = data.safe;
+			limit = data.limit;
+		}
+	}
 };
 
 
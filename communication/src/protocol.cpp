@@ -42,6 +42,10 @@ ProtocolError Protocol::handle_received_message(Message& message,
 {
 	last_message_millis = callbacks.millis();
 	pinger.message_received();
+	save_keepalive();
+	// the ping has been answered
+	if (traffic==SparkCallbacks::TRAFFIC_PING)
+		account_traffic(SparkCallbacks::TRAFFIC_MESSAGES);
 	uint8_t* queue = message.buf();
 	message_type = Messages::decodeType(queue, message.length());
 	token_t token = queue[4];
@@ -76,6 +80,7 @@ ProtocolError Protocol::handle_received_message(Message& message,
 	case CoAPMessageType::SAVE_BEGIN:
 		// fall through
 	case CoAPMessageType::UPDATE_BEGIN:
+		account_traffic(SparkCallbacks::TRAFFIC_OTA);
 		return chunkedTransfer.handle_update_begin(token, message, channel);
 
 	case CoAPMessageType::CHUNK:
@@ -224,6 +229,32 @@ void Protocol::update_subscription_crc()
 	}
 }
 
+/**
+ * Restores the keep-alive intervals learned on the current network.
+ */
+void Protocol::restore_keepalive()
+{
+	KeepAlivePersistData data;
+	if (pinger.is_adaptive() && callbacks.restore &&
+			callbacks.restore(&data, sizeof(data), SparkCallbacks::PERSIST_KEEPALIVE, nullptr)==sizeof(data))
+	{
+		pinger.restore(data);
+	}
+}
+
+/**
+ * Persists the keep-alive intervals when they have changed.
+ */
+void Protocol::save_keepalive()
+{
+	if (pinger.take_learned() && callbacks.save)
+	{
+		KeepAlivePersistData data;
+		pinger.save(data);
+		callbacks.save(&data, sizeof(data), SparkCallbacks::PERSIST_KEEPALIVE, nullptr);
+	}
+}
+
 /**
  * Computes the current checksum from the application cloud state
  */
@@ -243,6 +274,10 @@ int Protocol::begin()
 {
 	chunkedTransfer.reset();
 	pinger.reset();
+	restore_keepalive();
+	// the socket is new, so its traffic isn't accounted yet
+	traffic = 0;
+	account_traffic(SparkCallbacks::TRAFFIC_HANDSHAKE);
 
 	uint32_t channel_flags = 0;
 	ProtocolError error = channel.establish(channel_flags, application_state_checksum());
@@ -261,11 +296,24 @@ int Protocol::begin()
 		}
 	}
 
+	if (session_resumed && channel.is_unreliable() && (flags & FAST_RESUME))
+	{
+		// the first message sent moves the session, so nothing needs to be sent now.
+		// A changed application state is synchronized once the cloud has answered.
+		if (!(channel_flags & SKIP_SESSION_RESUME_HELLO))
+			flags |= DEFERRED_HELLO;
+		last_message_millis = callbacks.millis();
+		DEBUG("resumed session - fast resume");
+		account_traffic(SparkCallbacks::TRAFFIC_MESSAGES);
+		return error;
+	}
+
 	// hello not needed because it's already been sent and the server maintains device state
 	if (session_resumed && channel.is_unreliable() && (flags & SKIP_SESSION_RESUME_HELLO))
 	{
 		ping(true);
 		DEBUG("resumed session - not sending hello message");
+		account_traffic(SparkCallbacks::TRAFFIC_MESSAGES);
 		return error;
 	}
 
@@ -287,6 +335,7 @@ int Protocol::begin()
 	INFO("Hanshake: completed");
 	channel.notify_established();
 	flags |= SKIP_SESSION_RESUME_HELLO;
+	account_traffic(SparkCallbacks::TRAFFIC_MESSAGES);
 	return error;
 }
 
@@ -316,6 +365,15 @@ ProtocolError Protocol::hello_response()
 	return error;
 }
 
+ProtocolError Protocol::send_deferred_hello()
+{
+	flags &= ~DEFERRED_HELLO;
+	ProtocolError error = hello(descriptor.was_ota_upgrade_successful());
+	if (!error)
+		send_subscriptions();
+	return error;
+}
+
 /**
  * Wait for a specific message type to be received.
  * @param message_type		The type of message wait for
@@ -359,6 +417,9 @@ ProtocolError Protocol::event_loop(CoAPMessageType::Enum& message_type)
 		if (message.length())
 		{
 			error = handle_received_message(message, message_type);
+			// the cloud has answered, so the resumed session is good
+			if (!error && (flags & DEFERRED_HELLO))
+				error = send_deferred_hello();
 		}
 		else
 		{
@@ -370,6 +431,8 @@ ProtocolError Protocol::event_loop(CoAPMessageType::Enum& message_type)
 	{
 		// bail if and only if there was an error
 		chunkedTransfer.cancel();
+		pinger.connection_lost();
+		save_keepalive();
 		WARN("Event loop error %d", error);
 		return error;
 	}
@@ -494,5 +557,16 @@ system_tick_t Protocol::ChunkedTransferCallbacks::millis()
 	return callbacks->millis();
 }
 
+int Protocol::ChunkedTransferCallbacks::save_transfer_progress(const TransferPersistData& progress)
+{
+	return callbacks->save ? callbacks->save(&progress, sizeof(progress), SparkCallbacks::PERSIST_TRANSFER, nullptr) : -1;
+}
+
+bool Protocol::ChunkedTransferCallbacks::restore_transfer_progress(TransferPersistData& progress)
+{
+	return callbacks->restore &&
+			callbacks->restore(&progress, sizeof(progress), SparkCallbacks::PERSIST_TRANSFER, nullptr)==sizeof(progress);
+}
+
 
 }}
@@ -86,6 +86,10 @@ class Protocol
 
 		  virtual system_tick_t millis();
 
+		  virtual int save_transfer_progress(const TransferPersistData& progress);
+
+		  virtual bool restore_transfer_progress(TransferPersistData& progress);
+
 	} chunkedTransferCallbacks;
 
 	/**
@@ -118,6 +122,11 @@ class Protocol
 
 	uint8_t flags;
 
+	/**
+	 * The SparkCallbacks::TrafficType the traffic is accounted to, 0 when not known.
+	 */
+	uint8_t traffic;
+
 public:
 	enum Flags
 	{
@@ -137,6 +146,18 @@ public:
 		 * a keep-alive for UDP
 		 */
 		PING_AS_EMPTY_MESSAGE = 1<<2,
+
+		/**
+		 * Resume a persisted session without a round trip: neither a hello nor a ping
+		 * is sent, so the first application message is the first thing on the wire.
+		 */
+		FAST_RESUME = 1<<3,
+
+		/**
+		 * Internal flag. Set when a fast resume skipped the hello that the changed
+		 * application state needs. It is sent once the cloud has answered.
+		 */
+		DEFERRED_HELLO = 1<<4,
 	};
 
 
@@ -169,6 +190,21 @@ protected:
 	 */
 	ProtocolError hello_response();
 
+	/**
+	 * Sends the hello and subscriptions deferred by a fast resume.
+	 */
+	ProtocolError send_deferred_hello();
+
+	/**
+	 * Accounts the following traffic to a SparkCallbacks::TrafficType.
+	 */
+	void account_traffic(uint8_t type)
+	{
+		if (type!=traffic && callbacks.traffic)
+			callbacks.traffic(type, nullptr);
+		traffic = type;
+	}
+
 	virtual size_t build_hello(Message& message, bool was_ota_upgrade_successful)=0;
 
 	/**
@@ -201,9 +237,11 @@ protected:
 		}
 		else
 		{
+			if (traffic==SparkCallbacks::TRAFFIC_OTA)
+				account_traffic(SparkCallbacks::TRAFFIC_MESSAGES);
 			ProtocolError error = pinger.process(
-					callbacks.millis() - last_message_millis, [this]
-					{	return ping();});
+					callbacks.millis() - last_message_millis, [this]() -> ProtocolError
+					{	account_traffic(SparkCallbacks::TRAFFIC_PING); return ping();});
 			if (error)
 				return error;
 		}
@@ -256,10 +294,13 @@ protected:
 
 	uint32_t application_state_checksum();
 
+	void restore_keepalive();
+	void save_keepalive();
+
 public:
 	Protocol(MessageChannel& channel) :
 			channel(channel),
-			product_id(PRODUCT_ID), product_firmware_version(PRODUCT_FIRMWARE_VERSION), initialized(false)
+			product_id(PRODUCT_ID), product_firmware_version(PRODUCT_FIRMWARE_VERSION), initialized(false), traffic(0)
 	{
 	}
 
@@ -278,6 +319,23 @@ public:
 		pinger.set_interval(interval);
 	}
 
+	void set_fast_resume(bool enable)
+	{
+		if (enable)
+			flags |= FAST_RESUME;
+		else
+			flags &= ~(FAST_RESUME|DEFERRED_HELLO);
+	}
+
+	/**
+	 * Lets the keep-alive interval grow up to the given maximum, 0 to keep it fixed.
+	 */
+	void set_keepalive_max(system_tick_t max)
+	{
+		pinger.set_adaptive(max);
+		restore_keepalive();
+	}
+
 	void set_handlers(CommunicationsHandlers& handlers)
 	{
 		copy_and_init(&this->handlers, sizeof(this->handlers), &handlers, handlers.size);
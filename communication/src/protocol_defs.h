@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <cstddef>
 #include "system_tick_hal.h"
 
 typedef uint16_t product_id_t;
@@ -73,7 +74,9 @@ namespace Connection
 {
 enum Enum
 {
-    PING = 0
+    PING = 0,
+    PING_MAX = 1,    // the longest interval probed by the adaptive keep-alive
+    FAST_RESUME = 2  // resume a session without a round trip when non-zero
 };
 }
 
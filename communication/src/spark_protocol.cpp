@@ -977,6 +977,7 @@ bool SparkProtocol::handle_update_begin(msg& message)
         file.chunk_size = decode_uint16(queue+9);
         file.file_length = decode_uint32(queue+11);
         file.store = FileTransfer::Store::Enum(decode_uint8(queue+15));
+        file.flags = (flags & 0x2) ? FileTransfer::Flags::COMPRESSED : 0;
         file.file_address = decode_uint32(queue+16);
         file.chunk_address = file.file_address;
     }
@@ -984,10 +985,15 @@ bool SparkProtocol::handle_update_begin(msg& message)
         file.chunk_size = 0;
         file.file_length = 0;
         file.store = FileTransfer::Store::FIRMWARE;
+        file.flags = 0;
         file.file_address = 0;
         file.chunk_address = 0;
     }
 
+    // a compressed file is expanded as it is received, so is sent in order rather than with fast OTA
+    if (file.flags & FileTransfer::Flags::COMPRESSED)
+        flags &= ~0x1;
+
     // check the parameters only
     bool success = !callbacks.prepare_for_firmware_update(file, 1, NULL);
     if (success) {
@@ -1080,9 +1086,20 @@ bool SparkProtocol::handle_chunk(msg& message)
         bool has_response = false;
         bool crc_valid = (crc == given_crc);
         DEBUG("chunk idx=%d crc=%d fast=%d updating=%d", chunk_index, crc_valid, fast_ota, updating);
-        if (crc_valid)
+        if (crc_valid && callbacks.save_firmware_chunk(file, chunk, NULL))
+        {
+            // the file can't be stored, so the update fails now rather than once all of it is sent
+            WARN("chunk %d could not be saved - aborting transfer", chunk_index);
+            reset_updating();
+            callbacks.finish_firmware_update(file, 0, NULL);
+            if (!fast_ota)
+            {
+                chunk_received(msg_to_send + 2, message.token, ChunkReceivedCode::BAD);
+                has_response = true;
+            }
+        }
+        else if (crc_valid)
         {
-            callbacks.save_firmware_chunk(file, chunk, NULL);
             if (!fast_ota || (updating!=2 && (true || (chunk_index & 32)==0))) {
                 chunk_received(msg_to_send + 2, message.token, ChunkReceivedCode::OK);
                 has_response = true;
@@ -139,6 +139,14 @@ int spark_protocol_set_connection_property(ProtocolFacade* protocol, unsigned pr
     {
         protocol->set_keepalive(data);
     }
+    else if (property_id == particle::protocol::Connection::PING_MAX)
+    {
+        protocol->set_keepalive_max(data);
+    }
+    else if (property_id == particle::protocol::Connection::FAST_RESUME)
+    {
+        protocol->set_fast_resume(data);
+    }
     return 0;
 }
 int spark_protocol_command(ProtocolFacade* protocol, ProtocolCommands::Enum cmd, uint32_t data, void* reserved)
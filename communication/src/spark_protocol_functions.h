@@ -106,7 +106,9 @@ struct SparkCallbacks
 
   	enum PersistType
 	{
-  		PERSIST_SESSION = 0
+  		PERSIST_SESSION = 0,
+  		PERSIST_KEEPALIVE = 1,
+  		PERSIST_TRANSFER = 2
 	};
 	int (*save)(const void* data, size_t length, uint8_t type, void* reserved);
 	/**
@@ -115,9 +117,26 @@ struct SparkCallbacks
 	int (*restore)(void* data, size_t max_length, uint8_t type, void* reserved);
 
 	// size == 52
+
+	/**
+	 * What the following traffic is for. The values match socket_usage_t.
+	 */
+	enum TrafficType
+	{
+		TRAFFIC_MESSAGES = 1,
+		TRAFFIC_HANDSHAKE = 2,
+		TRAFFIC_PING = 3,
+		TRAFFIC_OTA = 4
+	};
+	/**
+	 * Called when the traffic changes purpose, so the data used can be accounted to it.
+	 */
+	void (*traffic)(uint8_t type, void* reserved);
+
+	// size == 56
 };
 
-STATIC_ASSERT(SparkCallbacks_size, sizeof(SparkCallbacks)==(sizeof(void*)*13));
+STATIC_ASSERT(SparkCallbacks_size, sizeof(SparkCallbacks)==(sizeof(void*)*14));
 
 /**
  * Application-supplied callbacks. (Deliberately distinct from the system-supplied
@@ -201,6 +220,15 @@ void extract_public_rsa_key(uint8_t* device_pubkey, const uint8_t* device_privke
  */
 extern ProtocolFacade* spark_protocol_instance();
 
+/**
+ * Allocates a new protocol instance, separate from the static instance. This is not
+ * exported from the dynamic library, so is only available where the communication
+ * library is linked in, such as the virtual device.
+ * @param factory   The protocol to create.
+ * @return The new instance, or NULL when the protocol isn't supported on this platform.
+ */
+extern ProtocolFacade* create_protocol(ProtocolFactory factory);
+
 #ifdef	__cplusplus
 }
 #endif
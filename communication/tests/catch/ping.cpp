@@ -96,3 +96,118 @@ SCENARIO("ping requests and responses are managed")
 	}
 
 }
+
+SCENARIO("the adaptive keep-alive converges on the longest interval that keeps the session")
+{
+	GIVEN("An adaptive pinger probing from 15s up to 120s")
+	{
+		Pinger pinger;
+		pinger.init(15000, 10000);
+		pinger.set_adaptive(120000);
+		REQUIRE(pinger.is_adaptive());
+
+		auto ping_at = [&](system_tick_t interval) {
+			REQUIRE(pinger.process(interval, []{return NO_ERROR;})==NO_ERROR);
+			REQUIRE(pinger.is_expecting_ping_ack());
+		};
+
+		THEN("The first probe doubles the interval")
+		{
+			REQUIRE(pinger.interval()==30000);
+		}
+
+		WHEN("The probes succeed")
+		{
+			ping_at(30001);
+			pinger.message_received();
+			REQUIRE(pinger.take_learned());
+			REQUIRE(!pinger.take_learned());
+			REQUIRE(pinger.interval()==60000);
+			ping_at(60001);
+			pinger.message_received();
+			ping_at(120001);
+			pinger.message_received();
+
+			THEN("The interval stops at the maximum")
+			{
+				REQUIRE(pinger.interval()==120000);
+			}
+		}
+
+		// pings until the interval no longer changes
+		auto converge = [&](system_tick_t nat) {
+			for (int i=0; i<20; i++)
+			{
+				system_tick_t interval = pinger.interval();
+				ping_at(interval+1);
+				if (interval < nat)
+					pinger.message_received();
+				else
+				{
+					pinger.connection_lost();
+					pinger.reset();
+				}
+			}
+			return pinger.interval();
+		};
+
+		WHEN("The NAT drops the mapping after 50s")
+		{
+			const system_tick_t nat = 50000;
+			system_tick_t interval = converge(nat);
+
+			THEN("The interval converges just below the NAT timeout")
+			{
+				REQUIRE(interval < nat);
+				REQUIRE(interval >= nat - nat/Pinger::ADAPTIVE_RESOLUTION);
+			}
+
+			THEN("The learned intervals can be restored")
+			{
+				KeepAlivePersistData data;
+				pinger.save(data);
+				Pinger restored;
+				restored.init(15000, 10000);
+				restored.set_adaptive(120000);
+				restored.restore(data);
+				REQUIRE(restored.interval()==interval);
+			}
+		}
+
+		WHEN("An interval that was safe fails")
+		{
+			system_tick_t safe = converge(50000);
+			pinger.take_learned();
+			ping_at(safe+1);
+			pinger.connection_lost();
+
+			THEN("The search starts again from the configured interval")
+			{
+				REQUIRE(pinger.take_learned());
+				REQUIRE(pinger.interval()==15000 + (safe-15000)/2);
+			}
+		}
+
+		WHEN("The connection fails without a ping outstanding")
+		{
+			pinger.connection_lost();
+
+			THEN("Nothing is learned")
+			{
+				REQUIRE(!pinger.take_learned());
+				REQUIRE(pinger.interval()==30000);
+			}
+		}
+
+		WHEN("The interval is set to a fixed value")
+		{
+			pinger.set_interval(20000);
+
+			THEN("No longer intervals are probed")
+			{
+				REQUIRE(!pinger.is_adaptive());
+				REQUIRE(pinger.interval()==20000);
+			}
+		}
+	}
+}
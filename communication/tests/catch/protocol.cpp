@@ -42,6 +42,10 @@ public:
 		Protocol::init(callbacks, descriptor);
 	}
 
+	virtual void command(ProtocolCommands::Enum command, uint32_t data)
+	{
+	}
+
 };
 
 SCENARIO("default product co-ordinates are set")
@@ -226,3 +230,64 @@ SCENARIO("Events are non-confirmable over an unreliable channel with the NO_ACK
 {
 	verify_event_type_with_flags(EventType::NO_ACK, CoAPType::NON);
 }
+
+SCENARIO("A fast resume sends nothing until the application does")
+{
+	ProtocolBuilder builder;
+	builder.callbacks.millis = &fake_millis;
+	builder.descriptor.size = sizeof(builder.descriptor);
+	builder.descriptor.was_ota_upgrade_successful = []{ return false; };
+	Mock<MessageChannel> channel;
+	AbstractProtocol p(channel.get());
+	builder.build(p);
+	p.set_fast_resume(true);
+
+	bool state_changed = false;
+	When(Method(channel,establish)).AlwaysDo([&state_changed](uint32_t& flags, uint32_t app_crc) {
+		if (!state_changed)
+			flags |= Protocol::SKIP_SESSION_RESUME_HELLO;
+		return SESSION_RESUMED;
+	});
+	When(Method(channel,is_unreliable)).AlwaysReturn(true);
+	When(Method(channel,command)).AlwaysReturn(NO_ERROR);
+	uint8_t buf[50];
+	When(Method(channel,create)).AlwaysDo([&buf](Message& msg, size_t size) {
+		msg.set_buffer(buf, sizeof(buf));
+		return NO_ERROR;
+	});
+	When(Method(channel,send)).AlwaysReturn(NO_ERROR);
+
+	GIVEN("The application state is unchanged")
+	{
+		THEN("No message is sent on resume")
+		{
+			REQUIRE(p.begin()==SESSION_RESUMED);
+			VerifyNoOtherInvocations(Method(channel,send));
+		}
+	}
+
+	GIVEN("The application state has changed")
+	{
+		state_changed = true;
+		REQUIRE(p.begin()==SESSION_RESUMED);
+		VerifyNoOtherInvocations(Method(channel,send));
+
+		WHEN("The cloud answers")
+		{
+			Message ack;
+			uint8_t ack_buf[50];
+			ack.set_buffer(ack_buf, sizeof(ack_buf));
+			ack.set_length(Messages::empty_ack(ack_buf, 0, 0));
+			When(Method(channel,receive)).Do([&ack](Message& msg) {
+				msg = ack;
+				return NO_ERROR;
+			});
+			REQUIRE(p.event_loop());
+
+			THEN("The deferred hello is sent")
+			{
+				Verify(Method(channel,send)).AtLeastOnce();
+			}
+		}
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FLEET_HAL_H
+#define FLEET_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A fleet is many simulated devices run in one process. Only the virtual device
+ * implements these functions.
+ */
+typedef struct {
+    uint16_t size;
+    uint16_t threads;           /* the number of threads running the devices, 0 for one per core */
+    const char* directory;      /* holds a directory for each device, named after its device ID */
+} hal_fleet_config_t;
+
+/**
+ * Retrieves the fleet this process is configured to run.
+ * @return false when the process runs just its own device.
+ */
+bool HAL_Fleet_Config(hal_fleet_config_t* config, void* reserved);
+
+typedef struct hal_fleet_device hal_fleet_device_t;
+
+/**
+ * Creates a device with its own HAL state. The device ID is given, the private key is read
+ * from device_key.der in the device's directory and the eeprom from eeprom.bin when present.
+ * Otherwise the device is configured as this process's device is.
+ * @return NULL when the device key cannot be read.
+ */
+hal_fleet_device_t* HAL_Fleet_Device_Create(const char* directory, const char* device_id, void* reserved);
+
+void HAL_Fleet_Device_Destroy(hal_fleet_device_t* device, void* reserved);
+
+/**
+ * Makes the HAL functions called on this thread act on the given device.
+ * @param device    The device, or NULL for this process's own device.
+ * @return The device selected previously.
+ */
+hal_fleet_device_t* HAL_Fleet_Device_Select(hal_fleet_device_t* device, void* reserved);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* FLEET_HAL_H */
@@ -113,12 +113,22 @@ uint16_t HAL_OTA_ChunkSize();
 flash_device_t HAL_OTA_FlashDevice();
 
 /**
- * Erase a region of flash in preparation for flashing content.
- * @param address   The start address to erase. Must be on a flash boundary.
- * @param length
+ * Prepares a region of flash for an update. Platforms with large flash sectors, such as
+ * the Photon and Electron, don't erase the region here. HAL_FLASH_Update() erases each
+ * sector the first time it writes to it, so the update doesn't wait for the whole region
+ * to be erased. Other platforms erase the whole region here.
+ * @param address   The start of the region. Must be on a flash boundary.
+ * @param length    The length of the content to be written.
  */
 bool HAL_FLASH_Begin(uint32_t address, uint32_t length, void* reserved);
 
+/**
+ * Continues an update that was interrupted after HAL_FLASH_Begin(). The region
+ * is not erased, so what was written previously is kept.
+ * @return true if the update can be continued.
+ */
+bool HAL_FLASH_Resume(uint32_t address, uint32_t length, void* reserved);
+
 /**
  * Updates part of the OTA image.
  * @result 0 on success. non-zero on error.
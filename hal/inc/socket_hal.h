@@ -29,6 +29,7 @@
 
 #include "debug.h"
 #include <stdint.h>
+#include <stddef.h>
 #include "system_tick_hal.h"
 #include "inet_hal.h"
 #include <stdbool.h>
@@ -128,6 +129,79 @@ typedef struct sock_peer_t {
 } sock_peer_t;
 sock_result_t socket_peer(sock_handle_t sd, sock_peer_t* peer, void* reserved);
 
+typedef struct sock_iovec_t {
+    const void* data;
+    socklen_t length;
+} sock_iovec_t;
+
+/**
+ * Sends the content of several buffers on a connected socket as a single write.
+ * @param sd        The socket handle to send
+ * @param iov       The buffers to send, in order
+ * @param count     The number of buffers
+ * @return The number of bytes sent, which can be less than the total requested, or a negative value on error.
+ */
+sock_result_t socket_sendv(sock_handle_t sd, const sock_iovec_t* iov, size_t count, void* reserved);
+
+/**
+ * Waits until one or more sockets have data available to read or a connection to accept.
+ * @param handles   Receives the handles of the ready sockets. May be NULL.
+ * @param count     The maximum number of handles to store.
+ * @param timeout   The maximum time to wait in milliseconds. 0 returns immediately.
+ * @return The number of ready sockets, 0 on timeout, or a negative value when readiness
+ *  notification is not supported by the platform.
+ */
+sock_result_t socket_wait_readable(sock_handle_t* handles, size_t count, system_tick_t timeout, void* reserved);
+
+/**
+ * What the traffic of a socket is for, so the data used can be accounted to
+ * the subsystems of the device.
+ */
+typedef enum socket_usage_t {
+    SOCKET_USAGE_APPLICATION = 0,       // application sockets, the default
+    SOCKET_USAGE_CLOUD = 1,             // cloud messages: events, functions and variables
+    SOCKET_USAGE_CLOUD_HANDSHAKE = 2,   // establishing the cloud session
+    SOCKET_USAGE_CLOUD_PING = 3,        // cloud keep-alive
+    SOCKET_USAGE_OTA = 4,               // firmware updates
+    SOCKET_USAGE_COUNT
+} socket_usage_t;
+
+/**
+ * The data moved by a socket, or by all sockets used for a subsystem. Only the
+ * payload is counted, not the headers added by the network stack.
+ */
+typedef struct socket_usage_stats_t {
+    uint16_t size;
+    uint32_t tx_bytes;
+    uint32_t rx_bytes;
+    uint32_t tx_packets;    // sends that moved data
+    uint32_t rx_packets;    // receives that moved data
+} socket_usage_stats_t;
+
+/**
+ * Accounts the following traffic of a socket to a subsystem.
+ * @param sd        The socket handle
+ * @param usage     The socket_usage_t. Sockets are created as SOCKET_USAGE_APPLICATION.
+ * @return 0 on success, or a negative value when not supported by the platform.
+ */
+sock_result_t socket_set_usage(sock_handle_t sd, uint8_t usage, void* reserved);
+
+/**
+ * Retrieves the data moved by a socket since it was created.
+ * @param sd        The socket handle
+ * @param stats     Receives the counters. The size member must be set by the caller.
+ * @return 0 on success, or a negative value on error.
+ */
+sock_result_t socket_usage(sock_handle_t sd, socket_usage_stats_t* stats, void* reserved);
+
+/**
+ * Retrieves the data moved by all sockets for a subsystem since the device started.
+ * @param usage     The socket_usage_t
+ * @param stats     Receives the counters. The size member must be set by the caller.
+ * @return 0 on success, or a negative value on error.
+ */
+sock_result_t socket_usage_total(uint8_t usage, socket_usage_stats_t* stats, void* reserved);
+
 //------------ Socket Types ------------
 
 // don't redefine when building GCC target on OSX or linux
@@ -0,0 +1,115 @@
+/**
+  Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#ifndef SOCKET_USAGE_H
+#define	SOCKET_USAGE_H
+
+#include "socket_hal.h"
+#include <string.h>
+
+/**
+ * The traffic counters a socket HAL keeps for each socket.
+ */
+struct SocketTraffic
+{
+    uint8_t usage;
+    socket_usage_stats_t stats;
+
+    SocketTraffic() { reset(); }
+
+    void reset()
+    {
+        memset(&stats, 0, sizeof(stats));
+        stats.size = sizeof(stats);
+        usage = SOCKET_USAGE_APPLICATION;
+    }
+};
+
+/**
+ * Accounts the data moved by the sockets of a HAL to the sockets and to the
+ * subsystems they are used for. The counters aren't guarded; a count may be
+ * lost when two threads use sockets at the same time.
+ */
+class SocketUsage
+{
+    socket_usage_stats_t totals[SOCKET_USAGE_COUNT];
+
+    static void add(uint32_t& bytes, uint32_t& packets, sock_result_t result)
+    {
+        if (result>0) {
+            bytes += result;
+            packets++;
+        }
+    }
+
+public:
+
+    SocketUsage()
+    {
+        memset(totals, 0, sizeof(totals));
+    }
+
+    /**
+     * Accounts the result of a send.
+     */
+    void sent(SocketTraffic& socket, sock_result_t result)
+    {
+        add(socket.stats.tx_bytes, socket.stats.tx_packets, result);
+        add(totals[socket.usage].tx_bytes, totals[socket.usage].tx_packets, result);
+    }
+
+    /**
+     * Accounts the result of a receive.
+     */
+    void received(SocketTraffic& socket, sock_result_t result)
+    {
+        add(socket.stats.rx_bytes, socket.stats.rx_packets, result);
+        add(totals[socket.usage].rx_bytes, totals[socket.usage].rx_packets, result);
+    }
+
+    static sock_result_t set_usage(SocketTraffic& socket, uint8_t usage)
+    {
+        if (usage>=SOCKET_USAGE_COUNT)
+            return -1;
+        socket.usage = usage;
+        return 0;
+    }
+
+    sock_result_t total(uint8_t usage, socket_usage_stats_t* stats) const
+    {
+        if (usage>=SOCKET_USAGE_COUNT)
+            return -1;
+        return copy(totals[usage], stats);
+    }
+
+    /**
+     * Copies the counters to a structure of the size given by the caller,
+     * who may be compiled against an older version of the HAL.
+     */
+    static sock_result_t copy(const socket_usage_stats_t& from, socket_usage_stats_t* to)
+    {
+        if (!to || to->size<sizeof(to->size))
+            return -1;
+        uint16_t size = to->size;
+        memcpy(to, &from, size<sizeof(from) ? size : sizeof(from));
+        to->size = size;
+        return 0;
+    }
+};
+
+#endif	/* SOCKET_USAGE_H */
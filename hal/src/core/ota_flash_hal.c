@@ -59,6 +59,11 @@ bool HAL_FLASH_Begin(uint32_t sFLASH_Address, uint32_t fileSize, void* reserved)
     return true;
 }
 
+bool HAL_FLASH_Resume(uint32_t sFLASH_Address, uint32_t fileSize, void* reserved)
+{
+    return false;
+}
+
 int HAL_FLASH_Update(const uint8_t *pBuffer, uint32_t address, uint32_t bufferSize,  void* reserved)
 {
     return FLASH_Update(pBuffer, address, bufferSize);
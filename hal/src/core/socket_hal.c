@@ -212,3 +212,42 @@ sock_result_t socket_peer(sock_handle_t sd, sock_peer_t* peer, void* reserved)
 {
     return -1;
 }
+
+sock_result_t socket_sendv(sock_handle_t sd, const sock_iovec_t* iov, size_t count, void* reserved)
+{
+    sock_result_t total = 0;
+    size_t i;
+    for (i=0; i<count; i++) {
+        sock_result_t result = socket_send(sd, iov[i].data, iov[i].length);
+        if (result<0)
+            return total ? total : result;
+        total += result;
+        if ((socklen_t)result<iov[i].length)
+            break;
+    }
+    return total;
+}
+
+sock_result_t socket_wait_readable(sock_handle_t* handles, size_t count, system_tick_t timeout, void* reserved)
+{
+    /* Not supported on Core */
+    return -1;
+}
+
+sock_result_t socket_set_usage(sock_handle_t sd, uint8_t usage, void* reserved)
+{
+    /* Not supported on Core */
+    return -1;
+}
+
+sock_result_t socket_usage(sock_handle_t sd, socket_usage_stats_t* stats, void* reserved)
+{
+    /* Not supported on Core */
+    return -1;
+}
+
+sock_result_t socket_usage_total(uint8_t usage, socket_usage_stats_t* stats, void* reserved)
+{
+    /* Not supported on Core */
+    return -1;
+}
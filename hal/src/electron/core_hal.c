@@ -76,9 +76,9 @@ IDX[x] = added IRQ handler
 25 [x] EXTI3_IRQHandler                  // EXTI Line3
 26 [x] EXTI4_IRQHandler                  // EXTI Line4
 27 [ ] DMA1_Stream0_IRQHandler           // DMA1 Stream 0
-28 [ ] DMA1_Stream1_IRQHandler           // DMA1 Stream 1
+28 [x] DMA1_Stream1_IRQHandler           // DMA1 Stream 1
 29 [ ] DMA1_Stream2_IRQHandler           // DMA1 Stream 2
-30 [ ] DMA1_Stream3_IRQHandler           // DMA1 Stream 3
+30 [x] DMA1_Stream3_IRQHandler           // DMA1 Stream 3
 31 [ ] DMA1_Stream4_IRQHandler           // DMA1 Stream 4
 32 [ ] DMA1_Stream5_IRQHandler           // DMA1 Stream 5
 33 [ ] DMA1_Stream6_IRQHandler           // DMA1 Stream 6
@@ -162,6 +162,8 @@ const unsigned EXTI1_IRQHandler_Idx                 = 23;
 const unsigned EXTI2_IRQHandler_Idx                 = 24;
 const unsigned EXTI3_IRQHandler_Idx                 = 25;
 const unsigned EXTI4_IRQHandler_Idx                 = 26;
+const unsigned DMA1_Stream1_IRQHandler_Idx          = 28;
+const unsigned DMA1_Stream3_IRQHandler_Idx          = 30;
 const unsigned ADC_IRQHandler_Idx                   = 34;
 const unsigned CAN1_TX_IRQHandler_Idx               = 35;
 const unsigned CAN1_RX0_IRQHandler_Idx              = 36;
@@ -290,6 +292,10 @@ void HAL_Core_Setup_override_interrupts(void)
     isrs[I2C3_EV_IRQHandler_Idx]            = (uint32_t)I2C3_EV_irq;
     isrs[I2C3_ER_IRQHandler_Idx]            = (uint32_t)I2C3_ER_irq;
     isrs[DMA1_Stream7_IRQHandler_Idx]       = (uint32_t)DMA1_Stream7_irq;
+#if !defined(USE_USART3_DMA) || USE_USART3_DMA   // the default in electronserialpipe_hal.h
+    isrs[DMA1_Stream1_IRQHandler_Idx]       = (uint32_t)DMA1_Stream1_irq;
+    isrs[DMA1_Stream3_IRQHandler_Idx]       = (uint32_t)DMA1_Stream3_irq;
+#endif
     isrs[DMA2_Stream5_IRQHandler_Idx]       = (uint32_t)DMA2_Stream5_irq;
     isrs[RTC_Alarm_IRQHandler_Idx]          = (uint32_t)RTC_Alarm_irq;
     SCB->VTOR = (unsigned long)isrs;
@@ -0,0 +1,270 @@
+/*
+ ******************************************************************************
+ *  Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include "at_lexer.h"
+
+// the patterns in order of precedence, when more than one matches the same line
+const AtLexer::Pattern AtLexer::_patterns[] = {
+    { "\r\n+USORD: %d,%d,\"%c\"",                   NULL,               TYPE_PLUS       },
+    { "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"",  NULL,               TYPE_PLUS       },
+    { "\r\n+URDFILE: %s,%d,\"%c\"",                 NULL,               TYPE_PLUS       },
+    { "\r\nOK\r\n",                                 NULL,               TYPE_OK         },
+    { "\r\nERROR\r\n",                              NULL,               TYPE_ERROR      },
+    { "\r\n+CME ERROR:",                            "\r\n",             TYPE_ERROR      },
+    { "\r\n+CMS ERROR:",                            "\r\n",             TYPE_ERROR      },
+    { "\r\nRING\r\n",                               NULL,               TYPE_RING       },
+    { "\r\nCONNECT\r\n",                            NULL,               TYPE_CONNECT    },
+    { "\r\nNO CARRIER\r\n",                         NULL,               TYPE_NOCARRIER  },
+    { "\r\nNO DIALTONE\r\n",                        NULL,               TYPE_NODIALTONE },
+    { "\r\nBUSY\r\n",                               NULL,               TYPE_BUSY       },
+    { "\r\nNO ANSWER\r\n",                          NULL,               TYPE_NOANSWER   },
+    { "\r\n+",                                      "\r\n",             TYPE_PLUS       },
+    { "\r\n@",                                      NULL,               TYPE_PROMPT     }, // Sockets
+    { "\r\n>",                                      NULL,               TYPE_PROMPT     }, // SMS
+    { "\n>",                                        NULL,               TYPE_PROMPT     }, // File
+    { "\r\nABORTED\r\n",                            NULL,               TYPE_ABORTED    }, // Current command aborted
+};
+
+enum {
+    MATCH_FORMAT,       // the next char is compared with the format
+    MATCH_NUMBER,       // within %d
+    MATCH_CHARS,        // within %c
+    MATCH_STRING,       // within the quotes of %s
+    MATCH_STRING_END,   // the char following %s is compared with the format
+    MATCH_ANY,          // the char in front of the terminator
+    MATCH_END           // searching for the terminator
+};
+
+const int AtLexer::_patternCount = sizeof(_patterns)/sizeof(*_patterns);
+
+void AtLexer::reset(void)
+{
+    _pattern = -1;
+    _start = 0;
+    _pos = 0;
+    _pending = false;
+    _payload = 0;
+    _quote = false;
+}
+
+int AtLexer::_literal(const Pattern& pattern, Match& match, char ch)
+{
+    if (*match.fmt++ != ch)
+        return NOT_FOUND;
+    if (match.bulk && _atPayload(match))
+        return 1; // the payload goes to the sink
+    if (*match.fmt)
+        return WAIT;
+    if (pattern.end) {
+        match.state = MATCH_ANY;
+        return WAIT;
+    }
+    return 1;
+}
+
+int AtLexer::_feed(const Pattern& pattern, Match& match, char ch)
+{
+    for (;;) {
+        switch (match.state) {
+        case MATCH_FORMAT:
+            if (*match.fmt == '%') {
+                char spec = match.fmt[1];
+                if (spec == 'd') {
+                    match.fmt += 2;
+                    match.num = 0;
+                    match.state = MATCH_NUMBER;
+                    continue;
+                }
+                if (spec == 'c') {
+                    match.fmt += 2;
+                    match.state = MATCH_CHARS;
+                    continue;
+                }
+                if (spec == 's') {
+                    match.fmt += 2;
+                    if (ch != '\"')
+                        return NOT_FOUND;
+                    match.state = MATCH_STRING;
+                    return WAIT;
+                }
+            }
+            return _literal(pattern, match, ch);
+        case MATCH_NUMBER:
+            if (ch >= '0' && ch <= '9') {
+                match.num = match.num * 10 + (ch - '0');
+                return WAIT;
+            }
+            match.state = MATCH_FORMAT;
+            return _literal(pattern, match, ch);
+        case MATCH_CHARS:
+            // the char following the payload is compared with the format
+            if (match.num > 0) {
+                match.num --;
+                return WAIT;
+            }
+            match.state = MATCH_FORMAT;
+            return _literal(pattern, match, ch);
+        case MATCH_STRING:
+            if (ch == '\"')
+                match.state = MATCH_STRING_END;
+            return WAIT;
+        case MATCH_STRING_END:
+            match.state = MATCH_FORMAT;
+            return _literal(pattern, match, ch);
+        case MATCH_ANY:
+            match.state = MATCH_END;
+            match.end = 0;
+            return WAIT;
+        default: // MATCH_END
+            match.end = (pattern.end[match.end] == ch) ? match.end + 1 :
+                        (pattern.end[0] == ch)         ? 1 :
+                                                         0;
+            return pattern.end[match.end] ? WAIT : 1;
+        }
+    }
+}
+
+void AtLexer::_begin(int pattern, Pipe<char>* pipe)
+{
+    _pattern = pattern;
+    _match.fmt = _patterns[pattern].fmt;
+    _match.num = 0;
+    _match.state = MATCH_FORMAT;
+    _match.bulk = (_sink != NULL);
+    _pos = _start;
+    pipe->set(_pos);
+}
+
+void AtLexer::_fail(Pipe<char>* pipe)
+{
+    if (_pattern + 1 < _patternCount) {
+        _begin(_pattern + 1, pipe);
+    }
+    else {
+        // no line starts here, try again from the following char
+        _pattern = -1;
+        _pos = _start + 1;
+        pipe->set(_pos);
+    }
+}
+
+int AtLexer::_extract(Pipe<char>* pipe, char* buf)
+{
+    if (_start > 0) {
+        int unkn = _start;
+        _pos -= unkn;
+        _start = 0;
+        _pending = true;
+        return TYPE_UNKNOWN | pipe->get(buf, unkn);
+    }
+    int type = _patterns[_pattern].type;
+    int len = _pos;
+    bool payload = _atPayload(_match);
+    int num = _match.num;
+    reset();
+    if (payload) {
+        // the line ends with the opening quote, the payload follows
+        _payload = num;
+        _quote = true;
+    }
+    return type | pipe->get(buf, len);
+}
+
+int AtLexer::getPayload(Pipe<char>* pipe)
+{
+    if (_payload > 0) {
+        int n = _sink ? _sink->move(pipe, _payload) : 0;
+        _payload -= n;
+        if (_payload > 0 && pipe->readable() && (!_sink || !_sink->free())) {
+            // nowhere to put it, drop it to keep the modem output flowing
+            n = pipe->size();
+            if (n > _payload)
+                n = _payload;
+            pipe->set(n);
+            pipe->done();
+            _payload -= n;
+        }
+    }
+    if (!_payload && _quote && pipe->readable()) {
+        _quote = false;
+        pipe->set(0);
+        if (pipe->next() == '\"')
+            pipe->done();
+    }
+    return _payload + _quote;
+}
+
+int AtLexer::getLine(Pipe<char>* pipe, char* buf, int len)
+{
+    if ((_payload || _quote) && getPayload(pipe))
+        return WAIT;
+    if (_pending) {
+        _pending = false;
+        return _extract(pipe, buf);
+    }
+    int sz = pipe->size();
+    if (_pos > sz)
+        reset(); // the pipe was read by someone else
+    // when the pipe or the buffer is full, waiting for more data won't help
+    bool full = !pipe->free() || len <= sz;
+    int limit = (len < sz) ? len : sz;
+    pipe->set(_pos);
+    for (;;) {
+        if (_pos >= limit) {
+            if (_pattern < 0 || !full)
+                break;
+            _fail(pipe);
+            continue;
+        }
+        char ch = pipe->next();
+        _pos ++;
+        if (_pattern < 0) {
+            // every pattern starts with a line break
+            if (ch != '\r' && ch != '\n')
+                continue;
+            _start = _pos - 1;
+            _begin(0, pipe);
+            continue;
+        }
+        int ret = _feed(_patterns[_pattern], _match, ch);
+        if (ret == WAIT) {
+            if (_match.state == MATCH_CHARS && _match.num > 0) {
+                // skip over the binary payload
+                int skip = limit - _pos;
+                if (skip > _match.num)
+                    skip = _match.num;
+                _match.num -= skip;
+                _pos += skip;
+                pipe->set(_pos);
+            }
+        }
+        else if (ret == NOT_FOUND) {
+            _fail(pipe);
+        }
+        else {
+            return _extract(pipe, buf);
+        }
+    }
+    if (!full || !_pos)
+        return WAIT;
+    // nothing fits, so pass on the text scanned so far
+    int unkn = _pos;
+    reset();
+    return TYPE_UNKNOWN | pipe->get(buf, unkn);
+}
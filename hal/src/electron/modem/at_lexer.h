@@ -0,0 +1,165 @@
+/*
+ ******************************************************************************
+ *  Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "pipe_hal.h"
+#include "enums_hal.h"
+
+/** Splits the modem output into final results, prompts, URCs (including
+    their binary payloads) and unknown text.
+
+    The lexer remembers how far it has scanned the receive pipe, so a line
+    that arrives over several calls to #getLine isn't scanned again on each
+    call, and binary payloads are skipped using their announced length.
+    Every pattern starts with a line break, so text between lines is
+    skipped with a single compare per char.
+
+    When a sink is set, the binary payload of a +USORD, +USORF or +URDFILE
+    response isn't returned with its line. The line up to the opening quote
+    is returned, and the payload is then moved straight from the pipe to
+    the sink as it arrives, so it needn't fit the pipe or the line buffer.
+
+    The lexer must be the only reader of the pipe; call #reset whenever
+    the pipe is read or cleared by other means.
+*/
+class AtLexer
+{
+public:
+    AtLexer(void) : _sink(NULL)
+    {
+        reset();
+    }
+
+    /** Forget any partially scanned input.
+    */
+    void reset(void);
+
+    /** Get the next line from the pipe.
+        \param pipe the receiving buffer pipe
+        \param buf the buffer to store the line
+        \param len the size of the buffer
+        \return type and length if something was found,
+                WAIT if not enough data is available
+    */
+    int getLine(Pipe<char>* pipe, char* buf, int len);
+
+    /** Set where binary payloads go.
+        \param sink the buffer receiving the payloads, NULL to return them
+               with their line
+    */
+    void setSink(Pipe<char>* sink)
+    {
+        _sink = sink;
+    }
+
+    /** Move the part of a binary payload that has arrived to the sink,
+        dropping what doesn't fit. Called by #getLine, which returns WAIT
+        until the payload is complete.
+        \param pipe the receiving buffer pipe
+        \return the number of payload chars still expected
+    */
+    int getPayload(Pipe<char>* pipe);
+
+private:
+    //! a pattern the modem output is matched against
+    struct Pattern {
+        const char* fmt;    //!< the start of the line (%d any number, %c any char of last %d len, %s quoted string)
+        const char* end;    //!< the line terminator following at least one char, NULL if none
+        int type;           //!< the #getLine type reported for the line
+    };
+
+    //! the progress of a pattern over the candidate line
+    struct Match {
+        const char* fmt;    //!< the remainder of the pattern format
+        int num;            //!< the last %d value, or the %c chars still to skip
+        uint8_t state;      //!< what the next char is checked against
+        uint8_t end;        //!< the number of terminator chars matched
+        bool bulk;          //!< stop in front of a binary payload
+    };
+
+    static const Pattern _patterns[];
+    static const int _patternCount;
+
+    /** Feed the next char of the candidate line to a pattern.
+        \return WAIT if more chars are needed, NOT_FOUND if the line
+                doesn't match and a positive value once it matches
+    */
+    static int _feed(const Pattern& pattern, Match& match, char ch);
+
+    //! compare the next char against a literal char of the pattern
+    static int _literal(const Pattern& pattern, Match& match, char ch);
+
+    //! true if the match stopped in front of a binary payload
+    static bool _atPayload(const Match& match)
+    {
+        return match.fmt[0] == '%' && match.fmt[1] == 'c';
+    }
+
+    //! start matching the candidate line against a pattern
+    void _begin(int pattern, Pipe<char>* pipe);
+
+    /** The current pattern doesn't match the candidate line, so try the
+        next one from the start of the line, in order of precedence.
+    */
+    void _fail(Pipe<char>* pipe);
+
+    /** Extract the matched line, or the unknown text in front of it,
+        which is then followed by the line on the next call.
+    */
+    int _extract(Pipe<char>* pipe, char* buf);
+
+    Match _match;
+    int _pattern;           //!< the pattern being matched, -1 if there is no candidate line
+    int _start;             //!< offset of the candidate line
+    int _pos;               //!< number of chars scanned
+    bool _pending;          //!< the matched line follows the unknown text just returned
+    Pipe<char>* _sink;      //!< where binary payloads go, NULL if returned with their line
+    int _payload;           //!< payload chars still to move to the sink
+    bool _quote;            //!< the closing quote of the payload is still to be skipped
+};
+
+/** An entry in a table of unsolicited result code handlers.
+*/
+template <class T>
+struct AtUrcHandler {
+    const char* prefix;                         //!< the URC following the '+', e.g. "UUSORD: "
+    void (T::*handler)(const char* args);       //!< called with the text following the prefix
+};
+
+/** Call the handler for a URC.
+    \param target the object the handlers are called on
+    \param table the handlers
+    \param urc the line following the '+'
+    \return true if a handler was found
+*/
+template <class T, size_t N>
+bool at_dispatch_urc(T* target, const AtUrcHandler<T> (&table)[N], const char* urc)
+{
+    for (size_t i = 0; i < N; i ++) {
+        size_t n = strlen(table[i].prefix);
+        if (!strncmp(urc, table[i].prefix, n)) {
+            (target->*table[i].handler)(urc + n);
+            return true;
+        }
+    }
+    return false;
+}
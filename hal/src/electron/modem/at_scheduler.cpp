@@ -0,0 +1,64 @@
+/*
+ ******************************************************************************
+ *  Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "at_scheduler.h"
+#include "delay_hal.h"
+
+#define AT_YIELD_MS     1   //!< how long to step back for a more urgent thread
+
+AtScheduler::AtScheduler(void) : _depth(0)
+{
+    memset(_waiting, 0, sizeof(_waiting));
+}
+
+void AtScheduler::lock(int priority)
+{
+    _queue.lock();
+    _waiting[priority] ++;
+    _queue.unlock();
+    for (;;) {
+        _modem.lock();
+        // a nested lock never steps back, the thread already talks to the modem
+        if (_depth || !outranked(priority))
+            break;
+        _modem.unlock();
+        HAL_Delay_Milliseconds(AT_YIELD_MS);
+    }
+    _depth ++;
+    _queue.lock();
+    _waiting[priority] --;
+    _queue.unlock();
+}
+
+void AtScheduler::unlock(void)
+{
+    _depth --;
+    _modem.unlock();
+}
+
+bool AtScheduler::outranked(int priority)
+{
+    std::lock_guard<std::mutex> guard(_queue);
+    for (int p = priority + 1; p < AT_PRIORITY_COUNT; p++) {
+        if (_waiting[p])
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,85 @@
+/*
+ ******************************************************************************
+ *  Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <mutex>
+
+/** The urgency of a modem transaction */
+enum AtPriority {
+    AT_PRIORITY_BACKGROUND,     //!< status queries, e.g. the signal strength
+    AT_PRIORITY_NORMAL,         //!< everything else, e.g. application sockets
+    AT_PRIORITY_CLOUD,          //!< the cloud connection
+    AT_PRIORITY_COUNT
+};
+
+/** Decides which thread talks to the modem next.
+
+    Only one thread talks to the modem at a time, and it may lock again
+    while it does (e.g. socketSocket calling reconnect). A thread that
+    locks while a more urgent one is waiting for the modem steps back until
+    that thread had its turn, so the cloud connection isn't queued behind
+    application sockets and status queries.
+
+    Waits that can take long, such as waiting for socket data, must not
+    hold the lock; they poll, releasing the lock in between. Long transfers
+    check #outranked between blocks to let more urgent transactions in.
+*/
+class AtScheduler
+{
+public:
+    AtScheduler(void);
+
+    /** Wait until the modem is free and no more urgent thread waits for it.
+        \param priority the AtPriority of the transaction
+    */
+    void lock(int priority);
+
+    /** Release the modem.
+    */
+    void unlock(void);
+
+    /** Check if a more urgent thread waits for the modem.
+        \param priority the AtPriority of the calling thread
+        \return true if the caller should release the modem soon
+    */
+    bool outranked(int priority);
+
+private:
+    std::recursive_mutex _modem;        //!< held by the thread talking to the modem
+    std::mutex _queue;                  //!< guards _waiting
+    int _waiting[AT_PRIORITY_COUNT];    //!< the threads waiting for the modem by priority
+    int _depth;                         //!< lock nesting of the thread holding the modem
+};
+
+/** Holds the modem for the scope of a block */
+class AtSchedulerLock
+{
+public:
+    AtSchedulerLock(AtScheduler& scheduler, int priority) : _scheduler(scheduler)
+    {
+        _scheduler.lock(priority);
+    }
+    ~AtSchedulerLock(void)
+    {
+        _scheduler.unlock();
+    }
+private:
+    AtScheduler& _scheduler;
+};
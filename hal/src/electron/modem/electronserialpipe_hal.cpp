@@ -23,17 +23,36 @@
 #include "pinmap_impl.h"
 #include "gpio_hal.h"
 #include "mdm_hal.h"
+#include "delay_hal.h"
 
 static USART_InitTypeDef USART_InitStructure;
 
 ElectronSerialPipe::ElectronSerialPipe(int rxSize, int txSize) :
     _pipeRx( rxSize ),
-    _pipeTx( txSize )
+    _pipeTx( txSize ),
+    _rxSignal( NULL ),
+    _rxWaiting( false )
+#if USE_USART3_DMA
+    , _dmaRxPos( 0 ),
+    _dmaTxLen( 0 )
+#endif
 {
+    os_semaphore_create(&_rxSignal, 1, 0);
 }
 
 ElectronSerialPipe::~ElectronSerialPipe(void)
 {
+#if USE_USART3_DMA
+    // the running transfer starts the next one until the pipe is empty
+    while (_dmaTxLen)
+        /* nothing / just wait */;
+    USART_DMACmd(USART3, USART_DMAReq_Rx | USART_DMAReq_Tx, DISABLE);
+    USART_ITConfig(USART3, USART_IT_IDLE, DISABLE);
+    DMA_Cmd(DMA1_Stream1, DISABLE);
+    DMA_Cmd(DMA1_Stream3, DISABLE);
+    NVIC_DisableIRQ(DMA1_Stream1_IRQn);
+    NVIC_DisableIRQ(DMA1_Stream3_IRQn);
+#endif
     // wait for transmission of outgoing data
     while (_pipeTx.readable())
     {
@@ -64,6 +83,9 @@ ElectronSerialPipe::~ElectronSerialPipe(void)
 
     // clear any received data
     // ... should be handled with ~Pipe deconstructor
+
+    if (_rxSignal)
+        os_semaphore_destroy(_rxSignal);
 }
 
 void ElectronSerialPipe::begin(unsigned int baud)
@@ -127,9 +149,52 @@ void ElectronSerialPipe::begin(unsigned int baud)
     // Enable the USART
     USART_Cmd(USART3, ENABLE);
 
+#if USE_USART3_DMA
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+
+    // DMA1 stream 1 channel 4 receives into the circular buffer
+    DMA_InitTypeDef DMA_InitStructure;
+    DMA_StructInit(&DMA_InitStructure);
+    DMA_InitStructure.DMA_Channel = DMA_Channel_4;
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&USART3->DR;
+    DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)_dmaRx;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralToMemory;
+    DMA_InitStructure.DMA_BufferSize = sizeof(_dmaRx);
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+    DMA_DeInit(DMA1_Stream1);
+    DMA_Init(DMA1_Stream1, &DMA_InitStructure);
+    _dmaRxPos = 0;
+
+    // DMA1 stream 3 channel 4 sends from the tx pipe, the memory and length are set per transfer
+    DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+    DMA_InitStructure.DMA_BufferSize = 1;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_Medium;
+    DMA_DeInit(DMA1_Stream3);
+    DMA_Init(DMA1_Stream3, &DMA_InitStructure);
+    _dmaTxLen = 0;
+
+    // same priority as the USART interrupt, so the rx handlers don't preempt each other
+    NVIC_InitStructure.NVIC_IRQChannel = DMA1_Stream1_IRQn;
+    NVIC_Init(&NVIC_InitStructure);
+    NVIC_InitStructure.NVIC_IRQChannel = DMA1_Stream3_IRQn;
+    NVIC_Init(&NVIC_InitStructure);
+
+    DMA_ITConfig(DMA1_Stream1, DMA_IT_HT | DMA_IT_TC, ENABLE);
+    DMA_ITConfig(DMA1_Stream3, DMA_IT_TC, ENABLE);
+    DMA_Cmd(DMA1_Stream1, ENABLE);
+    USART_DMACmd(USART3, USART_DMAReq_Rx | USART_DMAReq_Tx, ENABLE);
+
+    // data that ends before the buffer is half full is moved when the line goes idle
+    USART_ITConfig(USART3, USART_IT_IDLE, ENABLE);
+    txStart();
+#else
     // Enable USART Receive and Transmit interrupts
     USART_ITConfig(USART3, USART_IT_TXE, ENABLE);
     USART_ITConfig(USART3, USART_IT_RXNE, ENABLE);
+#endif
 }
 
 // tx channel
@@ -178,14 +243,46 @@ void ElectronSerialPipe::txCopy(void)
 
 void ElectronSerialPipe::txIrqBuf(void)
 {
+#if USE_USART3_DMA
+    // the transfer is done, so its bytes can leave the pipe
+    _pipeTx.skip(_dmaTxLen);
+    _dmaTxLen = 0;
+    txDmaStart();
+#else
     txCopy();
     // detach tx isr if we are done
     if (!_pipeTx.readable())
         USART_ITConfig(USART3, USART_IT_TXE, DISABLE);
+#endif
 }
 
+#if USE_USART3_DMA
+void ElectronSerialPipe::txDmaStart(void)
+{
+    if (_dmaTxLen)
+        return;
+    int n;
+    const char* p = _pipeTx.peek(&n);
+    if (!n)
+        return;
+    // the pipe doesn't overwrite the bytes until they are skipped
+    _dmaTxLen = n;
+    DMA_ClearFlag(DMA1_Stream3, DMA_FLAG_TCIF3 | DMA_FLAG_HTIF3 | DMA_FLAG_TEIF3 | DMA_FLAG_DMEIF3 | DMA_FLAG_FEIF3);
+    DMA1_Stream3->M0AR = (uint32_t)p;
+    DMA_SetCurrDataCounter(DMA1_Stream3, n);
+    DMA_Cmd(DMA1_Stream3, ENABLE);
+}
+#endif
+
 void ElectronSerialPipe::txStart(void)
 {
+#if USE_USART3_DMA
+    // keep the transfer complete interrupt from starting a transfer at the same time
+    NVIC_DisableIRQ(DMA1_Stream3_IRQn);
+    txDmaStart();
+    NVIC_EnableIRQ(DMA1_Stream3_IRQn);
+    return;
+#endif
     // disable the tx isr to avoid interruption
     USART_ITConfig(USART3, USART_IT_TXE, DISABLE);
     txCopy();
@@ -212,13 +309,50 @@ int ElectronSerialPipe::get(void* buffer, int length, bool blocking)
     return _pipeRx.get((char*)buffer,length,blocking);
 }
 
+bool ElectronSerialPipe::waitReadable(int size, system_tick_t timeout_ms)
+{
+    if (_pipeRx.size() > size)
+        return true;
+    if (!_rxSignal) {
+        HAL_Delay_Milliseconds(timeout_ms);
+        return _pipeRx.size() > size;
+    }
+    // drop a signal left over from an earlier wait
+    os_semaphore_take(_rxSignal, 0, false);
+    _rxWaiting = true;
+    // data received before the flag was set doesn't signal
+    if (_pipeRx.size() <= size)
+        os_semaphore_take(_rxSignal, timeout_ms, false);
+    _rxWaiting = false;
+    return _pipeRx.size() > size;
+}
+
 void ElectronSerialPipe::rxIrqBuf(void)
 {
+#if USE_USART3_DMA
+    // move what the DMA wrote since the last call, what doesn't fit overflows
+    int pos = sizeof(_dmaRx) - DMA_GetCurrDataCounter(DMA1_Stream1);
+    if (pos >= (int)sizeof(_dmaRx))
+        pos = 0;
+    if (pos == _dmaRxPos)
+        return;
+    if (pos < _dmaRxPos) {
+        _pipeRx.put(&_dmaRx[_dmaRxPos], sizeof(_dmaRx) - _dmaRxPos);
+        _dmaRxPos = 0;
+    }
+    _pipeRx.put(&_dmaRx[_dmaRxPos], pos - _dmaRxPos);
+    _dmaRxPos = pos;
+#else
     char c = USART_ReceiveData(USART3);
     if (_pipeRx.writeable())
         _pipeRx.putc(c);
     else
         /* overflow */;
+#endif
+    if (_rxWaiting) {
+        _rxWaiting = false;
+        os_semaphore_give(_rxSignal, false);
+    }
 }
 
 /*******************************************************************************
@@ -230,6 +364,15 @@ void ElectronSerialPipe::rxIrqBuf(void)
  *******************************************************************************/
 extern "C" void HAL_USART3_Handler(void)
 {
+#if USE_USART3_DMA
+    if(USART_GetITStatus(USART3, USART_IT_IDLE) != RESET)
+    {
+        // reading the data register after the status register clears the flag
+        USART_ReceiveData(USART3);
+        electronMDM.rxIrqBuf();
+    }
+    return;
+#endif
     if(USART_GetITStatus(USART3, USART_IT_RXNE) != RESET)
     {
         electronMDM.rxIrqBuf();
@@ -240,3 +383,39 @@ extern "C" void HAL_USART3_Handler(void)
         electronMDM.txIrqBuf();
     }
 }
+
+#if USE_USART3_DMA
+/*******************************************************************************
+ * Function Name  : DMA1_Stream1_irq
+ * Description    : This function handles the USART3 rx DMA half and complete
+ *                  transfer interrupts.
+ * Input          : None.
+ * Output         : None.
+ * Return         : None.
+ *******************************************************************************/
+extern "C" void DMA1_Stream1_irq(void)
+{
+    if (DMA_GetITStatus(DMA1_Stream1, DMA_IT_HTIF1) != RESET)
+        DMA_ClearITPendingBit(DMA1_Stream1, DMA_IT_HTIF1);
+    if (DMA_GetITStatus(DMA1_Stream1, DMA_IT_TCIF1) != RESET)
+        DMA_ClearITPendingBit(DMA1_Stream1, DMA_IT_TCIF1);
+    electronMDM.rxIrqBuf();
+}
+
+/*******************************************************************************
+ * Function Name  : DMA1_Stream3_irq
+ * Description    : This function handles the USART3 tx DMA complete transfer
+ *                  interrupt.
+ * Input          : None.
+ * Output         : None.
+ * Return         : None.
+ *******************************************************************************/
+extern "C" void DMA1_Stream3_irq(void)
+{
+    if (DMA_GetITStatus(DMA1_Stream3, DMA_IT_TCIF3) != RESET)
+    {
+        DMA_ClearITPendingBit(DMA1_Stream3, DMA_IT_TCIF3);
+        electronMDM.txIrqBuf();
+    }
+}
+#endif
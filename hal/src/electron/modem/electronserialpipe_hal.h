@@ -20,11 +20,23 @@
 #pragma once
 
 #include "pipe_hal.h"
+#include "concurrent_hal.h"
+#include "system_tick_hal.h"
 
 #ifndef EOF
     #define EOF (-1)
 #endif
 
+/* Receive into a circular DMA buffer and transmit from the tx pipe by DMA,
+   instead of taking an interrupt per byte */
+#ifndef USE_USART3_DMA
+#define USE_USART3_DMA 1
+#endif
+
+#ifndef USART3_DMA_RX_SIZE
+#define USART3_DMA_RX_SIZE 256 //!< emptied at half and full, and when the line goes idle
+#endif
+
 /** Buffered serial interface (rtos capable/interrupt driven)
 */
 class ElectronSerialPipe
@@ -88,11 +100,20 @@ public:
     */
     int get(void* buffer, int length, bool blocking);
 
-    /** receive interrupt routine
+    /** wait until more data is received, without polling
+        \param size the number of bytes already seen in the buffer
+        \param timeout_ms the maximum time to wait
+        \return true if more than size bytes are available
+    */
+    bool waitReadable(int size, system_tick_t timeout_ms);
+
+    /** receive interrupt routine, also called when the line goes idle
+        and by the rx DMA interrupt
     */
     void rxIrqBuf(void);
 
-    /** transmit interrupt routine
+    /** transmit interrupt routine, called by the tx DMA interrupt
+        when a transfer is complete
     */
     void txIrqBuf(void);
 
@@ -101,6 +122,17 @@ protected:
     void txStart(void);
     //! move bytes to hardware
     void txCopy(void);
+#if USE_USART3_DMA
+    //! start a DMA transfer of the bytes at the head of the tx pipe, unless one is running
+    void txDmaStart(void);
+#endif
     Pipe<char> _pipeRx; //!< receive pipe
     Pipe<char> _pipeTx; //!< transmit pipe
+    os_semaphore_t _rxSignal; //!< given by the receive interrupt when someone is waiting
+    volatile bool _rxWaiting; //!< set while waiting for received data
+#if USE_USART3_DMA
+    char _dmaRx[USART3_DMA_RX_SIZE]; //!< circular buffer the rx DMA writes to
+    int _dmaRxPos; //!< the received bytes not moved to the rx pipe yet start here
+    volatile int _dmaTxLen; //!< bytes of the tx pipe being sent by DMA, 0 if idle
+#endif
 };
@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <string.h>
+#include <new>
 
 #include "mdm_hal.h"
 #include "timer_hal.h"
@@ -33,10 +34,10 @@
 #include "stm32f2xx.h"
 #include "service_debug.h"
 #include "concurrent_hal.h"
-#include <mutex>
+#include "at_scheduler.h"
 #include "net_hal.h"
 
-std::recursive_mutex mdm_mutex;
+AtScheduler mdm_scheduler;
 
 /* Private typedef ----------------------------------------------------------*/
 
@@ -46,6 +47,8 @@ std::recursive_mutex mdm_mutex;
 #define PROFILE         "0"   //!< this is the psd profile used
 #define MAX_SIZE        1024  //!< max expected messages (used with RX)
 #define USO_MAX_WRITE   1024  //!< maximum number of bytes to write to socket (used with TX)
+#define USO_MAX_READ    1024  //!< maximum number of bytes to read from socket (streamed from the rx pipe)
+#define MDM_POLL_MS     10    //!< longest wait for modem data before checking for cancellation
 // num sockets
 #define NUMSOCKETS      ((int)(sizeof(_sockets)/sizeof(*_sockets)))
 //! test if it is a socket is ok to use
@@ -57,7 +60,9 @@ std::recursive_mutex mdm_mutex;
 //! registration done check helper (no need to poll further)
 #define REG_DONE(r)     ((r == REG_HOME) || (r == REG_ROAMING) || (r == REG_DENIED))
 //! helper to make sure that lock unlock pair is always balanced
-#define LOCK()      std::lock_guard<std::recursive_mutex> __mdm_guard(mdm_mutex);
+#define LOCK()      AtSchedulerLock __mdm_guard(mdm_scheduler, AT_PRIORITY_NORMAL);
+//! as LOCK(), for transactions of a given AtPriority
+#define LOCK_PRIORITY(p) AtSchedulerLock __mdm_guard(mdm_scheduler, (p));
 //! helper to make sure that lock unlock pair is always balanced
 #define UNLOCK()
 
@@ -174,6 +179,7 @@ MDMParser::MDMParser(void)
     memset(_sockets, 0, sizeof(_sockets));
     for (int socket = 0; socket < NUMSOCKETS; socket ++)
         _sockets[socket].handle = MDM_SOCKET_ERROR;
+    _rxSink = NULL;
 #ifdef MDM_DEBUG
     _debugLevel = 3;
     _debugTime = HAL_Timer_Get_Milli_Seconds();
@@ -240,7 +246,7 @@ int MDMParser::waitFinalResp(_CALLBACKPTR cb /* = NULL*/,
     char buf[MAX_SIZE + 64 /* add some more space for framing */];
     system_tick_t start = HAL_Timer_Get_Milli_Seconds();
     do {
-        int ret = getLine(buf, sizeof(buf));
+        int ret = getLine(buf, sizeof(buf) - 1);
 #ifdef MDM_DEBUG
         if ((_debugLevel >= 3) && (ret != WAIT) && (ret != NOT_FOUND))
         {
@@ -262,94 +268,21 @@ int MDMParser::waitFinalResp(_CALLBACKPTR cb /* = NULL*/,
         if ((ret != WAIT) && (ret != NOT_FOUND))
         {
             int type = TYPE(ret);
+            buf[LENGTH(ret)] = '\0';
             // handle unsolicited commands here
             if (type == TYPE_PLUS) {
-                const char* cmd = buf+3;
-                int a, b, c, d, r;
-                char s[32];
-
-                // SMS Command ---------------------------------
-                // +CNMI: <mem>,<index>
-                if (sscanf(cmd, "CMTI: \"%*[^\"]\",%d", &a) == 1) {
-                    DEBUG_D("New SMS at index %d\r\n", a);
-                    if (sms_cb) SMSreceived(a);
-                }
-                else if ((sscanf(cmd, "CIEV: 9,%d", &a) == 1)) {
-                    DEBUG_D("CIEV matched: 9,%d\r\n", a);
-                    // Wait until the system is attached before attempting to act on GPRS detach
-                    if (_attached) {
-                        _attached_urc = (a==2)?1:0;
-                        if (!_attached_urc) ARM_GPRS_TIMEOUT(15*1000); // If detached, set WDT
-                        else CLR_GPRS_TIMEOUT(); // else if re-attached clear WDT.
-                    }
-                // Socket Specific Command ---------------------------------
-                // +UUSORD: <socket>,<length>
-                } else if ((sscanf(cmd, "UUSORD: %d,%d", &a, &b) == 2)) {
-                    int socket = _findSocket(a);
-                    DEBUG_D("Socket %d: handle %d has %d bytes pending\r\n", socket, a, b);
-                    if (socket != MDM_SOCKET_ERROR)
-                        _sockets[socket].pending = b;
-                // +UUSORF: <socket>,<length>
-                } else if ((sscanf(cmd, "UUSORF: %d,%d", &a, &b) == 2)) {
-                    int socket = _findSocket(a);
-                    DEBUG_D("Socket %d: handle %d has %d bytes pending\r\n", socket, a, b);
-                    if (socket != MDM_SOCKET_ERROR)
-                        _sockets[socket].pending = b;
-                // +UUSOCL: <socket>
-                } else if ((sscanf(cmd, "UUSOCL: %d", &a) == 1)) {
-                    int socket = _findSocket(a);
-                    DEBUG_D("Socket %d: handle %d closed by remote host\r\n", socket, a);
-                    if (socket != MDM_SOCKET_ERROR) {
-                        _socketFree(socket);
-                    }
-                }
-
-                // GSM/UMTS Specific -------------------------------------------
-                // +UUPSDD: <profile_id>
-                if (sscanf(cmd, "UUPSDD: %s", s) == 1) {
-                    DEBUG_D("UUPSDD: %s matched\r\n", PROFILE);
-                    if ( !strcmp(s, PROFILE) ) {
-                        _ip = NOIP;
-                        _attached = false;
-                        DEBUG("PDP context deactivated remotely!\r\n");
-                        // PDP context was remotely deactivated via URC,
-                        // Notify system of disconnect.
-                        HAL_NET_notify_dhcp(false);
-                    }
-                } else {
-                    // +CREG|CGREG: <n>,<stat>[,<lac>,<ci>[,AcT[,<rac>]]] // reply to AT+CREG|AT+CGREG
-                    // +CREG|CGREG: <stat>[,<lac>,<ci>[,AcT[,<rac>]]]     // URC
-                    b = (int)0xFFFF; c = (int)0xFFFFFFFF; d = -1;
-                    r = sscanf(cmd, "%s %*d,%d,\"%x\",\"%x\",%d",s,&a,&b,&c,&d);
-                    if (r <= 1)
-                        r = sscanf(cmd, "%s %d,\"%x\",\"%x\",%d",s,&a,&b,&c,&d);
-                    if (r >= 2) {
-                        Reg *reg = !strcmp(s, "CREG:")  ? &_net.csd :
-                                   !strcmp(s, "CGREG:") ? &_net.psd : NULL;
-                        if (reg) {
-                            // network status
-                            if      (a == 0) *reg = REG_NONE;     // 0: not registered, home network
-                            else if (a == 1) *reg = REG_HOME;     // 1: registered, home network
-                            else if (a == 2) *reg = REG_NONE;     // 2: not registered, but MT is currently searching a new operator to register to
-                            else if (a == 3) *reg = REG_DENIED;   // 3: registration denied
-                            else if (a == 4) *reg = REG_UNKNOWN;  // 4: unknown
-                            else if (a == 5) *reg = REG_ROAMING;  // 5: registered, roaming
-                            if ((r >= 3) && (b != (int)0xFFFF))      _net.lac = b; // location area code
-                            if ((r >= 4) && (c != (int)0xFFFFFFFF))  _net.ci  = c; // cell ID
-                            // access technology
-                            if (r >= 5) {
-                                if      (d == 0) _net.act = ACT_GSM;      // 0: GSM
-                                else if (d == 1) _net.act = ACT_GSM;      // 1: GSM COMPACT
-                                else if (d == 2) _net.act = ACT_UTRAN;    // 2: UTRAN
-                                else if (d == 3) _net.act = ACT_EDGE;     // 3: GSM with EDGE availability
-                                else if (d == 4) _net.act = ACT_UTRAN;    // 4: UTRAN with HSDPA availability
-                                else if (d == 5) _net.act = ACT_UTRAN;    // 5: UTRAN with HSUPA availability
-                                else if (d == 6) _net.act = ACT_UTRAN;    // 6: UTRAN with HSDPA and HSUPA availability
-                            }
-                        }
-                    }
-                }
-            } // end ==TYPE_PLUS
+                static const AtUrcHandler<MDMParser> urcs[] = {
+                    { "CMTI: ",     &MDMParser::_urcCMTI    },
+                    { "CIEV: ",     &MDMParser::_urcCIEV    },
+                    { "UUSORD: ",   &MDMParser::_urcUUSORD  },
+                    { "UUSORF: ",   &MDMParser::_urcUUSORD  },
+                    { "UUSOCL: ",   &MDMParser::_urcUUSOCL  },
+                    { "UUPSDD: ",   &MDMParser::_urcUUPSDD  },
+                    { "CREG: ",     &MDMParser::_urcCREG    },
+                    { "CGREG: ",    &MDMParser::_urcCGREG   },
+                };
+                at_dispatch_urc(this, urcs, buf+3);
+            }
             if (cb) {
                 int len = LENGTH(ret);
                 int ret = cb(type, buf, len, param);
@@ -365,14 +298,138 @@ int MDMParser::waitFinalResp(_CALLBACKPTR cb /* = NULL*/,
             if (type == TYPE_ABORTED)
                 return RESP_ABORTED; // This means the current command was ABORTED, so retry your command if critical.
         }
-        // relax a bit
-        HAL_Delay_Milliseconds(10);
+        else {
+            // sleep until more data arrives, waking regularly to check for cancellation
+            system_tick_t wait_ms = MDM_POLL_MS;
+            if (timeout_ms != TIMEOUT_BLOCKING) {
+                system_tick_t elapsed = HAL_Timer_Get_Milli_Seconds() - start;
+                if (elapsed >= timeout_ms)
+                    break;
+                if (timeout_ms - elapsed < wait_ms)
+                    wait_ms = timeout_ms - elapsed;
+            }
+            _waitReadable(wait_ms);
+        }
     }
     while (!TIMEOUT(start, timeout_ms) && !_cancel_all_operations);
 
     return WAIT;
 }
 
+// +CMTI: <mem>,<index>
+void MDMParser::_urcCMTI(const char* args)
+{
+    int a;
+    if (sscanf(args, "\"%*[^\"]\",%d", &a) == 1) {
+        DEBUG_D("New SMS at index %d\r\n", a);
+        if (sms_cb) SMSreceived(a);
+    }
+}
+
+// +CIEV: <descr>,<value>
+void MDMParser::_urcCIEV(const char* args)
+{
+    int a;
+    if (sscanf(args, "9,%d", &a) == 1) {
+        DEBUG_D("CIEV matched: 9,%d\r\n", a);
+        // Wait until the system is attached before attempting to act on GPRS detach
+        if (_attached) {
+            _attached_urc = (a==2)?1:0;
+            if (!_attached_urc) ARM_GPRS_TIMEOUT(15*1000); // If detached, set WDT
+            else CLR_GPRS_TIMEOUT(); // else if re-attached clear WDT.
+        }
+    }
+}
+
+// +UUSORD: <socket>,<length>
+// +UUSORF: <socket>,<length>
+void MDMParser::_urcUUSORD(const char* args)
+{
+    int a, b;
+    if (sscanf(args, "%d,%d", &a, &b) == 2) {
+        int socket = _findSocket(a);
+        DEBUG_D("Socket %d: handle %d has %d bytes pending\r\n", socket, a, b);
+        if (socket != MDM_SOCKET_ERROR)
+            _sockets[socket].pending = b;
+    }
+}
+
+// +UUSOCL: <socket>
+void MDMParser::_urcUUSOCL(const char* args)
+{
+    int a;
+    if (sscanf(args, "%d", &a) == 1) {
+        int socket = _findSocket(a);
+        DEBUG_D("Socket %d: handle %d closed by remote host\r\n", socket, a);
+        if (socket != MDM_SOCKET_ERROR) {
+            _socketFree(socket);
+        }
+    }
+}
+
+// +UUPSDD: <profile_id>
+void MDMParser::_urcUUPSDD(const char* args)
+{
+    char s[32];
+    if (sscanf(args, "%31s", s) == 1) {
+        DEBUG_D("UUPSDD: %s matched\r\n", PROFILE);
+        if ( !strcmp(s, PROFILE) ) {
+            _ip = NOIP;
+            _attached = false;
+            DEBUG("PDP context deactivated remotely!\r\n");
+            // PDP context was remotely deactivated via URC,
+            // Notify system of disconnect.
+            HAL_NET_notify_dhcp(false);
+        }
+    }
+}
+
+void MDMParser::_urcCREG(const char* args)
+{
+    _urcReg(&_net.csd, args);
+}
+
+void MDMParser::_urcCGREG(const char* args)
+{
+    _urcReg(&_net.psd, args);
+}
+
+// +CREG|CGREG: <n>,<stat>[,<lac>,<ci>[,AcT[,<rac>]]] // reply to AT+CREG|AT+CGREG
+// +CREG|CGREG: <stat>[,<lac>,<ci>[,AcT[,<rac>]]]     // URC
+void MDMParser::_urcReg(Reg* reg, const char* args)
+{
+    int a, b = (int)0xFFFF, c = (int)0xFFFFFFFF, d = -1;
+    int r = sscanf(args, "%*d,%d,\"%x\",\"%x\",%d",&a,&b,&c,&d);
+    if (r <= 0)
+        r = sscanf(args, "%d,\"%x\",\"%x\",%d",&a,&b,&c,&d);
+    if (r >= 1) {
+        // network status
+        if      (a == 0) *reg = REG_NONE;     // 0: not registered, home network
+        else if (a == 1) *reg = REG_HOME;     // 1: registered, home network
+        else if (a == 2) *reg = REG_NONE;     // 2: not registered, but MT is currently searching a new operator to register to
+        else if (a == 3) *reg = REG_DENIED;   // 3: registration denied
+        else if (a == 4) *reg = REG_UNKNOWN;  // 4: unknown
+        else if (a == 5) *reg = REG_ROAMING;  // 5: registered, roaming
+        if ((r >= 2) && (b != (int)0xFFFF))      _net.lac = b; // location area code
+        if ((r >= 3) && (c != (int)0xFFFFFFFF))  _net.ci  = c; // cell ID
+        // access technology
+        if (r >= 4) {
+            if      (d == 0) _net.act = ACT_GSM;      // 0: GSM
+            else if (d == 1) _net.act = ACT_GSM;      // 1: GSM COMPACT
+            else if (d == 2) _net.act = ACT_UTRAN;    // 2: UTRAN
+            else if (d == 3) _net.act = ACT_EDGE;     // 3: GSM with EDGE availability
+            else if (d == 4) _net.act = ACT_UTRAN;    // 4: UTRAN with HSDPA availability
+            else if (d == 5) _net.act = ACT_UTRAN;    // 5: UTRAN with HSUPA availability
+            else if (d == 6) _net.act = ACT_UTRAN;    // 6: UTRAN with HSDPA and HSUPA availability
+        }
+    }
+}
+
+void MDMParser::_waitReadable(system_tick_t timeout_ms)
+{
+    HAL_Delay_Milliseconds(timeout_ms);
+}
+
 int MDMParser::_cbString(int type, const char* buf, int len, char* str)
 {
     if (str && (type == TYPE_UNKNOWN)) {
@@ -596,7 +653,8 @@ bool MDMParser::powerOn(const char* simpin)
                 goto failure;
         } else if (_dev.sim != SIM_READY) {
             system_tick_t start = HAL_Timer_Get_Milli_Seconds();
-            while ((HAL_Timer_Get_Milli_Seconds() - start < 1000UL) && !_cancel_all_operations); // just wait
+            while ((HAL_Timer_Get_Milli_Seconds() - start < 1000UL) && !_cancel_all_operations)
+                HAL_Delay_Milliseconds(MDM_POLL_MS); // just wait
         }
     }
     if (_dev.sim != SIM_READY) {
@@ -789,7 +847,8 @@ bool MDMParser::registerNet(NetStatus* status /*= NULL*/, system_tick_t timeout_
             system_tick_t start = HAL_Timer_Get_Milli_Seconds();
             while (!checkNetStatus(status) && !TIMEOUT(start, timeout_ms) && !_cancel_all_operations) {
                 system_tick_t start = HAL_Timer_Get_Milli_Seconds();
-                while ((HAL_Timer_Get_Milli_Seconds() - start < 15000UL) && !_cancel_all_operations); // just wait
+                while ((HAL_Timer_Get_Milli_Seconds() - start < 15000UL) && !_cancel_all_operations)
+                    HAL_Delay_Milliseconds(MDM_POLL_MS); // just wait
                 //HAL_Delay_Milliseconds(15000);
             }
             if (_net.csd == REG_DENIED) MDM_ERROR("CSD Registration Denied\r\n");
@@ -853,7 +912,7 @@ failure:
 bool MDMParser::getSignalStrength(NetStatus &status)
 {
     bool ok = false;
-    LOCK();
+    LOCK_PRIORITY(AT_PRIORITY_BACKGROUND);
     if (_init && _pwr) {
         MDM_INFO("\r\n[ Modem::getSignalStrength ] = = = = = = = = = =");
         sendFormated("AT+CSQ\r\n");
@@ -870,7 +929,7 @@ bool MDMParser::getSignalStrength(NetStatus &status)
 bool MDMParser::getDataUsage(MDM_DataUsage &data)
 {
     bool ok = false;
-    LOCK();
+    LOCK_PRIORITY(AT_PRIORITY_BACKGROUND);
     if (_init && _pwr) {
         MDM_INFO("\r\n[ Modem::getDataUsage ] = = = = = = = = = =");
         sendFormated("AT+UGCNTRD\r\n");
@@ -1504,14 +1563,35 @@ int MDMParser::_socketSocket(int socket, IpProtocol ipproto, int port)
         sendFormated("AT+USOCR=6\r\n");
     }
     int handle = MDM_SOCKET_ERROR;
+    Pipe<char>* rx = NULL;
     if ((RESP_OK == waitFinalResp(_cbUSOCR, &handle)) &&
         (handle != MDM_SOCKET_ERROR)) {
+        rx = _sockets[socket].rx;
+        if (!rx) {
+            rx = new (std::nothrow) Pipe<char>(MDM_SOCKET_RX_SIZE);
+            if (rx && !rx->allocated()) {
+                delete rx;
+                rx = NULL;
+            }
+        }
+        if (!rx) {
+            // the socket can't receive without a buffer, so the modem's socket is given back
+            DEBUG_D("Socket %d: no memory for the receive buffer, closing handle %d\r\n", socket, handle);
+            sendFormated("AT+USOCL=%d\r\n", handle);
+            waitFinalResp();
+        }
+    }
+    if (rx) {
         DEBUG_D("Socket %d: handle %d was created\r\n", socket, handle);
         _sockets[socket].handle     = handle;
         _sockets[socket].timeout_ms = TIMEOUT_BLOCKING;
         _sockets[socket].connected  = (ipproto == MDM_IPPROTO_UDP);
         _sockets[socket].pending    = 0;
         _sockets[socket].open       = true;
+        _sockets[socket].datagrams  = (ipproto == MDM_IPPROTO_UDP);
+        // the cloud connection of the Electron is the UDP socket
+        _sockets[socket].priority   = (ipproto == MDM_IPPROTO_UDP) ? AT_PRIORITY_CLOUD : AT_PRIORITY_NORMAL;
+        _sockets[socket].rx         = rx;
     }
     else {
         rv = MDM_SOCKET_ERROR;
@@ -1619,6 +1699,23 @@ bool MDMParser::socketSetBlocking(int socket, system_tick_t timeout_ms)
     return ok;
 }
 
+bool MDMParser::socketSetPriority(int socket, int priority)
+{
+    bool ok = false;
+    LOCK();
+    if (ISSOCKET(socket) && priority >= 0 && priority < AT_PRIORITY_COUNT) {
+        _sockets[socket].priority = priority;
+        ok = true;
+    }
+    UNLOCK();
+    return ok;
+}
+
+int MDMParser::_socketPriority(int socket)
+{
+    return ISSOCKET(socket) ? _sockets[socket].priority : AT_PRIORITY_NORMAL;
+}
+
 bool MDMParser::socketClose(int socket)
 {
     bool ok = false;
@@ -1655,6 +1752,11 @@ bool MDMParser::_socketFree(int socket)
             _sockets[socket].connected  = false;
             _sockets[socket].pending    = 0;
             _sockets[socket].open       = false;
+            // data that wasn't received yet is lost with the socket
+            if (_rxSink == _sockets[socket].rx)
+                _rxSink = NULL;
+            delete _sockets[socket].rx;
+            _sockets[socket].rx         = NULL;
         }
         ok = true;
     }
@@ -1669,64 +1771,80 @@ bool MDMParser::socketFree(int socket)
     return _socketFree(socket);
 }
 
-int MDMParser::socketSend(int socket, const char * buf, int len)
+int MDMParser::_socketWrite(int socket, MDM_IP ip, int port, const char* buf, int len)
 {
-    //DEBUG_D("socketSend(%d,,%d)\r\n", socket,len);
+    int priority = _socketPriority(socket);
     int cnt = len;
+    int next = 0; // the size of the block whose write command was already sent
+    // the modem stays locked while a write command is outstanding between blocks
+    mdm_scheduler.lock(priority);
     while (cnt > 0) {
         int blk = USO_MAX_WRITE;
         if (cnt < blk)
             blk = cnt;
         bool ok = false;
-        {
-            LOCK();
-            if (ISSOCKET(socket)) {
-                sendFormated("AT+USOWR=%d,%d\r\n",_sockets[socket].handle,blk);
-                if (RESP_PROMPT == waitFinalResp()) {
-                    HAL_Delay_Milliseconds(50);
-                    send(buf, blk);
-                    if (RESP_OK == waitFinalResp())
-                        ok = true;
+        if (ISSOCKET(socket)) {
+            if (!next)
+                _sendWriteCommand(socket, ip, port, blk);
+            next = 0;
+            if (RESP_PROMPT == waitFinalResp()) {
+                HAL_Delay_Milliseconds(MDM_SOCKET_WRITE_PROMPT_DELAY);
+                send(buf, blk);
+#if MDM_PIPELINE_SOCKET_WRITES
+                // a more urgent transaction goes between the blocks instead
+                if (!mdm_scheduler.outranked(priority)) {
+                    next = cnt - blk;
+                    if (next > USO_MAX_WRITE)
+                        next = USO_MAX_WRITE;
+                    // queue the next write while the modem sends this block
+                    if (next)
+                        _sendWriteCommand(socket, ip, port, next);
                 }
+#endif
+                if (RESP_OK == waitFinalResp())
+                    ok = true;
             }
-            UNLOCK();
         }
-        if (!ok)
+        if (!ok) {
+            // the modem may still prompt for the queued block, which has to be satisfied
+            if (next && RESP_PROMPT == waitFinalResp()) {
+                HAL_Delay_Milliseconds(MDM_SOCKET_WRITE_PROMPT_DELAY);
+                send(buf + blk, next);
+                waitFinalResp();
+            }
+            mdm_scheduler.unlock();
             return MDM_SOCKET_ERROR;
+        }
         buf += blk;
         cnt -= blk;
+        if (!next) {
+            // nothing outstanding, let waiting threads talk to the modem
+            mdm_scheduler.unlock();
+            mdm_scheduler.lock(priority);
+        }
     }
+    mdm_scheduler.unlock();
     return (len - cnt);
 }
 
+void MDMParser::_sendWriteCommand(int socket, MDM_IP ip, int port, int len)
+{
+    if (ip == NOIP)
+        sendFormated("AT+USOWR=%d,%d\r\n",_sockets[socket].handle,len);
+    else
+        sendFormated("AT+USOST=%d,\"" IPSTR "\",%d,%d\r\n",_sockets[socket].handle,IPNUM(ip),port,len);
+}
+
+int MDMParser::socketSend(int socket, const char * buf, int len)
+{
+    //DEBUG_D("socketSend(%d,,%d)\r\n", socket,len);
+    return _socketWrite(socket, NOIP, 0, buf, len);
+}
+
 int MDMParser::socketSendTo(int socket, MDM_IP ip, int port, const char * buf, int len)
 {
     DEBUG_D("socketSendTo(%d," IPSTR ",%d,,%d)\r\n", socket,IPNUM(ip),port,len);
-    int cnt = len;
-    while (cnt > 0) {
-        int blk = USO_MAX_WRITE;
-        if (cnt < blk)
-            blk = cnt;
-        bool ok = false;
-        {
-            LOCK();
-            if (ISSOCKET(socket)) {
-                sendFormated("AT+USOST=%d,\"" IPSTR "\",%d,%d\r\n",_sockets[socket].handle,IPNUM(ip),port,blk);
-                if (RESP_PROMPT == waitFinalResp()) {
-                    HAL_Delay_Milliseconds(50);
-                    send(buf, blk);
-                    if (RESP_OK == waitFinalResp())
-                        ok = true;
-                }
-            }
-            UNLOCK();
-        }
-        if (!ok)
-            return MDM_SOCKET_ERROR;
-        buf += blk;
-        cnt -= blk;
-    }
-    return (len - cnt);
+    return _socketWrite(socket, ip, port, buf, len);
 }
 
 int MDMParser::socketReadable(int socket)
@@ -1734,25 +1852,95 @@ int MDMParser::socketReadable(int socket)
     int pending = MDM_SOCKET_ERROR;
     if (_cancel_all_operations)
             return MDM_SOCKET_ERROR;
-    LOCK();
+    LOCK_PRIORITY(_socketPriority(socket));
     if (ISSOCKET(socket) && _sockets[socket].connected) {
             //DEBUG_D("socketReadable(%d)\r\n", socket);
-        // allow to receive unsolicited commands
-        waitFinalResp(NULL, NULL, 0);
-        if (_sockets[socket].connected)
-           pending = _sockets[socket].pending;
+        if (!_sockets[socket].rx->readable()) {
+            // allow to receive unsolicited commands
+            waitFinalResp(NULL, NULL, 0);
+            _socketPrefetch();
+        }
+        if (ISSOCKET(socket) && _sockets[socket].connected)
+           pending = _socketBuffered(socket) + _sockets[socket].pending;
     }
     UNLOCK();
     return pending;
 }
 
+int MDMParser::_socketBuffered(int socket)
+{
+    Pipe<char>* rx = _sockets[socket].rx;
+    if (!_sockets[socket].datagrams)
+        return rx->size();
+    // only the next datagram can be received by one socketRecvFrom
+    if (!rx->readable())
+        return 0;
+    RxHeader hdr;
+    rx->set(0);
+    for (size_t i = 0; i < sizeof(hdr); i ++)
+        ((char*)&hdr)[i] = rx->next();
+    return hdr.len;
+}
+
+bool MDMParser::_socketFetch(int socket)
+{
+    SockCtrl& sock = _sockets[socket];
+    int blk = sock.pending;
+    if (blk > USO_MAX_READ)
+        blk = USO_MAX_READ;
+    int space = sock.rx->free();
+    if (sock.datagrams)
+        space -= sizeof(RxHeader);
+    if (blk > space) {
+        // a datagram is read as a whole, so wait until it fits
+        if (sock.datagrams)
+            return true;
+        blk = space;
+    }
+    if (blk <= 0)
+        return true;
+    USORDparam param;
+    param.rx = &sock.rx;
+    param.len = 0;
+    int ret;
+    // the payload is moved from the rx pipe to the ring, not through the line buffer
+    _rxSink = sock.rx;
+    if (sock.datagrams) {
+        sendFormated("AT+USORF=%d,%d\r\n", sock.handle, blk);
+        ret = waitFinalResp(_cbUSORF, &param);
+    } else {
+        sendFormated("AT+USORD=%d,%d\r\n", sock.handle, blk);
+        ret = waitFinalResp(_cbUSORD, &param);
+    }
+    _rxSink = NULL;
+    if (RESP_OK != ret)
+        return false;
+    // a +UUSORD received meanwhile may already account for this block,
+    // and nothing returned means nothing is left
+    sock.pending = param.len ? sock.pending - param.len : 0;
+    if (sock.pending < 0)
+        sock.pending = 0;
+    return true;
+}
+
+/* Fetches the data announced by +UUSORD/+UUSORF into the receive rings, so the
+   following socketRecv/socketRecvFrom calls are served without a round trip.
+   Not done from the URC handlers, since they run while a command is pending. */
+void MDMParser::_socketPrefetch(void)
+{
+    for (int socket = 0; socket < NUMSOCKETS; socket ++) {
+        if (ISSOCKET(socket) && _sockets[socket].pending > 0)
+            _socketFetch(socket);
+    }
+}
+
 int MDMParser::_cbUSORD(int type, const char* buf, int len, USORDparam* param)
 {
     if ((type == TYPE_PLUS) && param) {
         int sz, sk;
+        // the line ends with the opening quote, the payload goes to rx
         if ((sscanf(buf, "\r\n+USORD: %d,%d,", &sk, &sz) == 2) &&
-            (buf[len-sz-2] == '\"') && (buf[len-1] == '\"')) {
-            memcpy(param->buf, &buf[len-1-sz], sz);
+            (buf[len-1] == '\"') && *param->rx) {
             param->len = sz;
         } else {
             param->len = 0;
@@ -1773,11 +1961,10 @@ int MDMParser::socketRecv(int socket, char* buf, int len)
     system_tick_t start = HAL_Timer_Get_Milli_Seconds();
     while (len) {
         // DEBUG_D("socketRecv: LEN: %d\r\n", len);
-        int blk = MAX_SIZE; // still need space for headers and unsolicited  commands
-        if (len < blk) blk = len;
         bool ok = false;
+        bool wait = false;
         {
-            LOCK();
+            LOCK_PRIORITY(_socketPriority(socket));
             if (ISSOCKET(socket)) {
                 if (_sockets[socket].connected) {
                     int available = socketReadable(socket);
@@ -1791,24 +1978,24 @@ int MDMParser::socketRecv(int socket, char* buf, int len)
                     }
                     else
                     {
-                        if (blk > available)    // only read up to the amount available. When 0,
-                            blk = available;// skip reading and check timeout.
+                        int blk = _sockets[socket].rx->get(buf, len);
                         if (blk > 0) {
-                            DEBUG_D("socketRecv: _cbUSORD\r\n");
-                            sendFormated("AT+USORD=%d,%d\r\n",_sockets[socket].handle, blk);
-                            USORDparam param;
-                            param.buf = buf;
-                            if (RESP_OK == waitFinalResp(_cbUSORD, &param)) {
-                                blk = param.len;
-                                _sockets[socket].pending -= blk;
-                                len -= blk;
-                                cnt += blk;
-                                buf += blk;
-                                ok = true;
-                            }
+                            len -= blk;
+                            cnt += blk;
+                            buf += blk;
+                            ok = true;
+                        } else if (available > 0) {
+                            // prefetching failed, fetch again to report the error
+                            ok = _socketFetch(socket);
+                        } else if (!_sockets[socket].timeout_ms) {
+                            // non-blocking, return what was buffered
+                            len = 0;
+                            ok = true;
                         } else if (!TIMEOUT(start, _sockets[socket].timeout_ms)) {
                             // DEBUG_D("socketRecv: WAIT FOR URCs\r\n");
-                            ok = (WAIT == waitFinalResp(NULL,NULL,0)); // wait for URCs
+                            // socketReadable has polled for URCs, wait for more without holding the modem
+                            wait = true;
+                            ok = true;
                         } else {
                             // DEBUG_D("socketRecv: TIMEOUT\r\n");
                             len = 0;
@@ -1827,21 +2014,27 @@ int MDMParser::socketRecv(int socket, char* buf, int len)
             // DEBUG_D("socketRecv: ERROR\r\n");
             return MDM_SOCKET_ERROR;
         }
+        if (wait)
+            HAL_Delay_Milliseconds(MDM_POLL_MS);
     }
     // DEBUG_D("socketRecv: %d \"%*s\"\r\n", cnt, cnt, buf-cnt);
     return cnt;
 }
 
-int MDMParser::_cbUSORF(int type, const char* buf, int len, USORFparam* param)
+int MDMParser::_cbUSORF(int type, const char* buf, int len, USORDparam* param)
 {
     if ((type == TYPE_PLUS) && param) {
         int sz, sk, p, a,b,c,d;
+        Pipe<char>* rx = *param->rx;
         int r = sscanf(buf, "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,",
             &sk,&a,&b,&c,&d,&p,&sz);
-        if ((r == 7) && (buf[len-sz-2] == '\"') && (buf[len-1] == '\"')) {
-            memcpy(param->buf, &buf[len-1-sz], sz);
-            param->ip = IPADR(a,b,c,d);
-            param->port = p;
+        if ((r == 7) && (buf[len-1] == '\"') && rx) {
+            // the header goes ahead of the payload, which follows this line
+            RxHeader hdr;
+            hdr.ip = IPADR(a,b,c,d);
+            hdr.port = p;
+            hdr.len = sz;
+            rx->put((const char*)&hdr, sizeof(hdr));
             param->len = sz;
         } else {
             param->len = 0;
@@ -1857,43 +2050,32 @@ int MDMParser::socketRecvFrom(int socket, MDM_IP* ip, int* port, char* buf, int
 #ifdef MDM_DEBUG
     memset(buf, '\0', len);
 #endif
-    system_tick_t start = HAL_Timer_Get_Milli_Seconds();
-    while (len) {
-        int blk = MAX_SIZE; // still need space for headers and unsolicited commands
-        if (len < blk) blk = len;
-        bool ok = false;
-        {
-                LOCK();
-            if (ISSOCKET(socket)) {
-                if (blk > 0) {
-                    sendFormated("AT+USORF=%d,%d\r\n",_sockets[socket].handle, blk);
-                    USORFparam param;
-                    param.buf = buf;
-                    if (RESP_OK == waitFinalResp(_cbUSORF, &param)) {
-                        *ip = param.ip;
-                        *port = param.port;
-                        blk = param.len;
-                        _sockets[socket].pending -= blk;
-                        len -= blk;
-                        cnt += blk;
-                        buf += blk;
-                        len = 0; // done
-                        ok = true;
-                    }
-                } else if (!TIMEOUT(start, _sockets[socket].timeout_ms)) {
-                    ok = (WAIT == waitFinalResp(NULL,NULL,0)); // wait for URCs
-                } else {
-                    len = 0; // no more data and socket closed or timed-out
-                    ok = true;
-                }
+    bool ok = true;
+    LOCK_PRIORITY(_socketPriority(socket));
+    if (ISSOCKET(socket) && len > 0) {
+        if (!_sockets[socket].rx->readable())
+            ok = _socketFetch(socket);
+        // the socket may have been closed while fetching
+        if (ok && ISSOCKET(socket) && _sockets[socket].rx->readable()) {
+            Pipe<char>* rx = _sockets[socket].rx;
+            RxHeader hdr;
+            rx->get((char*)&hdr, sizeof(hdr));
+            cnt = (hdr.len < len) ? hdr.len : len;
+            rx->get(buf, cnt);
+            if (hdr.len > cnt) {
+                // the rest of the datagram doesn't fit and is dropped
+                rx->set(hdr.len - cnt);
+                rx->done();
             }
-            UNLOCK();
-        }
-        if (!ok) {
-            DEBUG_D("socketRecv: ERROR\r\n");
-            return MDM_SOCKET_ERROR;
+            *ip = hdr.ip;
+            *port = hdr.port;
         }
     }
+    UNLOCK();
+    if (!ok) {
+        DEBUG_D("socketRecv: ERROR\r\n");
+        return MDM_SOCKET_ERROR;
+    }
     //DEBUG_D("socketRecv: %d \"%*s\"\r\n", cnt, cnt, buf-cnt);
     return cnt;
 }
@@ -2147,144 +2329,13 @@ void MDMParser::dumpIp(MDM_IP ip)
     }
 }
 
-// ----------------------------------------------------------------
-int MDMParser::_parseMatch(Pipe<char>* pipe, int len, const char* sta, const char* end)
-{
-    int o = 0;
-    if (sta) {
-        while (*sta) {
-            if (++o > len)                  return WAIT;
-            char ch = pipe->next();
-            if (*sta++ != ch)               return NOT_FOUND;
-        }
-    }
-    if (!end)                               return o; // no termination
-    // at least any char
-    if (++o > len)                      return WAIT;
-    pipe->next();
-    // check the end
-    int x = 0;
-    while (end[x]) {
-        if (++o > len)                      return WAIT;
-        char ch = pipe->next();
-        x = (end[x] == ch) ? x + 1 :
-            (end[0] == ch) ? 1 :
-                            0;
-    }
-    return o;
-}
-
-int MDMParser::_parseFormated(Pipe<char>* pipe, int len, const char* fmt)
-{
-    int o = 0;
-    int num = 0;
-    if (fmt) {
-        while (*fmt) {
-            if (++o > len)                  return WAIT;
-            char ch = pipe->next();
-            if (*fmt == '%') {
-                fmt++;
-                if (*fmt == 'd') { // numeric
-                    fmt ++;
-                    num = 0;
-                    while (ch >= '0' && ch <= '9') {
-                        num = num * 10 + (ch - '0');
-                        if (++o > len)      return WAIT;
-                        ch = pipe->next();
-                    }
-                }
-                else if (*fmt == 'c') { // char buffer (takes last numeric as length)
-                    fmt ++;
-                    while (num --) {
-                        if (++o > len)      return WAIT;
-                        ch = pipe->next();
-                    }
-                }
-                else if (*fmt == 's') {
-                    fmt ++;
-                    if (ch != '\"')         return NOT_FOUND;
-                    do {
-                        if (++o > len)      return WAIT;
-                        ch = pipe->next();
-                    } while (ch != '\"');
-                    if (++o > len)          return WAIT;
-                    ch = pipe->next();
-                }
-            }
-            if (*fmt++ != ch)               return NOT_FOUND;
-        }
-    }
-    return o;
-}
-
-int MDMParser::_getLine(Pipe<char>* pipe, char* buf, int len)
-{
-    int unkn = 0;
-    int sz = pipe->size();
-    int fr = pipe->free();
-    if (len > sz)
-        len = sz;
-    while (len > 0)
-    {
-        static struct {
-              const char* fmt;                              int type;
-        } lutF[] = {
-            { "\r\n+USORD: %d,%d,\"%c\"",                   TYPE_PLUS       },
-            { "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"",  TYPE_PLUS       },
-            { "\r\n+URDFILE: %s,%d,\"%c\"",                 TYPE_PLUS       },
-        };
-        static struct {
-              const char* sta;          const char* end;    int type;
-        } lut[] = {
-            { "\r\nOK\r\n",             NULL,               TYPE_OK         },
-            { "\r\nERROR\r\n",          NULL,               TYPE_ERROR      },
-            { "\r\n+CME ERROR:",        "\r\n",             TYPE_ERROR      },
-            { "\r\n+CMS ERROR:",        "\r\n",             TYPE_ERROR      },
-            { "\r\nRING\r\n",           NULL,               TYPE_RING       },
-            { "\r\nCONNECT\r\n",        NULL,               TYPE_CONNECT    },
-            { "\r\nNO CARRIER\r\n",     NULL,               TYPE_NOCARRIER  },
-            { "\r\nNO DIALTONE\r\n",    NULL,               TYPE_NODIALTONE },
-            { "\r\nBUSY\r\n",           NULL,               TYPE_BUSY       },
-            { "\r\nNO ANSWER\r\n",      NULL,               TYPE_NOANSWER   },
-            { "\r\n+",                  "\r\n",             TYPE_PLUS       },
-            { "\r\n@",                  NULL,               TYPE_PROMPT     }, // Sockets
-            { "\r\n>",                  NULL,               TYPE_PROMPT     }, // SMS
-            { "\n>",                    NULL,               TYPE_PROMPT     }, // File
-            { "\r\nABORTED\r\n",        NULL,               TYPE_ABORTED    }, // Current command aborted
-        };
-        for (int i = 0; i < (int)(sizeof(lutF)/sizeof(*lutF)); i ++) {
-            pipe->set(unkn);
-            int ln = _parseFormated(pipe, len, lutF[i].fmt);
-            if (ln == WAIT && fr)
-                return WAIT;
-            if ((ln != NOT_FOUND) && (unkn > 0))
-                return TYPE_UNKNOWN | pipe->get(buf, unkn);
-            if (ln > 0)
-                return lutF[i].type  | pipe->get(buf, ln);
-        }
-        for (int i = 0; i < (int)(sizeof(lut)/sizeof(*lut)); i ++) {
-            pipe->set(unkn);
-            int ln = _parseMatch(pipe, len, lut[i].sta, lut[i].end);
-            if (ln == WAIT && fr)
-                return WAIT;
-            if ((ln != NOT_FOUND) && (unkn > 0))
-                return TYPE_UNKNOWN | pipe->get(buf, unkn);
-            if (ln > 0)
-                return lut[i].type | pipe->get(buf, ln);
-        }
-        // UNKNOWN
-        unkn ++;
-        len--;
-    }
-    return WAIT;
-}
-
 // ----------------------------------------------------------------
 // Electron Serial Implementation
 // ----------------------------------------------------------------
 
 MDMElectronSerial::MDMElectronSerial(int rxSize /*= 256*/, int txSize /*= 256*/) :
-    ElectronSerialPipe(rxSize, txSize)
+    ElectronSerialPipe(rxSize, txSize),
+    _rxSeen(0)
 {
 #ifdef MDM_DEBUG
         //_debugLevel = -1;
@@ -2305,5 +2356,14 @@ int MDMElectronSerial::_send(const void* buf, int len)
 
 int MDMElectronSerial::getLine(char* buffer, int length)
 {
-    return _getLine(&_pipeRx, buffer, length);
+    // move a socket payload first, so what's seen is only what's left to lex
+    _lexer.setSink(_rxSink);
+    _lexer.getPayload(&_pipeRx);
+    _rxSeen = _pipeRx.size();
+    return _lexer.getLine(&_pipeRx, buffer, length);
+}
+
+void MDMElectronSerial::_waitReadable(system_tick_t timeout_ms)
+{
+    waitReadable(_rxSeen, timeout_ms);
 }
@@ -29,12 +29,33 @@
 #include "pinmap_hal.h"
 #include "system_tick_hal.h"
 #include "enums_hal.h"
+#include "at_lexer.h"
 
 /* Include for debug capabilty */
 #define MDM_DEBUG
 
 #define USE_USART3_HARDWARE_FLOW_CONTROL_RTS_CTS 1
 
+/* Send the next socket write command before the modem confirms the previous
+   block, so large writes don't wait a round trip per block */
+#ifndef MDM_PIPELINE_SOCKET_WRITES
+#define MDM_PIPELINE_SOCKET_WRITES 0
+#endif
+
+/* Milliseconds to wait after the @ prompt of a socket write before sending
+   the data. The u-blox AT manual asks for at least 50ms, or the first bytes
+   can be lost */
+#ifndef MDM_SOCKET_WRITE_PROMPT_DELAY
+#define MDM_SOCKET_WRITE_PROMPT_DELAY 50
+#endif
+
+/* Size of the receive ring allocated for each open socket. Data announced
+   by the modem is fetched into the ring ahead of socketRecv/socketRecvFrom,
+   it must hold at least one full datagram (1024 bytes) and its header */
+#ifndef MDM_SOCKET_RX_SIZE
+#define MDM_SOCKET_RX_SIZE 1280
+#endif
+
 /** basic modem parser class
 */
 class MDMParser
@@ -217,6 +238,14 @@ public:
     */
     bool socketSetBlocking(int socket, system_tick_t timeout_ms);
 
+    /** Set how urgent the modem transactions of a socket are, by default
+        AT_PRIORITY_CLOUD for UDP and AT_PRIORITY_NORMAL for TCP sockets
+        \param socket the socket handle
+        \param priority the AtPriority
+        \return true if successful
+    */
+    bool socketSetPriority(int socket, int priority);
+
     /** Write socket data
         \param socket the socket handle
         \param buf the buffer to write
@@ -235,7 +264,8 @@ public:
     */
     int socketSendTo(int socket, MDM_IP ip, int port, const char * buf, int len);
 
-    /** Get the number of bytes pending for reading for this socket
+    /** Get the number of bytes pending for reading for this socket,
+        the modem is only polled when nothing was fetched ahead already
         \param socket the socket handle
         \return the number of bytes pending or SOCKET_ERROR on failure
     */
@@ -372,7 +402,7 @@ public:
 
     /** Get a line from the physical interface. This function need
         to be implemented in a inherited class. Usually just calls
-        #_getLine on the rx buffer pipe.
+        AtLexer::getLine on the rx buffer pipe.
 
         \param buf the buffer to store it
         \param buf size of the buffer
@@ -455,32 +485,11 @@ protected:
     */
     virtual int _send(const void* buf, int len) = 0;
 
-    /** Helper: Parse a line from the receiving buffered pipe
-        \param pipe the receiving buffer pipe
-        \param buf the parsed line
-        \param len the size of the parsed line
-        \return type and length if something was found,
-                WAIT if not enough data is available
-                NOT_FOUND if nothing was found
-    */
-    static int _getLine(Pipe<char>* pipe, char* buffer, int length);
-
-    /** Helper: Parse a match from the pipe
-        \param pipe the buffered pipe
-        \param number of bytes to parse at maximum,
-        \param sta the starting string, NULL if none
-        \param end the terminating string, NULL if none
-        \return size of parsed match
+    /** Wait for more data from the physical interface. The default
+        implementation just sleeps.
+        \param timeout_ms the maximum time to wait
     */
-    static int _parseMatch(Pipe<char>* pipe, int len, const char* sta, const char* end);
-
-    /** Helper: Parse a match from the pipe
-        \param pipe the buffered pipe
-        \param number of bytes to parse at maximum,
-        \param fmt the formating string (%d any number, %c any char of last %d len)
-        \return size of parsed match
-    */
-    static int _parseFormated(Pipe<char>* pipe, int len, const char* fmt);
+    virtual void _waitReadable(system_tick_t timeout_ms);
 
     /** Helper: Send SMS received index to callback
         \param index the index of the received SMS
@@ -516,10 +525,9 @@ protected:
     static int _cbUDNSRN(int type, const char* buf, int len, MDM_IP* ip);
     static int _cbUSOCR(int type, const char* buf, int len, int* handle);
     static int _cbUSOCTL(int type, const char* buf, int len, int* handle);
-    typedef struct { char* buf; int len; } USORDparam;
+    typedef struct { Pipe<char>* const* rx; int len; } USORDparam; // rx of the socket, NULL once freed; len of the payload
     static int _cbUSORD(int type, const char* buf, int len, USORDparam* param);
-    typedef struct { char* buf; MDM_IP ip; int port; int len; } USORFparam;
-    static int _cbUSORF(int type, const char* buf, int len, USORFparam* param);
+    static int _cbUSORF(int type, const char* buf, int len, USORDparam* param);
     typedef struct { char* buf; char* num; } CMGRparam;
     static int _cbCUSD(int type, const char* buf, int len, char* resp);
     // sms
@@ -530,6 +538,15 @@ protected:
     typedef struct { const char* filename; char* buf; int sz; int len; } URDFILEparam;
     static int _cbUDELFILE(int type, const char* buf, int len, void*);
     static int _cbURDFILE(int type, const char* buf, int len, URDFILEparam* param);
+    // unsolicited result codes, called with the arguments following the URC name
+    void _urcCMTI(const char* args);
+    void _urcCIEV(const char* args);
+    void _urcUUSORD(const char* args);
+    void _urcUUSOCL(const char* args);
+    void _urcUUPSDD(const char* args);
+    void _urcCREG(const char* args);
+    void _urcCGREG(const char* args);
+    void _urcReg(Reg* reg, const char* args);
     // variables
     DevStatus   _dev; //!< collected device information
     NetStatus   _net; //!< collected network information
@@ -545,15 +562,26 @@ protected:
         volatile bool connected;
         volatile int pending;
         volatile bool open;
+        bool datagrams;     //!< each datagram in rx is preceded by its RxHeader
+        Pipe<char>* rx;     //!< data fetched from the modem but not received yet
+        int priority;       //!< AtPriority of the transactions for this socket
     } SockCtrl;
+    typedef struct { MDM_IP ip; int port; int len; } RxHeader;
     // LISA-C has 6 TCP and 6 UDP sockets
     // LISA-U and SARA-G have 7 sockets
     SockCtrl _sockets[7];
+    Pipe<char>* _rxSink; //!< rx of the socket being read, which #getLine moves the payload to
     int _findSocket(int handle = MDM_SOCKET_ERROR/* = CREATE*/);
     int _socketCloseHandleIfOpen(int socket);
     int _socketCloseUnusedHandles(void);
     int _socketSocket(int socket, IpProtocol ipproto, int port);
     bool _socketFree(int socket);
+    bool _socketFetch(int socket);
+    void _socketPrefetch(void);
+    int _socketBuffered(int socket);
+    int _socketPriority(int socket);
+    int _socketWrite(int socket, MDM_IP ip, int port, const char* buf, int len); // NOIP to send on a connected socket
+    void _sendWriteCommand(int socket, MDM_IP ip, int port, int len);
     bool _powerOn(void);
     void _setBandSelectString(MDM_BandSelect &data, char* bands, int index=0); // private helper to create bands strings
     static MDMParser* inst;
@@ -600,6 +628,7 @@ public:
     {
         while (readable())
             getc();
+        _lexer.reset();
     }
 protected:
     /** Write bytes to the physical interface.
@@ -608,6 +637,14 @@ protected:
         \return bytes written
     */
     virtual int _send(const void* buf, int len);
+
+    /** Wait until the modem sends more data than was seen by #getLine.
+        \param timeout_ms the maximum time to wait
+    */
+    virtual void _waitReadable(system_tick_t timeout_ms);
+
+    AtLexer _lexer;
+    int _rxSeen; //!< bytes in the receive pipe when last parsed
 };
 
 /* Instance of MDMElectronSerial for use in HAL_USART3_Handler */
@@ -21,6 +21,7 @@
 
 #include <string.h>
 #include <stddef.h>
+#include <new>
 
 #include "service_debug.h"
 
@@ -45,7 +46,7 @@ public:
     */
     Pipe(int n, T* b = NULL)
     {
-        _a = b ? NULL : n ? new T[n] : NULL;
+        _a = b ? NULL : n ? new (std::nothrow) T[n] : NULL;
         _r = 0;
         _w = 0;
         _b = b ? b : _a;
@@ -83,6 +84,14 @@ public:
     // writing thread/context API
     //-------------------------------------------------------------
 
+    /** Check the buffer could be allocated
+        \return true if the pipe has a buffer
+    */
+    bool allocated(void)
+    {
+        return _b != NULL;
+    }
+
     /** Check if buffer is writeable (=not full)
         \return true if writeable
     */
@@ -151,6 +160,35 @@ public:
         return n - c;
     }
 
+    /* Move elements from another buffer, without copying them to an
+       intermediate buffer. (non blocking)
+        \param src the buffer to take the elements from
+        \param n the maximum number elements to move
+        \return number elements moved
+    */
+    int move(Pipe<T>* src, int n)
+    {
+        int c = n;
+        while (c)
+        {
+            int f = free();
+            int a = src->size();
+            if (f > a) f = a;
+            if (!f) break;
+            if (c < f) f = c;
+            int w = _w;
+            int r = src->_r;
+            // check wrap of both buffers
+            if (f > _s - w) f = _s - w;
+            if (f > src->_s - r) f = src->_s - r;
+            memcpy(&_b[w], &src->_b[r], f * sizeof(T));
+            _w = _inc(w, f);
+            src->_r = src->_inc(r, f);
+            c -= f;
+        }
+        return n - c;
+    }
+
     // reading thread/context API
     // --------------------------------------------------------
 
@@ -219,6 +257,28 @@ public:
         return n - c;
     }
 
+    /** get the elements that follow each other in memory from the read
+        position, e.g. to hand them to a DMA transfer. They stay in the
+        buffer until removed with #skip.
+        \param n set to the number of elements
+        \return pointer to the first element
+    */
+    const T* peek(int* n)
+    {
+        int r = _r;
+        int w = _w;
+        *n = (w >= r) ? w - r : _s - r;
+        return &_b[r];
+    }
+
+    /** remove elements from the buffer without copying them
+        \param n the number of elements to remove
+    */
+    void skip(int n)
+    {
+        _r = _inc(_r, n);
+    }
+
     // the following functions are useful if you like to inspect
     // or parse the buffer in the reading thread/context
     // --------------------------------------------------------
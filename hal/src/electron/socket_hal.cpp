@@ -1,16 +1,26 @@
 
 #include <stdint.h>
 #include "socket_hal.h"
+#include "socket_usage.h"
 #include "parser.h"
 
 const sock_handle_t SOCKET_MAX = (sock_handle_t)7; // 7 total sockets, handle 0-6
 const sock_handle_t SOCKET_INVALID = (sock_handle_t)-1;
 
+static SocketUsage accounting;
+static SocketTraffic traffic[SOCKET_MAX];
+
+inline bool is_valid(sock_handle_t handle)
+{
+    return handle<SOCKET_MAX;
+}
 
 sock_handle_t socket_create(uint8_t family, uint8_t type, uint8_t protocol, uint16_t port, network_interface_t nif)
 {
     sock_handle_t handle = electronMDM.socketSocket(protocol==IPPROTO_TCP ? MDM_IPPROTO_TCP : MDM_IPPROTO_UDP, port);
     electronMDM.socketSetBlocking(handle, 0);
+    if (is_valid(handle))
+        traffic[handle].reset();
     return handle;
 }
 
@@ -43,6 +53,8 @@ sock_result_t socket_receive(sock_handle_t sd, void* buffer, socklen_t len, syst
     }
     if (!result)
     		result = electronMDM.socketRecv(sd, (char*)buffer, len);
+    if (is_valid(sd))
+        accounting.received(traffic[sd], result);
     return result;
 }
 
@@ -62,6 +74,8 @@ sock_result_t socket_receivefrom(sock_handle_t sock, void* buffer, socklen_t buf
 
 	// have some data to let's get it.
 	result = electronMDM.socketRecvFrom(sock, &ip, &port, (char*)buffer, bufLen);
+    if (is_valid(sock))
+        accounting.received(traffic[sock], result);
     if (result > 0) {
         uint32_t ipv4 = ip;
         addr->sa_data[0] = (port>>8) & 0xFF;
@@ -93,7 +107,10 @@ sock_result_t socket_close(sock_handle_t sock)
 
 sock_result_t socket_send(sock_handle_t sd, const void* buffer, socklen_t len)
 {
-    return electronMDM.socketSend(sd, (const char*)buffer, len);
+    sock_result_t result = electronMDM.socketSend(sd, (const char*)buffer, len);
+    if (is_valid(sd))
+        accounting.sent(traffic[sd], result);
+    return result;
 }
 
 sock_result_t socket_sendto(sock_handle_t sd, const void* buffer, socklen_t len, uint32_t flags, sockaddr_t* addr, socklen_t addr_size)
@@ -101,12 +118,10 @@ sock_result_t socket_sendto(sock_handle_t sd, const void* buffer, socklen_t len,
     const uint8_t* addr_data = addr->sa_data;
     uint16_t port = addr_data[0]<<8 | addr_data[1];
     MDM_IP ip = IPADR(addr_data[2], addr_data[3], addr_data[4], addr_data[5]);
-    return electronMDM.socketSendTo(sd, ip, port, (const char*)buffer, len);
-}
-
-inline bool is_valid(sock_handle_t handle)
-{
-    return handle<SOCKET_MAX;
+    sock_result_t result = electronMDM.socketSendTo(sd, ip, port, (const char*)buffer, len);
+    if (is_valid(sd))
+        accounting.sent(traffic[sd], result);
+    return result;
 }
 
 uint8_t socket_handle_valid(sock_handle_t handle)
@@ -138,3 +153,37 @@ sock_result_t socket_create_tcp_server(uint16_t port, network_interface_t nif)
 {
     return -1;
 }
+
+sock_result_t socket_sendv(sock_handle_t sd, const sock_iovec_t* iov, size_t count, void* reserved)
+{
+    sock_result_t total = 0;
+    for (size_t i=0; i<count; i++) {
+        sock_result_t result = socket_send(sd, iov[i].data, iov[i].length);
+        if (result<0)
+            return total ? total : result;
+        total += result;
+        if (socklen_t(result)<iov[i].length)
+            break;
+    }
+    return total;
+}
+
+sock_result_t socket_wait_readable(sock_handle_t* handles, size_t count, system_tick_t timeout, void* reserved)
+{
+    return -1;
+}
+
+sock_result_t socket_set_usage(sock_handle_t sd, uint8_t usage, void* reserved)
+{
+    return is_valid(sd) ? SocketUsage::set_usage(traffic[sd], usage) : -1;
+}
+
+sock_result_t socket_usage(sock_handle_t sd, socket_usage_stats_t* stats, void* reserved)
+{
+    return is_valid(sd) ? SocketUsage::copy(traffic[sd].stats, stats) : -1;
+}
+
+sock_result_t socket_usage_total(uint8_t usage, socket_usage_stats_t* stats, void* reserved)
+{
+    return accounting.total(usage, stats);
+}
@@ -33,7 +33,7 @@
 #include <iostream>
 #include "filesystem.h"
 #include "service_debug.h"
-#include "device_config.h"
+#include "device_context.h"
 #include "hal_platform.h"
 #include "interrupts_hal.h"
 #include <boost/crc.hpp>  // for boost::crc_32_type
@@ -375,7 +375,7 @@ bool HAL_Feature_Get(HAL_Feature feature)
         {
         		uint8_t value = false;
 #if HAL_PLATFORM_CLOUD_UDP
-        		value = (deviceConfig.get_protocol()==PROTOCOL_DTLS);
+        		value = (current_device().config.get_protocol()==PROTOCOL_DTLS);
 #endif
         		return value;
         }
@@ -387,6 +387,8 @@ bool HAL_Feature_Get(HAL_Feature feature)
 
 #include "dtls_session_persist.h"
 SessionPersistDataOpaque session;
+KeepAlivePersistDataOpaque keepalive;
+TransferPersistDataOpaque transfer;
 
 int HAL_System_Backup_Save(size_t offset, const void* buffer, size_t length, void* reserved)
 {
@@ -395,6 +397,16 @@ int HAL_System_Backup_Save(size_t offset, const void* buffer, size_t length, voi
         memcpy(&session, buffer, length);
         return 0;
     }
+    if (offset==KeepAlivePersistOffset && length==sizeof(KeepAlivePersistDataOpaque))
+    {
+        memcpy(&keepalive, buffer, length);
+        return 0;
+    }
+    if (offset==TransferPersistOffset && length==sizeof(TransferPersistDataOpaque))
+    {
+        memcpy(&transfer, buffer, length);
+        return 0;
+    }
     return -1;
 }
 
@@ -406,6 +418,18 @@ int HAL_System_Backup_Restore(size_t offset, void* buffer, size_t max_length, si
         memcpy(buffer, &session, sizeof(session));
         return 0;
     }
+    if (offset==KeepAlivePersistOffset && max_length>=sizeof(KeepAlivePersistDataOpaque) && keepalive.size==sizeof(KeepAlivePersistDataOpaque))
+    {
+        *length = sizeof(KeepAlivePersistDataOpaque);
+        memcpy(buffer, &keepalive, sizeof(keepalive));
+        return 0;
+    }
+    if (offset==TransferPersistOffset && max_length>=sizeof(TransferPersistDataOpaque) && transfer.size==sizeof(TransferPersistDataOpaque))
+    {
+        *length = sizeof(TransferPersistDataOpaque);
+        memcpy(buffer, &transfer, sizeof(transfer));
+        return 0;
+    }
     return -1;
 }
 
@@ -18,17 +18,15 @@
 
 #include "delay_hal.h"
 #include "timer_hal.h"
-
-#include <boost/date_time/posix_time/posix_time.hpp>
-#include <boost/thread/thread.hpp>
+#include "device_clock.h"
 
 void HAL_Delay_Milliseconds(uint32_t millis)
 {
-    boost::this_thread::sleep(boost::posix_time::milliseconds(millis));
+    device_clock().sleep_micros(uint64_t(millis) * 1000);
 }
 
 void HAL_Delay_Microseconds(uint32_t micros)
 {
-    boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    device_clock().sleep_micros(micros);
 }
 
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "device_clock.h"
+#include <time.h>
+#include <cerrno>
+
+MonotonicClock::MonotonicClock() : start(read())
+{
+}
+
+uint64_t MonotonicClock::read()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t MonotonicClock::now_micros()
+{
+    return read() - start;
+}
+
+void MonotonicClock::sleep_micros(uint64_t micros)
+{
+    struct timespec ts;
+    ts.tv_sec = micros / 1000000;
+    ts.tv_nsec = (micros % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) && errno==EINTR) {
+    }
+}
+
+uint64_t FastForwardClock::now_micros()
+{
+    return poll_step ? now.fetch_add(poll_step) : now.load();
+}
+
+void FastForwardClock::sleep_micros(uint64_t micros)
+{
+    uint64_t current = now.load();
+    const uint64_t deadline = current + micros;
+    // move to the deadline unless another thread already moved past it
+    while (current<deadline && !now.compare_exchange_weak(current, deadline)) {
+    }
+}
+
+void FastForwardClock::advance(uint64_t micros)
+{
+    now += micros;
+}
+
+static DeviceClock* clock_override = nullptr;
+
+DeviceClock& device_clock()
+{
+    static MonotonicClock monotonic;
+    return clock_override ? *clock_override : monotonic;
+}
+
+void set_device_clock(DeviceClock& clock)
+{
+    clock_override = &clock;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+/**
+ * The source of time for the virtual device. The timer, delay and RTC HALs
+ * all go through the device clock so that time can be simulated.
+ */
+class DeviceClock
+{
+public:
+    virtual ~DeviceClock() {}
+
+    /**
+     * The number of microseconds since the clock started.
+     */
+    virtual uint64_t now_micros() = 0;
+
+    /**
+     * Waits until the given number of microseconds have elapsed.
+     */
+    virtual void sleep_micros(uint64_t micros) = 0;
+};
+
+/**
+ * Real time, read from CLOCK_MONOTONIC.
+ */
+class MonotonicClock : public DeviceClock
+{
+    uint64_t start;
+
+    static uint64_t read();
+
+public:
+    MonotonicClock();
+
+    uint64_t now_micros() override;
+    void sleep_micros(uint64_t micros) override;
+};
+
+/**
+ * Simulated time that only moves when the device waits. A wait returns
+ * immediately with the clock moved forward to the end of the wait, so
+ * long timeouts and backoffs take no real time, and the times seen by the
+ * device depend only on what it does.
+ *
+ * When several threads wait at once the clock moves to the latest of
+ * their deadlines; it never moves backwards.
+ *
+ * Code that polls the time until a timeout passes without ever waiting, such as
+ * SparkProtocol::event_loop() and blocking_receive(), would spin forever on a clock
+ * that only moves when waiting. With a poll step, each reading of the clock also
+ * moves it forward by the step.
+ */
+class FastForwardClock : public DeviceClock
+{
+    std::atomic<uint64_t> now;
+    const uint64_t poll_step;
+
+public:
+    /**
+     * The poll step used by the virtual device.
+     */
+    static const uint64_t DEFAULT_POLL_STEP = 100;
+
+    FastForwardClock(uint64_t poll_step=0) : now(0), poll_step(poll_step) {}
+
+    uint64_t now_micros() override;
+    void sleep_micros(uint64_t micros) override;
+
+    /**
+     * Moves the clock forward without waiting.
+     */
+    void advance(uint64_t micros);
+};
+
+/**
+ * Retrieves the clock used by the device. This is a MonotonicClock unless
+ * another clock has been set.
+ */
+DeviceClock& device_clock();
+
+/**
+ * Sets the clock used by the device. The clock must outlive its use.
+ */
+void set_device_clock(DeviceClock& clock);
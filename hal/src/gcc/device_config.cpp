@@ -17,6 +17,8 @@
  */
 
 #include "device_config.h"
+#include "device_context.h"
+#include "device_clock.h"
 #include "core_msg.h"
 #include "filesystem.h"
 #include <cstdlib>
@@ -34,7 +36,6 @@ using namespace std;
 const char* DEVICE_ID = "device_id";
 const char* STATE_DIR = "state";
 
-DeviceConfig deviceConfig;
 
 const char* CMD_HELP = "help";
 const char* CMD_VERSION = "version";
@@ -95,6 +96,11 @@ public:
             ("server_key,sk", po::value<string>(&config.server_key)->default_value("server_key.der"), "the filename containing the server public key")
             ("state,s", po::value<string>(&config.periph_directory)->default_value("state"), "the directory where device state and peripherals is stored")
 			("protocol,p", po::value<ProtocolFactory>(&config.protocol)->default_value(PROTOCOL_LIGHTSSL), "the cloud communication protocol to use")
+			("sockets", po::value<uint16_t>(&config.socket_count)->default_value(64), "the maximum number of sockets that can be open at once")
+			("fleet", po::value<string>(&config.fleet_directory), "run every device in the given directory in this process")
+			("clock", po::value<string>(&config.clock)->default_value("monotonic"), "the device clock. 'monotonic' follows real time, 'fast' skips ahead over delays.")
+			("fleet_threads", po::value<uint16_t>(&config.fleet_threads)->default_value(0), "the number of threads running the fleet devices. 0 uses one thread per core.")
+			("flash_latency", po::value<uint32_t>(&config.flash_latency)->default_value(0), "the microseconds taken to write each kilobyte of a firmware update, simulating the time taken to program flash")
 			;
 
         command_line_options.add(program_options).add(device_options);
@@ -182,26 +188,41 @@ bool read_device_config(int argc, char* argv[])
         return false;
     }
 
-    deviceConfig.read(parser.config);
+    current_device().config.read(parser.config);
     return true;
 }
 
 void DeviceConfig::read(Configuration& configuration)
 {
 #ifndef SPARK_NO_CLOUD
-    size_t length = configuration.device_id.length();
-    if (length!=24) {
-        throw std::invalid_argument(std::string("expected device ID of length 24 from config ") + DEVICE_ID + ", got: '"+configuration.device_id+ "'");
-    }
+    // fleet devices each have their own ID and key
+    if (configuration.fleet_directory.empty()) {
+        size_t length = configuration.device_id.length();
+        if (length!=24) {
+            throw std::invalid_argument(std::string("expected device ID of length 24 from config ") + DEVICE_ID + ", got: '"+configuration.device_id+ "'");
+        }
 
-    hex2bin(configuration.device_id, device_id, sizeof(device_id));
+        hex2bin(configuration.device_id, device_id, sizeof(device_id));
 
-    read_file(configuration.device_key.c_str(), device_key, sizeof(device_key));
+        read_file(configuration.device_key.c_str(), device_key, sizeof(device_key));
+    }
     read_file(configuration.server_key.c_str(), server_key, sizeof(server_key));
 #endif
 
     setLoggerLevel(LoggerOutputLevel(NO_LOG_LEVEL-configuration.log_level));
 
+    if (configuration.clock=="fast") {
+        static FastForwardClock fast_clock(FastForwardClock::DEFAULT_POLL_STEP);
+        set_device_clock(fast_clock);
+    }
+    else if (configuration.clock!="monotonic") {
+        throw std::invalid_argument(std::string("unknown clock '") + configuration.clock + "'");
+    }
+
     this->protocol = configuration.protocol;
+    this->socket_count = configuration.socket_count;
+    this->fleet_directory = configuration.fleet_directory;
+    this->fleet_threads = configuration.fleet_threads;
+    this->flash_latency = configuration.flash_latency;
 }
 
@@ -52,6 +52,11 @@ struct Configuration
     std::string server_key;
     std::string periph_directory;
     uint16_t log_level = 0;
+    uint16_t socket_count = 0;
+    std::string fleet_directory;
+    uint16_t fleet_threads = 0;
+    std::string clock;
+    uint32_t flash_latency = 0;
     ProtocolFactory protocol = PROTOCOL_LIGHTSSL;
 };
 
@@ -65,6 +70,10 @@ struct DeviceConfig
     uint8_t device_key[1024];
     uint8_t server_key[1024];
     ProtocolFactory protocol;
+    uint16_t socket_count;
+    std::string fleet_directory;
+    uint16_t fleet_threads;
+    uint32_t flash_latency;     // microseconds taken to write each kilobyte of the OTA file
 
     size_t hex2bin(const std::string& hex, uint8_t* dest, size_t destLen);
 
@@ -81,7 +90,3 @@ struct DeviceConfig
 
     ProtocolFactory get_protocol() { return protocol; }
 };
-
-
-
-extern DeviceConfig deviceConfig;
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "device_context.h"
+
+static DeviceContext process_device;
+
+static thread_local DeviceContext* thread_device = nullptr;
+
+DeviceContext& current_device()
+{
+    return thread_device ? *thread_device : process_device;
+}
+
+DeviceContext* select_device(DeviceContext* device)
+{
+    DeviceContext* previous = thread_device;
+    thread_device = device;
+    return previous;
+}
+
+DeviceScope::DeviceScope(DeviceContext& device) : previous(select_device(&device))
+{
+}
+
+DeviceScope::~DeviceScope()
+{
+    select_device(previous);
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include "device_config.h"
+#include "mapped_file.h"
+
+class SocketTable;
+
+/**
+ * Destroys a socket table created by the socket HAL, closing any open sockets.
+ */
+void socket_table_destroy(SocketTable* table);
+
+/**
+ * The state of a single virtual device. The HAL reads and writes device state
+ * through current_device(), so several devices can be simulated in one process
+ * by binding a different context to each thread that runs a device.
+ */
+struct DeviceContext
+{
+    DeviceConfig config;
+
+    static const size_t EEPROM_SIZE = 2048;
+
+    /**
+     * The eeprom contents when the eeprom is transient.
+     */
+    uint8_t eeprom_buffer[EEPROM_SIZE];
+
+    /**
+     * The file the eeprom is mapped from when the eeprom is persisted.
+     */
+    MappedFile eeprom_file;
+
+    /**
+     * The file receiving firmware updates.
+     */
+    MappedFile ota_file;
+
+    uint8_t* eeprom()
+    {
+        return eeprom_file.is_open() ? eeprom_file.data() : eeprom_buffer;
+    }
+
+    /**
+     * The device's sockets, created by the socket HAL on first use.
+     */
+    SocketTable* sockets = nullptr;
+
+    DeviceContext() = default;
+    DeviceContext(const DeviceContext&) = delete;
+    DeviceContext& operator=(const DeviceContext&) = delete;
+
+    ~DeviceContext()
+    {
+        socket_table_destroy(sockets);
+    }
+};
+
+/**
+ * Retrieves the device bound to the calling thread, or the process-wide
+ * device when no device has been bound.
+ */
+DeviceContext& current_device();
+
+/**
+ * Binds a device to the calling thread.
+ * @param device    The device, or nullptr for the process-wide device.
+ * @return The device bound previously, nullptr for the process-wide device.
+ */
+DeviceContext* select_device(DeviceContext* device);
+
+/**
+ * Binds a device to the calling thread for the lifetime of this object.
+ */
+class DeviceScope
+{
+    DeviceContext* previous;
+
+public:
+    DeviceScope(DeviceContext& device);
+    ~DeviceScope();
+
+    DeviceScope(const DeviceScope&) = delete;
+    DeviceScope& operator=(const DeviceScope&) = delete;
+};
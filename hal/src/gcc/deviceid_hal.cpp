@@ -25,7 +25,7 @@
 
 
 #include "deviceid_hal.h"
-#include "device_config.h"
+#include "device_context.h"
 #include "filesystem.h"
 
 #include <stddef.h>
@@ -41,7 +41,7 @@ using std::string;
 
 unsigned HAL_device_ID(uint8_t* dest, unsigned destLen)
 {
-    return deviceConfig.fetchDeviceID(dest, destLen);
+    return current_device().config.fetchDeviceID(dest, destLen);
 }
 
 unsigned HAL_Platform_ID()
@@ -1,8 +1,17 @@
 
 #pragma once
 
+/**
+ * Persists the eeprom in the given file. The file is mapped into memory,
+ * and is created or extended with erased (0xFF) bytes as needed.
+ */
 void GCC_EEPROM_Load(const char* filename);
 
+/**
+ * Writes a copy of the eeprom contents to the given file.
+ */
 void GCC_EEPROM_Save(const char* filename);
 
 
+
+
@@ -20,28 +20,25 @@
 #include "eeprom_hal.h"
 #include "eeprom_file.h"
 #include "filesystem.h"
+#include "device_context.h"
 #include <string.h>
 #include <string>
+#include <stdexcept>
 
 /*
  * Implements eeprom either as a transient storage,
  * or as a persisted storage, depending upon if the file exists.
- *
+ * Persisted eeprom is mapped from the file, so writes are memory stores
+ * and the file is synced when the eeprom is cleared or unmapped.
+ * The eeprom contents belong to the current device.
  */
 
-static uint8_t eeprom[2048];
-
-std::string eeprom_file;
-
 /**
  * Write the eeprom state to the file.
- * This currently writes the entire file.
  */
 void GCC_EEPROM_Flush()
 {
-	if (eeprom_file.length()) {
-		GCC_EEPROM_Save(eeprom_file.c_str());
-	}
+	current_device().eeprom_file.sync();
 }
 
 /**
@@ -51,7 +48,7 @@ void GCC_EEPROM_Flush()
  */
 void HAL_EEPROM_Init()
 {
-	if (!eeprom_file.length())
+	if (!current_device().eeprom_file.is_open())
 		HAL_EEPROM_Clear();
 }
 
@@ -69,23 +66,22 @@ void HAL_EEPROM_Write(uint32_t index, uint8_t data)
 
 void HAL_EEPROM_Get(uint32_t index, void *data, size_t length)
 {
-	memcpy(data, eeprom+index, length);
+	memcpy(data, current_device().eeprom()+index, length);
 }
 
 void HAL_EEPROM_Put(uint32_t index, const void *data, size_t length)
 {
-	memcpy(eeprom+index, data, length);
-	GCC_EEPROM_Flush();
+	memcpy(current_device().eeprom()+index, data, length);
 }
 
 size_t HAL_EEPROM_Length()
 {
-	return sizeof(eeprom);
+	return DeviceContext::EEPROM_SIZE;
 }
 
 void HAL_EEPROM_Clear()
 {
-	memset(eeprom, 0xFF, sizeof(eeprom));
+	memset(current_device().eeprom(), 0xFF, DeviceContext::EEPROM_SIZE);
 	GCC_EEPROM_Flush();
 }
 
@@ -100,13 +96,18 @@ void HAL_EEPROM_Perform_Pending_Erase()
 
 void GCC_EEPROM_Load(const char* filename)
 {
-	read_file(filename, eeprom, sizeof(eeprom));
-	eeprom_file = filename;
+	if (!current_device().eeprom_file.open(filename, DeviceContext::EEPROM_SIZE)) {
+		throw std::invalid_argument(std::string("unable to map file '") + filename + "'");
+	}
 }
 
 void GCC_EEPROM_Save(const char* filename)
 {
-	write_file(filename, eeprom, sizeof(eeprom));
+	DeviceContext& device = current_device();
+	// rewriting the mapped file would truncate it under the mapping
+	if (device.eeprom_file.is_open() && device.eeprom_file.name()==filename) {
+		GCC_EEPROM_Flush();
+		return;
+	}
+	write_file(filename, current_device().eeprom(), DeviceContext::EEPROM_SIZE);
 }
-
-
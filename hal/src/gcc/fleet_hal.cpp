@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fleet_hal.h"
+#include "device_context.h"
+#include "eeprom_file.h"
+#include "eeprom_hal.h"
+#include "filesystem.h"
+#include <memory>
+#include <stdexcept>
+
+struct hal_fleet_device : DeviceContext
+{
+};
+
+bool HAL_Fleet_Config(hal_fleet_config_t* config, void* reserved)
+{
+    const DeviceConfig& process = current_device().config;
+    if (process.fleet_directory.empty())
+        return false;
+    config->threads = process.fleet_threads;
+    config->directory = process.fleet_directory.c_str();
+    return true;
+}
+
+hal_fleet_device_t* HAL_Fleet_Device_Create(const char* directory, const char* device_id, void* reserved)
+{
+    std::unique_ptr<hal_fleet_device_t> device(new hal_fleet_device_t());
+    DeviceConfig& config = device->config;
+    config = current_device().config;
+    config.hex2bin(device_id, config.device_id, sizeof(config.device_id));
+    std::string path(directory);
+    try {
+        read_file((path + "/device_key.der").c_str(), config.device_key, sizeof(config.device_key));
+    }
+    catch (const std::invalid_argument&) {
+        return nullptr;
+    }
+
+    DeviceScope scope(*device);
+    HAL_EEPROM_Init();
+    std::string eeprom = path + "/eeprom.bin";
+    if (exists_file(eeprom.c_str()))
+        GCC_EEPROM_Load(eeprom.c_str());
+    return device.release();
+}
+
+void HAL_Fleet_Device_Destroy(hal_fleet_device_t* device, void* reserved)
+{
+    delete device;
+}
+
+hal_fleet_device_t* HAL_Fleet_Device_Select(hal_fleet_device_t* device, void* reserved)
+{
+    // outside the HAL devices are selected only here, so the previous device is a fleet device
+    return static_cast<hal_fleet_device_t*>(select_device(device));
+}
@@ -5,6 +5,8 @@
 
 namespace ip = boost::asio::ip;
 
+boost::asio::io_service device_io_service;
+
 int inet_gethostbyname(const char* hostname, uint16_t hostnameLen, HAL_IPAddress* out_ip_addr,
         network_interface_t nif, void* reserved)
 {
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mapped_file.h"
+#include "service_debug.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+bool MappedFile::open(const char* filename, size_t size, uint8_t fill)
+{
+    close();
+    fd = ::open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd<0) {
+        ERROR("unable to open '%s': %d", filename, errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t(st.st_size)<size && ftruncate(fd, size))) {
+        ERROR("unable to size '%s': %d", filename, errno);
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping==MAP_FAILED) {
+        ERROR("unable to map '%s': %d", filename, errno);
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    data_ = (uint8_t*)mapping;
+    size_ = size;
+    name_ = filename;
+    if (size_t(st.st_size)<size) {
+        memset(data_+st.st_size, fill, size-st.st_size);
+    }
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data_) {
+        sync();
+        munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+    if (fd>=0) {
+        ::close(fd);
+        fd = -1;
+    }
+    name_.clear();
+}
+
+void MappedFile::sync(size_t offset, size_t length)
+{
+    if (!data_ || offset>=size_)
+        return;
+    if (length>size_-offset)
+        length = size_-offset;
+    // msync requires a page aligned address
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t start = offset - (offset % page);
+    msync(data_+start, length+(offset-start), MS_SYNC);
+}
+
+void MappedFile::advise_sequential()
+{
+    if (data_)
+        madvise(data_, size_, MADV_SEQUENTIAL);
+}
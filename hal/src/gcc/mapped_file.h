@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * A file mapped into memory, used to back the virtual device's persistent storage.
+ * Writes are plain memory stores; sync() writes them back to the file.
+ */
+class MappedFile
+{
+    int fd = -1;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    std::string name_;
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    /**
+     * Maps a file, creating it if it doesn't exist. A file shorter than
+     * {@code size} is extended, and the added bytes are set to {@code fill}.
+     * @return true if the file was mapped.
+     */
+    bool open(const char* filename, size_t size, uint8_t fill=0xFF);
+
+    /**
+     * Syncs and unmaps the file.
+     */
+    void close();
+
+    /**
+     * Writes changes in the given range back to the file and waits for the write to complete.
+     */
+    void sync(size_t offset, size_t length);
+
+    void sync()
+    {
+        sync(0, size_);
+    }
+
+    /**
+     * Hints that the mapping will be accessed sequentially.
+     */
+    void advise_sequential();
+
+    bool is_open() const
+    {
+        return data_!=nullptr;
+    }
+
+    uint8_t* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+};
@@ -1,9 +1,10 @@
 #include "ota_flash_hal.h"
-#include "device_config.h"
+#include "device_context.h"
 #include <string.h>
 #include <cstdio>
 #include "service_debug.h"
 #include "core_hal.h"
+#include "delay_hal.h"
 #include "filesystem.h"
 #include "bytes2hexbuf.h"
 
@@ -29,27 +30,50 @@ uint16_t HAL_OTA_ChunkSize()
     return 512;
 }
 
-FILE* output_file;
+/**
+ * Firmware updates are written to this file, which is mapped for the duration of the update.
+ */
+const char* OTA_FILE = "output.bin";
 
 bool HAL_FLASH_Begin(uint32_t sFLASH_Address, uint32_t fileSize, void* reserved)
 {
-    output_file = fopen("output.bin", "wb");
+    MappedFile& output = current_device().ota_file;
+    // start from an empty file so nothing remains from a previous update
+    std::remove(OTA_FILE);
+    if (!output.open(OTA_FILE, fileSize ? fileSize : HAL_OTA_FlashLength()))
+        return false;
+    output.advise_sequential();
     DEBUG("flash started");
-    return output_file;
+    return true;
+}
+
+bool HAL_FLASH_Resume(uint32_t sFLASH_Address, uint32_t fileSize, void* reserved)
+{
+    // the file holds what was written before the update was interrupted
+    MappedFile& output = current_device().ota_file;
+    if (!output.open(OTA_FILE, fileSize ? fileSize : HAL_OTA_FlashLength()))
+        return false;
+    DEBUG("flash resumed");
+    return true;
 }
 
 int HAL_FLASH_Update(const uint8_t *pBuffer, uint32_t address, uint32_t length, void* reserved)
 {
 	DEBUG("flash write %d %d", address, length);
-	fseek(output_file, address, SEEK_SET);
-    fwrite(pBuffer, length, 1, output_file);
+	MappedFile& output = current_device().ota_file;
+	if (!output.is_open() || address>output.size() || length>output.size()-address)
+		return 1;
+	memcpy(output.data()+address, pBuffer, length);
+	uint32_t latency = current_device().config.flash_latency;
+	if (latency)
+		HAL_Delay_Microseconds(uint64_t(latency)*length/1024);
     return 0;
 }
 
  hal_update_complete_t HAL_FLASH_End(void* reserved)
 {
-	 fclose(output_file);
-	 output_file = NULL;
+	 // close() syncs the file
+	 current_device().ota_file.close();
      return HAL_UPDATE_APPLIED;
 }
 
@@ -130,7 +154,7 @@ void HAL_FLASH_Read_ServerAddress(ServerAddress* server_addr)
 {
 	memset(server_addr, 0, sizeof(ServerAddress));
 	int offset = HAL_Feature_Get(FEATURE_CLOUD_UDP) ? SERVER_ADDRESS_OFFSET_EC : SERVER_ADDRESS_OFFSET;
-    parseServerAddressData(server_addr, deviceConfig.server_key+offset);
+    parseServerAddressData(server_addr, current_device().config.server_key+offset);
 }
 
 bool HAL_OTA_Flashed_GetStatus(void)
@@ -147,7 +171,7 @@ void HAL_OTA_Flashed_ResetStatus(void)
 
 void HAL_FLASH_Read_ServerPublicKey(uint8_t *keyBuffer)
 {
-    memcpy(keyBuffer, deviceConfig.server_key, PUBLIC_KEY_LEN);
+    memcpy(keyBuffer, current_device().config.server_key, PUBLIC_KEY_LEN);
     char buf[PUBLIC_KEY_LEN*2];
     bytes2hexbuf(keyBuffer, PUBLIC_KEY_LEN, buf);
     INFO("server key: %s", buf);
@@ -155,7 +179,7 @@ void HAL_FLASH_Read_ServerPublicKey(uint8_t *keyBuffer)
 
 int HAL_FLASH_Read_CorePrivateKey(uint8_t *keyBuffer, private_key_generation_t* generation)
 {
-    memcpy(keyBuffer, deviceConfig.device_key, PRIVATE_KEY_LEN);
+    memcpy(keyBuffer, current_device().config.device_key, PRIVATE_KEY_LEN);
     char buf[PRIVATE_KEY_LEN*2];
     bytes2hexbuf(keyBuffer, PRIVATE_KEY_LEN, buf);
     INFO("device key: %s", buf);
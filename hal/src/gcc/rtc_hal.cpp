@@ -1,5 +1,6 @@
 
 #include "rtc_hal.h"
+#include "device_clock.h"
 
 
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -20,10 +21,15 @@ time_t to_time_t(boost::posix_time::ptime t)
 }
 #endif
 
+/**
+ * The wall clock time when the device started. The current time is computed from
+ * the device clock so that it follows simulated time.
+ */
+static const time_t start_time = to_time_t(boost::posix_time::microsec_clock::universal_time());
+
 time_t HAL_RTC_Get_UnixTime(void)
 {
-    auto now = boost::posix_time::microsec_clock::universal_time();
-    return to_time_t(now);
+    return start_time + device_clock().now_micros() / 1000000;
 }
 
 void HAL_RTC_Set_UnixTime(time_t value)
@@ -22,465 +22,468 @@
   License along with this library; if not, see <http://www.gnu.org/licenses/>.
  ******************************************************************************
  */
-#include "device_globals.h"
+
+/**
+ * The virtual device sockets are native non-blocking sockets. All open sockets
+ * are registered with an epoll instance so readiness for any number of
+ * sockets can be queried with a single call.
+ */
+
+// the system socket headers come first so socket_hal.h doesn't redefine the socket constants
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include "socket_hal.h"
+#include "socket_usage.h"
 #include "inet_hal.h"
 #include "core_msg.h"
-#include <vector>
-
-#pragma GCC diagnostic ignored "-Wunused-variable"
-#pragma GCC diagnostic ignored "-Wmissing-braces"
-#include <boost/array.hpp>
-
-// conflict of types
-#define socklen_t boost_socklen_t
-#include <boost/asio.hpp>
-#undef socklen_t
-
-#include <boost/system/system_error.hpp>
+#include "device_context.h"
 
-namespace ip = boost::asio::ip;
-
-const sock_handle_t SOCKET_COUNT = sock_handle_t(8);
-const sock_handle_t SOCKET_MAX =  SOCKET_COUNT*2;
 const sock_handle_t SOCKET_INVALID = (sock_handle_t)-1;
 
-boost::asio::io_service device_io_service;
-boost::system::error_code ec;
-
-boost::array<ip::tcp::socket, SOCKET_COUNT> tcp_handles = {
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service)
-};
-
-boost::array<ip::udp::socket, SOCKET_COUNT> udp_handles = {
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service)
-};
-
-
-ip::tcp::socket invalid_tcp_(device_io_service);
-ip::udp::socket invalid_udp_(device_io_service);
-
-ip::tcp::socket& invalid_tcp() {
-    return invalid_tcp_;
-}
-
-ip::udp::socket& invalid_udp() {
-    return invalid_udp_;
-}
-
-bool is_tcp_socket(sock_handle_t sd)
-{
-	return sd<SOCKET_COUNT;
-}
-
-bool is_udp_socket(sock_handle_t sd)
-{
-	return sd>=SOCKET_COUNT && sd<SOCKET_MAX;
-}
-
+/**
+ * The number of sockets used when the device configuration doesn't specify a count.
+ */
+const uint16_t DEFAULT_SOCKET_COUNT = 64;
 
-ip::tcp::socket& tcp_from(sock_handle_t sd)
-{
-    if (sd>=SOCKET_COUNT)
-        return invalid_tcp();
-    return tcp_handles[sd];
-}
+/**
+ * How long socket_connect() waits for the connection to be established.
+ */
+const int CONNECT_TIMEOUT_MILLIS = 10000;
 
-ip::udp::socket& udp_from(sock_handle_t sd)
+struct SocketEntry
 {
-    if (sd<SOCKET_COUNT || sd>=SOCKET_MAX)
-        return invalid_udp();
-    return udp_handles[sd-SOCKET_COUNT];
-}
-
+	enum Type { UNUSED, TCP, UDP, TCP_SERVER };
 
-sock_handle_t next_unused_tcp()
-{
-    for (sock_handle_t i=0; i<SOCKET_COUNT; i++) {
-        if (!tcp_from(i).is_open())
-            return i;
-    }
-    return -1;
-}
+	int fd = -1;
+	Type type = UNUSED;
+	bool peer_closed = false;
+	SocketTraffic traffic;
+};
 
-sock_handle_t next_unused_udp()
+/**
+ * The table of sockets. The socket handle is the index into the table.
+ */
+class SocketTable
 {
-    for (sock_handle_t i=SOCKET_COUNT; i<SOCKET_MAX; i++) {
-        if (!udp_from(i).is_open())
-            return i;
-    }
-    return -1;
-}
-
-
-
-bool is_valid(ip::tcp::socket& handle) {
-    return &handle!=&invalid_tcp();
-}
-
-bool is_valid(ip::udp::socket& handle) {
-    return &handle!=&invalid_udp();
-}
-
-
+	std::vector<SocketEntry> entries;
+	int epoll_fd = -1;
+	SocketUsage socket_usage;
 
-class TCPServer
-{
-	uint16_t _port;
+	void init()
+	{
+		if (!entries.empty())
+			return;
+		uint16_t count = current_device().config.socket_count;
+		if (!count)
+			count = DEFAULT_SOCKET_COUNT;
+		entries.resize(count);
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd<0)
+			DEBUG("epoll_create1 failed: %d", errno);
+	}
 
-	ip::tcp::acceptor acceptor;
+public:
 
-	void accept_handler(const boost::system::error_code& error)
+	~SocketTable()
 	{
-		if (!error)
-		{
-			start_accept();
+		for (sock_handle_t i=0; i<entries.size(); i++) {
+			remove(i);
 		}
+		if (epoll_fd>=0)
+			::close(epoll_fd);
 	}
 
-	sock_handle_t start_accept()
+	SocketEntry* from(sock_handle_t handle)
 	{
-		sock_handle_t handle = next_unused_tcp();
-		if (!socket_handle_valid(handle))
-			return handle;
-
-		ip::tcp::socket& sock = tcp_from(handle);
-		acceptor.accept(sock);
-		return handle;
+		if (handle>=entries.size() || entries[handle].type==SocketEntry::UNUSED)
+			return nullptr;
+		return &entries[handle];
 	}
 
-
-public:
-	TCPServer(uint16_t port)
-		: _port(port),
-		  acceptor(device_io_service, ip::tcp::endpoint(ip::tcp::v4(), port))
+	SocketEntry* from(sock_handle_t handle, SocketEntry::Type type)
 	{
-		acceptor.non_blocking(true);
+		SocketEntry* entry = from(handle);
+		return (entry && entry->type==type) ? entry : nullptr;
 	}
 
-	~TCPServer()
+	bool is_valid(sock_handle_t handle)
 	{
-		acceptor.cancel();
+		return handle<entries.size();
 	}
 
-	sock_handle_t accept()
+	/**
+	 * The traffic of all sockets of the device, by subsystem.
+	 */
+	SocketUsage& usage()
 	{
-		sock_handle_t handle = next_unused_tcp();
-		if (!socket_handle_valid(handle))
-			return handle;
-
-		ip::tcp::socket& sock = tcp_from(handle);
-
-		acceptor.accept(sock, ec);
-		return !ec ? handle : socket_handle_invalid();
+		return socket_usage;
 	}
 
-
-};
-
-class TCPServers
-{
-	std::vector<TCPServer*> servers;
-public:
-
-	bool is_valid(sock_handle_t handle) {
-		return handle>=SOCKET_MAX && handle<SOCKET_MAX+servers.size();
-	}
-
-	TCPServer* from(sock_handle_t handle)
+	/**
+	 * Takes ownership of the given file descriptor, registers it for readiness
+	 * notification and returns the handle.
+	 */
+	sock_handle_t add(int fd, SocketEntry::Type type)
 	{
-		if (!is_valid(handle))
-			return nullptr;
-
-		return servers[handle-SOCKET_MAX];
+		init();
+		for (sock_handle_t i=0; i<entries.size(); i++) {
+			if (entries[i].type==SocketEntry::UNUSED) {
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+				struct epoll_event event;
+				memset(&event, 0, sizeof(event));
+				event.events = EPOLLIN | EPOLLRDHUP;
+				event.data.u32 = i;
+				epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+				entries[i].fd = fd;
+				entries[i].type = type;
+				entries[i].peer_closed = false;
+				entries[i].traffic.reset();
+				return i;
+			}
+		}
+		::close(fd);
+		return SOCKET_INVALID;
 	}
 
-	sock_handle_t add(TCPServer* server)
+	void remove(sock_handle_t handle)
 	{
-		if (!server)
-			return SOCKET_INVALID;
-		size_t handle = servers.size();
-		servers.push_back(server);
-		return SOCKET_MAX + handle;
+		SocketEntry* entry = from(handle);
+		if (entry) {
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, entry->fd, nullptr);
+			::close(entry->fd);
+			*entry = SocketEntry();
+		}
 	}
 
-	void dispose(sock_handle_t handle)
+	int wait(sock_handle_t* handles, size_t count, system_tick_t timeout)
 	{
-		if (is_valid(handle)) {
-			size_t index = handle-SOCKET_MAX;
-			TCPServer* server = servers[index];
-			servers[index] = nullptr;
-			delete server;
+		init();
+		const size_t MAX_EVENTS = 64;
+		struct epoll_event events[MAX_EVENTS];
+		int ready = epoll_wait(epoll_fd, events, std::min(std::max(count, size_t(1)), MAX_EVENTS), timeout);
+		if (ready<0)
+			return errno==EINTR ? 0 : -errno;
+		for (int i=0; handles && i<ready && size_t(i)<count; i++) {
+			handles[i] = events[i].data.u32;
 		}
+		return ready;
 	}
 };
 
+/**
+ * Retrieves the socket table of the current device.
+ */
+static SocketTable& sockets()
+{
+	DeviceContext& device = current_device();
+	if (!device.sockets)
+		device.sockets = new SocketTable();
+	return *device.sockets;
+}
+
+void socket_table_destroy(SocketTable* table)
+{
+	delete table;
+}
+
+static int socket_error(int error=errno)
+{
+	return error ? -error : -1;
+}
 
+static bool would_block(int error)
+{
+	return error==EAGAIN || error==EWOULDBLOCK;
+}
 
-TCPServers servers;
+static void to_sockaddr_in(const sockaddr_t* addr, struct sockaddr_in& in)
+{
+	memset(&in, 0, sizeof(in));
+	in.sin_family = AF_INET;
+	// sa_data[0..1] is the port, [2..5] the IP address, both in network byte order
+	memcpy(&in.sin_port, addr->sa_data, 2);
+	memcpy(&in.sin_addr.s_addr, addr->sa_data+2, 4);
+}
+
+static void from_sockaddr_in(const struct sockaddr_in& in, sockaddr_t* addr)
+{
+	addr->sa_family = AF_INET;
+	memcpy(addr->sa_data, &in.sin_port, 2);
+	memcpy(addr->sa_data+2, &in.sin_addr.s_addr, 4);
+}
+
+/**
+ * Waits for the given events on a single socket.
+ * @return >0 when ready, 0 on timeout, <0 on error.
+ */
+static int wait_for(int fd, short events, int timeout)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+	int result;
+	do {
+		result = poll(&pfd, 1, timeout);
+	}
+	while (result<0 && errno==EINTR);
+	return result;
+}
 
 sock_result_t socket_create_tcp_server(uint16_t port, network_interface_t nif)
 {
 	DEBUG("Creating TCP Server on port %d", port);
-	TCPServer* server = new TCPServer(port);
-	return servers.add(server);
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd<0)
+		return socket_error();
+
+	int enable = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+	struct sockaddr_in in;
+	memset(&in, 0, sizeof(in));
+	in.sin_family = AF_INET;
+	in.sin_port = htons(port);
+	in.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (::bind(fd, (struct sockaddr*)&in, sizeof(in)) || ::listen(fd, SOMAXCONN)) {
+		int error = errno;
+		DEBUG("TCP server on port %d: %s", port, strerror(error));
+		::close(fd);
+		return socket_error(error);
+	}
+	return sockets().add(fd, SocketEntry::TCP_SERVER);
 }
 
 sock_result_t socket_accept(sock_handle_t handle)
 {
-	TCPServer* server = servers.from(handle);
+	SocketEntry* server = sockets().from(handle, SocketEntry::TCP_SERVER);
 	if (!server)
 		return socket_handle_invalid();
-	return server->accept();
+	int fd = ::accept4(server->fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd<0)
+		return socket_handle_invalid();
+	int enable = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+	return sockets().add(fd, SocketEntry::TCP);
 }
 
-
 int32_t socket_connect(sock_handle_t sd, const sockaddr_t *addr, long addrlen)
 {
-    auto& handle = tcp_from(sd);
-    if (!is_valid(handle))
-        return -1;
-
-    unsigned port = addr->sa_data[0] << 8 | addr->sa_data[1];
-    // 2-5 are IP address in network byte order
-    const uint8_t* dest = addr->sa_data+2;
-
-    ip::address_v4::bytes_type address = {{ dest[0], dest[1], dest[2], dest[3] }};
-    ip::tcp::endpoint endpoint(boost::asio::ip::address_v4(address),port);
-
-    handle.connect(endpoint, ec);
-    bool open = handle.is_open();
-    return ec.value();
+	SocketEntry* entry = sockets().from(sd, SocketEntry::TCP);
+	if (!entry)
+		return -1;
+
+	struct sockaddr_in in;
+	to_sockaddr_in(addr, in);
+	if (!::connect(entry->fd, (struct sockaddr*)&in, sizeof(in)))
+		return 0;
+	if (errno!=EINPROGRESS)
+		return errno;
+
+	int ready = wait_for(entry->fd, POLLOUT, CONNECT_TIMEOUT_MILLIS);
+	if (ready<=0)
+		return ready<0 ? errno : ETIMEDOUT;
+
+	int error = 0;
+	socklen_t len = sizeof(error);
+	getsockopt(entry->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+	return error;
 }
 
 sock_result_t socket_reset_blocking_call()
 {
-    return 0;
+	return 0;
 }
 
 sock_result_t socket_receive(sock_handle_t sd, void* buffer, socklen_t len, system_tick_t _timeout)
 {
-    auto& handle = tcp_from(sd);
-    if (!is_valid(handle))
-        return -1;
-    boost::asio::socket_base::bytes_readable command(true);
-    handle.io_control(command);
-    std::size_t available = command.get();
-    sock_result_t result = 0;
-    if (_timeout || available)
-    available = handle.read_some(boost::asio::buffer(buffer, len), ec);
-    result = ec.value() ? -abs(ec.value()) : available;
-    if (ec.value()) {
-        if (ec.value() == boost::system::errc::resource_deadlock_would_occur || // EDEADLK (35)
-            ec.value() == boost::system::errc::resource_unavailable_try_again) { // EAGAIN (11)
-            result = 0; // No data available
-        } else {
-            DEBUG("socket receive error: %d %s, read=%d", ec.value(), ec.message().c_str(), available);
-        }
-    }
-    return result;
+	SocketEntry* entry = sockets().from(sd, SocketEntry::TCP);
+	if (!entry)
+		return -1;
+
+	ssize_t count = ::recv(entry->fd, buffer, len, 0);
+	if (count<0 && would_block(errno) && _timeout) {
+		if (wait_for(entry->fd, POLLIN, _timeout)>0)
+			count = ::recv(entry->fd, buffer, len, 0);
+	}
+	if (count<0) {
+		if (would_block(errno))
+			return 0; // No data available
+		DEBUG("socket receive error: %d %s", errno, strerror(errno));
+		return socket_error();
+	}
+	if (count==0 && len) {
+		entry->peer_closed = true;
+		return -1;
+	}
+	sockets().usage().received(entry->traffic, count);
+	return count;
 }
 
-sock_result_t socket_send(sock_handle_t sd, const void* buffer, socklen_t len)
+sock_result_t socket_sendv(sock_handle_t sd, const sock_iovec_t* iov, size_t count, void* reserved)
 {
-    auto& socket = tcp_from(sd);
-    if (!is_valid(socket))
-        return -1;
-    try
-    {
-        sock_result_t result = write(socket, boost::asio::buffer(buffer, len));
-        return result;
-    }
-    catch (boost::system::system_error e)
-    {
-        return -1;
-    }
+	SocketEntry* entry = sockets().from(sd);
+	if (!entry || entry->type==SocketEntry::TCP_SERVER)
+		return -1;
+
+	const size_t MAX_IOV = 16;
+	struct iovec vec[MAX_IOV];
+	if (count>MAX_IOV)
+		count = MAX_IOV;
+	for (size_t i=0; i<count; i++) {
+		vec[i].iov_base = const_cast<void*>(iov[i].data);
+		vec[i].iov_len = iov[i].length;
+	}
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = vec;
+	msg.msg_iovlen = count;
+
+	ssize_t sent = ::sendmsg(entry->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (sent<0)
+		return would_block(errno) ? 0 : socket_error();
+	sockets().usage().sent(entry->traffic, sent);
+	return sent;
 }
 
+sock_result_t socket_send(sock_handle_t sd, const void* buffer, socklen_t len)
+{
+	sock_iovec_t iov = { buffer, len };
+	return socket_sendv(sd, &iov, 1, nullptr);
+}
 
 sock_result_t socket_create_nonblocking_server(sock_handle_t sock, uint16_t port)
 {
-    NOT_IMPLEMENTED("create nonblocking server");
-    return 0;
+	NOT_IMPLEMENTED("create nonblocking server");
+	return 0;
 }
 
 sock_result_t socket_receivefrom(sock_handle_t sock, void* buffer, socklen_t bufLen, uint32_t flags, sockaddr_t* addr, socklen_t* addrsize)
 {
-	ip::udp::endpoint endpoint;
-	auto& socket = udp_from(sock);
-
-	int count = socket.receive_from(boost::asio::buffer(buffer, bufLen), endpoint, 0, ec);
+	SocketEntry* entry = sockets().from(sock, SocketEntry::UDP);
+	if (!entry)
+		return -1;
+
+	struct sockaddr_in in;
+	socklen_t in_len = sizeof(in);
+	ssize_t count = ::recvfrom(entry->fd, buffer, bufLen, 0, (struct sockaddr*)&in, &in_len);
+	if (count<0) {
+		if (would_block(errno))
+			return 0;
+		DEBUG("result: %d %s", errno, strerror(errno));
+		return socket_error();
+	}
 	if (addr && addrsize && *addrsize>=6u) {
-		uint16_t port = endpoint.port();
-		addr->sa_data[0] = port >> 8;
-		addr->sa_data[1] = port & 0xFF;
-		uint32_t ip = endpoint.address().to_v4().to_ulong();
-		addr->sa_data[2] = (ip >> 24) & 0xFF;
-		addr->sa_data[3] = (ip >> 16) & 0xFF;
-		addr->sa_data[4] = (ip >> 8) & 0xFF;
-		addr->sa_data[5] = (ip >> 0) & 0xFF;
+		from_sockaddr_in(in, addr);
 	}
-
-	sock_handle_t result = ec.value();
-
-    if (result == boost::asio::error::would_block)
-        return 0;
-   if (result==boost::asio::error::try_again)
-	   return 0;
-	if (!result)
-		DEBUG("count: %d", count);
-	else
-		DEBUG("result: %d %s", ec.value(), ec.message().c_str());
-
-	return result ? result : count;
+	DEBUG("count: %d", int(count));
+	sockets().usage().received(entry->traffic, count);
+	return count;
 }
 
 sock_result_t socket_sendto(sock_handle_t sd, const void* buffer, socklen_t len, uint32_t flags, sockaddr_t* addr, socklen_t addr_size)
 {
-    unsigned port = addr->sa_data[0] << 8 | addr->sa_data[1];
-    // 2-5 are IP address in network byte order
-    const uint8_t* dest = addr->sa_data+2;
-
-    ip::address_v4::bytes_type address = {{ dest[0], dest[1], dest[2], dest[3] }};
-    ip::udp::endpoint endpoint(boost::asio::ip::address_v4(address),port);
-
-	auto& socket = udp_from(sd);
-	int count = socket.send_to(boost::asio::buffer(buffer, len), endpoint, 0, ec);
-
-	sock_handle_t result = ec.value();
-    if (result == boost::asio::error::would_block)
-        return 0;
-
-	return result ? result : count;
+	SocketEntry* entry = sockets().from(sd, SocketEntry::UDP);
+	if (!entry)
+		return -1;
+
+	struct sockaddr_in in;
+	to_sockaddr_in(addr, in);
+	ssize_t count = ::sendto(entry->fd, buffer, len, MSG_NOSIGNAL | MSG_DONTWAIT, (struct sockaddr*)&in, sizeof(in));
+	if (count<0)
+		return would_block(errno) ? 0 : socket_error();
+	sockets().usage().sent(entry->traffic, count);
+	return count;
 }
 
-
 sock_result_t socket_bind(sock_handle_t sock, uint16_t port)
 {
-    NOT_IMPLEMENTED("socket_bind");
-    return 0;
+	NOT_IMPLEMENTED("socket_bind");
+	return 0;
 }
 
 uint8_t socket_active_status(sock_handle_t socket)
 {
-    bool open;
-    if (socket>=SOCKET_COUNT)
-    		open = udp_from(socket).is_open();
-    else
-    		open = tcp_from(socket).is_open();
-    return open ? SOCKET_STATUS_ACTIVE : SOCKET_STATUS_INACTIVE;
+	SocketEntry* entry = sockets().from(socket);
+	bool open = entry && !entry->peer_closed;
+	return open ? SOCKET_STATUS_ACTIVE : SOCKET_STATUS_INACTIVE;
 }
 
 sock_result_t socket_close(sock_handle_t socket)
 {
-	if (servers.is_valid(socket))
-	{
-		servers.dispose(socket);
-	}
-	else if (socket>=SOCKET_COUNT)
-    {
-    		auto& s = udp_from(socket);
-    		s.shutdown(boost::asio::ip::udp::socket::shutdown_both, ec);
-    		udp_from(socket).close();
-    }
-    else
-    {
-    		auto& s = tcp_from(socket);
-		s.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
-    		s.close();
-    }
-    return 0;
+	SocketEntry* entry = sockets().from(socket);
+	if (entry && entry->type!=SocketEntry::TCP_SERVER)
+		::shutdown(entry->fd, SHUT_RDWR);
+	sockets().remove(socket);
+	return 0;
 }
 
-
 sock_handle_t socket_create(uint8_t family, uint8_t type, uint8_t protocol, uint16_t port, network_interface_t nif)
 {
 	bool udp = protocol==IPPROTO_UDP;
-    sock_handle_t handle = udp ? next_unused_udp() : next_unused_tcp();
-    if (handle==SOCKET_INVALID)
-        return -1;
-
-    if (udp) {
-        auto& socket = udp_from(handle);
-        socket.open(ip::udp::v4(), ec);
-        sock_handle_t result = ec.value();
-        if (result)				// error
-            return result;
-
-        std::string address_mcast = "224.0.0.251";
-        boost::asio::ip::address mcast_addr = boost::asio::ip::address::from_string(address_mcast, ec);
-        boost::asio::ip::udp::endpoint listen_endpoint(mcast_addr, port);
-        socket.open(listen_endpoint.protocol(), ec);
-
-        socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
-
-        socket.bind(listen_endpoint, ec);
-        result = ec.value();
-        if (result) {
-            DEBUG("%d %s", port, ec.message().c_str());
-            return result;
-        }
-
-        socket.non_blocking(true, ec);
-    }
-    else {
-        auto& socket = tcp_from(handle);
-        socket.open(ip::tcp::v4(), ec);
-        sock_handle_t result = ec.value();
-        if (result)
-            return result;
-
-        socket.non_blocking(true, ec);
-    }
-
-    sock_handle_t result = ec.value();
-    return result ? result : handle;
+	int fd = ::socket(AF_INET, (udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_CLOEXEC, 0);
+	if (fd<0)
+		return socket_error();
+
+	int enable = 1;
+	if (udp) {
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+		struct sockaddr_in in;
+		memset(&in, 0, sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_port = htons(port);
+		in.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (::bind(fd, (struct sockaddr*)&in, sizeof(in))) {
+			int error = errno;
+			DEBUG("%d %s", port, strerror(error));
+			::close(fd);
+			return socket_error(error);
+		}
+	}
+	else {
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+	}
+	return sockets().add(fd, udp ? SocketEntry::UDP : SocketEntry::TCP);
 }
 
-uint8_t socket_handle_valid(sock_handle_t handle) {
-    if (handle==SOCKET_INVALID)
-    		return false;
-	if (handle>=SOCKET_MAX)
-    		return servers.is_valid(handle);
-    return handle<SOCKET_COUNT ? is_valid(tcp_from(handle)) : is_valid(udp_from(handle));
+uint8_t socket_handle_valid(sock_handle_t handle)
+{
+	return sockets().is_valid(handle);
 }
 
-
 sock_handle_t socket_handle_invalid()
 {
-    return SOCKET_INVALID;
+	return SOCKET_INVALID;
 }
 
 sock_result_t socket_join_multicast(const HAL_IPAddress* addr, network_interface_t nif, socket_multicast_info_t* info)
 {
 	if (info) {
-		sock_handle_t socket = info->sock_handle;
-		if (socket>=SOCKET_COUNT)
+		SocketEntry* entry = sockets().from(info->sock_handle, SocketEntry::UDP);
+		if (entry)
 		{
-			auto& s = udp_from(socket);
-			ip::address_v4 address(addr->ipv4);
-			DEBUG("join multicast %s", address.to_string().c_str());
-			s.set_option(ip::multicast::enable_loopback(true));
-			boost::asio::ip::multicast::join_group option(address);
-			s.set_option(option);
-			return 0;
+			struct ip_mreq mreq;
+			mreq.imr_multiaddr.s_addr = htonl(addr->ipv4);
+			mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+			DEBUG("join multicast %s", inet_ntoa(mreq.imr_multiaddr));
+			unsigned char loop = 1;
+			setsockopt(entry->fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+			return setsockopt(entry->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) ? socket_error() : 0;
 		}
 	}
-    return -1;
+	return -1;
 }
 
 sock_result_t socket_leave_multicast(const HAL_IPAddress* addr, network_interface_t nif, socket_multicast_info_t* reserved)
@@ -490,5 +493,36 @@ sock_result_t socket_leave_multicast(const HAL_IPAddress* addr, network_interfac
 
 sock_result_t socket_peer(sock_handle_t sd, sock_peer_t* peer, void* reserved)
 {
-    return -1;
+	SocketEntry* entry = sockets().from(sd, SocketEntry::TCP);
+	if (!entry || !peer)
+		return -1;
+	struct sockaddr_in in;
+	socklen_t len = sizeof(in);
+	if (getpeername(entry->fd, (struct sockaddr*)&in, &len))
+		return socket_error();
+	peer->address.ipv4 = ntohl(in.sin_addr.s_addr);
+	peer->port = ntohs(in.sin_port);
+	return 0;
+}
+
+sock_result_t socket_wait_readable(sock_handle_t* handles, size_t count, system_tick_t timeout, void* reserved)
+{
+	return sockets().wait(handles, count, timeout);
+}
+
+sock_result_t socket_set_usage(sock_handle_t sd, uint8_t usage, void* reserved)
+{
+	SocketEntry* entry = sockets().from(sd);
+	return entry ? SocketUsage::set_usage(entry->traffic, usage) : -1;
+}
+
+sock_result_t socket_usage(sock_handle_t sd, socket_usage_stats_t* stats, void* reserved)
+{
+	SocketEntry* entry = sockets().from(sd);
+	return entry ? SocketUsage::copy(entry->traffic.stats, stats) : -1;
+}
+
+sock_result_t socket_usage_total(uint8_t usage, socket_usage_stats_t* stats, void* reserved)
+{
+	return sockets().usage().total(usage, stats);
 }
@@ -6,7 +6,7 @@
 #include "static_assert.h"
 #include "dns_redirect.h"
 #include "wiced_security.h"
-#include "jsmn.h"
+#include "jsmn_stream.h"
 #include "softap.h"
 #include "softap_http.h"
 #include "dct.h"
@@ -83,42 +83,6 @@ class JSONCommand : public Command {
 
 protected:
 
-    jsmntok_t * json_tokenise(char *js)
-    {
-        jsmn_parser parser;
-        parser.size = sizeof(parser);
-        jsmn_init(&parser, NULL);
-
-        unsigned int n = 64;
-        jsmntok_t* tokens = (jsmntok_t*)malloc(sizeof(jsmntok_t) * n);
-        if (!tokens) return nullptr;
-        int ret = jsmn_parse(&parser, js, strlen(js), tokens, n, NULL);
-        while (ret==JSMN_ERROR_NOMEM)
-        {
-            n = n * 2 + 1;
-            jsmntok_t* prev = tokens;
-            tokens = (jsmntok_t*)realloc(tokens, sizeof(jsmntok_t) * n);
-            if (!tokens) {
-            		free(prev);
-            		return nullptr;
-            }
-            ret = jsmn_parse(&parser, js, strlen(js), tokens, n, NULL);
-        }
-        return tokens;
-    }
-
-    bool json_token_streq(const char *js, jsmntok_t *t, const char *s)
-    {
-        return (strncmp(js + t->start, s, t->end - t->start) == 0
-                && strlen(s) == (size_t) (t->end - t->start));
-    }
-
-    char* json_token_tostr(char *js, jsmntok_t *t)
-    {
-        js[t->end] = '\0';
-        return js + t->start;
-    }
-
     void write_result_code(Writer& writer, int result) {
         write_char(writer, '{');
         write_json_int(writer, "r", result);
@@ -210,88 +174,90 @@ protected:
     /**
      * Template methods allowing subclasses to handle the parsed JSON values.
      * @param index	the key index this value belongs to
-     * @param t		the jsmn token
+     * @param type	the json type of the value
      * @param value	The string value.
      *
-     * Note that the t and value parameters have a lifetime only for the duration of the method.
-     * They should not be stored for later use.
+     * Note that the value parameter has a lifetime only for the duration of the method.
+     * It should not be stored for later use.
+     */
+    virtual bool parsed_value(unsigned index, jsmntype_t type, char* value)=0;
+
+    /**
+     * Size of the buffer receiving each JSON value. Large enough for the hex-encoded
+     * RSA-encrypted password.
      */
-    virtual bool parsed_value(unsigned index, jsmntok_t* t, char* value)=0;
+    static const size_t JSON_VALUE_SIZE = 513;
+    static const size_t JSON_CHUNK_SIZE = 64;
 
+    static int json_read(void* state, char* buf, size_t length) {
+        Reader* reader = (Reader*)state;
+        int result = reader->read((uint8_t*)buf, length);
+        return result<0 ? 0 : result;
+    }
+
+    /**
+     * Parses the request object incrementally from the reader. Only the current value is
+     * held in memory so the memory used doesn't depend upon the size of the request.
+     */
     int parse_json_request(Reader& reader, const char* const keys[], const jsmntype_t types[], unsigned count) {
 
         int result = -1;
-    		char* js = reader.fetch_as_string();
-        if (js)
+        char* buf = (char*)malloc(JSON_CHUNK_SIZE+JSON_VALUE_SIZE);
+        if (buf)
         {
-			jsmntok_t *tokens = json_tokenise(js);
-			if (tokens)
-			{
-				enum parse_state { START, KEY, VALUE, SKIP, STOP };
-
-				parse_state state = START;
-				jsmntype_t expected_type = JSMN_OBJECT;
-
-				result = 0;
-				int key = -1;
-
-				for (size_t i = 0, j = 1; j > 0; i++, j--)
-				{
-					jsmntok_t *t = &tokens[i];
-					if (t->type == JSMN_ARRAY || t->type == JSMN_OBJECT)
-						j += t->size * 2;
-
-					switch (state)
-					{
-						case START:
-							state = KEY;
-							break;
-
-						case KEY:
-							state = VALUE;
-							key = -1;
-							for (size_t i = 0; i < count; i++)
-							{
-								if (json_token_streq(js, t, keys[i]))
-								{
-									expected_type = types[i];
-									if (parsed_key(i)) {
-										key = i;
-										JSON_DEBUG( ( "key: %s %d %d\n", keys[i], i, (int)expected_type ) );
-									}
-								}
-							}
-							if (key==-1) {
-								JSON_DEBUG( ( "unknown key: %s\n", json_token_tostr(js, t) ) );
-								result = -1;
-							}
-							break;
-
-						case VALUE:
-							if (key!=-1) {
-								if (t->type != expected_type) {
-									result = -1;
-									JSON_DEBUG( ( "type mismatch\n" ) );
-								}
-								else {
-									char *str = json_token_tostr(js, t);
-									if (!parsed_value(key, t, str))
-										result = -1;
-								}
-							}
-							state = KEY;
-							break;
-
-						case STOP: // Just consume the tokens
-							break;
-
-						default:
-							result = -1;
-					}
-				}
-				free(tokens);
-			}
-			free(js);
+            jsmn_stream_parser parser;
+            jsmn_stream_init(&parser, buf, JSON_CHUNK_SIZE, buf+JSON_CHUNK_SIZE, JSON_VALUE_SIZE, json_read, &reader, NULL);
+            char* str = parser.value;
+
+            jsmn_stream_token t;
+            int ret = jsmn_stream_next(&parser, &t, NULL);
+            if (ret>0 && t.type==JSMN_OBJECT)
+            {
+                result = 0;
+                int key = -1;
+                jsmntype_t expected_type = JSMN_OBJECT;
+
+                while ((ret = jsmn_stream_next(&parser, &t, NULL))>0)
+                {
+                    if (!t.depth)           // the request object is complete
+                        break;
+                    if (t.depth!=1 || t.end)    // skip the content of nested values
+                        continue;
+
+                    if (t.key)
+                    {
+                        key = -1;
+                        for (size_t i = 0; i < count && !t.truncated; i++)
+                        {
+                            if (!strcmp(str, keys[i]))
+                            {
+                                expected_type = types[i];
+                                if (parsed_key(i)) {
+                                    key = i;
+                                    JSON_DEBUG( ( "key: %s %d %d\n", keys[i], i, (int)expected_type ) );
+                                }
+                            }
+                        }
+                        if (key==-1) {
+                            JSON_DEBUG( ( "unknown key: %s\n", str ) );
+                            result = -1;
+                        }
+                    }
+                    else if (key!=-1)
+                    {
+                        if (t.type != expected_type || t.truncated) {
+                            result = -1;
+                            JSON_DEBUG( ( "type mismatch\n" ) );
+                        }
+                        else if (!parsed_value(key, t.type, str))
+                            result = -1;
+                        key = -1;
+                    }
+                }
+            }
+            if (ret<0)
+                result = -1;
+            free(buf);
         }
         return result;
     }
@@ -488,18 +454,18 @@ protected:
         return true;
     }
 
-    virtual bool parsed_value(unsigned key, jsmntok_t* t, char* str) {
+    virtual bool parsed_value(unsigned key, jsmntype_t type, char* str) {
         void* data = ((uint8_t*)&configureAP)+OFFSET[key];
 
         if (!data) {
             JSON_DEBUG( ( "no data\n" ) );
             return false;
         }
-        if (key==1 && t->type==JSMN_STRING) {
+        if (key==1 && type==JSMN_STRING) {
             strncpy((char*)data, str, sizeof(ConfigureAP::ssid)-1);
             JSON_DEBUG( ( "copied value %s\n", (char*)str ) );
         }
-        else if (key==2 && t->type==JSMN_STRING) {
+        else if (key==2 && type==JSMN_STRING) {
 #define USE_PWD_ENCRYPTION 1
 #if USE_PWD_ENCRYPTION
             decrypt_result = decrypt((char*)data, sizeof(ConfigureAP::passcode), str);
@@ -656,7 +622,7 @@ protected:
     		target[len-1] = '\0';
     }
 
-    virtual bool parsed_value(unsigned index, jsmntok_t* t, char* value) {
+    virtual bool parsed_value(unsigned index, jsmntype_t type, char* value) {
         if (index==0)     // key
         		assign(this->key, value, MAX_KEY_LEN);
         else
@@ -893,10 +859,38 @@ void cleanup_http_body(wiced_http_message_body_t* body)
     }
 }
 
+/**
+ * Makes the fragment of the current packet that follows the one last read the data in the body.
+ * @return false when the packet has no more fragments.
+ */
+static bool next_http_body_fragment(wiced_http_message_body_t* body)
+{
+    wiced_packet_t* packet = (wiced_packet_t*)body->user;
+    uint16_t offset = 0;
+    uint16_t fragment_length;
+    uint16_t available_data_length;
+    uint8_t* data;
+    bool previous = false;
+    while (packet && !wiced_packet_get_data(packet, offset, &data, &fragment_length, &available_data_length) && fragment_length)
+    {
+        if (previous)
+        {
+            body->data = data;
+            body->message_data_length = fragment_length;
+            return true;
+        }
+        previous = (data+fragment_length==body->data);
+        if (fragment_length>=available_data_length)
+            break;
+        offset += fragment_length;
+    }
+    return false;
+}
+
 int read_from_http_body_part(wiced_http_message_body_t* body, uint8_t* target, size_t length)
 {
-    // first read from the data already read in the body
-    if (body->message_data_length)
+    // first read from the data already read in the body, and the rest of the packet it came in
+    if (body->message_data_length || next_http_body_fragment(body))
     {
         if (length>body->message_data_length)
             length = body->message_data_length;
@@ -910,40 +904,24 @@ int read_from_http_body_part(wiced_http_message_body_t* body, uint8_t* target, s
     {
         cleanup_http_body(body);
 
-        // fetch the next packet - we assume length is large enough to hold the packet content
-        // which is the case since we are retrieving the entire content in Reader::fetch_as_string())
+        // fetch the next packet. What isn't read now is kept in the body for the calls that follow.
         wiced_packet_t* packet = NULL;
         wiced_result_t result = wiced_tcp_receive(body->socket, &packet, 3000);
         if (result)
             return -1;
 
         body->user = packet;         // ensure we clean up the packet
-        uint16_t packet_length;
+        uint16_t fragment_length;
         uint16_t available_data_length;
-        uint32_t offset =0;
         uint8_t* data;
+        result = wiced_packet_get_data(packet, 0, &data, &fragment_length, &available_data_length);
+        if (result)
+            return -1;
 
-        do
-        {
-            result = wiced_packet_get_data(packet, offset, &data, &packet_length, &available_data_length);
-            if (result)
-                return -1;
-
-            if (length>available_data_length)
-                length = available_data_length;
-            else
-                available_data_length = length;
-
-            uint32_t tocopy = std::min(length, size_t(packet_length));
-            memcpy(target, data, tocopy);
-            length -= tocopy;
-            target += tocopy;
-            offset += packet_length;
-        }
-        while (length && offset < available_data_length);
-
-        body->total_message_data_remaining -= available_data_length;
-        return available_data_length;
+        body->data = data;
+        body->message_data_length = fragment_length;
+        body->total_message_data_remaining -= std::min(available_data_length, body->total_message_data_remaining);
+        return read_from_http_body_part(body, target, length);
     }
     else
         return -1;
@@ -952,8 +930,8 @@ int read_from_http_body_part(wiced_http_message_body_t* body, uint8_t* target, s
 /**
  * This implementation takes some shortcuts since it's just a placeholder until
  * WICED implements http based on streams rather than packets.
- * This function relies upon the Reader::fetch_as_string() call that reads
- * the entire content in one call.
+ * The body is read a packet at a time, so a call may span several packets and a packet
+ * may be read over several calls.
  * @param r
  * @param target
  * @param length
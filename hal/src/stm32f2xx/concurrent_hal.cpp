@@ -411,6 +411,13 @@ int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool rese
 
 int os_semaphore_give(os_semaphore_t semaphore, bool reserved)
 {
+    if (HAL_IsISR()) {
+        portBASE_TYPE woken = pdFALSE;
+        int result = xSemaphoreGiveFromISR(semaphore, &woken)!=pdTRUE;
+        // switch straight to a task waiting on the semaphore
+        portYIELD_FROM_ISR(woken);
+        return result;
+    }
     return xSemaphoreGive(semaphore)!=pdTRUE;
 }
 
@@ -42,6 +42,7 @@
 #include "stm32f2xx.h"
 #include "core_cm3.h"
 #include "bootloader.h"
+#include "module_registry.h"
 #include "core_hal_stm32f2xx.h"
 #include "stm32f2xx.h"
 #include "timer_hal.h"
@@ -368,6 +369,8 @@ void HAL_Core_Setup(void) {
     bootloader_update_if_needed();
     HAL_Bootloader_Lock(true);
 
+    module_registry_init();
+
     HAL_save_device_id(DCT_DEVICE_ID_OFFSET);
 
 #if !defined(MODULAR_FIRMWARE)
@@ -1213,6 +1216,8 @@ bool HAL_Feature_Get(HAL_Feature feature)
 #include <string.h>
 
 retained_system SessionPersistDataOpaque session;
+retained_system KeepAlivePersistDataOpaque keepalive;
+retained_system TransferPersistDataOpaque transfer;
 
 int HAL_System_Backup_Save(size_t offset, const void* buffer, size_t length, void* reserved)
 {
@@ -1221,6 +1226,16 @@ int HAL_System_Backup_Save(size_t offset, const void* buffer, size_t length, voi
 		memcpy(&session, buffer, length);
 		return 0;
 	}
+	if (offset==KeepAlivePersistOffset && length==sizeof(KeepAlivePersistDataOpaque))
+	{
+		memcpy(&keepalive, buffer, length);
+		return 0;
+	}
+	if (offset==TransferPersistOffset && length==sizeof(TransferPersistDataOpaque))
+	{
+		memcpy(&transfer, buffer, length);
+		return 0;
+	}
 	return -1;
 }
 
@@ -1232,6 +1247,18 @@ int HAL_System_Backup_Restore(size_t offset, void* buffer, size_t max_length, si
 		memcpy(buffer, &session, sizeof(session));
 		return 0;
 	}
+	if (offset==KeepAlivePersistOffset && max_length>=sizeof(KeepAlivePersistDataOpaque) && keepalive.size==sizeof(KeepAlivePersistDataOpaque))
+	{
+		*length = sizeof(KeepAlivePersistDataOpaque);
+		memcpy(buffer, &keepalive, sizeof(keepalive));
+		return 0;
+	}
+	if (offset==TransferPersistOffset && max_length>=sizeof(TransferPersistDataOpaque) && transfer.size==sizeof(TransferPersistDataOpaque))
+	{
+		*length = sizeof(TransferPersistDataOpaque);
+		memcpy(buffer, &transfer, sizeof(transfer));
+		return 0;
+	}
 	return -1;
 }
 
@@ -80,6 +80,8 @@ void I2C1_ER_irq(void);
 void I2C3_EV_irq(void);
 void I2C3_ER_irq(void);
 void DMA1_Stream7_irq(void);
+void DMA1_Stream1_irq(void);
+void DMA1_Stream3_irq(void);
 void DMA2_Stream5_irq(void);
 void DMA1_Stream2_irq(void);
 void DMA2_Stream2_irq_override(void);
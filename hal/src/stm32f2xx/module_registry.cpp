@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "module_registry.h"
+#include <cstring>
+
+ModuleRegistry::ModuleRegistry(const module_bounds_t* const* bounds, unsigned count, fetch_fn fetch, uint16_t check_flags) :
+    bounds_(bounds), count_(count < MAX_MODULES ? count : MAX_MODULES), fetch_(fetch), check_flags_(check_flags),
+    current_(false)
+{
+}
+
+void ModuleRegistry::refresh_locked()
+{
+    if (!current_) {
+        for (unsigned i=0; i<count_; i++) {
+            fetch_(modules_+i, bounds_[i], false, check_flags_);
+        }
+        current_ = true;
+    }
+}
+
+void ModuleRegistry::refresh()
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    refresh_locked();
+}
+
+unsigned ModuleRegistry::copy(hal_module_t* target)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    refresh_locked();
+    memcpy(target, modules_, count_*sizeof(hal_module_t));
+    return count_;
+}
+
+void ModuleRegistry::invalidate(uint32_t address, uint32_t length)
+{
+    for (unsigned i=0; i<count_; i++) {
+        if (address < bounds_[i]->end_address && address + length > bounds_[i]->start_address) {
+            invalidate();
+            break;
+        }
+    }
+}
+
+void ModuleRegistry::invalidate()
+{
+    // waits for a fetch in progress, which would otherwise mark the registry current again
+    std::lock_guard<std::mutex> lock(lock_);
+    current_ = false;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULE_REGISTRY_H
+#define MODULE_REGISTRY_H
+
+#include "ota_flash_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Builds the registry of installed modules. Called during startup, once pending
+ * updates have been applied, so later queries don't have to validate the modules.
+ */
+void module_registry_init(void);
+
+#ifdef __cplusplus
+}
+
+#include <mutex>
+
+/**
+ * Caches the modules installed in flash with the result of validating them, so
+ * the system info, dependency checks and OTA validation don't locate and CRC
+ * each module every time they are needed. The modules are fetched when the
+ * registry is first queried, and again only after flash holding one of them is
+ * written.
+ *
+ * Flash is written on the OTA writer thread while other threads query the
+ * registry, so the table is only fetched, invalidated and read under its lock.
+ */
+class ModuleRegistry
+{
+public:
+    static const unsigned MAX_MODULES = 8;
+
+    typedef bool (*fetch_fn)(hal_module_t* target, const module_bounds_t* bounds, bool userDepsOptional, uint16_t check_flags);
+
+    /**
+     * @param bounds        The locations of the modules, at most MAX_MODULES.
+     * @param fetch         Fetches and validates the module at a location.
+     * @param check_flags   The validation done on each module.
+     */
+    ModuleRegistry(const module_bounds_t* const* bounds, unsigned count, fetch_fn fetch, uint16_t check_flags);
+
+    /**
+     * Copies the modules, in the order of their bounds, fetching them first if the
+     * registry isn't current.
+     * @param target    Receives count() modules.
+     * @return The number of modules copied.
+     */
+    unsigned copy(hal_module_t* target);
+
+    /**
+     * Fetches the modules if the registry isn't current.
+     */
+    void refresh();
+
+    unsigned count() const { return count_; }
+
+    bool current() const { return current_; }
+
+    /**
+     * Notes that a range of flash has changed. The modules are fetched again when
+     * the range overlaps any of them.
+     */
+    void invalidate(uint32_t address, uint32_t length);
+
+    void invalidate();
+
+private:
+    void refresh_locked();
+
+    std::mutex lock_;
+    const module_bounds_t* const* bounds_;
+    unsigned count_;
+    fetch_fn fetch_;
+    uint16_t check_flags_;
+    volatile bool current_;
+    hal_module_t modules_[MAX_MODULES];
+};
+
+/**
+ * The registry of the modules on this platform.
+ */
+ModuleRegistry& module_registry();
+
+#endif  /* __cplusplus */
+
+#endif  /* MODULE_REGISTRY_H */
@@ -36,6 +36,11 @@
 #include "spark_protocol_functions.h"
 #include "hal_platform.h"
 #include "service_debug.h"
+#include "delta_patch.h"
+#include "module_registry.h"
+#include "lazy_erase.h"
+#include "deepsleep_hal_impl.h"
+#include <cstdlib>
 
 #define OTA_CHUNK_SIZE          512
 
@@ -62,18 +67,27 @@ void set_key_value(key_value* kv, const char* key, const char* value)
     strncpy(kv->value, value, sizeof(kv->value)-1);
 }
 
+ModuleRegistry& module_registry()
+{
+    static ModuleRegistry registry(module_bounds, module_bounds_length, fetch_module, MODULE_VALIDATION_INTEGRITY);
+    return registry;
+}
+
+void module_registry_init(void)
+{
+    module_registry().refresh();
+}
+
 void HAL_System_Info(hal_system_info_t* info, bool construct, void* reserved)
 {
     if (construct) {
         info->platform_id = PLATFORM_ID;
         // bootloader, system 1, system 2, optional user code and factory restore
-        uint8_t count = module_bounds_length;
+        ModuleRegistry& registry = module_registry();
+        uint8_t count = registry.count();
         info->modules = new hal_module_t[count];
         if (info->modules) {
-            info->module_count = count;
-            for (unsigned i=0; i<count; i++) {
-                fetch_module(info->modules+i, module_bounds[i], false, MODULE_VALIDATION_INTEGRITY);
-            }
+            info->module_count = registry.copy(info->modules);
         }
     }
     else
@@ -94,12 +108,10 @@ bool validate_module_dependencies_full(const module_info_t* module, const module
     // When updating system-parts
     // If MODULE_VALIDATION_DEPENDENCIES_FULL was requested, validate that the dependecies
     // would still be satisfied after the module from the "ota_module" replaces the current one
-    hal_system_info_t sysinfo;
-    memset(&sysinfo, 0, sizeof(sysinfo));
-    sysinfo.size = sizeof(sysinfo);
-    HAL_System_Info(&sysinfo, true, nullptr);
-    for (unsigned i=0; i<sysinfo.module_count; i++) {
-        const hal_module_t& smod = sysinfo.modules[i];
+    hal_module_t modules[ModuleRegistry::MAX_MODULES];
+    unsigned count = module_registry().copy(modules);
+    for (unsigned i=0; i<count; i++) {
+        const hal_module_t& smod = modules[i];
         const module_info_t* info = smod.info;
         if (!info)
             continue;
@@ -130,7 +142,6 @@ bool validate_module_dependencies_full(const module_info_t* module, const module
             }
         }
     }
-    HAL_System_Info(&sysinfo, false, nullptr);
 
     return valid;
 }
@@ -206,15 +217,155 @@ uint16_t HAL_OTA_ChunkSize()
     return OTA_CHUNK_SIZE;
 }
 
+/**
+ * The sectors of the region being updated that have been erased. Kept in backup RAM so that an
+ * interrupted update can be resumed without erasing the chunks already received.
+ */
+retained_system lazy_erase ota_erase;
+
+static const flash_io* ota_flash_io()
+{
+#ifdef USE_SERIAL_FLASH
+    return FLASH_DeviceIO(FLASH_SERIAL);
+#else
+    return FLASH_DeviceIO(FLASH_INTERNAL);
+#endif
+}
+
+/**
+ * The length of the file being received, which bounds the delta patch it may hold.
+ */
+static uint32_t ota_length;
+
+/**
+ * The RAM a delta patch is moved to before it is applied. Reserved when the chunk holding the
+ * patch header is received, so a patch that can't be applied is refused before the rest of it
+ * is transferred.
+ */
+static uint8_t* delta_patch_buffer;
+static uint32_t delta_patch_buffer_size;
+
+static bool reserve_delta_patch(uint32_t length)
+{
+    if (length>DELTA_PATCH_MAX_LENGTH)
+    {
+        WARN("delta patch of %d bytes is longer than %d", length, DELTA_PATCH_MAX_LENGTH);
+        return false;
+    }
+    uint32_t size = length + OTA_CHUNK_SIZE;
+    if (delta_patch_buffer_size<size)
+    {
+        free(delta_patch_buffer);
+        delta_patch_buffer = (uint8_t*)malloc(size);
+        delta_patch_buffer_size = delta_patch_buffer ? size : 0;
+    }
+    return delta_patch_buffer!=NULL;
+}
+
+static void release_delta_patch()
+{
+    free(delta_patch_buffer);
+    delta_patch_buffer = NULL;
+    delta_patch_buffer_size = 0;
+}
+
+static bool ota_begin(uint32_t address, uint32_t length)
+{
+    module_registry().invalidate(address, length);
+    OTA_Flashed_ResetStatus();
+    return !lazy_erase_begin(&ota_erase, ota_flash_io(), address, length);
+}
+
+static int ota_update(const uint8_t *pBuffer, uint32_t address, uint32_t length)
+{
+    module_registry().invalidate(address, length);
+    if (lazy_erase_prepare(&ota_erase, ota_flash_io(), address, length))
+        return 1;
+    return FLASH_Update(pBuffer, address, length);
+}
+
+/**
+ * The region isn't erased here, since erasing all of it at once stalls the system for seconds.
+ * Each sector is erased when the first chunk written to it arrives.
+ */
 bool HAL_FLASH_Begin(uint32_t address, uint32_t length, void* reserved)
 {
-    FLASH_Begin(address, length);
+    release_delta_patch();
+    ota_length = length;
+    return ota_begin(address, length);
+}
+
+bool HAL_FLASH_Resume(uint32_t address, uint32_t length, void* reserved)
+{
+    // without the sectors erased, the chunks received can't be told from what was there before
+    if (!lazy_erase_is_valid(&ota_erase, address, length))
+        return false;
+    release_delta_patch();
+    ota_length = length;
+    module_registry().invalidate(address, length);
+    OTA_Flashed_ResetStatus();
     return true;
 }
 
 int HAL_FLASH_Update(const uint8_t *pBuffer, uint32_t address, uint32_t length, void* reserved)
 {
-    return FLASH_Update(pBuffer, address, length);
+    if (address==module_ota.start_address && delta_patch_is_patch(pBuffer, length) && !reserve_delta_patch(ota_length))
+        return 1;
+    return ota_update(pBuffer, address, length);
+}
+
+static int delta_read_reference(void* context, uint32_t offset, uint8_t* data, uint32_t length)
+{
+    const delta_patch_header* header = (const delta_patch_header*)context;
+    memcpy(data, (const void*)(header->reference_address + offset), length);
+    return 0;
+}
+
+static int delta_write_image(void* context, uint32_t offset, const uint8_t* data, uint32_t length)
+{
+    return ota_update(data, module_ota.start_address + offset, length);
+}
+
+/**
+ * When the OTA region holds a delta patch rather than a module, rebuilds the module
+ * in its place from the module installed at the address the patch was made against.
+ * @return false when the region holds a patch that could not be applied.
+ */
+static bool apply_delta_patch()
+{
+    const uint8_t* staged = (const uint8_t*)module_ota.start_address;
+    if (!delta_patch_is_patch(staged, module_ota.maximum_size))
+        return true;
+
+    delta_patch_header header;
+    int32_t length = delta_patch_length(staged, module_ota.maximum_size);
+    if (length<0 || delta_patch_parse_header(staged, length, &header))
+        return false;
+
+    if (header.target_length>module_ota.maximum_size ||
+        !FLASH_CheckValidAddressRange(FLASH_INTERNAL, header.reference_address, header.reference_length) ||
+        Compute_CRC32((const uint8_t*)header.reference_address, header.reference_length)!=header.reference_crc)
+    {
+        WARN("delta patch doesn't apply to the installed module");
+        return false;
+    }
+
+    // the module is rebuilt over the patch, so the patch is moved to RAM first. The RAM is
+    // normally reserved already, but not when the header was received before a resumed transfer.
+    if (!reserve_delta_patch(length))
+        return false;
+    uint8_t* patch = delta_patch_buffer;
+    memcpy(patch, staged, length);
+
+    bool applied = false;
+    if (ota_begin(module_ota.start_address, header.target_length))
+    {
+        delta_patch p;
+        delta_patch_init(&p, delta_read_reference, delta_write_image, &header, patch + length, OTA_CHUNK_SIZE);
+        applied = delta_patch_update(&p, patch, length)==DELTA_PATCH_COMPLETE;
+    }
+    DEBUG("delta patch of %d bytes applied %d", length, applied);
+    return applied;
 }
 
 hal_update_complete_t HAL_FLASH_End(void* reserved)
@@ -222,6 +373,13 @@ hal_update_complete_t HAL_FLASH_End(void* reserved)
     hal_module_t module;
     hal_update_complete_t result = HAL_UPDATE_ERROR;
 
+    bool patched = apply_delta_patch();
+    release_delta_patch();
+    if (!patched)
+    {
+        return result;
+    }
+
     bool module_fetched = fetch_module(&module, &module_ota, true, MODULE_VALIDATION_INTEGRITY | MODULE_VALIDATION_DEPENDENCIES_FULL);
 	DEBUG("module fetched %d, checks=%d, result=%d", module_fetched, module.validity_checked, module.validity_result);
     if (module_fetched && (module.validity_checked==module.validity_result))
@@ -233,6 +391,7 @@ hal_update_complete_t HAL_FLASH_End(void* reserved)
         if (function==MODULE_FUNCTION_BOOTLOADER) {
             if (bootloader_update((const void*)module_ota.start_address, moduleLength+4))
                 result = HAL_UPDATE_APPLIED;
+            module_registry().invalidate();
         }
         else
         {
@@ -53,6 +53,11 @@ bool HAL_FLASH_Begin(uint32_t address, uint32_t length, void* reserved)
     return false;
 }
 
+bool HAL_FLASH_Resume(uint32_t address, uint32_t length, void* reserved)
+{
+    return false;
+}
+
 int HAL_FLASH_Update(const uint8_t *pBuffer, uint32_t address, uint32_t length, void* reserved)
 {
     return 0;
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "delta_encoder.h"
+#include "delta_patch.h"
+
+namespace {
+
+const uint32_t NONE = 0xFFFFFFFF;
+const unsigned HASH_BITS = 16;
+
+void put_u16(std::vector<uint8_t>& out, uint16_t value)
+{
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+void put_u32(std::vector<uint8_t>& out, uint32_t value)
+{
+    put_u16(out, value & 0xFFFF);
+    put_u16(out, value >> 16);
+}
+
+void put_varint(std::vector<uint8_t>& out, uint32_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+void put_add(std::vector<uint8_t>& out, const std::vector<uint8_t>& target, size_t start, size_t end)
+{
+    if (end > start) {
+        out.push_back(DELTA_PATCH_OP_ADD);
+        put_varint(out, end - start);
+        out.insert(out.end(), target.begin() + start, target.begin() + end);
+    }
+}
+
+} // namespace
+
+DeltaEncoder::DeltaEncoder(const std::vector<uint8_t>& reference, uint32_t reference_address, const Options& options) :
+        reference_(reference), reference_address_(reference_address), options_(options),
+        heads_(1 << HASH_BITS, NONE), chain_(reference.size(), NONE)
+{
+    for (size_t i = 0; i + BLOCK <= reference_.size(); i++) {
+        uint32_t h = hash(&reference_[i]);
+        chain_[i] = heads_[h];
+        heads_[h] = i;
+    }
+}
+
+uint32_t DeltaEncoder::hash(const uint8_t* data) const
+{
+    uint32_t h = 2166136261u;
+    for (unsigned i = 0; i < BLOCK; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return (h ^ (h >> HASH_BITS)) & ((1 << HASH_BITS) - 1);
+}
+
+size_t DeltaEncoder::match_length(uint32_t reference_offset, const std::vector<uint8_t>& target, size_t target_offset) const
+{
+    size_t length = 0;
+    while (reference_offset + length < reference_.size() && target_offset + length < target.size()
+            && reference_[reference_offset + length] == target[target_offset + length]) {
+        length++;
+    }
+    return length;
+}
+
+std::vector<uint8_t> DeltaEncoder::encode(const std::vector<uint8_t>& target) const
+{
+    std::vector<uint8_t> out;
+    put_u32(out, DELTA_PATCH_MAGIC);
+    put_u16(out, DELTA_PATCH_VERSION);
+    put_u16(out, DELTA_PATCH_HEADER_SIZE);
+    put_u32(out, reference_address_);
+    put_u32(out, reference_.size());
+    put_u32(out, crc32(reference_.data(), reference_.size()));
+    put_u32(out, target.size());
+
+    size_t literal = 0;         // the start of the bytes not yet encoded
+    size_t pos = 0;
+    uint32_t next_copy = NONE;  // the reference offset following the last copy
+    while (pos < target.size()) {
+        size_t best_length = 0;
+        uint32_t best_offset = 0;
+        if (next_copy != NONE) {
+            // the bytes after a copy usually carry on from the same place, after the literal in between
+            uint32_t offset = next_copy + (pos - literal);
+            if (offset < reference_.size()) {
+                best_length = match_length(offset, target, pos);
+                best_offset = offset;
+            }
+        }
+        if (best_length < options_.min_match && pos + BLOCK <= target.size()) {
+            unsigned examined = 0;
+            for (uint32_t candidate = heads_[hash(&target[pos])]; candidate != NONE && examined < options_.candidates;
+                    candidate = chain_[candidate], examined++) {
+                size_t length = match_length(candidate, target, pos);
+                if (length > best_length) {
+                    best_length = length;
+                    best_offset = candidate;
+                }
+            }
+        }
+        if (best_length >= options_.min_match) {
+            put_add(out, target, literal, pos);
+            out.push_back(DELTA_PATCH_OP_COPY);
+            put_varint(out, best_offset);
+            put_varint(out, best_length);
+            pos += best_length;
+            literal = pos;
+            next_copy = best_offset + best_length;
+        }
+        else {
+            pos++;
+        }
+    }
+    put_add(out, target, literal, target.size());
+    out.push_back(DELTA_PATCH_OP_END);
+    return out;
+}
+
+uint32_t DeltaEncoder::crc32(const uint8_t* data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    while (length--) {
+        crc ^= *data++;
+        for (unsigned i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+    return crc ^ 0xFFFFFFFF;
+}
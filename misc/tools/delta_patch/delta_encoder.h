@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Creates delta patches in the format applied by services/src/delta_patch.c.
+ *
+ * The encoder indexes the reference by blocks and walks the target, emitting a
+ * copy wherever a match of at least min_match bytes is found and adding the
+ * bytes in between literally. A copy that continues where the previous one ended
+ * is preferred, since rebuilt firmware keeps most code in order but shifted.
+ */
+class DeltaEncoder
+{
+public:
+    struct Options
+    {
+        unsigned min_match = 16;        // shorter matches cost more to encode than they save
+        unsigned candidates = 16;       // reference positions examined per block
+    };
+
+    DeltaEncoder(const std::vector<uint8_t>& reference, uint32_t reference_address, const Options& options);
+    DeltaEncoder(const std::vector<uint8_t>& reference, uint32_t reference_address) :
+            DeltaEncoder(reference, reference_address, Options()) {}
+
+    std::vector<uint8_t> encode(const std::vector<uint8_t>& target) const;
+
+    /**
+     * The CRC32 written to the header, as HAL_Core_Compute_CRC32() computes it on the device.
+     */
+    static uint32_t crc32(const uint8_t* data, size_t length);
+
+private:
+    static const unsigned BLOCK = 8;
+
+    uint32_t hash(const uint8_t* data) const;
+    size_t match_length(uint32_t reference_offset, const std::vector<uint8_t>& target, size_t target_offset) const;
+
+    const std::vector<uint8_t>& reference_;
+    uint32_t reference_address_;
+    Options options_;
+    std::vector<uint32_t> heads_;       // the latest reference position for each hash
+    std::vector<uint32_t> chain_;       // the previous position with the same hash
+};
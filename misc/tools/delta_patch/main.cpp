@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "delta_encoder.h"
+#include "delta_patch.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+bool read_file(const char* name, std::vector<uint8_t>& data)
+{
+    std::ifstream in(name, std::ios::binary);
+    if (!in)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+uint32_t read_u32(const std::vector<uint8_t>& data, size_t offset)
+{
+    return data[offset] | (data[offset+1] << 8) | (data[offset+2] << 16) | (uint32_t(data[offset+3]) << 24);
+}
+
+/**
+ * The module start address from the module info, which follows the vector table
+ * when the module starts with one, as FLASH_ModuleInfo() finds it.
+ */
+bool module_start_address(const std::vector<uint8_t>& image, uint32_t& address)
+{
+    if (image.size() < 0x184 + 4)
+        return false;
+    size_t info = ((read_u32(image, 0) & 0x2FF10000) == 0x20000000) ? 0x184 : 0;
+    address = read_u32(image, info);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 4 || argc > 5) {
+        std::fprintf(stderr, "usage: %s <installed.bin> <new.bin> <patch.bin> [installed address]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> reference, target;
+    if (!read_file(argv[1], reference) || !read_file(argv[2], target)) {
+        std::fprintf(stderr, "unable to read the images\n");
+        return 1;
+    }
+
+    uint32_t address = 0;
+    if (argc == 5)
+        address = std::strtoul(argv[4], nullptr, 0);
+    else if (!module_start_address(reference, address)) {
+        std::fprintf(stderr, "%s is not a module image, give the address it's installed at\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<uint8_t> patch = DeltaEncoder(reference, address).encode(target);
+    if (patch.size() > DELTA_PATCH_MAX_LENGTH) {
+        std::fprintf(stderr, "the %u byte patch is longer than the %u bytes a device applies, send the image instead\n",
+                unsigned(patch.size()), unsigned(DELTA_PATCH_MAX_LENGTH));
+        return 1;
+    }
+    std::ofstream out(argv[3], std::ios::binary);
+    out.write(reinterpret_cast<const char*>(patch.data()), patch.size());
+    if (!out) {
+        std::fprintf(stderr, "unable to write %s\n", argv[3]);
+        return 1;
+    }
+    std::printf("%u byte patch for a %u byte image, reference at 0x%08x\n", unsigned(patch.size()),
+            unsigned(target.size()), unsigned(address));
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lzss_encoder.h"
+#include "lzss.h"
+
+#include <algorithm>
+
+namespace {
+
+const uint32_t NONE = 0xFFFFFFFF;
+const unsigned HASH_BITS = 15;
+
+void put_u16(std::vector<uint8_t>& out, uint16_t value)
+{
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+void put_u32(std::vector<uint8_t>& out, uint32_t value)
+{
+    put_u16(out, value & 0xFFFF);
+    put_u16(out, value >> 16);
+}
+
+uint32_t hash(const uint8_t* data)
+{
+    uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16);
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+ * Collects items into groups behind their flag byte.
+ */
+class Groups
+{
+public:
+    Groups(std::vector<uint8_t>& out) : out_(out), flags_(0), count_(8) {}
+
+    void literal(uint8_t b) {
+        begin_item(true);
+        out_.push_back(b);
+    }
+
+    void match(uint16_t token) {
+        begin_item(false);
+        put_u16(out_, token);
+    }
+
+private:
+    void begin_item(bool literal) {
+        if (count_ == 8) {
+            flags_ = out_.size();
+            out_.push_back(0);
+            count_ = 0;
+        }
+        if (literal)
+            out_[flags_] |= 1 << count_;
+        count_++;
+    }
+
+    std::vector<uint8_t>& out_;
+    size_t flags_;
+    unsigned count_;
+};
+
+} // namespace
+
+LzssEncoder::LzssEncoder(const Options& options) :
+        options_(options), window_(size_t(1) << options.window_bits),
+        max_match_(LZSS_MIN_MATCH + (size_t(1) << (16 - options.window_bits)) - 1)
+{
+}
+
+LzssEncoder::Match LzssEncoder::find(const std::vector<uint8_t>& image, size_t pos,
+        const std::vector<uint32_t>& heads, const std::vector<uint32_t>& chain) const
+{
+    Match best;
+    if (pos + LZSS_MIN_MATCH > image.size())
+        return best;
+    size_t limit = std::min(max_match_, image.size() - pos);
+    uint32_t candidate = heads[hash(&image[pos])];
+    for (unsigned i = 0; i < options_.chain && candidate != NONE && pos - candidate <= window_; i++) {
+        size_t length = 0;
+        while (length < limit && image[candidate + length] == image[pos + length])
+            length++;
+        if (length > best.length) {
+            best.length = length;
+            best.distance = pos - candidate;
+            if (length == limit)
+                break;
+        }
+        candidate = chain[candidate];
+    }
+    if (best.length < LZSS_MIN_MATCH)
+        best.length = 0;
+    return best;
+}
+
+std::vector<uint8_t> LzssEncoder::encode(const std::vector<uint8_t>& image) const
+{
+    std::vector<uint8_t> out;
+    put_u32(out, LZSS_MAGIC);
+    out.push_back(LZSS_VERSION);
+    out.push_back(options_.window_bits);
+    put_u16(out, LZSS_HEADER_SIZE);
+    put_u32(out, image.size());
+
+    std::vector<uint32_t> heads(1 << HASH_BITS, NONE);
+    std::vector<uint32_t> chain(image.size(), NONE);
+    size_t indexed = 0;
+    // indexes the positions before end, so a search never finds the position being encoded
+    auto index = [&](size_t end) {
+        for (; indexed < end && indexed + LZSS_MIN_MATCH <= image.size(); indexed++) {
+            uint32_t h = hash(&image[indexed]);
+            chain[indexed] = heads[h];
+            heads[h] = indexed;
+        }
+    };
+
+    Groups groups(out);
+    size_t pos = 0;
+    while (pos < image.size()) {
+        index(pos);
+        Match match = find(image, pos, heads, chain);
+        if (match.length) {
+            index(pos + 1);
+            Match next = find(image, pos + 1, heads, chain);
+            if (next.length > match.length) {
+                // emit this byte literally and take the longer match that follows
+                groups.literal(image[pos++]);
+                match = next;
+            }
+            size_t token = (match.distance - 1) | ((match.length - LZSS_MIN_MATCH) << options_.window_bits);
+            groups.match(uint16_t(token));
+            pos += match.length;
+        }
+        else {
+            groups.literal(image[pos++]);
+        }
+    }
+    return out;
+}
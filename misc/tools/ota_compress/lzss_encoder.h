@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Compresses images in the format expanded by services/src/lzss.c.
+ *
+ * Matches are found with hash chains over 3 byte prefixes. A match is deferred by a byte
+ * when the next position has a longer one (lazy matching), which is worth a few percent
+ * on code without slowing the device, since only the encoder does the searching.
+ */
+class LzssEncoder
+{
+public:
+    struct Options
+    {
+        unsigned window_bits = 10;      // the device reserves 1<<window_bits bytes to expand the image
+        unsigned chain = 128;           // positions examined per match
+    };
+
+    LzssEncoder(const Options& options);
+    LzssEncoder() : LzssEncoder(Options()) {}
+
+    std::vector<uint8_t> encode(const std::vector<uint8_t>& image) const;
+
+private:
+    struct Match
+    {
+        size_t length = 0;
+        size_t distance = 0;
+    };
+
+    Match find(const std::vector<uint8_t>& image, size_t pos, const std::vector<uint32_t>& heads,
+            const std::vector<uint32_t>& chain) const;
+
+    Options options_;
+    size_t window_;
+    size_t max_match_;
+};
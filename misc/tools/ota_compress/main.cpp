@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lzss_encoder.h"
+#include "lzss.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+bool read_file(const char* name, std::vector<uint8_t>& data)
+{
+    std::ifstream in(name, std::ios::binary);
+    if (!in)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3 || argc > 4) {
+        std::fprintf(stderr, "usage: %s <firmware.bin> <compressed.bin> [window bits]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> image;
+    if (!read_file(argv[1], image)) {
+        std::fprintf(stderr, "unable to read %s\n", argv[1]);
+        return 1;
+    }
+
+    LzssEncoder::Options options;
+    if (argc == 4)
+        options.window_bits = std::strtoul(argv[3], nullptr, 0);
+    if (options.window_bits < LZSS_MIN_WINDOW_BITS || options.window_bits > LZSS_MAX_WINDOW_BITS) {
+        std::fprintf(stderr, "the window is between %d and %d bits\n", LZSS_MIN_WINDOW_BITS, LZSS_MAX_WINDOW_BITS);
+        return 1;
+    }
+
+    std::vector<uint8_t> compressed = LzssEncoder(options).encode(image);
+    std::ofstream out(argv[2], std::ios::binary);
+    out.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+    if (!out) {
+        std::fprintf(stderr, "unable to write %s\n", argv[2]);
+        return 1;
+    }
+    std::printf("%u bytes compressed to %u (%u%%)\n", unsigned(image.size()), unsigned(compressed.size()),
+            unsigned(image.empty() ? 100 : compressed.size() * 100 / image.size()));
+    return 0;
+}
@@ -139,6 +139,13 @@ void FLASH_WriteProtection_Enable(uint32_t FLASH_Sectors);
 void FLASH_WriteProtection_Disable(uint32_t FLASH_Sectors);
 uint32_t FLASH_PagesMask(uint32_t imageSize, uint32_t pageSize);
 
+struct flash_io;
+
+/**
+ * The copy engine's view of a flash device, or NULL when the device isn't present.
+ */
+const struct flash_io* FLASH_DeviceIO(flash_device_t device);
+
 
 #include "flash_access.h"
 
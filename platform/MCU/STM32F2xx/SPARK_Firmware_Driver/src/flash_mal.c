@@ -28,6 +28,7 @@
 #include "flash_mal.h"
 #include "dct.h"
 #include "module_info.h"
+#include "flash_copy.h"
 #include <string.h>
 
 /* Private functions ---------------------------------------------------------*/
@@ -253,9 +254,12 @@ bool FLASH_EraseMemory(flash_device_t flashDeviceID, uint32_t startAddress, uint
     return false;
 }
 
-bool FLASH_CheckCopyMemory(flash_device_t sourceDeviceID, uint32_t sourceAddress,
+/**
+ * Validates a copy. When verifyCRC is false, the caller checks the CRC requested in the flags.
+ */
+static bool CheckCopyMemory(flash_device_t sourceDeviceID, uint32_t sourceAddress,
                       flash_device_t destinationDeviceID, uint32_t destinationAddress,
-                      uint32_t length, uint8_t module_function, uint8_t flags)
+                      uint32_t length, uint8_t module_function, uint8_t flags, bool verifyCRC)
 {
     if (!FLASH_CheckValidAddressRange(sourceDeviceID, sourceAddress, length))
     {
@@ -294,7 +298,7 @@ bool FLASH_CheckCopyMemory(flash_device_t sourceDeviceID, uint32_t sourceAddress
             return false;
         }
 
-        if ((flags & MODULE_VERIFY_CRC) && !FLASH_VerifyCRC32(sourceDeviceID, sourceAddress, moduleLength))
+        if (verifyCRC && (flags & MODULE_VERIFY_CRC) && !FLASH_VerifyCRC32(sourceDeviceID, sourceAddress, moduleLength))
         {
             return false;
         }
@@ -303,103 +307,193 @@ bool FLASH_CheckCopyMemory(flash_device_t sourceDeviceID, uint32_t sourceAddress
     return true;
 }
 
-bool CopyFlashBlock(flash_device_t sourceDeviceID, uint32_t sourceAddress, flash_device_t destinationDeviceID, uint32_t destinationAddress, uint32_t length)
+bool FLASH_CheckCopyMemory(flash_device_t sourceDeviceID, uint32_t sourceAddress,
+                      flash_device_t destinationDeviceID, uint32_t destinationAddress,
+                      uint32_t length, uint8_t module_function, uint8_t flags)
 {
-#ifdef USE_SERIAL_FLASH
-    uint8_t serialFlashData[4];
-#endif
+    return CheckCopyMemory(sourceDeviceID, sourceAddress, destinationDeviceID, destinationAddress,
+            length, module_function, flags, true);
+}
+
+/**
+ * The working memory for copies from devices that aren't memory mapped.
+ */
+#define FLASH_COPY_BUFFER_SIZE 512
+
+static const uint8_t* internal_flash_map(const flash_io* io, uint32_t address)
+{
+    return (const uint8_t*)address;
+}
+
+static int internal_flash_read(const flash_io* io, uint32_t address, uint8_t* data, uint32_t length)
+{
+    memcpy(data, (const void*)address, length);
+    return 0;
+}
 
-	uint32_t endAddress = sourceAddress+length;
+static int internal_flash_write(const flash_io* io, uint32_t address, const uint8_t* data, uint32_t length)
+{
+    int result = 0;
+
+    /* Unlock the internal flash program erase controller */
+    FLASH_Unlock();
 
-    if (!FLASH_EraseMemory(destinationDeviceID, destinationAddress, length))
+    FLASH_ClearFlags();
+
+    while (length)
     {
-        return false;
+        uint32_t word = 0xFFFFFFFF;
+        uint32_t count = length < 4 ? length : 4;
+        memcpy(&word, data, count);
+        if (FLASH_ProgramWord(address, word) != FLASH_COMPLETE)
+        {
+            result = -1;
+            break;
+        }
+        address += 4;
+        data += count;
+        length -= count;
     }
 
-	if (destinationDeviceID == FLASH_INTERNAL)
-	{
-	    /* Locks the internal flash program erase controller */
-	    FLASH_Unlock();
-	}
+    /* Locks the internal flash program erase controller */
+    FLASH_Lock();
 
-	bool success = true;
+    return result;
+}
 
-	/* Program source to destination */
-	while (sourceAddress < endAddress)
-	{
-	    uint32_t internalFlashData = 0;
-
-		if (sourceDeviceID == FLASH_INTERNAL)
-		{
-			/* Read data from internal flash source address */
-			internalFlashData = (*(__IO uint32_t*) sourceAddress);
-		}
-	#ifdef USE_SERIAL_FLASH
-		else if (sourceDeviceID == FLASH_SERIAL)
-		{
-			/* Read data from serial flash source address */
-			sFLASH_ReadBuffer(serialFlashData, sourceAddress, 4);
-		}
-	#endif
-
-		if (destinationDeviceID == FLASH_INTERNAL)
-		{
-	#ifdef USE_SERIAL_FLASH
-			if (sourceDeviceID == FLASH_SERIAL)
-			{
-				internalFlashData = (uint32_t)(serialFlashData[0] | (serialFlashData[1] << 8) | (serialFlashData[2] << 16) | (serialFlashData[3] << 24));
-			}
-	#endif
-
-			/* Program data to internal flash destination address */
-			FLASH_Status status = FLASH_ProgramWord(destinationAddress, internalFlashData);
-
-			/* If program operation fails, return Failure */
-			if (status != FLASH_COMPLETE)
-			{
-				success = false;
-				break;
-			}
-		}
-	#ifdef USE_SERIAL_FLASH
-		else if (destinationDeviceID == FLASH_SERIAL)
-		{
-			if (sourceDeviceID == FLASH_INTERNAL)
-			{
-				serialFlashData[0] = (uint8_t)(internalFlashData & 0xFF);
-				serialFlashData[1] = (uint8_t)((internalFlashData & 0xFF00) >> 8);
-				serialFlashData[2] = (uint8_t)((internalFlashData & 0xFF0000) >> 16);
-				serialFlashData[3] = (uint8_t)((internalFlashData & 0xFF000000) >> 24);
-			}
-
-			/* Program data to serial flash destination address */
-			sFLASH_WriteBuffer(serialFlashData, destinationAddress, 4);
-		}
-	#endif
-
-		sourceAddress += 4;
-		destinationAddress += 4;
-	}
+static int internal_flash_erase(const flash_io* io, uint32_t address)
+{
+    return FLASH_EraseMemory(FLASH_INTERNAL, address, 1) ? 0 : -1;
+}
 
-	if (destinationDeviceID == FLASH_INTERNAL)
-	{
-	    /* Locks the internal flash program erase controller */
-	    FLASH_Lock();
-	}
+static uint32_t internal_flash_sector_end(const flash_io* io, uint32_t address)
+{
+    return EndOfFlashSector(FLASH_INTERNAL, address);
+}
+
+static const flash_io internal_flash = {
+    sizeof(flash_io), 0, NULL,
+    internal_flash_map,
+    internal_flash_read,
+    NULL,
+    internal_flash_write,
+    internal_flash_erase,
+    internal_flash_sector_end
+};
+
+#ifdef USE_SERIAL_FLASH
+static int serial_flash_read(const flash_io* io, uint32_t address, uint8_t* data, uint32_t length)
+{
+    sFLASH_ReadBuffer(data, address, length);
+    return 0;
+}
+
+static int serial_flash_write(const flash_io* io, uint32_t address, const uint8_t* data, uint32_t length)
+{
+    sFLASH_WriteBuffer(data, address, length);
+    return 0;
+}
+
+static int serial_flash_erase(const flash_io* io, uint32_t address)
+{
+    sFLASH_EraseSector(address);
+    return 0;
+}
+
+static uint32_t serial_flash_sector_end(const flash_io* io, uint32_t address)
+{
+    return EndOfFlashSector(FLASH_SERIAL, address);
+}
+
+/**
+ * The SPI driver has no DMA, so reads complete before returning and there is no sync.
+ */
+static const flash_io serial_flash = {
+    sizeof(flash_io), 0, NULL,
+    NULL,
+    serial_flash_read,
+    NULL,
+    serial_flash_write,
+    serial_flash_erase,
+    serial_flash_sector_end
+};
+#endif
+
+const flash_io* FLASH_DeviceIO(flash_device_t device)
+{
+    if (device == FLASH_INTERNAL)
+        return &internal_flash;
+#ifdef USE_SERIAL_FLASH
+    if (device == FLASH_SERIAL)
+        return &serial_flash;
+#endif
+    return NULL;
+}
 
-	return success;
+/**
+ * The module CRC, computed a block at a time as the source of a copy is scanned.
+ * The blocks are whole words up to the end of the module, so the hardware CRC unit
+ * accumulates across them.
+ */
+typedef struct {
+    uint32_t length;    /* the number of bytes covered by the CRC */
+    uint32_t crc;
+} module_crc_t;
+
+static void module_crc_observe(void* context, uint32_t offset, const uint8_t* data, uint32_t length)
+{
+    module_crc_t* state = (module_crc_t*)context;
+    if (offset >= state->length)
+        return;
+
+    if (offset == 0)
+        CRC_ResetDR();
+
+    if (length > state->length - offset)
+        length = state->length - offset;
+
+    uint32_t i;
+    for (i = length >> 2; i--; data += 4)
+    {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        CRC->DR = __RBIT(word);
+    }
+
+    if (offset + length == state->length)
+    {
+        uint32_t crc = __RBIT(CRC->DR);
+        for (i = length & 3; i--; )
+        {
+            crc ^= (uint32_t)*data++;
+            uint32_t j;
+            for (j = 0; j < 8; j++)
+            {
+                crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+            }
+        }
+        state->crc = crc ^ 0xFFFFFFFF;
+    }
 }
 
 bool FLASH_CopyMemory(flash_device_t sourceDeviceID, uint32_t sourceAddress,
                       flash_device_t destinationDeviceID, uint32_t destinationAddress,
                       uint32_t length, uint8_t module_function, uint8_t flags)
 {
-    if (!FLASH_CheckCopyMemory(sourceDeviceID, sourceAddress, destinationDeviceID, destinationAddress, length, module_function, flags))
+    // the CRC is computed while scanning the source below, rather than in a pass of its own
+    if (!CheckCopyMemory(sourceDeviceID, sourceAddress, destinationDeviceID, destinationAddress, length, module_function, flags, false))
+    {
+        return false;
+    }
+
+    const flash_io* source = FLASH_DeviceIO(sourceDeviceID);
+    const flash_io* destination = FLASH_DeviceIO(destinationDeviceID);
+    if (!source || !destination)
     {
         return false;
     }
 
-    if (sourceDeviceID == FLASH_SERIAL)
+    if (sourceDeviceID == FLASH_SERIAL || destinationDeviceID == FLASH_SERIAL)
     {
 #ifdef USE_SERIAL_FLASH
         /* Initialize SPI Flash */
@@ -407,27 +501,40 @@ bool FLASH_CopyMemory(flash_device_t sourceDeviceID, uint32_t sourceAddress,
 #endif
     }
 
-    while (length)
+    module_crc_t moduleCRC = { 0, 0 };
+#ifndef USE_SERIAL_FLASH
+    if ((sourceDeviceID == FLASH_INTERNAL) && (flags & MODULE_VERIFY_CRC))
     {
-        uint32_t endBlockAddress = EndOfFlashSector(destinationDeviceID, destinationAddress);
-    		uint32_t blockLength = endBlockAddress-destinationAddress;
-    		if (blockLength>length)
-    			blockLength = length;
-    		if (!CopyFlashBlock(sourceDeviceID, sourceAddress, destinationDeviceID, destinationAddress, blockLength))
-    			return false;
-    		length -= blockLength;
-    		sourceAddress += blockLength;
-    		destinationAddress += blockLength;
+        moduleCRC.length = FLASH_ModuleLength(sourceDeviceID, sourceAddress);
+        if (!moduleCRC.length)
+        {
+            return false;
+        }
     }
-    return true;
+#endif
+
+    /* Find the destination sectors that differ from the source, and verify the source before any are erased */
+    uint8_t buffer[FLASH_COPY_BUFFER_SIZE];
+    uint32_t changed;
+    if (flash_copy_scan(source, sourceAddress, destination, destinationAddress, length, buffer, sizeof(buffer),
+            moduleCRC.length ? module_crc_observe : NULL, &moduleCRC, &changed))
+    {
+        return false;
+    }
+
+    if (moduleCRC.length && moduleCRC.crc != __REV(*(__IO uint32_t*)(sourceAddress + moduleCRC.length)))
+    {
+        return false;
+    }
+
+    return flash_copy_sectors(source, sourceAddress, destination, destinationAddress, length,
+            buffer, sizeof(buffer), changed) == 0;
 }
 
 bool FLASH_CompareMemory(flash_device_t sourceDeviceID, uint32_t sourceAddress,
                          flash_device_t destinationDeviceID, uint32_t destinationAddress,
                          uint32_t length)
 {
-	uint32_t endAddress = sourceAddress + length;
-
     if (FLASH_CheckValidAddressRange(sourceDeviceID, sourceAddress, length) != true)
     {
         return false;
@@ -438,59 +545,24 @@ bool FLASH_CompareMemory(flash_device_t sourceDeviceID, uint32_t sourceAddress,
         return false;
     }
 
-    if (sourceDeviceID == FLASH_SERIAL || destinationDeviceID == FLASH_SERIAL)
+    const flash_io* source = FLASH_DeviceIO(sourceDeviceID);
+    const flash_io* destination = FLASH_DeviceIO(destinationDeviceID);
+    if (!source || !destination)
     {
-#ifdef USE_SERIAL_FLASH
-        /* Initialize SPI Flash */
-        sFLASH_Init();
-#endif
+        return false;
     }
 
-    /* Program source to destination */
-    while (sourceAddress < endAddress)
+    if (sourceDeviceID == FLASH_SERIAL || destinationDeviceID == FLASH_SERIAL)
     {
-    		uint32_t sourceDeviceData = 0;
-        if (sourceDeviceID == FLASH_INTERNAL)
-        {
-            /* Read data from internal flash source address */
-            sourceDeviceData = (*(__IO uint32_t*) sourceAddress);
-        }
 #ifdef USE_SERIAL_FLASH
-        else if (sourceDeviceID == FLASH_SERIAL)
-        {
-            /* Read data from serial flash source address */
-            sFLASH_ReadBuffer(serialFlashData, sourceAddress, 4);
-            sourceDeviceData = (uint32_t)(serialFlashData[0] | (serialFlashData[1] << 8) | (serialFlashData[2] << 16) | (serialFlashData[3] << 24));
-        }
-#endif
-
-        uint32_t destinationDeviceData = 0;
-        if (destinationDeviceID == FLASH_INTERNAL)
-        {
-            /* Read data from internal flash destination address */
-            destinationDeviceData = (*(__IO uint32_t*) destinationAddress);
-        }
-#ifdef USE_SERIAL_FLASH
-        else if (destinationDeviceID == FLASH_SERIAL)
-        {
-            /* Read data from serial flash destination address */
-            sFLASH_ReadBuffer(serialFlashData, destinationAddress, 4);
-            destinationDeviceData = (uint32_t)(serialFlashData[0] | (serialFlashData[1] << 8) | (serialFlashData[2] << 16) | (serialFlashData[3] << 24));
-        }
+        /* Initialize SPI Flash */
+        sFLASH_Init();
 #endif
-
-        if (sourceDeviceData != destinationDeviceData)
-        {
-            /* Failed comparison check */
-            return false;
-        }
-
-        sourceAddress += 4;
-        destinationAddress += 4;
     }
 
-    /* Passed comparison check */
-    return true;
+    uint8_t buffer[FLASH_COPY_BUFFER_SIZE];
+    return flash_compare(source, sourceAddress, destination, destinationAddress, length,
+            buffer, sizeof(buffer)) == 0;
 }
 
 bool FLASH_AddToNextAvailableModulesSlot(flash_device_t sourceDeviceID, uint32_t sourceAddress,
@@ -868,18 +940,6 @@ uint32_t FLASH_PagesMask(uint32_t imageSize, uint32_t pageSize)
     return numPages;
 }
 
-void FLASH_Begin(uint32_t FLASH_Address, uint32_t imageSize)
-{
-    system_flags.OTA_FLASHED_Status_SysFlag = 0x0000;
-    Save_SystemFlags();
-
-#ifdef USE_SERIAL_FLASH
-    FLASH_EraseMemory(FLASH_SERIAL, FLASH_Address, imageSize);
-#else
-    FLASH_EraseMemory(FLASH_INTERNAL, FLASH_Address, imageSize);
-#endif
-}
-
 int FLASH_Update(const uint8_t *pBuffer, uint32_t address, uint32_t bufferSize)
 {
 #ifdef USE_SERIAL_FLASH
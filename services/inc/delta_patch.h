@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A delta patch rebuilds a module image from the module already installed (the reference).
+ *
+ * The patch is a header followed by a stream of operations, each an opcode byte
+ * followed by unsigned LEB128 values:
+ *
+ *  DELTA_PATCH_OP_ADD  length, then length bytes     - appends the bytes to the image
+ *  DELTA_PATCH_OP_COPY offset, length                - appends bytes of the reference
+ *  DELTA_PATCH_OP_END                                - the image is complete
+ *
+ * All header fields are little endian. Patches are created with misc/tools/delta_patch.
+ */
+#define DELTA_PATCH_MAGIC           0x544C4450  /* "PDLT" */
+#define DELTA_PATCH_VERSION         1
+#define DELTA_PATCH_HEADER_SIZE     24
+
+/**
+ * The longest patch a device applies. The image is rebuilt over the patch, so the patch is
+ * held in RAM while it is applied. The RAM is reserved when the chunk holding the header is
+ * received, and an update whose file is longer than this is refused at that point.
+ */
+#ifndef DELTA_PATCH_MAX_LENGTH
+#define DELTA_PATCH_MAX_LENGTH      (16*1024)
+#endif
+
+#define DELTA_PATCH_OP_END          0
+#define DELTA_PATCH_OP_ADD          1
+#define DELTA_PATCH_OP_COPY         2
+
+#define DELTA_PATCH_COMPLETE        1
+#define DELTA_PATCH_ERROR_FORMAT    (-1)
+#define DELTA_PATCH_ERROR_RANGE     (-2)
+#define DELTA_PATCH_ERROR_READ      (-3)
+#define DELTA_PATCH_ERROR_WRITE     (-4)
+#define DELTA_PATCH_ERROR_LENGTH    (-5)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t reference_address;     /* where the reference is installed */
+    uint32_t reference_length;
+    uint32_t reference_crc;         /* CRC32 of the reference, as computed by HAL_Core_Compute_CRC32() */
+    uint32_t target_length;
+} delta_patch_header;
+
+/**
+ * Reads bytes of the reference.
+ * @param offset    The offset from the start of the reference.
+ * @return 0 on success.
+ */
+typedef int (*delta_patch_read_fn)(void* context, uint32_t offset, uint8_t* data, uint32_t length);
+
+/**
+ * Receives the rebuilt image, in order.
+ * @param offset    The offset from the start of the image.
+ * @return 0 on success.
+ */
+typedef int (*delta_patch_write_fn)(void* context, uint32_t offset, const uint8_t* data, uint32_t length);
+
+/**
+ * Applies a patch as it is received. The rebuilt image is collected in a buffer and
+ * passed to the write function a buffer at a time.
+ */
+typedef struct {
+    uint16_t size;
+    uint8_t state;
+    uint8_t shift;              /* of the next 7 bits of the value being decoded */
+    uint32_t value;             /* the value being decoded */
+    uint32_t offset;            /* the reference offset of a copy */
+    uint32_t remaining;         /* bytes remaining in the current operation or header */
+    uint32_t written;           /* bytes of the image passed to the write function */
+    delta_patch_header header;
+    uint8_t header_data[DELTA_PATCH_HEADER_SIZE];
+    uint8_t* buffer;
+    uint32_t buffer_size;
+    uint32_t buffer_length;
+    delta_patch_read_fn read;
+    delta_patch_write_fn write;
+    void* context;
+} delta_patch;
+
+/**
+ * Determines if data starts with a patch header.
+ */
+int delta_patch_is_patch(const uint8_t* data, uint32_t length);
+
+/**
+ * Decodes a patch header.
+ * @return 0 on success.
+ */
+int delta_patch_parse_header(const uint8_t* data, uint32_t length, delta_patch_header* header);
+
+/**
+ * Determines the length of a patch, from the start of the header to the end operation.
+ * @return The length, or a negative error when the patch is malformed or doesn't end within {@code length} bytes.
+ */
+int32_t delta_patch_length(const uint8_t* data, uint32_t length);
+
+/**
+ * Initializes a patch.
+ * @param buffer        Collects the image for the write function. The size should be a
+ *                      multiple of the flash word size.
+ */
+void delta_patch_init(delta_patch* patch, delta_patch_read_fn read, delta_patch_write_fn write, void* context,
+        uint8_t* buffer, uint32_t buffer_size);
+
+/**
+ * Applies the next part of a patch.
+ * @return 0 when more of the patch is expected, DELTA_PATCH_COMPLETE once the image is
+ *  complete and written, otherwise one of the DELTA_PATCH_ERROR codes. Data after the end is ignored.
+ */
+int delta_patch_update(delta_patch* patch, const uint8_t* data, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* DELTA_PATCH_H */
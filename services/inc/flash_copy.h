@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FLASH_COPY_H
+#define FLASH_COPY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_COPY_ERROR_READ       (-1)
+#define FLASH_COPY_ERROR_WRITE      (-2)
+#define FLASH_COPY_ERROR_ERASE      (-3)
+#define FLASH_COPY_ERROR_ARGUMENT   (-4)
+#define FLASH_COPY_MISMATCH         (-5)
+
+typedef struct flash_io flash_io;
+
+/**
+ * A flash device as seen by the copy engine. The platform provides one for each
+ * of its devices; the unit tests provide RAM-backed ones.
+ *
+ * All functions return 0 on success.
+ */
+struct flash_io {
+    uint16_t size;
+    uint16_t reserved;
+
+    /**
+     * Free for use by the device.
+     */
+    void* context;
+
+    /**
+     * Retrieves a pointer to the contents at an address, for devices that are memory mapped.
+     * NULL when the device must be read with {@code read}.
+     */
+    const uint8_t* (*map)(const flash_io* io, uint32_t address);
+
+    /**
+     * Reads a block. When {@code sync} is provided, the read may only be started
+     * and the data is available once {@code sync} returns.
+     */
+    int (*read)(const flash_io* io, uint32_t address, uint8_t* data, uint32_t length);
+
+    /**
+     * Waits for the read in progress to complete. NULL when reads complete before {@code read} returns.
+     */
+    int (*sync)(const flash_io* io);
+
+    /**
+     * Programs a block of erased flash.
+     */
+    int (*write)(const flash_io* io, uint32_t address, const uint8_t* data, uint32_t length);
+
+    /**
+     * Erases the sector containing an address.
+     */
+    int (*erase)(const flash_io* io, uint32_t address);
+
+    /**
+     * The address after the end of the sector containing an address.
+     */
+    uint32_t (*sector_end)(const flash_io* io, uint32_t address);
+};
+
+/**
+ * The number of destination sectors tracked by flash_copy_scan(). Sectors beyond these
+ * are always taken to have changed.
+ */
+#define FLASH_COPY_MAX_SECTORS 32
+
+/**
+ * Receives the source a block at a time during flash_copy_scan(), in order.
+ * @param offset    The offset of the block from the start of the source.
+ */
+typedef void (*flash_copy_observer)(void* context, uint32_t offset, const uint8_t* data, uint32_t length);
+
+/**
+ * Copies a block of flash, erasing each destination sector before it is programmed.
+ * Data is moved in blocks of half the buffer, so the read of the next block can be in progress
+ * while the current block is programmed. Sources that are memory mapped are programmed
+ * directly and don't need the buffer.
+ *
+ * @param buffer        Working memory, at least 8 bytes.
+ * @return 0 on success, otherwise one of the FLASH_COPY_ERROR codes.
+ */
+int flash_copy(const flash_io* src, uint32_t src_address, const flash_io* dst, uint32_t dst_address,
+        uint32_t length, uint8_t* buffer, uint32_t buffer_size);
+
+/**
+ * Reads the source once, presenting it to an observer, and determines which destination
+ * sectors differ from it. Nothing is written, so a checksum computed by the observer can be
+ * checked before the destination is changed.
+ *
+ * @param observer      Optional.
+ * @param changed       Receives a bit for each destination sector spanned by the copy, set when the sector differs.
+ */
+int flash_copy_scan(const flash_io* src, uint32_t src_address, const flash_io* dst, uint32_t dst_address,
+        uint32_t length, uint8_t* buffer, uint32_t buffer_size,
+        flash_copy_observer observer, void* context, uint32_t* changed);
+
+/**
+ * As flash_copy(), but only the destination sectors flagged in {@code changed} are erased and
+ * programmed.
+ */
+int flash_copy_sectors(const flash_io* src, uint32_t src_address, const flash_io* dst, uint32_t dst_address,
+        uint32_t length, uint8_t* buffer, uint32_t buffer_size, uint32_t changed);
+
+/**
+ * Compares two blocks of flash.
+ * @return 0 when they are the same, FLASH_COPY_MISMATCH when they differ, otherwise an error code.
+ */
+int flash_compare(const flash_io* a, uint32_t a_address, const flash_io* b, uint32_t b_address,
+        uint32_t length, uint8_t* buffer, uint32_t buffer_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* FLASH_COPY_H */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSMN_STREAM_H
+#define JSMN_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "jsmn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Maximum nesting depth of objects and arrays supported by the streaming parser.
+ */
+#define JSMN_STREAM_MAX_DEPTH 32
+
+/**
+ * Reads up to {@code length} bytes of JSON text into {@code buf}.
+ * @return The number of bytes read. 0 or a negative value signals the end of the input.
+ */
+typedef int (*jsmn_stream_read_fn)(void* state, char* buf, size_t length);
+
+/**
+ * A single token produced by the streaming parser.
+ *
+ * Objects and arrays produce two tokens, one for the opening bracket and one
+ * (with {@code end} set) for the closing bracket. Strings and primitives produce
+ * a single token, and their text is copied to the value buffer given to
+ * jsmn_stream_init().
+ */
+typedef struct {
+    jsmntype_t type;
+    uint8_t key;        /* the token is a string used as an object key */
+    uint8_t end;        /* the token closes an object or array */
+    uint8_t truncated;  /* the value didn't fit the value buffer */
+    uint8_t depth;      /* nesting level of the token. Top-level tokens have depth 0. */
+    size_t length;      /* length of the value text, even when truncated */
+} jsmn_stream_token;
+
+/**
+ * Incremental JSON parser. Text is pulled from a read callback in chunks, so
+ * memory use is fixed by the chunk and value buffers regardless of the size
+ * of the document.
+ */
+typedef struct {
+    uint16_t size;
+    uint8_t state;
+    uint8_t depth;
+    uint32_t objects;       /* bit per nesting level, set for objects, clear for arrays */
+    jsmn_stream_read_fn read;
+    void* read_state;
+    char* chunk;
+    size_t chunk_size;
+    size_t chunk_len;
+    size_t chunk_pos;
+    char* value;
+    size_t value_size;
+    uint8_t eof;
+} jsmn_stream_parser;
+
+/**
+ * Initializes a streaming parser.
+ * @param parser        The parser to initialize.
+ * @param chunk         Buffer used to hold text fetched from the read callback.
+ * @param chunk_size    The size of the chunk buffer.
+ * @param value         Buffer receiving the null-terminated text of string and primitive tokens.
+ *                      String text is copied without the quotes and escape sequences are left as-is.
+ * @param value_size    The size of the value buffer.
+ * @param read          Callback supplying the JSON text.
+ * @param read_state    Opaque state passed to the read callback.
+ */
+void jsmn_stream_init(jsmn_stream_parser* parser, char* chunk, size_t chunk_size, char* value, size_t value_size,
+        jsmn_stream_read_fn read, void* read_state, void* reserved);
+
+/**
+ * Fetches the next token.
+ * @return 1 when a token was produced, 0 when the top-level value has been fully parsed,
+ *  JSMN_ERROR_INVAL for malformed input, JSMN_ERROR_PART when the input ended before the
+ *  top-level value was complete, JSMN_ERROR_NOMEM when JSMN_STREAM_MAX_DEPTH is exceeded.
+ */
+int jsmn_stream_next(jsmn_stream_parser* parser, jsmn_stream_token* token, void* reserved);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JSMN_STREAM_H */
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LAZY_ERASE_H
+#define LAZY_ERASE_H
+
+#include "flash_copy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The number of sectors of a region that are erased as they are first written.
+ * Sectors beyond these are erased when the region is begun.
+ */
+#define LAZY_ERASE_MAX_SECTORS 32
+
+/**
+ * A region of flash that is erased a sector at a time, as each sector is first written,
+ * rather than all at once before the first write. The state is plain data and carries its
+ * own check, so it can be kept in memory that survives a reset and the region written to
+ * further afterwards.
+ */
+typedef struct lazy_erase {
+    uint32_t address;
+    uint32_t length;
+    uint32_t erased;        /* a bit for each sector from the start of the region, set once it's erased */
+    uint32_t check;
+} lazy_erase;
+
+/**
+ * Begins a region with none of its sectors erased.
+ * @return 0 on success, otherwise one of the FLASH_COPY_ERROR codes.
+ */
+int lazy_erase_begin(lazy_erase* region, const flash_io* io, uint32_t address, uint32_t length);
+
+/**
+ * Erases the sectors of the region spanned by a write that haven't been erased already.
+ * Sectors that are already blank are taken as erased, without erasing them again.
+ * Parts of the write outside the region are left to the caller.
+ * @return 0 on success, otherwise one of the FLASH_COPY_ERROR codes.
+ */
+int lazy_erase_prepare(lazy_erase* region, const flash_io* io, uint32_t address, uint32_t length);
+
+/**
+ * Determines if the state is intact and describes the given region.
+ */
+int lazy_erase_is_valid(const lazy_erase* region, uint32_t address, uint32_t length);
+
+/**
+ * Forgets the region, so that lazy_erase_is_valid() fails.
+ */
+void lazy_erase_clear(lazy_erase* region);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* LAZY_ERASE_H */
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LZSS_H
+#define LZSS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * An LZSS compressed image is a header followed by groups of up to 8 items. Each group
+ * starts with a flag byte, read from the least significant bit, with a bit for each item:
+ *
+ *  1   a literal byte
+ *  0   a match, 2 bytes little endian: the distance back in the window less one in the
+ *      low window_bits bits, the length less LZSS_MIN_MATCH in the remaining bits
+ *
+ * The image is complete once the expanded length given in the header is produced.
+ * All header fields are little endian. Images are created with misc/tools/ota_compress.
+ */
+#define LZSS_MAGIC                  0x535A4C50  /* "PLZS" */
+#define LZSS_VERSION                1
+#define LZSS_HEADER_SIZE            12
+#define LZSS_MIN_MATCH              3
+#define LZSS_MIN_WINDOW_BITS        8
+#define LZSS_MAX_WINDOW_BITS        12
+
+#define LZSS_COMPLETE               1
+#define LZSS_ERROR_FORMAT           (-1)
+#define LZSS_ERROR_WINDOW           (-2)
+#define LZSS_ERROR_WRITE            (-3)
+#define LZSS_ERROR_LENGTH           (-4)
+
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t window_bits;            /* the window is 1<<window_bits bytes */
+    uint16_t header_size;
+    uint32_t length;                /* of the expanded image */
+} lzss_header;
+
+/**
+ * Receives the expanded image, in order.
+ * @param offset    The offset from the start of the image.
+ * @return 0 on success.
+ */
+typedef int (*lzss_write_fn)(void* context, uint32_t offset, const uint8_t* data, uint32_t length);
+
+/**
+ * Expands an image as it is received. The expanded image is collected in a buffer and
+ * passed to the write function a buffer at a time.
+ */
+typedef struct {
+    uint16_t size;
+    uint8_t state;
+    uint8_t flags;              /* the flag bits remaining in the current group */
+    uint8_t items;              /* the items remaining in the current group */
+    uint8_t token;              /* the first byte of a match */
+    uint16_t remaining;         /* bytes remaining of the header */
+    uint32_t mask;              /* window positions wrap with this mask */
+    uint32_t expanded;          /* bytes of the image produced */
+    uint32_t written;           /* bytes of the image passed to the write function */
+    lzss_header header;
+    uint8_t header_data[LZSS_HEADER_SIZE];
+    uint8_t* window;
+    uint32_t window_size;
+    uint8_t* buffer;
+    uint32_t buffer_size;
+    uint32_t buffer_length;
+    lzss_write_fn write;
+    void* context;
+} lzss_decoder;
+
+/**
+ * Determines if data starts with a compressed image header.
+ */
+int lzss_is_compressed(const uint8_t* data, uint32_t length);
+
+/**
+ * Decodes a compressed image header.
+ * @return 0 on success.
+ */
+int lzss_parse_header(const uint8_t* data, uint32_t length, lzss_header* header);
+
+/**
+ * Initializes a decoder.
+ * @param window        Holds the most recently expanded bytes. Images with a larger window
+ *                      than this are refused with LZSS_ERROR_WINDOW.
+ * @param buffer        Collects the image for the write function. The size should be a
+ *                      multiple of the flash word size.
+ */
+void lzss_decoder_init(lzss_decoder* decoder, uint8_t* window, uint32_t window_size,
+        uint8_t* buffer, uint32_t buffer_size, lzss_write_fn write, void* context);
+
+/**
+ * Expands the next part of an image.
+ * @return 0 when more of the image is expected, LZSS_COMPLETE once the image is expanded
+ *  and written, otherwise one of the LZSS_ERROR codes. Data after the end is ignored.
+ */
+int lzss_decoder_update(lzss_decoder* decoder, const uint8_t* data, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* LZSS_H */
@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "delta_patch.h"
+#include <string.h>
+
+enum {
+    STATE_HEADER,
+    STATE_SKIP_HEADER,      /* fields of a later version this one doesn't know */
+    STATE_OP,
+    STATE_ADD_LENGTH,
+    STATE_ADD_DATA,
+    STATE_COPY_OFFSET,
+    STATE_COPY_LENGTH,
+    STATE_DONE,
+    STATE_ERROR
+};
+
+static uint32_t read_u32(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t read_u16(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+int delta_patch_is_patch(const uint8_t* data, uint32_t length)
+{
+    return length >= 4 && read_u32(data) == DELTA_PATCH_MAGIC;
+}
+
+int delta_patch_parse_header(const uint8_t* data, uint32_t length, delta_patch_header* header)
+{
+    if (length < DELTA_PATCH_HEADER_SIZE || !delta_patch_is_patch(data, length))
+        return DELTA_PATCH_ERROR_FORMAT;
+    header->magic = read_u32(data);
+    header->version = read_u16(data + 4);
+    header->header_size = read_u16(data + 6);
+    header->reference_address = read_u32(data + 8);
+    header->reference_length = read_u32(data + 12);
+    header->reference_crc = read_u32(data + 16);
+    header->target_length = read_u32(data + 20);
+    if (header->version != DELTA_PATCH_VERSION || header->header_size < DELTA_PATCH_HEADER_SIZE)
+        return DELTA_PATCH_ERROR_FORMAT;
+    return 0;
+}
+
+/**
+ * Decodes an unsigned LEB128 value from a buffer.
+ * @return the number of bytes used, 0 when the value isn't complete or is too large.
+ */
+static uint32_t decode_varint(const uint8_t* data, uint32_t length, uint32_t* value)
+{
+    uint32_t result = 0;
+    unsigned shift = 0;
+    for (uint32_t i = 0; i < length && shift < 32; i++, shift += 7)
+    {
+        result |= (uint32_t)(data[i] & 0x7F) << shift;
+        if (!(data[i] & 0x80))
+        {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+int32_t delta_patch_length(const uint8_t* data, uint32_t length)
+{
+    delta_patch_header header;
+    if (delta_patch_parse_header(data, length, &header))
+        return DELTA_PATCH_ERROR_FORMAT;
+
+    uint32_t pos = header.header_size;
+    while (pos < length)
+    {
+        uint8_t op = data[pos++];
+        uint32_t value, used;
+        switch (op)
+        {
+        case DELTA_PATCH_OP_END:
+            return pos;
+        case DELTA_PATCH_OP_ADD:
+            if (!(used = decode_varint(data + pos, length - pos, &value)))
+                return DELTA_PATCH_ERROR_FORMAT;
+            pos += used;
+            if (value > length - pos)
+                return DELTA_PATCH_ERROR_FORMAT;
+            pos += value;
+            break;
+        case DELTA_PATCH_OP_COPY:
+            if (!(used = decode_varint(data + pos, length - pos, &value)))
+                return DELTA_PATCH_ERROR_FORMAT;
+            pos += used;
+            if (!(used = decode_varint(data + pos, length - pos, &value)))
+                return DELTA_PATCH_ERROR_FORMAT;
+            pos += used;
+            break;
+        default:
+            return DELTA_PATCH_ERROR_FORMAT;
+        }
+    }
+    return DELTA_PATCH_ERROR_FORMAT;
+}
+
+void delta_patch_init(delta_patch* patch, delta_patch_read_fn read, delta_patch_write_fn write, void* context,
+        uint8_t* buffer, uint32_t buffer_size)
+{
+    memset(patch, 0, sizeof(*patch));
+    patch->size = sizeof(*patch);
+    patch->state = STATE_HEADER;
+    patch->remaining = DELTA_PATCH_HEADER_SIZE;
+    patch->read = read;
+    patch->write = write;
+    patch->context = context;
+    patch->buffer = buffer;
+    patch->buffer_size = buffer_size;
+}
+
+static int flush(delta_patch* patch)
+{
+    if (!patch->buffer_length)
+        return 0;
+    if (patch->write(patch->context, patch->written, patch->buffer, patch->buffer_length))
+        return DELTA_PATCH_ERROR_WRITE;
+    patch->written += patch->buffer_length;
+    patch->buffer_length = 0;
+    return 0;
+}
+
+/**
+ * Checks that the image has room for more bytes.
+ */
+static int reserve(delta_patch* patch, uint32_t length)
+{
+    uint32_t produced = patch->written + patch->buffer_length;
+    return (length > patch->header.target_length - produced) ? DELTA_PATCH_ERROR_LENGTH : 0;
+}
+
+static int add(delta_patch* patch, const uint8_t* data, uint32_t length)
+{
+    while (length)
+    {
+        uint32_t count = patch->buffer_size - patch->buffer_length;
+        if (count > length)
+            count = length;
+        memcpy(patch->buffer + patch->buffer_length, data, count);
+        patch->buffer_length += count;
+        data += count;
+        length -= count;
+        if (patch->buffer_length == patch->buffer_size)
+        {
+            int error = flush(patch);
+            if (error)
+                return error;
+        }
+    }
+    return 0;
+}
+
+static int copy(delta_patch* patch, uint32_t offset, uint32_t length)
+{
+    if (offset > patch->header.reference_length || length > patch->header.reference_length - offset)
+        return DELTA_PATCH_ERROR_RANGE;
+    int error = reserve(patch, length);
+    while (!error && length)
+    {
+        uint32_t count = patch->buffer_size - patch->buffer_length;
+        if (count > length)
+            count = length;
+        if (patch->read(patch->context, offset, patch->buffer + patch->buffer_length, count))
+            return DELTA_PATCH_ERROR_READ;
+        patch->buffer_length += count;
+        offset += count;
+        length -= count;
+        if (patch->buffer_length == patch->buffer_size)
+            error = flush(patch);
+    }
+    return error;
+}
+
+/**
+ * Adds the next byte to the value being decoded.
+ * @return 1 when the value is complete, 0 when more bytes are needed, or an error.
+ */
+static int decode(delta_patch* patch, uint8_t b)
+{
+    if (patch->shift >= 32)
+        return DELTA_PATCH_ERROR_FORMAT;
+    patch->value |= (uint32_t)(b & 0x7F) << patch->shift;
+    patch->shift += 7;
+    if (b & 0x80)
+        return 0;
+    patch->shift = 0;
+    return 1;
+}
+
+static int update(delta_patch* patch, const uint8_t* data, uint32_t length)
+{
+    const uint8_t* end = data + length;
+    while (data < end)
+    {
+        int result = 0;
+        switch (patch->state)
+        {
+        case STATE_HEADER:
+        {
+            uint32_t count = end - data;
+            if (count > patch->remaining)
+                count = patch->remaining;
+            memcpy(patch->header_data + DELTA_PATCH_HEADER_SIZE - patch->remaining, data, count);
+            data += count;
+            patch->remaining -= count;
+            if (!patch->remaining)
+            {
+                if (delta_patch_parse_header(patch->header_data, DELTA_PATCH_HEADER_SIZE, &patch->header))
+                    return DELTA_PATCH_ERROR_FORMAT;
+                patch->remaining = patch->header.header_size - DELTA_PATCH_HEADER_SIZE;
+                patch->state = STATE_SKIP_HEADER;
+            }
+            break;
+        }
+
+        case STATE_SKIP_HEADER:
+        {
+            uint32_t count = end - data;
+            if (count > patch->remaining)
+                count = patch->remaining;
+            data += count;
+            patch->remaining -= count;
+            if (!patch->remaining)
+                patch->state = STATE_OP;
+            break;
+        }
+
+        case STATE_OP:
+            patch->value = 0;
+            switch (*data++)
+            {
+            case DELTA_PATCH_OP_END:
+                if ((result = flush(patch)))
+                    return result;
+                if (patch->written != patch->header.target_length)
+                    return DELTA_PATCH_ERROR_LENGTH;
+                patch->state = STATE_DONE;
+                return DELTA_PATCH_COMPLETE;
+            case DELTA_PATCH_OP_ADD:
+                patch->state = STATE_ADD_LENGTH;
+                break;
+            case DELTA_PATCH_OP_COPY:
+                patch->state = STATE_COPY_OFFSET;
+                break;
+            default:
+                return DELTA_PATCH_ERROR_FORMAT;
+            }
+            break;
+
+        case STATE_ADD_LENGTH:
+            if ((result = decode(patch, *data++)) > 0)
+            {
+                if ((result = reserve(patch, patch->value)))
+                    return result;
+                patch->remaining = patch->value;
+                patch->state = patch->remaining ? STATE_ADD_DATA : STATE_OP;
+            }
+            break;
+
+        case STATE_ADD_DATA:
+        {
+            uint32_t count = end - data;
+            if (count > patch->remaining)
+                count = patch->remaining;
+            if ((result = add(patch, data, count)))
+                return result;
+            data += count;
+            patch->remaining -= count;
+            if (!patch->remaining)
+                patch->state = STATE_OP;
+            break;
+        }
+
+        case STATE_COPY_OFFSET:
+            if ((result = decode(patch, *data++)) > 0)
+            {
+                patch->offset = patch->value;
+                patch->value = 0;
+                patch->state = STATE_COPY_LENGTH;
+            }
+            break;
+
+        case STATE_COPY_LENGTH:
+            if ((result = decode(patch, *data++)) > 0)
+            {
+                if ((result = copy(patch, patch->offset, patch->value)))
+                    return result;
+                patch->state = STATE_OP;
+            }
+            break;
+
+        case STATE_DONE:
+            return DELTA_PATCH_COMPLETE;
+
+        default:
+            return DELTA_PATCH_ERROR_FORMAT;
+        }
+        if (result < 0)
+            return result;
+    }
+    return patch->state == STATE_DONE ? DELTA_PATCH_COMPLETE : 0;
+}
+
+int delta_patch_update(delta_patch* patch, const uint8_t* data, uint32_t length)
+{
+    if (patch->state == STATE_ERROR)
+        return DELTA_PATCH_ERROR_FORMAT;
+    int result = update(patch, data, length);
+    if (result < 0)
+        patch->state = STATE_ERROR;
+    return result;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "flash_copy.h"
+#include <string.h>
+
+static inline uint32_t min_u32(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+/**
+ * The block size used with a buffer, kept word aligned for devices that program words.
+ */
+static inline uint32_t block_size(uint32_t buffer_size)
+{
+    return (buffer_size / 2) & ~3u;
+}
+
+static int read_sync(const flash_io* io)
+{
+    return (io->sync && io->sync(io)) ? FLASH_COPY_ERROR_READ : 0;
+}
+
+static int read_begin(const flash_io* io, uint32_t address, uint8_t* data, uint32_t length)
+{
+    return io->read(io, address, data, length) ? FLASH_COPY_ERROR_READ : 0;
+}
+
+/**
+ * Programs a range that doesn't cross a destination sector.
+ */
+static int copy_range(const flash_io* src, uint32_t src_address, const flash_io* dst, uint32_t dst_address,
+        uint32_t length, uint8_t* buffer, uint32_t block)
+{
+    if (src->map)
+    {
+        const uint8_t* data = src->map(src, src_address);
+        if (!data)
+            return FLASH_COPY_ERROR_READ;
+        return dst->write(dst, dst_address, data, length) ? FLASH_COPY_ERROR_WRITE : 0;
+    }
+
+    uint8_t* current = buffer;
+    uint8_t* next = buffer + block;
+    uint32_t count = min_u32(block, length);
+    int error = read_begin(src, src_address, current, count);
+    while (!error && length)
+    {
+        error = read_sync(src);
+        if (error)
+            break;
+        uint32_t next_count = min_u32(block, length - count);
+        // the next read proceeds while the current block is programmed
+        if (next_count && (error = read_begin(src, src_address + count, next, next_count)))
+            break;
+        if (dst->write(dst, dst_address, current, count))
+        {
+            if (next_count)
+                read_sync(src);
+            error = FLASH_COPY_ERROR_WRITE;
+            break;
+        }
+        src_address += count;
+        dst_address += count;
+        length -= count;
+        count = next_count;
+        uint8_t* swap = current;
+        current = next;
+        next = swap;
+    }
+    return error;
+}
+
+static inline int sector_changed(uint32_t changed, unsigned sector)
+{
+    return sector >= FLASH_COPY_MAX_SECTORS || (changed & (1u << sector));
+}
+
+int flash_copy_sectors(const flash_io* src, uint32_t src_address, const flash_io* dst, uint32_t dst_address,
+        uint32_t length, uint8_t* buffer, uint32_t buffer_size, uint32_t changed)
+{
+    uint32_t block = block_size(buffer_size);
+    if (!src->map && !block)
+        return FLASH_COPY_ERROR_ARGUMENT;
+
+    for (unsigned sector = 0; length; sector++)
+    {
+        uint32_t end = dst->sector_end(dst, dst_address);
+        if (end <= dst_address)
+            return FLASH_COPY_ERROR_ARGUMENT;
+        uint32_t count = min_u32(end - dst_address, length);
+
+        if (sector_changed(changed, sector))
+        {
+            if (dst->erase(dst, dst_address))
+                return FLASH_COPY_ERROR_ERASE;
+
+            int error = copy_range(src, src_address, dst, dst_address, count, buffer, block);
+            if (error)
+                return error;
+        }
+
+        src_address += count;
+        dst_address += count;
+        length -= count;
+    }
+    return 0;
+}
+
+int flash_copy(const flash_io* src, uint32_t src_address, const flash_io* dst, uint32_t dst_address,
+        uint32_t length, uint8_t* buffer, uint32_t buffer_size)
+{
+    return flash_copy_sectors(src, src_address, dst, dst_address, length, buffer, buffer_size, 0xFFFFFFFF);
+}
+
+/**
+ * Retrieves a block of a device, either mapped or read into the buffer.
+ */
+static const uint8_t* fetch(const flash_io* io, uint32_t address, uint8_t* buffer, uint32_t length, int* error)
+{
+    if (io->map)
+    {
+        const uint8_t* data = io->map(io, address);
+        if (!data)
+            *error = FLASH_COPY_ERROR_READ;
+        return data;
+    }
+    if ((*error = read_begin(io, address, buffer, length)) || (*error = read_sync(io)))
+        return NULL;
+    return buffer;
+}
+
+int flash_compare(const flash_io* a, uint32_t a_address, const flash_io* b, uint32_t b_address,
+        uint32_t length, uint8_t* buffer, uint32_t buffer_size)
+{
+    uint32_t block = block_size(buffer_size);
+    if (a->map && b->map)
+        block = length;
+    if (!block)
+        return FLASH_COPY_ERROR_ARGUMENT;
+
+    while (length)
+    {
+        uint32_t count = min_u32(block, length);
+        int error = 0;
+        const uint8_t* a_data = fetch(a, a_address, buffer, count, &error);
+        const uint8_t* b_data = a_data ? fetch(b, b_address, buffer + block, count, &error) : NULL;
+        if (!b_data)
+            return error;
+        if (memcmp(a_data, b_data, count))
+            return FLASH_COPY_MISMATCH;
+        a_address += count;
+        b_address += count;
+        length -= count;
+    }
+    return 0;
+}
+
+int flash_copy_scan(const flash_io* src, uint32_t src_address, const flash_io* dst, uint32_t dst_address,
+        uint32_t length, uint8_t* buffer, uint32_t buffer_size,
+        flash_copy_observer observer, void* context, uint32_t* changed)
+{
+    uint32_t block = block_size(buffer_size);
+    if ((!src->map || !dst->map) && !block)
+        return FLASH_COPY_ERROR_ARGUMENT;
+
+    *changed = 0;
+    uint32_t offset = 0;
+    for (unsigned sector = 0; length; sector++)
+    {
+        uint32_t end = dst->sector_end(dst, dst_address);
+        if (end <= dst_address)
+            return FLASH_COPY_ERROR_ARGUMENT;
+        uint32_t remaining = min_u32(end - dst_address, length);
+        int differs = 0;
+
+        while (remaining)
+        {
+            uint32_t count = (src->map && dst->map) ? remaining : min_u32(block, remaining);
+            int error = 0;
+            const uint8_t* data = fetch(src, src_address, buffer, count, &error);
+            if (!data)
+                return error;
+            if (observer)
+                observer(context, offset, data, count);
+            // once the sector is known to differ, only the source is needed
+            if (!differs)
+            {
+                const uint8_t* existing = fetch(dst, dst_address, buffer + block, count, &error);
+                if (!existing)
+                    return error;
+                differs = memcmp(data, existing, count) != 0;
+            }
+            src_address += count;
+            dst_address += count;
+            offset += count;
+            length -= count;
+            remaining -= count;
+        }
+
+        if (differs && sector < FLASH_COPY_MAX_SECTORS)
+            *changed |= 1u << sector;
+    }
+    return 0;
+}
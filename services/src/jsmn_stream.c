@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "jsmn_stream.h"
+
+/**
+ * What the parser expects to see next.
+ */
+enum {
+    STATE_VALUE,            /* a value */
+    STATE_VALUE_OR_END,     /* a value or ']', following '[' */
+    STATE_KEY,              /* a key, following ',' in an object */
+    STATE_KEY_OR_END,       /* a key or '}', following '{' */
+    STATE_COLON,            /* ':', following a key */
+    STATE_NEXT,             /* ',' or a closing bracket, following a value */
+    STATE_DONE              /* the top-level value is complete */
+};
+
+/**
+ * Returns the next input character without consuming it, or -1 at the end of the input.
+ */
+static int jsmn_stream_peek(jsmn_stream_parser* parser) {
+    if (parser->chunk_pos >= parser->chunk_len) {
+        int len = 0;
+        if (!parser->eof && parser->read) {
+            len = parser->read(parser->read_state, parser->chunk, parser->chunk_size);
+        }
+        if (len <= 0) {
+            parser->eof = 1;
+            return -1;
+        }
+        parser->chunk_len = len;
+        parser->chunk_pos = 0;
+    }
+    char c = parser->chunk[parser->chunk_pos];
+    return c ? (unsigned char)c : -1;
+}
+
+static void jsmn_stream_advance(jsmn_stream_parser* parser) {
+    parser->chunk_pos++;
+}
+
+/**
+ * Appends a character to the current token value, truncating when the value buffer is full.
+ */
+static void jsmn_stream_append(jsmn_stream_parser* parser, jsmn_stream_token* token, char c) {
+    if (token->length + 1 < parser->value_size) {
+        parser->value[token->length] = c;
+    }
+    else {
+        token->truncated = 1;
+    }
+    token->length++;
+}
+
+static void jsmn_stream_begin_value(jsmn_stream_parser* parser, jsmn_stream_token* token, jsmntype_t type) {
+    token->type = type;
+    token->key = 0;
+    token->end = 0;
+    token->truncated = 0;
+    token->depth = parser->depth;
+    token->length = 0;
+}
+
+static void jsmn_stream_end_value(jsmn_stream_parser* parser, jsmn_stream_token* token) {
+    if (parser->value_size) {
+        size_t len = token->truncated ? parser->value_size - 1 : token->length;
+        parser->value[len] = 0;
+    }
+}
+
+static int jsmn_stream_is_hex(int c) {
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f');
+}
+
+/**
+ * Parses a string. The opening quote has already been consumed.
+ */
+static int jsmn_stream_parse_string(jsmn_stream_parser* parser, jsmn_stream_token* token) {
+    jsmn_stream_begin_value(parser, token, JSMN_STRING);
+    for (;;) {
+        int c = jsmn_stream_peek(parser);
+        if (c < 0) {
+            return JSMN_ERROR_PART;
+        }
+        jsmn_stream_advance(parser);
+        if (c == '\"') {
+            break;
+        }
+        jsmn_stream_append(parser, token, c);
+        if (c == '\\') {
+            c = jsmn_stream_peek(parser);
+            if (c < 0) {
+                return JSMN_ERROR_PART;
+            }
+            switch (c) {
+                case '\"': case '/' : case '\\' : case 'b' :
+                case 'f' : case 'r' : case 'n'  : case 't' :
+                    jsmn_stream_advance(parser);
+                    jsmn_stream_append(parser, token, c);
+                    break;
+                case 'u': {
+                    int i;
+                    jsmn_stream_advance(parser);
+                    jsmn_stream_append(parser, token, c);
+                    for (i = 0; i < 4; i++) {
+                        c = jsmn_stream_peek(parser);
+                        if (c < 0) {
+                            return JSMN_ERROR_PART;
+                        }
+                        if (!jsmn_stream_is_hex(c)) {
+                            return JSMN_ERROR_INVAL;
+                        }
+                        jsmn_stream_advance(parser);
+                        jsmn_stream_append(parser, token, c);
+                    }
+                    break;
+                }
+                default:
+                    return JSMN_ERROR_INVAL;
+            }
+        }
+    }
+    jsmn_stream_end_value(parser, token);
+    return 0;
+}
+
+/**
+ * Parses a number, boolean or null. The first character has not been consumed.
+ */
+static int jsmn_stream_parse_primitive(jsmn_stream_parser* parser, jsmn_stream_token* token) {
+    jsmn_stream_begin_value(parser, token, JSMN_PRIMITIVE);
+    for (;;) {
+        int c = jsmn_stream_peek(parser);
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+            case ':':
+            case '\t' : case '\r' : case '\n' : case ' ' :
+            case ','  : case ']'  : case '}' :
+                goto found;
+        }
+        if (c < 32 || c >= 127) {
+            return JSMN_ERROR_INVAL;
+        }
+        jsmn_stream_advance(parser);
+        jsmn_stream_append(parser, token, c);
+    }
+found:
+    jsmn_stream_end_value(parser, token);
+    return 0;
+}
+
+static uint8_t jsmn_stream_after_value(jsmn_stream_parser* parser) {
+    return parser->depth ? STATE_NEXT : STATE_DONE;
+}
+
+static int jsmn_stream_in_object(jsmn_stream_parser* parser) {
+    return (parser->objects >> (parser->depth - 1)) & 1;
+}
+
+void jsmn_stream_init(jsmn_stream_parser* parser, char* chunk, size_t chunk_size, char* value, size_t value_size,
+        jsmn_stream_read_fn read, void* read_state, void* reserved) {
+    parser->size = sizeof(*parser);
+    parser->state = STATE_VALUE;
+    parser->depth = 0;
+    parser->objects = 0;
+    parser->read = read;
+    parser->read_state = read_state;
+    parser->chunk = chunk;
+    parser->chunk_size = chunk_size;
+    parser->chunk_len = 0;
+    parser->chunk_pos = 0;
+    parser->value = value;
+    parser->value_size = value_size;
+    parser->eof = 0;
+}
+
+int jsmn_stream_next(jsmn_stream_parser* parser, jsmn_stream_token* token, void* reserved) {
+    for (;;) {
+        int c = jsmn_stream_peek(parser);
+        if (c < 0) {
+            return parser->state == STATE_DONE ? 0 : JSMN_ERROR_PART;
+        }
+        switch (c) {
+            case '\t' : case '\r' : case '\n' : case ' ':
+                jsmn_stream_advance(parser);
+                continue;
+        }
+        if (parser->state == STATE_DONE) {
+            return JSMN_ERROR_INVAL;
+        }
+        switch (c) {
+            case '{': case '[':
+                if (parser->state != STATE_VALUE && parser->state != STATE_VALUE_OR_END) {
+                    return JSMN_ERROR_INVAL;
+                }
+                if (parser->depth >= JSMN_STREAM_MAX_DEPTH) {
+                    return JSMN_ERROR_NOMEM;
+                }
+                jsmn_stream_advance(parser);
+                jsmn_stream_begin_value(parser, token, c == '{' ? JSMN_OBJECT : JSMN_ARRAY);
+                if (c == '{') {
+                    parser->objects |= (1u << parser->depth);
+                    parser->state = STATE_KEY_OR_END;
+                }
+                else {
+                    parser->objects &= ~(1u << parser->depth);
+                    parser->state = STATE_VALUE_OR_END;
+                }
+                parser->depth++;
+                return 1;
+
+            case '}': case ']': {
+                jsmntype_t type = (c == '}') ? JSMN_OBJECT : JSMN_ARRAY;
+                if (!parser->depth || jsmn_stream_in_object(parser) != (type == JSMN_OBJECT)) {
+                    return JSMN_ERROR_INVAL;
+                }
+                if (parser->state != STATE_NEXT &&
+                        !(type == JSMN_OBJECT && parser->state == STATE_KEY_OR_END) &&
+                        !(type == JSMN_ARRAY && parser->state == STATE_VALUE_OR_END)) {
+                    return JSMN_ERROR_INVAL;
+                }
+                jsmn_stream_advance(parser);
+                parser->depth--;
+                jsmn_stream_begin_value(parser, token, type);
+                token->end = 1;
+                parser->state = jsmn_stream_after_value(parser);
+                return 1;
+            }
+
+            case ':':
+                if (parser->state != STATE_COLON) {
+                    return JSMN_ERROR_INVAL;
+                }
+                jsmn_stream_advance(parser);
+                parser->state = STATE_VALUE;
+                continue;
+
+            case ',':
+                if (parser->state != STATE_NEXT) {
+                    return JSMN_ERROR_INVAL;
+                }
+                jsmn_stream_advance(parser);
+                parser->state = jsmn_stream_in_object(parser) ? STATE_KEY : STATE_VALUE;
+                continue;
+
+            case '\"': {
+                int key = (parser->state == STATE_KEY || parser->state == STATE_KEY_OR_END);
+                if (!key && parser->state != STATE_VALUE && parser->state != STATE_VALUE_OR_END) {
+                    return JSMN_ERROR_INVAL;
+                }
+                jsmn_stream_advance(parser);
+                int r = jsmn_stream_parse_string(parser, token);
+                if (r < 0) {
+                    return r;
+                }
+                token->key = key;
+                parser->state = key ? STATE_COLON : jsmn_stream_after_value(parser);
+                return 1;
+            }
+
+            default: {
+                if (parser->state != STATE_VALUE && parser->state != STATE_VALUE_OR_END) {
+                    return JSMN_ERROR_INVAL;
+                }
+                int r = jsmn_stream_parse_primitive(parser, token);
+                if (r < 0) {
+                    return r;
+                }
+                parser->state = jsmn_stream_after_value(parser);
+                return 1;
+            }
+        }
+    }
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lazy_erase.h"
+
+#define LAZY_ERASE_MAGIC 0x4C5A4552
+
+static uint32_t region_check(const lazy_erase* region)
+{
+    return LAZY_ERASE_MAGIC ^ region->address ^ (region->length << 1) ^ (region->erased * 0x9E3779B1u);
+}
+
+static void mark_erased(lazy_erase* region, unsigned index)
+{
+    region->erased |= 1u << index;
+    region->check = region_check(region);
+}
+
+/**
+ * Determines if a sector is already erased, for devices that are memory mapped.
+ */
+static int is_blank(const flash_io* io, uint32_t address, uint32_t end)
+{
+    const uint8_t* data = io->map ? io->map(io, address) : NULL;
+    if (!data)
+        return 0;
+    for (; address < end; address++)
+    {
+        if (*data++ != 0xFF)
+            return 0;
+    }
+    return 1;
+}
+
+int lazy_erase_begin(lazy_erase* region, const flash_io* io, uint32_t address, uint32_t length)
+{
+    region->address = address;
+    region->length = length;
+    region->erased = 0;
+    region->check = ~region_check(region);
+
+    uint32_t end = address + length;
+    unsigned index = 0;
+    for (uint32_t sector = address; sector < end; index++)
+    {
+        uint32_t next = io->sector_end(io, sector);
+        if (next <= sector)
+            return FLASH_COPY_ERROR_ARGUMENT;
+        if (index >= LAZY_ERASE_MAX_SECTORS && io->erase(io, sector))
+            return FLASH_COPY_ERROR_ERASE;
+        sector = next;
+    }
+    region->check = region_check(region);
+    return 0;
+}
+
+int lazy_erase_prepare(lazy_erase* region, const flash_io* io, uint32_t address, uint32_t length)
+{
+    if (region->check != region_check(region))
+        return FLASH_COPY_ERROR_ARGUMENT;
+
+    uint32_t end = address + length;
+    uint32_t region_end = region->address + region->length;
+    uint32_t sector = region->address;
+    for (unsigned index = 0; index < LAZY_ERASE_MAX_SECTORS && sector < region_end && sector < end; index++)
+    {
+        uint32_t next = io->sector_end(io, sector);
+        if (next <= sector)
+            return FLASH_COPY_ERROR_ARGUMENT;
+        if (next > address && !(region->erased & (1u << index)))
+        {
+            if (!is_blank(io, sector, next) && io->erase(io, sector))
+                return FLASH_COPY_ERROR_ERASE;
+            mark_erased(region, index);
+        }
+        sector = next;
+    }
+    return 0;
+}
+
+int lazy_erase_is_valid(const lazy_erase* region, uint32_t address, uint32_t length)
+{
+    return region->check == region_check(region) && region->address == address && region->length == length;
+}
+
+void lazy_erase_clear(lazy_erase* region)
+{
+    region->erased = 0;
+    region->check = ~region_check(region);
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lzss.h"
+#include <string.h>
+
+enum {
+    STATE_HEADER,
+    STATE_SKIP_HEADER,      /* fields of a later version this one doesn't know */
+    STATE_FLAGS,
+    STATE_ITEM,
+    STATE_MATCH,
+    STATE_DONE,
+    STATE_ERROR
+};
+
+static uint32_t read_u32(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t read_u16(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+int lzss_is_compressed(const uint8_t* data, uint32_t length)
+{
+    return length >= 4 && read_u32(data) == LZSS_MAGIC;
+}
+
+int lzss_parse_header(const uint8_t* data, uint32_t length, lzss_header* header)
+{
+    if (length < LZSS_HEADER_SIZE || !lzss_is_compressed(data, length))
+        return LZSS_ERROR_FORMAT;
+    header->magic = read_u32(data);
+    header->version = data[4];
+    header->window_bits = data[5];
+    header->header_size = read_u16(data + 6);
+    header->length = read_u32(data + 8);
+    if (header->version != LZSS_VERSION || header->header_size < LZSS_HEADER_SIZE ||
+            header->window_bits < LZSS_MIN_WINDOW_BITS || header->window_bits > LZSS_MAX_WINDOW_BITS)
+        return LZSS_ERROR_FORMAT;
+    return 0;
+}
+
+void lzss_decoder_init(lzss_decoder* decoder, uint8_t* window, uint32_t window_size,
+        uint8_t* buffer, uint32_t buffer_size, lzss_write_fn write, void* context)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->size = sizeof(*decoder);
+    decoder->state = STATE_HEADER;
+    decoder->remaining = LZSS_HEADER_SIZE;
+    decoder->window = window;
+    decoder->window_size = window_size;
+    decoder->buffer = buffer;
+    decoder->buffer_size = buffer_size;
+    decoder->write = write;
+    decoder->context = context;
+}
+
+static int flush(lzss_decoder* decoder)
+{
+    if (!decoder->buffer_length)
+        return 0;
+    if (decoder->write(decoder->context, decoder->written, decoder->buffer, decoder->buffer_length))
+        return LZSS_ERROR_WRITE;
+    decoder->written += decoder->buffer_length;
+    decoder->buffer_length = 0;
+    return 0;
+}
+
+/**
+ * Appends a byte to the image.
+ * @return LZSS_COMPLETE when this is the last byte, otherwise 0 or an error.
+ */
+static inline int put(lzss_decoder* decoder, uint8_t b)
+{
+    decoder->window[decoder->expanded++ & decoder->mask] = b;
+    decoder->buffer[decoder->buffer_length++] = b;
+    if (decoder->expanded == decoder->header.length)
+    {
+        int error = flush(decoder);
+        if (error)
+            return error;
+        decoder->state = STATE_DONE;
+        return LZSS_COMPLETE;
+    }
+    return decoder->buffer_length == decoder->buffer_size ? flush(decoder) : 0;
+}
+
+static int match(lzss_decoder* decoder, uint16_t value)
+{
+    uint32_t distance = (value & decoder->mask) + 1;
+    uint32_t length = (value >> decoder->header.window_bits) + LZSS_MIN_MATCH;
+    if (distance > decoder->expanded)
+        return LZSS_ERROR_FORMAT;
+    if (length > decoder->header.length - decoder->expanded)
+        return LZSS_ERROR_LENGTH;
+    int result = 0;
+    while (length-- && !result)
+        result = put(decoder, decoder->window[(decoder->expanded - distance) & decoder->mask]);
+    return result;
+}
+
+static int begin(lzss_decoder* decoder)
+{
+    if (lzss_parse_header(decoder->header_data, LZSS_HEADER_SIZE, &decoder->header))
+        return LZSS_ERROR_FORMAT;
+    uint32_t window = 1u << decoder->header.window_bits;
+    if (window > decoder->window_size || !decoder->buffer_size)
+        return LZSS_ERROR_WINDOW;
+    decoder->mask = window - 1;
+    decoder->remaining = decoder->header.header_size - LZSS_HEADER_SIZE;
+    decoder->state = STATE_SKIP_HEADER;
+    return 0;
+}
+
+static int update(lzss_decoder* decoder, const uint8_t* data, uint32_t length)
+{
+    const uint8_t* end = data + length;
+    int result = 0;
+    while (data < end && !result)
+    {
+        switch (decoder->state)
+        {
+        case STATE_HEADER:
+        {
+            uint32_t count = end - data;
+            if (count > decoder->remaining)
+                count = decoder->remaining;
+            memcpy(decoder->header_data + LZSS_HEADER_SIZE - decoder->remaining, data, count);
+            data += count;
+            decoder->remaining -= count;
+            if (!decoder->remaining)
+                result = begin(decoder);
+            break;
+        }
+
+        case STATE_SKIP_HEADER:
+        {
+            uint32_t count = end - data;
+            if (count > decoder->remaining)
+                count = decoder->remaining;
+            data += count;
+            decoder->remaining -= count;
+            break;
+        }
+
+        case STATE_FLAGS:
+            decoder->flags = *data++;
+            decoder->items = 8;
+            decoder->state = STATE_ITEM;
+            break;
+
+        case STATE_ITEM:
+        {
+            uint8_t literal = decoder->flags & 1;
+            decoder->flags >>= 1;
+            decoder->items--;
+            if (literal)
+            {
+                result = put(decoder, *data++);
+                if (decoder->state == STATE_ITEM && !decoder->items)
+                    decoder->state = STATE_FLAGS;
+            }
+            else
+            {
+                decoder->token = *data++;
+                decoder->state = STATE_MATCH;
+            }
+            break;
+        }
+
+        case STATE_MATCH:
+            decoder->state = decoder->items ? STATE_ITEM : STATE_FLAGS;
+            result = match(decoder, decoder->token | (*data++ << 8));
+            break;
+
+        case STATE_DONE:
+            return LZSS_COMPLETE;
+
+        default:
+            return LZSS_ERROR_FORMAT;
+        }
+
+        // the header may be all there is
+        if (!result && decoder->state == STATE_SKIP_HEADER && !decoder->remaining)
+        {
+            decoder->state = STATE_FLAGS;
+            if (!decoder->header.length)
+            {
+                decoder->state = STATE_DONE;
+                result = LZSS_COMPLETE;
+            }
+        }
+    }
+    return result;
+}
+
+int lzss_decoder_update(lzss_decoder* decoder, const uint8_t* data, uint32_t length)
+{
+    if (decoder->state == STATE_ERROR)
+        return LZSS_ERROR_FORMAT;
+    int result = update(decoder, data, length);
+    if (result < 0)
+        decoder->state = STATE_ERROR;
+    return result;
+}
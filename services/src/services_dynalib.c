@@ -24,6 +24,7 @@
 #include "rgbled.h"
 #include "debug.h"
 #include "jsmn.h"
+#include "jsmn_stream.h"
 #include "logging.h"
 #include "services_dynalib.h"
 
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platforms.h"
+
+/**
+ * Chunks are written from a thread of their own where threads are available.
+ */
+#ifndef OTA_CHUNK_WRITER
+#define OTA_CHUNK_WRITER (PLATFORM_THREADING || PLATFORM_ID==PLATFORM_GCC)
+#endif
+
+// The number of chunks that can be waiting to be written
+#define OTA_CHUNK_WRITER_SLOTS 4
+
+#if OTA_CHUNK_WRITER
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+/**
+ * Writes the chunks of an update from a thread of its own, so that receiving the next
+ * chunk isn't held up while the last is programmed. Chunks are copied to a bounded queue;
+ * once the queue is full, queuing a chunk waits for the oldest to be written.
+ *
+ * A failed write is reported by the writes that follow and by flush().
+ *
+ * The writer thread is started by the first begin() and then kept for the updates that
+ * follow, idle between them, since threads on the devices can't be joined. It only exits
+ * when the writer is destroyed.
+ */
+class ChunkWriter
+{
+public:
+    /**
+     * @return 0 on success.
+     */
+    typedef int (*write_fn)(void* context, uint32_t address, const uint8_t* data, uint32_t length);
+
+    /**
+     * Called from the writer thread once a queued chunk has been written.
+     */
+    typedef void (*written_fn)(void* context);
+
+    ChunkWriter(write_fn write, void* context, written_fn written=NULL);
+    ~ChunkWriter();
+
+    /**
+     * Allocates the queue, and starts the writer thread if it isn't already running.
+     * @param slot_size     The largest chunk that is queued. Larger chunks are written directly.
+     * @return false if the queue couldn't be allocated, in which case chunks are written directly.
+     */
+    bool begin(size_t slots, size_t slot_size);
+
+    /**
+     * Queues a chunk to be written.
+     * @return 0, or the result of the first write that failed.
+     */
+    int write(uint32_t address, const uint8_t* data, uint32_t length);
+
+    /**
+     * Waits for the chunks queued to be written and reported.
+     * @return 0 if all chunks were written.
+     */
+    int flush();
+
+    /**
+     * Writes the chunks queued and frees the queue. The writer thread waits idle for the next update.
+     * @return 0 if all chunks were written.
+     */
+    int end();
+
+    /**
+     * Clears the bits of a chunk bitmap for the chunks still waiting to be written,
+     * so that only chunks in flash are recorded as received.
+     * @param address   The address of the first chunk in the bitmap.
+     */
+    void clear_pending(uint32_t address, uint32_t chunk_size, uint8_t* bitmap, size_t bitmap_size);
+
+    bool is_active() const
+    {
+        return slot_count;
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t address;
+        uint32_t length;
+    };
+
+    void run();
+    int write_result(int result);
+
+    write_fn write_chunk;
+    void* context;
+    written_fn chunk_written;
+
+    std::unique_ptr<uint8_t[]> buffer;
+    std::unique_ptr<Slot[]> slots;
+    size_t slot_count;
+    size_t slot_size;
+    size_t head;            // the next slot written
+    size_t queued;          // the slots waiting, including the one being written
+    bool reporting;         // a write is being reported to chunk_written
+    bool exiting;
+    int result;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread thread;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "platforms.h"
+
+#if PLATFORM_ID==PLATFORM_GCC
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class FleetDevice;
+
+/**
+ * A fleet of simulated devices run in this process. Each subdirectory of the
+ * configured fleet directory that is named after a device ID is one device, and holds
+ * that device's private key (device_key.der) and optionally its eeprom (eeprom.bin).
+ *
+ * Every device has its own HAL state and keeps its own cloud session using the
+ * configured protocol.
+ */
+class Fleet
+{
+    std::vector<std::unique_ptr<FleetDevice>> devices;
+
+public:
+    Fleet();
+    ~Fleet();
+
+    /**
+     * Loads the devices in the fleet directory. Devices whose key cannot be read are skipped.
+     * The server key, protocol and socket count of this process are used for every device.
+     * @return The number of devices loaded.
+     */
+    size_t load(const std::string& directory);
+
+    /**
+     * Runs each device's cloud session for a single iteration on the calling thread.
+     * @return true if any device did any work.
+     */
+    bool poll();
+
+    /**
+     * Shares the devices out between worker threads that run them. Doesn't return.
+     * @param thread_count  The number of threads, 0 for one per core.
+     */
+    void run(unsigned thread_count);
+};
+
+/**
+ * Runs the fleet configured for this process in place of the application.
+ * @return false when no fleet is configured. Otherwise the function returns only
+ *  when no devices were found.
+ */
+bool system_fleet_run();
+
+#endif
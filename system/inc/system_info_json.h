@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM_INFO_JSON_H
+#define SYSTEM_INFO_JSON_H
+
+#include "appender.h"
+#include "ota_flash_hal.h"
+#include "string_convert.h"
+#include <string.h>
+
+/**
+ * Writes JSON to an appender. The output is collected in a buffer and passed on
+ * a buffer at a time, rather than a call for each token; without a buffer each
+ * token is passed on as it is written.
+ *
+ * Once the appender refuses output, all further writes fail. Call flush() to
+ * pass on the remaining output and retrieve the overall result.
+ */
+class AppendJson
+{
+    appender_fn fn;
+    void* data;
+    char* buffer;
+    size_t size;
+    size_t length;      // of the output waiting in the buffer
+    bool ok;
+
+public:
+
+    AppendJson(appender_fn fn, void* data, char* buffer=NULL, size_t size=0) :
+        fn(fn), data(data), buffer(buffer), size(buffer ? size : 0), length(0), ok(true) {
+    }
+
+    ~AppendJson() {
+        flush();
+    }
+
+    bool write_quoted(const char* value) {
+        return write('"') &&
+               write(value) &&
+               write('"');
+    }
+
+    bool write_attribute(const char* name) {
+        return
+                write_quoted(name) &&
+                write(':');
+    }
+
+    bool write_string(const char* name, const char* value) {
+        return write_attribute(name) &&
+               write_quoted(value) &&
+               next();
+    }
+
+    bool newline() { return true; /*return write("\r\n");*/ }
+
+    bool write_value(const char* name, int value) {
+        char buf[12];
+        itoa(value, buf, 10);
+        return write_attribute(name) &&
+               write(buf) &&
+               next();
+    }
+
+    bool write_unsigned(unsigned value) {
+        char buf[11];
+        return write(utoa(value, buf, 10));
+    }
+
+    bool end_list() {
+        return write_attribute("_") &&
+               write_quoted("");
+    }
+
+    bool write(char c) {
+        if (length < size) {
+            buffer[length++] = c;
+            return ok;
+        }
+        return write(&c, 1);
+    }
+
+    bool write(const char* string) {
+        return write(string, strlen(string));
+    }
+
+    bool write(const char* string, size_t count) {
+        if (count > size - length) {
+            if (!flush())
+                return false;
+            if (count > size)
+                return ok = ok && fn(data, (const uint8_t*)string, count);
+        }
+        memcpy(buffer + length, string, count);
+        length += count;
+        return ok;
+    }
+
+    /**
+     * Passes on the output waiting in the buffer.
+     * @return {@code true} when all output was accepted by the appender.
+     */
+    bool flush() {
+        if (length) {
+            ok = ok && fn(data, (const uint8_t*)buffer, length);
+            length = 0;
+        }
+        return ok;
+    }
+
+    bool next() { return write(',') && newline(); }
+
+    bool write_key_values(size_t count, const key_value* key_values)
+    {
+        bool result = true;
+        while (count-->0) {
+            result = result && write_key_value(key_values++);
+        }
+        return result;
+    }
+
+    bool write_key_value(const key_value* kv)
+    {
+        return write_string(kv->key, kv->value);
+    }
+};
+
+/**
+ * The size of the buffer used by AppendJson when writing the system info.
+ */
+const size_t SYSTEM_INFO_JSON_BUFFER_SIZE = 128;
+
+/**
+ * Writes the platform, key values and modules of the system info.
+ */
+bool system_info_to_json(AppendJson& json, const hal_system_info_t& system);
+
+/**
+ * Writes the system info through a buffered writer.
+ */
+bool system_info_to_json(appender_fn append, void* append_data, const hal_system_info_t& system);
+
+#endif  /* SYSTEM_INFO_JSON_H */
@@ -74,6 +74,13 @@ int Spark_Finish_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags,
  */
 int Spark_Save_Firmware_Chunk(FileTransfer::Descriptor& file, const uint8_t* chunk, void* reserved);
 
+/**
+ * Saves the progress of a firmware transfer to backup RAM. Only the chunks that have been
+ * written to flash are recorded as received.
+ * @return 0 on success.
+ */
+int system_save_transfer_progress(const void* progress, size_t length);
+
 typedef enum
 {
     /**
@@ -64,6 +64,7 @@ public:
         NAK = (0x15),   /* negative acknowledge */
         CA = (0x18),    /* two of these in succession aborts transfer */
         CRC16 = (0x43), /* 'C' == 0x43, request 16-bit CRC */
+        STREAM = (0x47), /* 'G' == 0x47, request 16-bit CRC and packets sent without waiting for ACK (YMODEM-G) */
 
         ABORT1 = (0x41), /* 'A' == 0x41, abort by user */
         ABORT2 = (0x61)  /* 'a' == 0x61, abort by user */
@@ -75,15 +76,43 @@ public:
         char file_size[FILE_SIZE_LENGTH];
     };
 
-    YModem(Stream& stream_) : stream(stream_)
+    /**
+     * @param streaming     Ask the sender to stream packets without waiting for each to be
+     *  acknowledged (YMODEM-G). Only for links that don't lose data, since a bad packet aborts
+     *  the transfer. Senders that don't stream send packets one at a time.
+     */
+    YModem(Stream& stream_, bool streaming_=false) : stream(stream_), streaming(streaming_), streamed(false), prepared(false)
     {
     }
 
     int32_t receive_file(FileTransfer::Descriptor& tx, file_desc_t& file_info);
 
+    /**
+     * Determines if the file was streamed by the sender.
+     */
+    bool is_streamed() const
+    {
+        return streamed;
+    }
+
+    /**
+     * Determines if the firmware update was started, and so must be finished.
+     */
+    bool is_prepared() const
+    {
+        return prepared;
+    }
+
+    /**
+     * Computes the CRC-16 (CCITT, initial value 0) that trails each packet.
+     */
+    static uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc=0);
+
 private:
     uint8_t packet_data[YModem::PACKET_1K_SIZE + YModem::PACKET_OVERHEAD];
     int32_t session_done, file_done, packets_received, errors, session_begin;
+    bool streaming, streamed, prepared;
+    uint8_t requested;      // the last request sent for a file packet, CRC16 or STREAM
 
     /**
      * @brief  Receive byte from sender
@@ -94,6 +123,21 @@ private:
      */
     int32_t receive_byte(uint8_t& c, uint32_t timeout);
 
+    /**
+     * @brief  Receive bytes from sender, reading all that are available at once
+     * @param  data: Where the bytes are stored
+     * @param  length: The number of bytes to receive
+     * @param  timeout: The longest wait for more bytes to arrive
+     * @retval 0: Bytes received
+     *         -1: Timeout
+     */
+    int32_t receive_bytes(uint8_t* data, uint32_t length, uint32_t timeout);
+
+    /**
+     * @brief  Ask the sender for a file packet
+     */
+    void request_file();
+
     /**
      * @brief  Send a byte
      * @param  c: Character
@@ -38,6 +38,7 @@
 #include "system_threading.h"
 #include "system_user.h"
 #include "system_update.h"
+#include "system_fleet.h"
 #include "core_hal.h"
 #include "delay_hal.h"
 #include "syshealth_hal.h"
@@ -567,6 +568,11 @@ void system_part2_post_init()
  *******************************************************************************/
 void app_setup_and_loop(void)
 {
+#if PLATFORM_ID==PLATFORM_GCC
+    // a fleet of simulated devices runs in place of this device's application
+    if (system_fleet_run())
+        return;
+#endif
     system_part2_post_init();
     HAL_Core_Init();
     // We have running firmware, otherwise we wouldn't have gotten here
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ota_chunk_writer.h"
+
+#if OTA_CHUNK_WRITER
+
+#include <string.h>
+#include <new>
+
+ChunkWriter::ChunkWriter(write_fn write, void* context, written_fn written)
+    : write_chunk(write), context(context), chunk_written(written), slot_count(0), slot_size(0),
+      head(0), queued(0), reporting(false), exiting(false), result(0)
+{
+}
+
+ChunkWriter::~ChunkWriter()
+{
+    end();
+    if (thread.joinable())
+    {
+        // only reached on the host, since the devices' writers are never destroyed
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            exiting = true;
+            changed.notify_all();
+        }
+        thread.join();
+    }
+}
+
+bool ChunkWriter::begin(size_t count, size_t size)
+{
+    end();
+    result = 0;
+    if (!count || !size)
+        return false;
+    buffer.reset(new (std::nothrow) uint8_t[count*size]);
+    slots.reset(new (std::nothrow) Slot[count]);
+    if (!buffer || !slots)
+    {
+        buffer.reset();
+        slots.reset();
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        slot_size = size;
+        head = 0;
+        queued = 0;
+        slot_count = count;
+    }
+    if (!thread.joinable())
+        thread = std::thread(&ChunkWriter::run, this);
+    return true;
+}
+
+int ChunkWriter::write_result(int written)
+{
+    if (written && !result)
+        result = written;
+    return result;
+}
+
+int ChunkWriter::write(uint32_t address, const uint8_t* data, uint32_t length)
+{
+    if (!is_active())
+        return write_chunk(context, address, data, length);
+
+    if (length>slot_size)
+    {
+        // too big to queue, so written in turn once the chunks before it are
+        if (flush())
+            return result;
+        int written = write_chunk(context, address, data, length);
+        std::lock_guard<std::mutex> guard(lock);
+        return write_result(written);
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this]{ return queued<slot_count || result; });
+    if (result)
+        return result;
+    size_t index = (head+queued) % slot_count;
+    slots[index].address = address;
+    slots[index].length = length;
+    memcpy(&buffer[index*slot_size], data, length);
+    queued++;
+    changed.notify_all();
+    return 0;
+}
+
+int ChunkWriter::flush()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this]{ return !queued && !reporting; });
+    return result;
+}
+
+void ChunkWriter::clear_pending(uint32_t address, uint32_t chunk_size, uint8_t* bitmap, size_t bitmap_size)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (!slot_count || !chunk_size)
+        return;
+    for (size_t i=0; i<queued; i++)
+    {
+        const Slot& slot = slots[(head+i) % slot_count];
+        if (slot.address<address || (slot.address-address) % chunk_size)
+            continue;
+        uint32_t index = (slot.address-address) / chunk_size;
+        if (index < bitmap_size*8)
+            bitmap[index >> 3] &= ~uint8_t(1 << (index & 7));
+    }
+}
+
+int ChunkWriter::end()
+{
+    if (!is_active())
+        return result;
+    {
+        // the writer thread is idle once the queue is empty, so the queue can be freed
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this]{ return !queued && !reporting; });
+        slot_count = 0;
+    }
+    buffer.reset();
+    slots.reset();
+    return result;
+}
+
+void ChunkWriter::run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        changed.wait(guard, [this]{ return queued || exiting; });
+        if (!queued)
+            break;      // the writer is destroyed
+        // the slot stays queued while it's written, so the producer can't reuse it
+        Slot slot = slots[head];
+        const uint8_t* data = &buffer[head*slot_size];
+        int written = 0;
+        bool wrote = false;
+        if (!result)
+        {
+            guard.unlock();
+            written = write_chunk(context, slot.address, data, slot.length);
+            wrote = !written;
+            guard.lock();
+        }
+        write_result(written);
+        head = (head+1) % slot_count;
+        queued--;
+        changed.notify_all();
+        if (chunk_written && wrote)
+        {
+            reporting = true;
+            guard.unlock();
+            chunk_written(context);
+            guard.lock();
+            reporting = false;
+            changed.notify_all();
+        }
+    }
+}
+
+#endif
@@ -26,6 +26,7 @@
 #include "system_task.h"
 #include "system_threading.h"
 #include "system_user.h"
+#include "system_update.h"
 #include "spark_wiring_string.h"
 #include "spark_protocol_functions.h"
 #include "append_list.h"
@@ -35,6 +36,7 @@
 #include "product_store_hal.h"
 #include "rtc_hal.h"
 #include "socket_hal.h"
+#include "cellular_hal.h"
 #include "rgbled.h"
 #include "spark_macros.h"   // for S2M
 #include "string_convert.h"
@@ -424,6 +426,16 @@ int Spark_Receive(unsigned char *buf, uint32_t buflen, void* reserved)
     return spark_receive_last_bytes_received;
 }
 
+static_assert(int(SparkCallbacks::TRAFFIC_MESSAGES)==int(SOCKET_USAGE_CLOUD) && int(SparkCallbacks::TRAFFIC_HANDSHAKE)==int(SOCKET_USAGE_CLOUD_HANDSHAKE)
+        && int(SparkCallbacks::TRAFFIC_PING)==int(SOCKET_USAGE_CLOUD_PING) && int(SparkCallbacks::TRAFFIC_OTA)==int(SOCKET_USAGE_OTA), "traffic types match the socket usage");
+
+// Accounts the following cloud traffic to a subsystem
+void Spark_Traffic(uint8_t type, void* reserved)
+{
+    // the protocol traffic types match the socket usage
+    socket_set_usage(sparkSocket, type, NULL);
+}
+
 int numUserFunctions(void)
 {
     return funcs.size();
@@ -484,8 +496,36 @@ void SystemEvents(const char* name, const char* data)
 using particle::protocol::SessionPersistOpaque;
 using particle::protocol::SessionPersistData;
 
+using particle::protocol::KeepAlivePersistData;
+
+/**
+ * Identifies the network the keep-alive is learned on. On cellular this is the SIM,
+ * and so the carrier.
+ */
+uint32_t compute_keepalive_network()
+{
+	uint32_t network = 0;
+#if HAL_PLATFORM_CELLULAR
+	CellularDevice device;
+	if (!cellular_device_info(&device, nullptr))
+		network = HAL_Core_Compute_CRC32((const uint8_t*)device.iccid, strlen(device.iccid));
+#endif
+	return network;
+}
+
 int Spark_Save(const void* buffer, size_t length, uint8_t type, void* reserved)
 {
+	if (type==SparkCallbacks::PERSIST_KEEPALIVE && length==sizeof(KeepAlivePersistData))
+	{
+		KeepAlivePersistData keepalive;
+		memcpy(&keepalive, buffer, sizeof(keepalive));
+		keepalive.network = compute_keepalive_network();
+		return HAL_System_Backup_Save(KeepAlivePersistOffset, &keepalive, sizeof(keepalive), nullptr);
+	}
+	if (type==SparkCallbacks::PERSIST_TRANSFER)
+	{
+		return system_save_transfer_progress(buffer, length);
+	}
 	if (type==SparkCallbacks::PERSIST_SESSION)
 	{
 		static_assert(sizeof(SessionPersistOpaque::connection)>=sizeof(cloud_endpoint),"connection space in session is not large enough");
@@ -504,6 +544,21 @@ int Spark_Save(const void* buffer, size_t length, uint8_t type, void* reserved)
 int Spark_Restore(void* buffer, size_t max_length, uint8_t type, void* reserved)
 {
 	size_t length = 0;
+	if (type==SparkCallbacks::PERSIST_KEEPALIVE)
+	{
+		// intervals learned on another network don't apply
+		if (max_length<sizeof(KeepAlivePersistData) ||
+				HAL_System_Backup_Restore(KeepAlivePersistOffset, buffer, max_length, &length, nullptr) ||
+				((KeepAlivePersistData*)buffer)->network!=compute_keepalive_network())
+			length = 0;
+		return length;
+	}
+	if (type==SparkCallbacks::PERSIST_TRANSFER)
+	{
+		if (HAL_System_Backup_Restore(TransferPersistOffset, buffer, max_length, &length, nullptr))
+			length = 0;
+		return length;
+	}
 	int error = HAL_System_Backup_Restore(0, buffer, max_length, &length, nullptr);
 	if (error)
 		length = 0;
@@ -611,6 +666,7 @@ void Spark_Protocol_Init(void)
         callbacks.signal = Spark_Signal;
         callbacks.millis = HAL_Timer_Get_Milli_Seconds;
         callbacks.set_time = system_set_time;
+        callbacks.traffic = Spark_Traffic;
 
         SparkDescriptor descriptor;
         memset(&descriptor, 0, sizeof(descriptor));
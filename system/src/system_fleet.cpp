@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_fleet.h"
+
+#if PLATFORM_ID==PLATFORM_GCC
+
+#include "spark_protocol_functions.h"
+#include "fleet_hal.h"
+#include "deviceid_hal.h"
+#include "socket_hal.h"
+#include "inet_hal.h"
+#include "ota_flash_hal.h"
+#include "timer_hal.h"
+#include "delay_hal.h"
+#include "core_hal.h"
+#include "service_debug.h"
+#include <dirent.h>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <stdexcept>
+
+namespace {
+
+const uint16_t CLOUD_PORT_TCP = 5683;
+const uint16_t CLOUD_PORT_UDP = 5684;
+
+const system_tick_t RECONNECT_DELAY_MIN = 1000;
+const system_tick_t RECONNECT_DELAY_MAX = 60000;
+
+/**
+ * How long a worker sleeps when none of its devices received any data.
+ */
+const unsigned IDLE_SLEEP_MILLIS = 5;
+
+/**
+ * The handshake receives in a loop until the data arrives, so a short
+ * timeout is used to avoid spinning the worker thread.
+ */
+const system_tick_t HANDSHAKE_RECEIVE_TIMEOUT = 100;
+
+/**
+ * The device being run on this thread. The protocol callbacks have no context
+ * argument for TCP so they find their device here.
+ */
+thread_local FleetDevice* active_device = nullptr;
+
+/**
+ * Selects a device's HAL state on the calling thread for the lifetime of this object.
+ */
+class DeviceSelection
+{
+    hal_fleet_device_t* previous;
+
+public:
+    DeviceSelection(hal_fleet_device_t* device) : previous(HAL_Fleet_Device_Select(device, nullptr))
+    {
+    }
+
+    ~DeviceSelection()
+    {
+        HAL_Fleet_Device_Select(previous, nullptr);
+    }
+};
+
+} // namespace
+
+/**
+ * A single device in the fleet, with its own HAL state and cloud session.
+ */
+class FleetDevice
+{
+    hal_fleet_device_t* device = nullptr;
+    /**
+     * The communication library has no function to free a protocol instance, so like the
+     * static instance this lives as long as the process.
+     */
+    ProtocolFacade* protocol = nullptr;
+    std::string name;
+    bool udp = false;
+    sockaddr_t endpoint = {};
+    sock_handle_t socket = socket_handle_invalid();
+    bool connected = false;
+    bool handshaking = false;
+    system_tick_t next_connect = 0;
+    system_tick_t reconnect_delay = RECONNECT_DELAY_MIN;
+
+    static int send(const unsigned char* buf, uint32_t buflen, void* reserved)
+    {
+        FleetDevice* device = active_device;
+        if (device->udp)
+            return socket_sendto(device->socket, buf, buflen, 0, &device->endpoint, sizeof(device->endpoint));
+        return socket_send(device->socket, buf, buflen);
+    }
+
+    static int receive(unsigned char* buf, uint32_t buflen, void* reserved)
+    {
+        FleetDevice* device = active_device;
+        system_tick_t timeout = device->handshaking ? HANDSHAKE_RECEIVE_TIMEOUT : 0;
+        if (device->udp) {
+            if (timeout)
+                socket_wait_readable(&device->socket, 1, timeout, nullptr);
+            sockaddr_t addr;
+            socklen_t size = sizeof(addr);
+            return socket_receivefrom(device->socket, buf, buflen, 0, &addr, &size);
+        }
+        return socket_receive(device->socket, buf, buflen, timeout);
+    }
+
+    // fleet devices don't accept firmware updates
+    static int prepare_for_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void* reserved)
+    {
+        return 1;
+    }
+
+    static int save_firmware_chunk(FileTransfer::Descriptor& descriptor, const unsigned char* chunk, void* reserved)
+    {
+        return 1;
+    }
+
+    static int finish_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void* reserved)
+    {
+        return 1;
+    }
+
+    static void signal(bool on, unsigned int param, void* reserved)
+    {
+    }
+
+    static void set_time(time_t t, unsigned int param, void* reserved)
+    {
+    }
+
+    // fleet devices have no application, so no functions, variables or event handlers
+    static int num_functions()
+    {
+        return 0;
+    }
+
+    static const char* get_function_key(int index)
+    {
+        return nullptr;
+    }
+
+    static int call_function(const char* key, const char* arg, SparkDescriptor::FunctionResultCallback callback, void* reserved)
+    {
+        return -1;
+    }
+
+    static int num_variables()
+    {
+        return 0;
+    }
+
+    static const char* get_variable_key(int index)
+    {
+        return nullptr;
+    }
+
+    static SparkReturnType::Enum variable_type(const char* key)
+    {
+        return SparkReturnType::INT;
+    }
+
+    static const void* get_variable(const char* key)
+    {
+        return nullptr;
+    }
+
+    static void call_event_handler(uint16_t size, FilteringEventHandler* handler, const char* event, const char* data, void* reserved)
+    {
+    }
+
+    /**
+     * Creates the device's protocol instance, for the protocol the device is configured with.
+     * @throws std::invalid_argument when the protocol isn't supported.
+     */
+    void init_protocol()
+    {
+        udp = HAL_Feature_Get(FEATURE_CLOUD_UDP);
+        ProtocolFactory factory = udp ? PROTOCOL_DTLS : PROTOCOL_LIGHTSSL;
+        protocol = create_protocol(factory);
+        if (!protocol)
+            throw std::invalid_argument("protocol not supported");
+
+        SparkCallbacks callbacks;
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.size = sizeof(callbacks);
+        callbacks.protocolFactory = factory;
+        callbacks.send = send;
+        callbacks.receive = receive;
+        callbacks.prepare_for_firmware_update = prepare_for_firmware_update;
+        callbacks.save_firmware_chunk = save_firmware_chunk;
+        callbacks.finish_firmware_update = finish_firmware_update;
+        callbacks.calculate_crc = HAL_Core_Compute_CRC32;
+        callbacks.signal = signal;
+        callbacks.millis = HAL_Timer_Get_Milli_Seconds;
+        callbacks.set_time = set_time;
+
+        SparkDescriptor descriptor;
+        memset(&descriptor, 0, sizeof(descriptor));
+        descriptor.size = sizeof(descriptor);
+        descriptor.num_functions = num_functions;
+        descriptor.get_function_key = get_function_key;
+        descriptor.call_function = call_function;
+        descriptor.num_variables = num_variables;
+        descriptor.get_variable_key = get_variable_key;
+        descriptor.variable_type = variable_type;
+        descriptor.get_variable = get_variable;
+        descriptor.was_ota_upgrade_successful = HAL_OTA_Flashed_GetStatus;
+        descriptor.ota_upgrade_status_sent = HAL_OTA_Flashed_ResetStatus;
+        descriptor.call_event_handler = call_event_handler;
+
+        unsigned char pubkey[EXTERNAL_FLASH_SERVER_PUBLIC_KEY_LENGTH] = {};
+        unsigned char private_key[EXTERNAL_FLASH_CORE_PRIVATE_KEY_LENGTH] = {};
+        SparkKeys keys;
+        memset(&keys, 0, sizeof(keys));
+        keys.size = sizeof(keys);
+        keys.server_public = pubkey;
+        keys.core_private = private_key;
+        HAL_FLASH_Read_CorePrivateKey(private_key, nullptr);
+        HAL_FLASH_Read_ServerPublicKey(pubkey);
+
+        uint8_t id[12];
+        HAL_device_ID(id, sizeof(id));
+        spark_protocol_init(protocol, (const char*)id, keys, callbacks, descriptor);
+    }
+
+    bool resolve(sockaddr_t& addr)
+    {
+        ServerAddress server;
+        HAL_FLASH_Read_ServerAddress(&server);
+        HAL_IPAddress ip = {};
+        if (server.addr_type==IP_ADDRESS) {
+            ip.ipv4 = server.ip;
+        }
+        else if (server.addr_type==DOMAIN_NAME) {
+            inet_gethostbyname(server.domain, strlen(server.domain), &ip, 0, nullptr);
+        }
+        if (!ip.ipv4)
+            return false;
+
+        uint16_t port = udp ? CLOUD_PORT_UDP : CLOUD_PORT_TCP;
+        if (server.port!=0 && server.port!=65535)
+            port = server.port;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sa_family = AF_INET;
+        addr.sa_data[0] = port >> 8;
+        addr.sa_data[1] = port & 0xFF;
+        addr.sa_data[2] = ip.ipv4 >> 24;
+        addr.sa_data[3] = ip.ipv4 >> 16;
+        addr.sa_data[4] = ip.ipv4 >> 8;
+        addr.sa_data[5] = ip.ipv4;
+        return true;
+    }
+
+    bool open_socket()
+    {
+        if (udp) {
+            socket = socket_create(AF_INET, SOCK_DGRAM, IPPROTO_UDP, 0, 0);
+            return socket_handle_valid(socket);
+        }
+        socket = socket_create(AF_INET, SOCK_STREAM, IPPROTO_TCP, 0, 0);
+        return socket_handle_valid(socket) && !socket_connect(socket, &endpoint, sizeof(endpoint));
+    }
+
+    void connect()
+    {
+        if (resolve(endpoint) && open_socket()) {
+            handshaking = true;
+            int err = spark_protocol_handshake(protocol);
+            handshaking = false;
+            if (!err) {
+                INFO("fleet device %s connected", name.c_str());
+                connected = true;
+                reconnect_delay = RECONNECT_DELAY_MIN;
+                return;
+            }
+        }
+        WARN("fleet device %s could not connect, retrying in %dms", name.c_str(), reconnect_delay);
+        disconnect();
+    }
+
+    void disconnect()
+    {
+        if (socket_handle_valid(socket))
+            socket_close(socket);
+        socket = socket_handle_invalid();
+        connected = false;
+        next_connect = HAL_Timer_Get_Milli_Seconds() + reconnect_delay;
+        reconnect_delay = std::min(reconnect_delay * 2, RECONNECT_DELAY_MAX);
+    }
+
+public:
+
+    ~FleetDevice()
+    {
+        if (!device)
+            return;
+        {
+            DeviceSelection selection(device);
+            if (socket_handle_valid(socket))
+                socket_close(socket);
+        }
+        HAL_Fleet_Device_Destroy(device, nullptr);
+    }
+
+    /**
+     * Loads the device state from the device directory.
+     * @throws std::invalid_argument when the device key cannot be read or the protocol isn't supported.
+     */
+    void load(const std::string& directory, const std::string& id)
+    {
+        name = id;
+        device = HAL_Fleet_Device_Create(directory.c_str(), id.c_str(), nullptr);
+        if (!device)
+            throw std::invalid_argument("device key cannot be read");
+
+        DeviceSelection selection(device);
+        init_protocol();
+    }
+
+    /**
+     * Runs the device's cloud session for a single iteration.
+     * @return true if the device did any work.
+     */
+    bool poll()
+    {
+        DeviceSelection selection(device);
+        active_device = this;
+        if (!connected) {
+            if (int32_t(HAL_Timer_Get_Milli_Seconds() - next_connect) < 0)
+                return false;
+            connect();
+            return true;
+        }
+        bool readable = socket_wait_readable(&socket, 1, 0, nullptr) > 0;
+        if (!spark_protocol_event_loop(protocol)) {
+            WARN("fleet device %s disconnected", name.c_str());
+            disconnect();
+        }
+        return readable;
+    }
+};
+
+namespace {
+
+bool is_device_id(const std::string& name)
+{
+    if (name.length()!=24)
+        return false;
+    for (char c : name) {
+        if (!isxdigit((unsigned char)c))
+            return false;
+    }
+    return true;
+}
+
+std::vector<std::string> list_devices(const std::string& directory)
+{
+    std::vector<std::string> ids;
+    if (DIR* dir = opendir(directory.c_str())) {
+        while (struct dirent* entry = readdir(dir)) {
+            if (is_device_id(entry->d_name))
+                ids.push_back(entry->d_name);
+        }
+        closedir(dir);
+    }
+    return ids;
+}
+
+void run_worker(std::vector<FleetDevice*> devices)
+{
+    for (;;) {
+        bool busy = false;
+        for (FleetDevice* device : devices) {
+            busy |= device->poll();
+        }
+        if (!busy)
+            HAL_Delay_Microseconds(IDLE_SLEEP_MILLIS * 1000);
+    }
+}
+
+} // namespace
+
+Fleet::Fleet()
+{
+}
+
+Fleet::~Fleet()
+{
+}
+
+size_t Fleet::load(const std::string& directory)
+{
+    for (const std::string& id : list_devices(directory)) {
+        std::unique_ptr<FleetDevice> device(new FleetDevice());
+        try {
+            device->load(directory + "/" + id, id);
+            devices.push_back(std::move(device));
+        }
+        catch (const std::invalid_argument& ex) {
+            ERROR("skipping fleet device %s: %s", id.c_str(), ex.what());
+        }
+    }
+    return devices.size();
+}
+
+bool Fleet::poll()
+{
+    bool busy = false;
+    for (auto& device : devices) {
+        busy |= device->poll();
+    }
+    return busy;
+}
+
+void Fleet::run(unsigned thread_count)
+{
+    if (!thread_count)
+        thread_count = std::thread::hardware_concurrency();
+    thread_count = std::max(1u, std::min(thread_count, unsigned(devices.size())));
+    INFO("running %u fleet devices on %u threads", unsigned(devices.size()), thread_count);
+
+    std::vector<std::vector<FleetDevice*>> assigned(thread_count);
+    for (size_t i=0; i<devices.size(); i++) {
+        assigned[i % thread_count].push_back(devices[i].get());
+    }
+    std::vector<std::thread> workers;
+    for (auto& worker_devices : assigned) {
+        workers.emplace_back(run_worker, worker_devices);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+bool system_fleet_run()
+{
+    hal_fleet_config_t config = {};
+    config.size = sizeof(config);
+    if (!HAL_Fleet_Config(&config, nullptr))
+        return false;
+
+    Fleet fleet;
+    if (!fleet.load(config.directory)) {
+        ERROR("no devices found in fleet directory '%s'", config.directory);
+        return true;
+    }
+    fleet.run(config.threads);
+    return true;
+}
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_info_json.h"
+#include "bytes2hexbuf.h"
+
+const char* module_function_string(module_function_t func) {
+    switch (func) {
+        case MODULE_FUNCTION_NONE: return "n";
+        case MODULE_FUNCTION_RESOURCE: return "r";
+        case MODULE_FUNCTION_BOOTLOADER: return "b";
+        case MODULE_FUNCTION_MONO_FIRMWARE: return "m";
+        case MODULE_FUNCTION_SYSTEM_PART: return "s";
+        case MODULE_FUNCTION_USER_PART: return "u";
+        default: return "_";
+    }
+}
+
+const char* module_store_string(module_store_t store) {
+    switch (store) {
+        case MODULE_STORE_MAIN: return "m";
+        case MODULE_STORE_BACKUP: return "b";
+        case MODULE_STORE_FACTORY: return "f";
+        case MODULE_STORE_SCRATCHPAD: return "t";
+        default: return "_";
+    }
+}
+
+const char* module_name(uint8_t index, char* buf)
+{
+    return itoa(index, buf, 10);
+}
+
+bool system_info_to_json(AppendJson& json, const hal_system_info_t& system)
+{
+    bool result = true;
+    result &= json.write_value("p", system.platform_id)
+        && json.write_key_values(system.key_value_count, system.key_values)
+        && json.write_attribute("m")
+        && json.write('[');
+    char buf[65];
+    for (unsigned i=0; i<system.module_count; i++) {
+        if (i) result &= json.write(',');
+        const hal_module_t& module = system.modules[i];
+        const module_info_t* info = module.info;
+        buf[64] = 0;
+        bool output_uuid = module.suffix && module_function(info)==MODULE_FUNCTION_USER_PART;
+        result &= json.write('{') && json.write_value("s", module.bounds.maximum_size) && json.write_string("l", module_store_string(module.bounds.store))
+                && json.write_value("vc",module.validity_checked) && json.write_value("vv", module.validity_result)
+          && (!output_uuid || json.write_string("u", bytes2hexbuf(module.suffix->sha, 32, buf)))
+          && (!info || (json.write_string("f", module_function_string(module_function(info)))
+                        && json.write_string("n", module_name(module_index(info), buf))
+                        && json.write_value("v", info->module_version)))
+        // on the photon we have just one dependency, this will need generalizing for other platforms
+          && json.write_attribute("d") && json.write('[');
+
+        for (unsigned int d=0; d<1 && info; d++) {
+            const module_dependency_t& dependency = info->dependency;
+            module_function_t function = module_function_t(dependency.module_function);
+            if (function==MODULE_FUNCTION_NONE) // skip empty dependents
+                continue;
+            if (d) result &= json.write(',');
+            result &= json.write('{')
+              && json.write_string("f", module_function_string(function))
+              && json.write_string("n", module_name(dependency.module_index, buf))
+              && json.write_value("v", dependency.module_version)
+               && json.end_list() && json.write('}');
+        }
+        result &= json.write("]}");
+    }
+
+    result &= json.write(']');
+    return result;
+}
+
+bool system_info_to_json(appender_fn append, void* append_data, const hal_system_info_t& system)
+{
+    char buffer[SYSTEM_INFO_JSON_BUFFER_SIZE];
+    AppendJson json(append, append_data, buffer, sizeof(buffer));
+    bool result = system_info_to_json(json, system);
+    return json.flush() && result;
+}
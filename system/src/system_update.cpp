@@ -24,6 +24,7 @@
 #include "spark_wiring_rgb.h"
 #include "spark_wiring_usbserial.h"
 #include "ota_flash_hal.h"
+#include "socket_hal.h"
 #include "core_hal.h"
 #include "delay_hal.h"
 #include "system_event.h"
@@ -40,7 +41,11 @@
 #include "system_version.h"
 #include "spark_macros.h"
 #include "system_network_internal.h"
-#include "bytes2hexbuf.h"
+#include "system_info_json.h"
+#include "lzss.h"
+#include "ota_chunk_writer.h"
+#include "chunked_transfer.h"
+#include <stdlib.h>
 
 #ifdef START_DFU_FLASHER_SERIAL_SPEED
 static uint32_t start_dfu_flasher_serial_speed = START_DFU_FLASHER_SERIAL_SPEED;
@@ -146,6 +151,11 @@ bool system_firmwareUpdate(Stream* stream, void* reserved)
     system_file_transfer_t tx;
     tx.descriptor.store = FileTransfer::Store::FIRMWARE;
     tx.stream = stream;
+#if PLATFORM_ID==PLATFORM_PHOTON_PRODUCTION || PLATFORM_ID==PLATFORM_P1 || PLATFORM_ID==PLATFORM_ELECTRON_PRODUCTION
+    // USB serial holds off the host while the receive buffer is full, so nothing is lost when streamed
+    if (stream==&Serial)
+        tx.descriptor.flags |= FileTransfer::Flags::STREAMING;
+#endif
     return system_fileTransfer(&tx);
 }
 
@@ -210,8 +220,164 @@ void set_flag(void* flag)
 	*p = true;
 }
 
+static int write_flash(void* context, uint32_t address, const uint8_t* data, uint32_t length)
+{
+    return HAL_FLASH_Update(data, address, length, NULL);
+}
+
+#if OTA_CHUNK_WRITER
+static void chunk_written(void* context);
+
+/**
+ * Programs the flash while the next chunk is received. Active between preparing
+ * for an update and finishing it.
+ */
+static ChunkWriter chunk_writer(write_flash, NULL, chunk_written);
+
+/**
+ * The transfer progress last saved by the protocol. Chunks still queued in the writer
+ * are lost at a reset, so a chunk is recorded in backup RAM only once it is written.
+ */
+static particle::protocol::TransferPersistData transfer_progress;
+static std::mutex transfer_progress_lock;
+
+static int save_written_progress()
+{
+    particle::protocol::TransferPersistData progress = transfer_progress;
+    if (progress.size==sizeof(progress))
+        chunk_writer.clear_pending(progress.file_address, progress.chunk_size, progress.bitmap, sizeof(progress.bitmap));
+    return HAL_System_Backup_Save(TransferPersistOffset, &progress, sizeof(progress), nullptr);
+}
+
+static void chunk_written(void* context)
+{
+    std::lock_guard<std::mutex> guard(transfer_progress_lock);
+    if (transfer_progress.size==sizeof(transfer_progress))
+        save_written_progress();
+}
+
+int system_save_transfer_progress(const void* progress, size_t length)
+{
+    if (length!=sizeof(transfer_progress))
+        return -1;
+    std::lock_guard<std::mutex> guard(transfer_progress_lock);
+    memcpy(&transfer_progress, progress, length);
+    return save_written_progress();
+}
+
+static void begin_chunk_writer(const FileTransfer::Descriptor& file)
+{
+    // when the queue can't be allocated, chunks are written as they are received
+    chunk_writer.begin(OTA_CHUNK_WRITER_SLOTS, file.chunk_size);
+}
+
+static int end_chunk_writer()
+{
+    return chunk_writer.end();
+}
+
+static int write_chunk(const uint8_t* data, uint32_t address, uint32_t length)
+{
+    return chunk_writer.write(address, data, length);
+}
+#else
+int system_save_transfer_progress(const void* progress, size_t length)
+{
+    return HAL_System_Backup_Save(TransferPersistOffset, progress, length, nullptr);
+}
+
+static void begin_chunk_writer(const FileTransfer::Descriptor& file)
+{
+}
+
+static int end_chunk_writer()
+{
+    return 0;
+}
+
+static int write_chunk(const uint8_t* data, uint32_t address, uint32_t length)
+{
+    return write_flash(NULL, address, data, length);
+}
+#endif
+
+/**
+ * Expands a compressed firmware update as it is received. Allocated only while
+ * a compressed update is in progress.
+ */
+struct CompressedUpdate
+{
+    static const unsigned WINDOW_BITS = 10;
+
+    lzss_decoder decoder;
+    uint32_t address;           // where the expanded image is written
+    uint32_t received;          // bytes of the compressed image received
+    int result;                 // of the last update of the decoder
+    uint8_t buffer[512];
+    uint8_t window[1<<WINDOW_BITS];
+
+    static int write(void* context, uint32_t offset, const uint8_t* data, uint32_t length)
+    {
+        CompressedUpdate* update = (CompressedUpdate*)context;
+        return write_chunk(data, update->address + offset, length);
+    }
+};
+
+static CompressedUpdate* compressed_update = NULL;
+
+static void end_compressed_update()
+{
+    free(compressed_update);
+    compressed_update = NULL;
+}
+
+static bool begin_compressed_update(const FileTransfer::Descriptor& file)
+{
+    end_compressed_update();
+    compressed_update = (CompressedUpdate*)malloc(sizeof(CompressedUpdate));
+    if (!compressed_update)
+        return false;
+    compressed_update->address = file.file_address;
+    compressed_update->received = 0;
+    compressed_update->result = 0;
+    lzss_decoder_init(&compressed_update->decoder, compressed_update->window, sizeof(compressed_update->window),
+            compressed_update->buffer, sizeof(compressed_update->buffer), CompressedUpdate::write, compressed_update);
+    return true;
+}
+
+static int save_compressed_chunk(FileTransfer::Descriptor& file, const uint8_t* chunk)
+{
+    CompressedUpdate* update = compressed_update;
+    // chunks must arrive in order to be expanded
+    if (!update || update->result<0 || file.chunk_address-file.file_address!=update->received)
+        return -1;
+
+    if (!update->received)
+    {
+        // the flash to erase is known once the header is received
+        lzss_header header;
+        if (lzss_parse_header(chunk, file.chunk_size, &header) || header.length>HAL_OTA_FlashLength())
+        {
+            update->result = LZSS_ERROR_FORMAT;
+            return -1;
+        }
+        if (!HAL_FLASH_Begin(update->address, header.length, NULL))
+        {
+            update->result = -1;
+            return -1;
+        }
+    }
+    update->received += file.chunk_size;
+    update->result = lzss_decoder_update(&update->decoder, chunk, file.chunk_size);
+    return update->result<0 ? -1 : 0;
+}
+
 int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags, void* reserved)
 {
+    bool compressed = file.flags & FileTransfer::Flags::COMPRESSED;
+    if (compressed && file.store!=FileTransfer::Store::FIRMWARE)
+        return 1;   // only firmware is expanded
+
     if (file.store==FileTransfer::Store::FIRMWARE)
     {
         // address is relative to the OTA region. Normally will be 0.
@@ -244,7 +410,24 @@ int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t f
             SPARK_FLASH_UPDATE = 1;
             TimingFlashUpdateTimeout = 0;
             system_notify_event(firmware_update, firmware_update_begin, &file);
-            HAL_FLASH_Begin(file.file_address, file.file_length, NULL);
+            if (compressed)
+            {
+                // the flash is prepared when the first chunk gives the expanded length
+                if (!begin_compressed_update(file))
+                    result = 1;
+            }
+            else if (file.flags & FileTransfer::Flags::RESUME)
+            {
+                // keep the chunks received before the transfer was interrupted
+                if (!HAL_FLASH_Resume(file.file_address, file.file_length, NULL))
+                    result = 1;
+            }
+            else if (!HAL_FLASH_Begin(file.file_address, file.file_length, NULL))
+            {
+                result = 1;
+            }
+            if (!result && file.store==FileTransfer::Store::FIRMWARE)
+                begin_chunk_writer(file);
         }
         else
         {
@@ -313,6 +496,17 @@ int Spark_Finish_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags,
     TimingFlashUpdateTimeout = 0;
     //DEBUG("update finished flags=%d store=%d", flags, file.store);
 
+    // chunks are acknowledged before they are written, so a failed write is known only now
+    if (end_chunk_writer())
+        flags &= ~1;
+
+    if (file.flags & FileTransfer::Flags::COMPRESSED)
+    {
+        if (!compressed_update || compressed_update->result!=LZSS_COMPLETE)
+            flags &= ~1;    // the image wasn't completely expanded
+        end_compressed_update();
+    }
+
     if (flags & 1) {    // update successful
         if (file.store==FileTransfer::Store::FIRMWARE)
         {
@@ -337,156 +531,48 @@ int Spark_Finish_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags,
 int Spark_Save_Firmware_Chunk(FileTransfer::Descriptor& file, const uint8_t* chunk, void* reserved)
 {
     TimingFlashUpdateTimeout = 0;
-    int result = -1;
+    int result = 0;     // chunks for other stores are discarded, and a failure aborts the transfer
     system_notify_event(firmware_update, firmware_update_progress, &file);
     if (file.store==FileTransfer::Store::FIRMWARE)
     {
-        result = HAL_FLASH_Update(chunk, file.chunk_address, file.chunk_size, NULL);
+        if (file.flags & FileTransfer::Flags::COMPRESSED)
+            result = save_compressed_chunk(file, chunk);
+        else
+            result = write_chunk(chunk, file.chunk_address, file.chunk_size);
         LED_Toggle(LED_RGB);
     }
     return result;
 }
 
-class AppendJson
-{
-    appender_fn fn;
-    void* data;
-
-public:
-
-    AppendJson(appender_fn fn, void* data) {
-        this->fn = fn; this->data = data;
-    }
-
-    bool write_quoted(const char* value) {
-        return write('"') &&
-               write(value) &&
-               write('"');
-    }
-
-    bool write_attribute(const char* name) {
-        return
-                write_quoted(name) &&
-                write(':');
-    }
-
-    bool write_string(const char* name, const char* value) {
-        return write_attribute(name) &&
-               write_quoted(value) &&
-               next();
-    }
-
-    bool newline() { return true; /*return write("\r\n");*/ }
-
-    bool write_value(const char* name, int value) {
-        char buf[10];
-        itoa(value, buf, 10);
-        return write_attribute(name) &&
-               write(buf) &&
-               next();
-    }
-
-    bool end_list() {
-        return write_attribute("_") &&
-               write_quoted("");
-    }
-
-    bool write(char c) {
-        return fn(data, (const uint8_t*)&c, 1);
-    }
-
-    bool write(const char* string) {
-        return fn(data, (const uint8_t*)string, strlen(string));
-    }
-
-    bool next() { return write(',') && newline(); }
-
-    bool write_key_values(size_t count, const key_value* key_values)
-    {
-        bool result = true;
-        while (count-->0) {
-            result = result && write_key_value(key_values++);
-        }
-        return result;
-    }
-
-    bool write_key_value(const key_value* kv)
-    {
-        return write_string(kv->key, kv->value);
-    }
-};
-
-const char* module_function_string(module_function_t func) {
-    switch (func) {
-        case MODULE_FUNCTION_NONE: return "n";
-        case MODULE_FUNCTION_RESOURCE: return "r";
-        case MODULE_FUNCTION_BOOTLOADER: return "b";
-        case MODULE_FUNCTION_MONO_FIRMWARE: return "m";
-        case MODULE_FUNCTION_SYSTEM_PART: return "s";
-        case MODULE_FUNCTION_USER_PART: return "u";
-        default: return "_";
-    }
-}
-
-const char* module_store_string(module_store_t store) {
-    switch (store) {
-        case MODULE_STORE_MAIN: return "m";
-        case MODULE_STORE_BACKUP: return "b";
-        case MODULE_STORE_FACTORY: return "f";
-        case MODULE_STORE_SCRATCHPAD: return "t";
-        default: return "_";
-    }
-}
-
-const char* module_name(uint8_t index, char* buf)
-{
-    return itoa(index, buf, 10);
-}
-
-bool system_info_to_json(appender_fn append, void* append_data, hal_system_info_t& system)
+/**
+ * Appends the data used by each subsystem as "du":{"<subsystem>":[tx bytes,rx bytes,tx packets,rx packets],...}
+ * Subsystems without traffic are left out, and so is the list when the platform doesn't count socket traffic.
+ */
+static bool data_usage_to_json(appender_fn append, void* append_data)
 {
-    AppendJson json(append, append_data);
+    static const char* const names[SOCKET_USAGE_COUNT] = { "a", "c", "h", "p", "o" };
+    char buffer[SYSTEM_INFO_JSON_BUFFER_SIZE];
+    AppendJson json(append, append_data, buffer, sizeof(buffer));
     bool result = true;
-    result &= json.write_value("p", system.platform_id)
-        && json.write_key_values(system.key_value_count, system.key_values)
-        && json.write_attribute("m")
-        && json.write('[');
-    char buf[65];
-    for (unsigned i=0; i<system.module_count; i++) {
-        if (i) result &= json.write(',');
-        const hal_module_t& module = system.modules[i];
-        const module_info_t* info = module.info;
-        buf[64] = 0;
-        bool output_uuid = module.suffix && module_function(info)==MODULE_FUNCTION_USER_PART;
-        result &= json.write('{') && json.write_value("s", module.bounds.maximum_size) && json.write_string("l", module_store_string(module.bounds.store))
-                && json.write_value("vc",module.validity_checked) && json.write_value("vv", module.validity_result)
-          && (!output_uuid || json.write_string("u", bytes2hexbuf(module.suffix->sha, 32, buf)))
-          && (!info || (json.write_string("f", module_function_string(module_function(info)))
-                        && json.write_string("n", module_name(module_index(info), buf))
-                        && json.write_value("v", info->module_version)))
-        // on the photon we have just one dependency, this will need generalizing for other platforms
-          && json.write_attribute("d") && json.write('[');
-
-        for (unsigned int d=0; d<1 && info; d++) {
-            const module_dependency_t& dependency = info->dependency;
-            module_function_t function = module_function_t(dependency.module_function);
-            if (function==MODULE_FUNCTION_NONE) // skip empty dependents
-                continue;
-            if (d) result &= json.write(',');
-            result &= json.write('{')
-              && json.write_string("f", module_function_string(function))
-              && json.write_string("n", module_name(dependency.module_index, buf))
-              && json.write_value("v", dependency.module_version)
-               && json.end_list() && json.write('}');
-        }
-        result &= json.write("]}");
+    bool first = true;
+    for (unsigned usage=0; usage<SOCKET_USAGE_COUNT; usage++) {
+        socket_usage_stats_t stats;
+        stats.size = sizeof(stats);
+        if (socket_usage_total(usage, &stats, NULL) || !(stats.tx_bytes || stats.rx_bytes))
+            continue;
+        result &= (first ? json.write(",\"du\":{") : json.write(','))
+            && json.write_attribute(names[usage]) && json.write('[')
+            && json.write_unsigned(stats.tx_bytes) && json.write(',')
+            && json.write_unsigned(stats.rx_bytes) && json.write(',')
+            && json.write_unsigned(stats.tx_packets) && json.write(',')
+            && json.write_unsigned(stats.rx_packets) && json.write(']');
+        first = false;
     }
-
-    result &= json.write(']');
-    return result;
+    if (!first)
+        result &= json.write('}');
+    return json.flush() && result;
 }
 
-
 bool system_module_info(appender_fn append, void* append_data, void* reserved)
 {
     hal_system_info_t info;
@@ -495,7 +581,7 @@ bool system_module_info(appender_fn append, void* append_data, void* reserved)
     HAL_System_Info(&info, true, NULL);
     bool result = system_info_to_json(append, append_data, info);
     HAL_System_Info(&info, false, NULL);
-    return result;
+    return result && data_usage_to_json(append, append_data);
 }
 
 bool append_system_version_info(Appender* appender)
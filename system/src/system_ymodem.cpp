@@ -86,6 +86,79 @@ inline int32_t YModem::receive_byte(uint8_t& c, uint32_t timeout)
     return -1;
 }
 
+/**
+ * @brief  Receive bytes from sender, reading all that are available at once
+ * @param  data: Where the bytes are stored
+ * @param  length: The number of bytes to receive
+ * @param  timeout: The longest wait for more bytes to arrive
+ * @retval 0: Bytes received
+ *         -1: Timeout
+ */
+int32_t YModem::receive_bytes(uint8_t* data, uint32_t length, uint32_t timeout)
+{
+    uint32_t start = HAL_Timer_Get_Milli_Seconds();
+    while (length)
+    {
+        int available = stream.available();
+        if (available > 0)
+        {
+            uint32_t count = (uint32_t(available) < length) ? available : length;
+            length -= count;
+            while (count--)
+            {
+                *data++ = stream.read();
+            }
+            start = HAL_Timer_Get_Milli_Seconds();
+        }
+        else if (HAL_Timer_Get_Milli_Seconds() - start > timeout)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * CRC-16/CCITT lookup table, polynomial 0x1021.
+ */
+static const uint16_t crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7, 0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6, 0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485, 0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4, 0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823, 0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12, 0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41, 0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70, 0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f, 0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e, 0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d, 0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c, 0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab, 0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a, 0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9, 0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8, 0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
+
+uint16_t YModem::crc16(const uint8_t* data, size_t length, uint16_t crc)
+{
+    while (length--)
+    {
+        crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ *data++) & 0xff];
+    }
+    return crc;
+}
+
+/**
+ * @brief  Ask the sender for a file packet. Streaming is asked for only at first,
+ *         so senders that don't stream are asked again when the request times out.
+ */
+void YModem::request_file()
+{
+    requested = (streaming && !errors) ? STREAM : CRC16;
+    send_byte(requested);
+}
+
 /**
  * @brief  Receive a packet from sender
  * @param  data
@@ -100,7 +173,7 @@ inline int32_t YModem::receive_byte(uint8_t& c, uint32_t timeout)
  */
 int32_t YModem::receive_packet(uint8_t *data, int32_t& length, uint32_t timeout)
 {
-    uint16_t i, packet_size;
+    uint16_t packet_size;
     uint8_t c;
     length = 0;
     if (receive_byte(c, timeout) != 0)
@@ -136,17 +209,19 @@ int32_t YModem::receive_packet(uint8_t *data, int32_t& length, uint32_t timeout)
         return -1;
     }
     *data = c;
-    for (i = 1; i < (packet_size + PACKET_OVERHEAD); i++)
+    if (receive_bytes(data + 1, packet_size + PACKET_OVERHEAD - 1, timeout) != 0)
     {
-        if (receive_byte(data[i], timeout) != 0)
-        {
-            return -1;
-        }
+        return -1;
     }
     if (data[PACKET_SEQNO_INDEX] != ((data[PACKET_SEQNO_COMP_INDEX] ^ 0xff) & 0xff))
     {
         return -1;
     }
+    const uint8_t* trailer = data + PACKET_HEADER + packet_size;
+    if (crc16(data + PACKET_HEADER, packet_size) != (trailer[0] << 8 | trailer[1]))
+    {
+        return -1;
+    }
     length = packet_size;
     return 0;
 }
@@ -182,16 +257,25 @@ int32_t YModem::handle_packet(uint8_t* packet_data, int32_t packet_length,
         send_byte(ACK);
         return 0;
 
-        /* End of transmission */
+        /* End of transmission, ask for the next file */
     case 0:
         send_byte(ACK);
         file_done = 1;
+        send_byte(requested);
         return 1;
     }
 
     if ((packet_data[PACKET_SEQNO_INDEX] & 0xff) != (packets_received & 0xff))
     {
-        send_byte(NAK);
+        if (streamed)
+        {
+            /* Packets that are streamed can't be sent again */
+            send_byte(CA);
+            send_byte(CA);
+            return 0;
+        }
+        /* The sender didn't see the ACK for the last packet */
+        send_byte(packets_received && (packet_data[PACKET_SEQNO_INDEX] & 0xff) == ((packets_received - 1) & 0xff) ? ACK : NAK);
     }
     else
     {
@@ -200,6 +284,7 @@ int32_t YModem::handle_packet(uint8_t* packet_data, int32_t packet_length,
             /* Filename packet */
             if (packet_data[PACKET_HEADER] != 0)
             {
+                streamed = (requested == STREAM);
                 parse_file_packet(tx, desc, packet_data);
                 if (Spark_Prepare_For_Firmware_Update(tx, 0, NULL))
                 {
@@ -208,9 +293,10 @@ int32_t YModem::handle_packet(uint8_t* packet_data, int32_t packet_length,
                     send_byte(CA);
                     return -1;
                 }
+                prepared = true;
                 tx.chunk_address = tx.file_address;
                 send_byte(ACK);
-                send_byte(CRC16);
+                send_byte(requested);
             } /* Filename packet is empty, end session */
             else
             {
@@ -230,7 +316,10 @@ int32_t YModem::handle_packet(uint8_t* packet_data, int32_t packet_length,
                 return -2;
             }
             tx.chunk_address += tx.chunk_size;
-            send_byte(ACK);
+            if (!streamed)
+            {
+                send_byte(ACK);
+            }
         }
         packets_received++;
         session_begin = 1;
@@ -245,6 +334,18 @@ int32_t YModem::receive_file(FileTransfer::Descriptor& tx, YModem::file_desc_t&
     session_done = 0;
     errors = 0;
     session_begin = 0;
+    streamed = false;
+    prepared = false;
+
+    /* Ask for the file straight away, unless the sender has already begun */
+    if (!stream.available())
+    {
+        request_file();
+    }
+    else
+    {
+        requested = CRC16;
+    }
 
     for (;!session_done;)
     {
@@ -271,10 +372,24 @@ int32_t YModem::receive_file(FileTransfer::Descriptor& tx, YModem::file_desc_t&
                 break;
 
             default:
+                if (streamed && packets_received)
+                {
+                    /* Packets that are streamed can't be sent again */
+                    send_byte(CA);
+                    send_byte(CA);
+                    return 0;
+                }
                 if (session_begin >= 0)
                 {
                     errors++;
-                    send_byte(CRC16);
+                    if (packets_received)
+                    {
+                        send_byte(NAK);
+                    }
+                    else
+                    {
+                        request_file();
+                    }
                 }
                 if (errors > MAX_ERRORS)
                 {
@@ -297,8 +412,9 @@ int32_t YModem::receive_file(FileTransfer::Descriptor& tx, YModem::file_desc_t&
 bool Ymodem_Serial_Flash_Update(Stream *serialObj, FileTransfer::Descriptor& file, void* reserved)
 {
     YModem::file_desc_t desc;
-    YModem* ymodem = new YModem(*serialObj);
+    YModem* ymodem = new YModem(*serialObj, file.flags & FileTransfer::Flags::STREAMING);
     int32_t size = ymodem->receive_file(file, desc);
+    bool prepared = ymodem->is_prepared();
     delete ymodem;
     if (size > 0)
     {
@@ -330,6 +446,11 @@ bool Ymodem_Serial_Flash_Update(Stream *serialObj, FileTransfer::Descriptor& fil
     {
         serialObj->println("Failed to receive the file!");
     }
+    if (prepared)
+    {
+        /* Stop writing the chunks received */
+        Spark_Finish_Firmware_Update(file, 0, NULL);
+    }
     return false;
 }
 
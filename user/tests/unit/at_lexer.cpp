@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Tests the modem AT response lexer against scripted modem output.
+
+#include "catch.hpp"
+#include "at_lexer.h"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+namespace {
+
+// The original MDMParser line parser, which rescanned the pipe from the start on every call.
+struct LegacyParser {
+
+    static int parseMatch(Pipe<char>* pipe, int len, const char* sta, const char* end) {
+        int o = 0;
+        if (sta) {
+            while (*sta) {
+                if (++o > len)                  return WAIT;
+                char ch = pipe->next();
+                if (*sta++ != ch)               return NOT_FOUND;
+            }
+        }
+        if (!end)                               return o;
+        if (++o > len)                          return WAIT;
+        pipe->next();
+        int x = 0;
+        while (end[x]) {
+            if (++o > len)                      return WAIT;
+            char ch = pipe->next();
+            x = (end[x] == ch) ? x + 1 : (end[0] == ch) ? 1 : 0;
+        }
+        return o;
+    }
+
+    static int parseFormated(Pipe<char>* pipe, int len, const char* fmt) {
+        int o = 0;
+        int num = 0;
+        while (*fmt) {
+            if (++o > len)                      return WAIT;
+            char ch = pipe->next();
+            if (*fmt == '%') {
+                fmt++;
+                if (*fmt == 'd') {
+                    fmt ++;
+                    num = 0;
+                    while (ch >= '0' && ch <= '9') {
+                        num = num * 10 + (ch - '0');
+                        if (++o > len)          return WAIT;
+                        ch = pipe->next();
+                    }
+                }
+                else if (*fmt == 'c') {
+                    fmt ++;
+                    while (num --) {
+                        if (++o > len)          return WAIT;
+                        ch = pipe->next();
+                    }
+                }
+                else if (*fmt == 's') {
+                    fmt ++;
+                    if (ch != '\"')             return NOT_FOUND;
+                    do {
+                        if (++o > len)          return WAIT;
+                        ch = pipe->next();
+                    } while (ch != '\"');
+                    if (++o > len)              return WAIT;
+                    ch = pipe->next();
+                }
+            }
+            if (*fmt++ != ch)                   return NOT_FOUND;
+        }
+        return o;
+    }
+
+    static int getLine(Pipe<char>* pipe, char* buf, int len) {
+        int unkn = 0;
+        int sz = pipe->size();
+        int fr = pipe->free();
+        if (len > sz)
+            len = sz;
+        while (len > 0) {
+            static struct { const char* fmt; int type; } lutF[] = {
+                { "\r\n+USORD: %d,%d,\"%c\"",                   TYPE_PLUS },
+                { "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"",  TYPE_PLUS },
+                { "\r\n+URDFILE: %s,%d,\"%c\"",                 TYPE_PLUS },
+            };
+            static struct { const char* sta; const char* end; int type; } lut[] = {
+                { "\r\nOK\r\n",             NULL,       TYPE_OK         },
+                { "\r\nERROR\r\n",          NULL,       TYPE_ERROR      },
+                { "\r\n+CME ERROR:",        "\r\n",     TYPE_ERROR      },
+                { "\r\n+CMS ERROR:",        "\r\n",     TYPE_ERROR      },
+                { "\r\nRING\r\n",           NULL,       TYPE_RING       },
+                { "\r\nCONNECT\r\n",        NULL,       TYPE_CONNECT    },
+                { "\r\nNO CARRIER\r\n",     NULL,       TYPE_NOCARRIER  },
+                { "\r\nNO DIALTONE\r\n",    NULL,       TYPE_NODIALTONE },
+                { "\r\nBUSY\r\n",           NULL,       TYPE_BUSY       },
+                { "\r\nNO ANSWER\r\n",      NULL,       TYPE_NOANSWER   },
+                { "\r\n+",                  "\r\n",     TYPE_PLUS       },
+                { "\r\n@",                  NULL,       TYPE_PROMPT     },
+                { "\r\n>",                  NULL,       TYPE_PROMPT     },
+                { "\n>",                    NULL,       TYPE_PROMPT     },
+                { "\r\nABORTED\r\n",        NULL,       TYPE_ABORTED    },
+            };
+            for (auto& p : lutF) {
+                pipe->set(unkn);
+                int ln = parseFormated(pipe, len, p.fmt);
+                if (ln == WAIT && fr)
+                    return WAIT;
+                if ((ln != NOT_FOUND) && (unkn > 0))
+                    return TYPE_UNKNOWN | pipe->get(buf, unkn);
+                if (ln > 0)
+                    return p.type | pipe->get(buf, ln);
+            }
+            for (auto& p : lut) {
+                pipe->set(unkn);
+                int ln = parseMatch(pipe, len, p.sta, p.end);
+                if (ln == WAIT && fr)
+                    return WAIT;
+                if ((ln != NOT_FOUND) && (unkn > 0))
+                    return TYPE_UNKNOWN | pipe->get(buf, unkn);
+                if (ln > 0)
+                    return p.type | pipe->get(buf, ln);
+            }
+            unkn ++;
+            len--;
+        }
+        return WAIT;
+    }
+};
+
+struct LexerParser {
+    AtLexer lexer;
+
+    int getLine(Pipe<char>* pipe, char* buf, int len) {
+        return lexer.getLine(pipe, buf, len);
+    }
+};
+
+std::string describe(int ret, const char* buf) {
+    std::ostringstream s;
+    s << std::hex << TYPE(ret) << ":" << std::string(buf, LENGTH(ret));
+    return s.str();
+}
+
+/**
+ * Plays scripted modem output into the receive pipe in chunks of the given
+ * size, collecting every line the parser returns after each chunk.
+ */
+template <typename Parser>
+std::vector<std::string> play(const std::string& script, size_t chunk, Parser& parser, int pipe_size = 1024) {
+    Pipe<char> pipe(pipe_size);
+    std::vector<std::string> lines;
+    char buf[1088];
+    for (size_t pos = 0; pos < script.size(); pos += chunk) {
+        size_t n = std::min(chunk, script.size() - pos);
+        REQUIRE(pipe.put(script.data() + pos, n) == (int)n);
+        int ret;
+        while ((ret = parser.getLine(&pipe, buf, sizeof(buf))) != WAIT) {
+            lines.push_back(describe(ret, buf));
+        }
+    }
+    return lines;
+}
+
+std::vector<std::string> lex(const std::string& script, size_t chunk = 1024) {
+    LexerParser parser;
+    return play(script, chunk, parser);
+}
+
+std::string line(int type, const std::string& text) {
+    return describe(type | text.size(), text.data());
+}
+
+std::string usord(int socket, const std::string& payload) {
+    std::ostringstream s;
+    s << "\r\n+USORD: " << socket << "," << payload.size() << ",\"" << payload << "\"";
+    return s.str();
+}
+
+} // namespace
+
+SCENARIO("final results, prompts and URCs are classified", "[at_lexer]") {
+    std::string script = std::string("\r\nOK\r\n") + "\r\nERROR\r\n" + "\r\n+CME ERROR: 10\r\n" +
+            "\r\n+CMS ERROR: 500\r\n" + "\r\nRING\r\n" + "\r\nCONNECT\r\n" + "\r\nNO CARRIER\r\n" +
+            "\r\nNO DIALTONE\r\n" + "\r\nBUSY\r\n" + "\r\nNO ANSWER\r\n" + "\r\n+UUSORD: 0,12\r\n" +
+            "\r\n@" + "\r\n>" + "\n>" + "\r\nABORTED\r\n";
+    std::vector<std::string> expected = {
+        line(TYPE_OK, "\r\nOK\r\n"),
+        line(TYPE_ERROR, "\r\nERROR\r\n"),
+        line(TYPE_ERROR, "\r\n+CME ERROR: 10\r\n"),
+        line(TYPE_ERROR, "\r\n+CMS ERROR: 500\r\n"),
+        line(TYPE_RING, "\r\nRING\r\n"),
+        line(TYPE_CONNECT, "\r\nCONNECT\r\n"),
+        line(TYPE_NOCARRIER, "\r\nNO CARRIER\r\n"),
+        line(TYPE_NODIALTONE, "\r\nNO DIALTONE\r\n"),
+        line(TYPE_BUSY, "\r\nBUSY\r\n"),
+        line(TYPE_NOANSWER, "\r\nNO ANSWER\r\n"),
+        line(TYPE_PLUS, "\r\n+UUSORD: 0,12\r\n"),
+        line(TYPE_PROMPT, "\r\n@"),
+        line(TYPE_PROMPT, "\r\n>"),
+        line(TYPE_PROMPT, "\n>"),
+        line(TYPE_ABORTED, "\r\nABORTED\r\n"),
+    };
+    REQUIRE(lex(script) == expected);
+}
+
+SCENARIO("unknown text is returned ahead of the following line", "[at_lexer]") {
+    REQUIRE(lex("\r\n1234\r\n\r\nOK\r\n") == std::vector<std::string>({
+        line(TYPE_UNKNOWN, "\r\n1234\r\n"), line(TYPE_OK, "\r\nOK\r\n") }));
+    // text without a following line stays in the pipe
+    REQUIRE(lex("\r\n1234\r\n").empty());
+}
+
+SCENARIO("binary payloads are returned whole", "[at_lexer]") {
+    std::string payload("\r\nOK\r\n\0\"\r\n+", 12);
+    std::string script = usord(3, payload) + "\r\nOK\r\n";
+    for (size_t chunk = 1; chunk < 8; chunk++) {
+        REQUIRE(lex(script, chunk) == std::vector<std::string>({
+            line(TYPE_PLUS, usord(3, payload)), line(TYPE_OK, "\r\nOK\r\n") }));
+    }
+    std::string usorf = std::string("\r\n+USORF: 1,\"10.0.0.1\",5683,4,\"") + std::string("\r\n\r\n", 4) + "\"";
+    REQUIRE(lex(usorf) == std::vector<std::string>({ line(TYPE_PLUS, usorf) }));
+    std::string urdfile = "\r\n+URDFILE: \"f.bin\",3,\"\n>\"\"";
+    REQUIRE(lex(urdfile) == std::vector<std::string>({ line(TYPE_PLUS, urdfile) }));
+}
+
+SCENARIO("binary payloads are moved to the sink without passing through the line", "[at_lexer]") {
+    std::string payload;
+    for (int i = 0; i < 300; i++)
+        payload += char(i * 7);
+    payload += "\r\nOK\r\n\"";
+    std::string script = "\r\n+UUSORD: 2,400\r\n" + usord(2, payload) + "\r\n\r\nOK\r\n";
+    for (size_t chunk : { 1, 2, 7, 64, 1024 }) {
+        CAPTURE(chunk);
+        // the pipe is smaller than the payload
+        Pipe<char> pipe(128);
+        Pipe<char> sink(1024);
+        AtLexer lexer;
+        lexer.setSink(&sink);
+        std::vector<std::string> lines;
+        char buf[64];
+        size_t pos = 0;
+        while (pos < script.size()) {
+            int n = pipe.put(script.data() + pos, std::min(chunk, script.size() - pos));
+            pos += n;
+            int ret;
+            while ((ret = lexer.getLine(&pipe, buf, sizeof(buf))) != WAIT)
+                lines.push_back(describe(ret, buf));
+        }
+        REQUIRE(lines == std::vector<std::string>({
+            line(TYPE_PLUS, "\r\n+UUSORD: 2,400\r\n"),
+            line(TYPE_PLUS, "\r\n+USORD: 2," + std::to_string(payload.size()) + ",\""),
+            line(TYPE_UNKNOWN, "\r\n"),
+            line(TYPE_OK, "\r\nOK\r\n") }));
+        std::string moved(sink.size(), '\0');
+        sink.get(&moved[0], moved.size());
+        REQUIRE(moved == payload);
+    }
+}
+
+SCENARIO("a payload that doesn't fit the sink is dropped", "[at_lexer]") {
+    Pipe<char> pipe(64);
+    Pipe<char> sink(8);
+    AtLexer lexer;
+    lexer.setSink(&sink);
+    char buf[64];
+    std::string script = usord(0, "0123456789abcdef") + "\r\nOK\r\n";
+    pipe.put(script.data(), script.size());
+    REQUIRE(TYPE(lexer.getLine(&pipe, buf, sizeof(buf))) == TYPE_PLUS);
+    REQUIRE(lexer.getLine(&pipe, buf, sizeof(buf)) == (TYPE_OK | 6));
+    REQUIRE(sink.size() == 7);
+}
+
+SCENARIO("the lexer returns the same lines as the original parser", "[at_lexer]") {
+    const char* const fragments[] = {
+        "\r\nOK\r\n", "\r\nERROR\r\n", "\r\n+CME ERROR: 3\r\n", "\r\n+CREG: 2,1,\"1A2B\",\"00C0FFEE\",6\r\n",
+        "\r\n+UUSORD: 1,64\r\n", "\r\n@", "\n>", "\r\n", "\r", "\n", "+", "\"", "garbage", "12345",
+        "\r\nNO CARRIER\r\n", "\r\nNO", "\r\n+USORD: 0,", "\r\n+USORF: 1,\"1.2.3.4\",80,", "\r\n+URDFILE: \"x\",",
+        "\r\n+CME ERROR:", "\r\nABORTED\r\n", "\r\nRING\r\n"
+    };
+    std::mt19937 rng(31);
+    for (int run = 0; run < 300; run++) {
+        std::string script;
+        int count = rng() % 12 + 1;
+        for (int i = 0; i < count; i++) {
+            if (rng() % 4 == 0) {
+                std::string payload(rng() % 40, '\0');
+                for (auto& c : payload) {
+                    c = "\r\n\"+OKA9x"[rng() % 8];
+                }
+                script += usord(rng() % 7, payload);
+            }
+            else {
+                script += fragments[rng() % (sizeof(fragments) / sizeof(*fragments))];
+            }
+        }
+        CAPTURE(script);
+        for (size_t chunk : { 1, 2, 3, 5, 8, 1024 }) {
+            LegacyParser legacy;
+            LexerParser lexer;
+            REQUIRE(play(script, chunk, lexer) == play(script, chunk, legacy));
+        }
+    }
+}
+
+SCENARIO("purging the pipe resets the lexer", "[at_lexer]") {
+    Pipe<char> pipe(64);
+    AtLexer lexer;
+    char buf[64];
+    std::string partial = "junk\r\n+USORD: 0,10,\"abc";
+    pipe.put(partial.data(), partial.size());
+    REQUIRE(lexer.getLine(&pipe, buf, sizeof(buf)) == WAIT);
+    while (pipe.readable())
+        pipe.getc();
+    lexer.reset();
+    pipe.put("\r\nOK\r\n", 6);
+    REQUIRE(lexer.getLine(&pipe, buf, sizeof(buf)) == (TYPE_OK | 6));
+}
+
+SCENARIO("text that fills the pipe is returned as unknown", "[at_lexer]") {
+    Pipe<char> pipe(32);
+    AtLexer lexer;
+    char buf[64];
+    std::string text(31, 'x');
+    pipe.put(text.data(), text.size());
+    REQUIRE(pipe.free() == 0);
+    REQUIRE(lexer.getLine(&pipe, buf, sizeof(buf)) == (TYPE_UNKNOWN | 31));
+    REQUIRE(lexer.getLine(&pipe, buf, sizeof(buf)) == WAIT);
+
+    // a line that can't fit is given up on, so the modem output keeps flowing
+    text = usord(0, std::string(40, 'p'));
+    pipe.put(text.data(), text.size());
+    REQUIRE(pipe.free() == 0);
+    REQUIRE(lexer.getLine(&pipe, buf, sizeof(buf)) == (TYPE_UNKNOWN | 31));
+}
+
+namespace {
+
+struct UrcTarget {
+    std::string seen;
+    void onSord(const char* args) { seen = std::string("sord:") + args; }
+    void onCreg(const char* args) { seen = std::string("creg:") + args; }
+};
+
+} // namespace
+
+SCENARIO("URCs are dispatched on their prefix", "[at_lexer]") {
+    static const AtUrcHandler<UrcTarget> urcs[] = {
+        { "UUSORD: ",   &UrcTarget::onSord },
+        { "CREG: ",     &UrcTarget::onCreg },
+    };
+    UrcTarget target;
+    REQUIRE(at_dispatch_urc(&target, urcs, "UUSORD: 1,20\r\n"));
+    REQUIRE(target.seen == "sord:1,20\r\n");
+    REQUIRE(at_dispatch_urc(&target, urcs, "CREG: 5\r\n"));
+    REQUIRE(target.seen == "creg:5\r\n");
+    REQUIRE_FALSE(at_dispatch_urc(&target, urcs, "CGREG: 5\r\n"));
+    REQUIRE_FALSE(at_dispatch_urc(&target, urcs, "UUSOR"));
+}
+
+namespace {
+
+// Feeds the script in chunks and counts the lines, without the bookkeeping of play()
+template <typename Parser>
+size_t count_lines(const std::string& script, size_t chunk, Parser& parser) {
+    Pipe<char> pipe(1024);
+    char buf[1088];
+    size_t lines = 0;
+    for (size_t pos = 0; pos < script.size(); pos += chunk) {
+        pipe.put(script.data() + pos, std::min(chunk, script.size() - pos));
+        while (parser.getLine(&pipe, buf, sizeof(buf)) != WAIT) {
+            lines++;
+        }
+    }
+    return lines;
+}
+
+} // namespace
+
+SCENARIO("benchmark AT parse cost per KB", "[.][benchmark][at_lexer]") {
+    typedef std::chrono::high_resolution_clock clock;
+    // socket reads with 512 byte payloads, polled as each 64 byte chunk arrives from the modem
+    std::string script;
+    for (int i = 0; i < 8; i++) {
+        script += "\r\n+UUSORD: 0,512\r\n" + usord(0, std::string(512, 'a' + i)) + "\r\nOK\r\n";
+    }
+    const unsigned iterations = 200;
+    size_t lines = 0;
+
+    auto start = clock::now();
+    for (unsigned i = 0; i < iterations; i++) {
+        LegacyParser legacy;
+        lines += count_lines(script, 64, legacy);
+    }
+    auto legacy = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+    start = clock::now();
+    for (unsigned i = 0; i < iterations; i++) {
+        LexerParser lexer;
+        lines -= count_lines(script, 64, lexer);
+    }
+    auto lexed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    REQUIRE(lines == 0);
+
+    double kb = script.size() * iterations / 1024.0;
+    std::cout << script.size() << " bytes of modem output: original parser " << int(legacy / kb)
+            << "ns/KB, lexer " << int(lexed / kb) << "ns/KB" << std::endl;
+}
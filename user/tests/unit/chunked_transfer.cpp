@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "chunked_transfer.h"
+
+#include <vector>
+#include <cstring>
+
+using namespace particle::protocol;
+
+namespace {
+
+const uint16_t CHUNK_SIZE = 16;
+const unsigned CHUNKS = 20;
+const uint32_t FILE_LENGTH = CHUNK_SIZE*CHUNKS;
+const uint32_t FILE_CRC = 0x1234ABCD;
+const token_t TOKEN = 7;
+
+uint32_t checksum(const unsigned char* buf, uint32_t length) {
+    uint32_t sum = 0;
+    while (length--)
+        sum = sum*31 + *buf++;
+    return sum;
+}
+
+/**
+ * What outlives a reset: the flash the file is written to and the backup RAM the progress is kept in.
+ */
+struct Storage {
+    std::vector<uint8_t> flash;
+    TransferPersistData backup;
+
+    Storage() : flash(FILE_LENGTH, 0xFF), backup() {}
+};
+
+/**
+ * Stands in for the system.
+ */
+struct TestCallbacks : public ChunkedTransfer::Callbacks {
+    std::vector<uint8_t>& flash;
+    TransferPersistData& backup;
+    std::vector<uint8_t> prepared;     // the file flags of each update begun
+    std::vector<uint32_t> finished;    // the flags of each update finished
+    unsigned writes = 0;
+    system_tick_t now = 0;
+    bool resumable = true;             // the storage still holds the chunks received
+    int failed_chunk = -1;             // the address of a chunk that can't be saved
+
+    TestCallbacks(Storage& storage) : flash(storage.flash), backup(storage.backup) {}
+
+    int prepare_for_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*) override {
+        if (!(flags & 1)) {
+            prepared.push_back(data.flags);
+            if ((data.flags & FileTransfer::Flags::RESUME) && !resumable)
+                return 1;
+            if (!(data.flags & FileTransfer::Flags::RESUME))
+                std::fill(flash.begin(), flash.end(), 0xFF);
+        }
+        return 0;
+    }
+
+    int save_firmware_chunk(FileTransfer::Descriptor& descriptor, const unsigned char* chunk, void*) override {
+        if (int(descriptor.chunk_address)==failed_chunk)
+            return 1;
+        std::memcpy(flash.data()+descriptor.chunk_address, chunk, descriptor.chunk_size);
+        writes++;
+        return 0;
+    }
+
+    int finish_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*) override {
+        finished.push_back(flags);
+        return 0;
+    }
+
+    uint32_t calculate_crc(const unsigned char *buf, uint32_t buflen) override {
+        return checksum(buf, buflen);
+    }
+
+    system_tick_t millis() override {
+        return now;
+    }
+
+    int save_transfer_progress(const TransferPersistData& progress) override {
+        backup = progress;
+        return 0;
+    }
+
+    bool restore_transfer_progress(TransferPersistData& progress) override {
+        progress = backup;
+        return backup.size==sizeof(backup);
+    }
+};
+
+/**
+ * Plays the server's side of the connection. Messages are received in the channel buffer,
+ * as they are by the real channels.
+ */
+class TestChannel : public MessageChannel {
+    uint8_t queue[PROTOCOL_BUFFER_SIZE];
+
+public:
+    std::vector<std::vector<uint8_t>> sent;
+
+    ProtocolError create(Message& message, size_t minimum_size=0) override {
+        message.clear();
+        message.set_buffer(queue, sizeof(queue));
+        return NO_ERROR;
+    }
+
+    ProtocolError response(Message& original, Message& response, size_t required) override {
+        size_t end = original.buf()+original.length()-queue;
+        response.set_buffer(queue+end, sizeof(queue)-end);
+        return NO_ERROR;
+    }
+
+    ProtocolError receive(Message& message) override { return NO_ERROR; }
+    ProtocolError command(Command cmd, void* arg) override { return NO_ERROR; }
+    bool is_unreliable() override { return true; }
+    ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override { return NO_ERROR; }
+    ProtocolError notify_established() override { return NO_ERROR; }
+
+    ProtocolError send(Message& message) override {
+        sent.push_back(std::vector<uint8_t>(message.buf(), message.buf()+message.length()));
+        return NO_ERROR;
+    }
+
+    Message deliver(const std::vector<uint8_t>& data) {
+        Message message;
+        create(message);
+        message.copy(data.data(), data.size());
+        return message;
+    }
+};
+
+std::vector<uint8_t> image() {
+    std::vector<uint8_t> data(FILE_LENGTH);
+    for (unsigned i=0; i<FILE_LENGTH; i++)
+        data[i] = uint8_t(i*7 + i/CHUNK_SIZE);
+    return data;
+}
+
+void put_u32(std::vector<uint8_t>& data, uint32_t value) {
+    data.push_back(value >> 24);
+    data.push_back(value >> 16);
+    data.push_back(value >> 8);
+    data.push_back(value);
+}
+
+std::vector<uint8_t> update_begin(bool with_crc, uint32_t crc=FILE_CRC) {
+    std::vector<uint8_t> data = { 0x40, 0x02, 0x00, 0x01, TOKEN, 0xb1, 'u', 0xFF,
+        0x01, CHUNK_SIZE >> 8, CHUNK_SIZE & 0xFF };      // fast OTA
+    put_u32(data, FILE_LENGTH);
+    data.push_back(FileTransfer::Store::FIRMWARE);
+    put_u32(data, 0);
+    if (with_crc)
+        put_u32(data, crc);
+    return data;
+}
+
+std::vector<uint8_t> chunk(const std::vector<uint8_t>& file, chunk_index_t index) {
+    std::vector<uint8_t> data = { 0x50, 0x02, 0x00, 0x02, TOKEN, 0xb1, 'c', 0x44 };
+    put_u32(data, checksum(file.data()+index*CHUNK_SIZE, CHUNK_SIZE));
+    data.push_back(0x42);
+    data.push_back(index >> 8);
+    data.push_back(index & 0xFF);
+    data.push_back(0xFF);
+    data.insert(data.end(), file.begin()+index*CHUNK_SIZE, file.begin()+(index+1)*CHUNK_SIZE);
+    return data;
+}
+
+std::vector<uint8_t> update_done() {
+    return { 0x40, 0x03, 0x00, 0x03, TOKEN, 0xb1, 'u' };
+}
+
+/**
+ * A device connected to the server.
+ */
+struct Device {
+    TestCallbacks callbacks;
+    TestChannel channel;
+    ChunkedTransfer transfer;
+
+    Device(Storage& storage) : callbacks(storage) {
+        transfer.init(&callbacks);
+        transfer.reset();
+    }
+
+    void begin(bool with_crc, uint32_t crc=FILE_CRC) {
+        Message message = channel.deliver(update_begin(with_crc, crc));
+        REQUIRE(transfer.handle_update_begin(TOKEN, message, channel)==NO_ERROR);
+    }
+
+    void send_chunk(const std::vector<uint8_t>& file, chunk_index_t index) {
+        Message message = channel.deliver(chunk(file, index));
+        REQUIRE(transfer.handle_chunk(TOKEN, message, channel)==NO_ERROR);
+    }
+
+    void done() {
+        Message message = channel.deliver(update_done());
+        REQUIRE(transfer.handle_update_done(TOKEN, message, channel)==NO_ERROR);
+    }
+
+    /**
+     * The payload of UpdateReady: the flags and, when resuming, the chunks received.
+     */
+    std::vector<uint8_t> update_ready() {
+        for (auto& message : channel.sent)
+            if (message.size()>6 && message[1]==0x44 && message[5]==0xFF)
+                return std::vector<uint8_t>(message.begin()+6, message.end());
+        return std::vector<uint8_t>();
+    }
+
+    /**
+     * The chunks last requested by the device.
+     */
+    std::vector<chunk_index_t> missing() {
+        std::vector<chunk_index_t> chunks;
+        for (auto& message : channel.sent)
+            if (message.size()>7 && message[1]==0x01 && message[5]=='c') {
+                chunks.clear();
+                for (size_t i=7; i+1<message.size(); i+=2)
+                    chunks.push_back(message[i]<<8 | message[i+1]);
+            }
+        return chunks;
+    }
+};
+
+/**
+ * Starts an update and receives all chunks but chunk 4 and those from 10, then loses the connection.
+ */
+void interrupted_transfer(Storage& storage, const std::vector<uint8_t>& file) {
+    Device device(storage);
+    device.begin(true);
+    for (chunk_index_t i=0; i<10; i++)
+        if (i!=4)
+            device.send_chunk(file, i);
+    // the connection is lost, which cancels the update
+    device.transfer.cancel();
+    REQUIRE(device.callbacks.finished==std::vector<uint32_t>{0});
+}
+
+} // namespace
+
+SCENARIO("a fast OTA transfer interrupted by a disconnect resumes from the chunks received", "[chunked_transfer]") {
+    Storage storage;
+    std::vector<uint8_t> file = image();
+    interrupted_transfer(storage, file);
+    REQUIRE(storage.backup.size==sizeof(storage.backup));
+
+    // the device reconnects, and the server begins the same update again
+    Device device(storage);
+    device.begin(true);
+    REQUIRE(device.callbacks.prepared==std::vector<uint8_t>{FileTransfer::Flags::RESUME});
+
+    std::vector<uint8_t> ready = device.update_ready();
+    REQUIRE(ready==(std::vector<uint8_t>{ 0x3, 0xEF, 0x03, 0x00 }));
+
+    // the server sends nothing more, so the device asks for the chunks it doesn't have
+    device.done();
+    std::vector<chunk_index_t> expected = { 4, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19 };
+    REQUIRE(device.missing()==expected);
+    for (chunk_index_t index : expected)
+        device.send_chunk(file, index);
+
+    REQUIRE(device.callbacks.finished==std::vector<uint32_t>{1});
+    REQUIRE(device.callbacks.writes==expected.size());
+    REQUIRE(device.callbacks.flash==file);
+    REQUIRE(storage.backup.size==0);
+}
+
+SCENARIO("chunks received before an interruption aren't written again when the server sends them", "[chunked_transfer]") {
+    Storage storage;
+    std::vector<uint8_t> file = image();
+    interrupted_transfer(storage, file);
+
+    Device device(storage);
+    device.begin(true);
+    for (chunk_index_t i=0; i<CHUNKS; i++)
+        device.send_chunk(file, i);
+    device.done();
+
+    REQUIRE(device.callbacks.writes==11);
+    REQUIRE(device.callbacks.finished==std::vector<uint32_t>{1});
+    REQUIRE(device.callbacks.flash==file);
+}
+
+SCENARIO("a different file isn't resumed", "[chunked_transfer]") {
+    Storage storage;
+    std::vector<uint8_t> file = image();
+    interrupted_transfer(storage, file);
+
+    Device device(storage);
+    device.begin(true, FILE_CRC+1);
+    REQUIRE(device.callbacks.prepared==std::vector<uint8_t>{0});
+    REQUIRE(device.update_ready()==std::vector<uint8_t>{0x1});
+    // the storage was erased, so the progress no longer applies
+    REQUIRE(storage.backup.size==0);
+
+    for (chunk_index_t i=0; i<CHUNKS; i++)
+        device.send_chunk(file, i);
+    device.done();
+    REQUIRE(device.callbacks.writes==CHUNKS);
+    REQUIRE(device.callbacks.flash==file);
+}
+
+SCENARIO("progress is discarded when the storage can't be resumed", "[chunked_transfer]") {
+    Storage storage;
+    std::vector<uint8_t> file = image();
+    interrupted_transfer(storage, file);
+
+    Device device(storage);
+    device.callbacks.resumable = false;
+    device.begin(true);
+    REQUIRE(device.callbacks.prepared==std::vector<uint8_t>{FileTransfer::Flags::RESUME});
+    REQUIRE(device.update_ready().empty());
+    REQUIRE(storage.backup.size==0);
+
+    // the next attempt starts afresh
+    Device retried(storage);
+    retried.begin(true);
+    REQUIRE(retried.callbacks.prepared==std::vector<uint8_t>{0});
+}
+
+SCENARIO("progress isn't kept when the server doesn't give the file CRC", "[chunked_transfer]") {
+    Storage storage;
+    std::vector<uint8_t> file = image();
+    Device device(storage);
+    device.begin(false);
+    for (chunk_index_t i=0; i<10; i++)
+        device.send_chunk(file, i);
+    device.transfer.cancel();
+    REQUIRE(storage.backup.size==0);
+
+    Device reconnected(storage);
+    reconnected.begin(false);
+    REQUIRE(reconnected.callbacks.prepared==std::vector<uint8_t>{0});
+}
+
+SCENARIO("a chunk that can't be saved fails the update without waiting for the rest of the file", "[chunked_transfer]") {
+    Storage storage;
+    std::vector<uint8_t> file = image();
+    Device device(storage);
+    device.callbacks.failed_chunk = 3*CHUNK_SIZE;
+    device.begin(true);
+    for (chunk_index_t i=0; i<4; i++)
+        device.send_chunk(file, i);
+
+    REQUIRE(device.callbacks.finished==std::vector<uint32_t>{0});
+    REQUIRE(device.callbacks.writes==3);
+    REQUIRE_FALSE(device.transfer.is_updating());
+    // the file is refused, so it isn't resumed either
+    REQUIRE(storage.backup.size==0);
+
+    // a disconnect doesn't fail the update a second time
+    device.transfer.cancel();
+    REQUIRE(device.callbacks.finished==std::vector<uint32_t>{0});
+}
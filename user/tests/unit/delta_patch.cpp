@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "delta_patch.h"
+#include "delta_encoder.h"
+#include "flash_simulator.h"
+
+#include <vector>
+#include <algorithm>
+
+namespace {
+
+const uint32_t MODULE_ADDRESS = 0x80A0000;
+const uint32_t OTA_ADDRESS = 0x80C0000;
+const uint32_t SECTOR = 16384;
+
+// Stands in for a compiled module: mostly unique bytes, so matches only come from real reuse
+std::vector<uint8_t> firmware(size_t length, uint32_t seed = 12345) {
+    std::vector<uint8_t> data(length);
+    for (auto& b : data) {
+        seed = seed * 1103515245 + 12345;
+        b = uint8_t(seed >> 16);
+    }
+    return data;
+}
+
+// The installed module and the OTA region, on simulated flash
+struct Device {
+    FlashSimulator installed;
+    FlashSimulator ota;
+
+    Device(const std::vector<uint8_t>& module) :
+        installed(MODULE_ADDRESS, SECTOR, 8, true),
+        ota(OTA_ADDRESS, SECTOR, 8, true) {
+        installed.fill(MODULE_ADDRESS, module);
+    }
+
+    static int read(void* context, uint32_t offset, uint8_t* data, uint32_t length) {
+        Device& device = *static_cast<Device*>(context);
+        std::copy_n(device.installed.at(MODULE_ADDRESS + offset), length, data);
+        return 0;
+    }
+
+    // the sink, as HAL_FLASH_Update
+    static int write(void* context, uint32_t offset, const uint8_t* data, uint32_t length) {
+        Device& device = *static_cast<Device*>(context);
+        return device.ota.io()->write(device.ota.io(), OTA_ADDRESS + offset, data, length);
+    }
+
+    // applies a patch received in chunks of the given size
+    int apply(const std::vector<uint8_t>& patch, size_t chunk) {
+        uint8_t buffer[512];
+        delta_patch p;
+        delta_patch_init(&p, read, write, this, buffer, sizeof(buffer));
+        int result = 0;
+        for (size_t pos = 0; pos < patch.size() && result == 0; pos += chunk) {
+            result = delta_patch_update(&p, patch.data() + pos, std::min(chunk, patch.size() - pos));
+        }
+        return result;
+    }
+};
+
+// a new build of the module: code inserted, a constant changed and more appended
+std::vector<uint8_t> rebuild(const std::vector<uint8_t>& module) {
+    std::vector<uint8_t> target = module;
+    std::vector<uint8_t> inserted = firmware(300, 99);
+    target.insert(target.begin() + 10000, inserted.begin(), inserted.end());
+    target[40000] ^= 0xFF;
+    target[40001] ^= 0x55;
+    std::vector<uint8_t> appended = firmware(1000, 7);
+    target.insert(target.end() - 4, appended.begin(), appended.end());
+    return target;
+}
+
+} // namespace
+
+SCENARIO("a delta patch rebuilds the new image from the installed one", "[delta_patch]") {
+    std::vector<uint8_t> module = firmware(60000);
+    std::vector<uint8_t> target = rebuild(module);
+    std::vector<uint8_t> patch = DeltaEncoder(module, MODULE_ADDRESS).encode(target);
+
+    // about the size of what changed
+    REQUIRE(patch.size() < 1500 + 200);
+
+    delta_patch_header header;
+    REQUIRE(delta_patch_parse_header(patch.data(), patch.size(), &header) == 0);
+    REQUIRE(header.reference_address == MODULE_ADDRESS);
+    REQUIRE(header.reference_length == module.size());
+    REQUIRE(header.reference_crc == DeltaEncoder::crc32(module.data(), module.size()));
+    REQUIRE(header.target_length == target.size());
+    REQUIRE(delta_patch_length(patch.data(), patch.size()) == int32_t(patch.size()));
+
+    for (size_t chunk : { size_t(1), size_t(7), size_t(512), patch.size() }) {
+        Device device(module);
+        REQUIRE(device.apply(patch, chunk) == DELTA_PATCH_COMPLETE);
+        REQUIRE(device.ota.read(OTA_ADDRESS, target.size()) == target);
+        // the image is written in whole buffers, as the flash is programmed
+        REQUIRE(device.ota.stats().writes == (target.size() + 511) / 512);
+        REQUIRE(device.ota.stats().violations == 0);
+    }
+}
+
+SCENARIO("a delta patch between unrelated images holds the whole image", "[delta_patch]") {
+    std::vector<uint8_t> module = firmware(20000, 1);
+    std::vector<uint8_t> target = firmware(20000, 2);
+    std::vector<uint8_t> patch = DeltaEncoder(module, MODULE_ADDRESS).encode(target);
+    REQUIRE(patch.size() < target.size() + 64);
+
+    Device device(module);
+    REQUIRE(device.apply(patch, 512) == DELTA_PATCH_COMPLETE);
+    REQUIRE(device.ota.read(OTA_ADDRESS, target.size()) == target);
+}
+
+SCENARIO("a delta patch for an unchanged image is tiny", "[delta_patch]") {
+    std::vector<uint8_t> module = firmware(50000);
+    std::vector<uint8_t> patch = DeltaEncoder(module, MODULE_ADDRESS).encode(module);
+    REQUIRE(patch.size() < DELTA_PATCH_HEADER_SIZE + 16);
+
+    Device device(module);
+    REQUIRE(device.apply(patch, 512) == DELTA_PATCH_COMPLETE);
+    REQUIRE(device.ota.read(OTA_ADDRESS, module.size()) == module);
+}
+
+SCENARIO("malformed delta patches are rejected", "[delta_patch]") {
+    std::vector<uint8_t> module = firmware(30000);
+    std::vector<uint8_t> target = rebuild(module);
+    std::vector<uint8_t> patch = DeltaEncoder(module, MODULE_ADDRESS).encode(target);
+    Device device(module);
+
+    WHEN("the patch is cut short") {
+        patch.resize(patch.size() / 2);
+        THEN("the image is not completed") {
+            REQUIRE(device.apply(patch, 512) == 0);
+            REQUIRE(delta_patch_length(patch.data(), patch.size()) < 0);
+        }
+    }
+
+    WHEN("a copy reaches past the reference") {
+        std::vector<uint8_t> bad(patch.begin(), patch.begin() + DELTA_PATCH_HEADER_SIZE);
+        bad.push_back(DELTA_PATCH_OP_COPY);
+        bad.push_back(0x80 | 0x7F); bad.push_back(0x7F);    // offset 16383
+        bad.push_back(0x80); bad.push_back(0x80); bad.push_back(0x01);  // 16384 bytes
+        THEN("the patch fails") {
+            REQUIRE(device.apply(bad, 512) == DELTA_PATCH_ERROR_RANGE);
+        }
+    }
+
+    WHEN("the operations produce more than the target length") {
+        std::vector<uint8_t> bad(patch.begin(), patch.begin() + DELTA_PATCH_HEADER_SIZE);
+        bad[20] = 4; bad[21] = bad[22] = bad[23] = 0;     // target length 4
+        bad.push_back(DELTA_PATCH_OP_COPY);
+        bad.push_back(0);
+        bad.push_back(8);
+        THEN("the patch fails") {
+            REQUIRE(device.apply(bad, 512) == DELTA_PATCH_ERROR_LENGTH);
+        }
+    }
+
+    WHEN("the data isn't a patch") {
+        THEN("it is not recognized") {
+            REQUIRE_FALSE(delta_patch_is_patch(target.data(), target.size()));
+            REQUIRE(device.apply(target, 512) == DELTA_PATCH_ERROR_FORMAT);
+        }
+    }
+}
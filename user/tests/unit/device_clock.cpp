@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "device_clock.h"
+#include "timer_hal.h"
+#include "delay_hal.h"
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Uses the given clock for the lifetime of this object
+class ClockScope
+{
+    DeviceClock& previous;
+
+public:
+    ClockScope(DeviceClock& clock) : previous(device_clock()) {
+        set_device_clock(clock);
+    }
+
+    ~ClockScope() {
+        set_device_clock(previous);
+    }
+};
+
+} // namespace
+
+SCENARIO("the monotonic clock follows real time", "[device_clock]") {
+    MonotonicClock clock;
+    uint64_t start = clock.now_micros();
+    clock.sleep_micros(2000);
+    uint64_t elapsed = clock.now_micros() - start;
+    REQUIRE(elapsed >= 2000);
+    REQUIRE(elapsed < 1000000);
+}
+
+SCENARIO("the fast clock moves only when the device waits", "[device_clock]") {
+    FastForwardClock clock;
+    ClockScope scope(clock);
+
+    REQUIRE(HAL_Timer_Get_Milli_Seconds() == 0);
+    REQUIRE(HAL_Timer_Get_Milli_Seconds() == 0);
+
+    // the longest CoAP retransmit span passes instantly
+    HAL_Delay_Milliseconds(45000);
+    REQUIRE(HAL_Timer_Get_Milli_Seconds() == 45000);
+
+    HAL_Delay_Microseconds(250);
+    REQUIRE(HAL_Timer_Get_Micro_Seconds() == 45000250);
+
+    clock.advance(24ULL * 60 * 60 * 1000000);
+    REQUIRE(clock.now_micros() == 45000250 + 24ULL * 60 * 60 * 1000000);
+}
+
+SCENARIO("polling the fast clock with a poll step moves it forward", "[device_clock]") {
+    const uint64_t step = FastForwardClock::DEFAULT_POLL_STEP;
+    FastForwardClock clock(step);
+    ClockScope scope(clock);
+
+    // as SparkProtocol::event_loop() waits for a message, without delaying
+    unsigned polls = 0;
+    system_tick_t start = HAL_Timer_Get_Milli_Seconds();
+    while (HAL_Timer_Get_Milli_Seconds() - start < 2000) {
+        polls++;
+    }
+    // reading the start took a step
+    REQUIRE(polls == 2000 * 1000 / step - 1);
+
+    // delays still jump to their end
+    uint64_t before = clock.now_micros();
+    HAL_Delay_Milliseconds(1000);
+    uint64_t elapsed = clock.now_micros() - before;
+    REQUIRE(elapsed >= 1000000);
+    REQUIRE(elapsed <= 1000000 + 4 * step);
+}
+
+SCENARIO("concurrent waits on the fast clock end at the latest deadline", "[device_clock]") {
+    FastForwardClock clock;
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i <= 8; i++) {
+        threads.emplace_back([&clock, i]() {
+            clock.sleep_micros(i * 1000);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    REQUIRE(clock.now_micros() >= 8000);
+    REQUIRE(clock.now_micros() <= 36000);
+}
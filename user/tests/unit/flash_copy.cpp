@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "flash_copy.h"
+#include "flash_simulator.h"
+
+#include <vector>
+#include <iostream>
+
+namespace {
+
+const uint32_t SERIAL_BASE = 0x10000;
+const uint32_t INTERNAL_BASE = 0x8020000;
+const uint32_t SECTOR = 4096;
+
+std::vector<uint8_t> pattern(size_t length, unsigned seed = 1) {
+    std::vector<uint8_t> data(length);
+    for (size_t i = 0; i < length; i++) {
+        data[i] = uint8_t((i * 31 + seed * 17) ^ (i >> 8));
+    }
+    return data;
+}
+
+// serial flash source with 4K sectors, internal destination with 4K sectors
+struct Devices {
+    FlashSimulator serial;
+    FlashSimulator internal;
+
+    Devices(bool async = false, bool mapped = false) :
+        serial(SERIAL_BASE, SECTOR, 16, mapped, async),
+        internal(INTERNAL_BASE, SECTOR, 16, true) {
+    }
+
+    void reset_stats() {
+        serial.reset_stats();
+        internal.reset_stats();
+    }
+};
+
+} // namespace
+
+SCENARIO("flash_copy copies between devices a block at a time", "[flash_copy]") {
+    Devices d;
+    const uint32_t length = SECTOR * 3 + 100;
+    std::vector<uint8_t> image = pattern(length);
+    d.serial.fill(SERIAL_BASE, image);
+    d.internal.fill(INTERNAL_BASE, pattern(SECTOR * 4, 2));
+
+    uint8_t buffer[512];
+    REQUIRE(flash_copy(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, buffer, sizeof(buffer)) == 0);
+
+    REQUIRE(d.internal.read(INTERNAL_BASE, length) == image);
+    REQUIRE(d.internal.stats().violations == 0);
+    REQUIRE(d.internal.stats().erases == 4);
+    // 256 byte blocks, which don't cross a destination sector
+    REQUIRE(d.serial.stats().reads == 16 * 3 + 1);
+    REQUIRE(d.serial.stats().read_bytes == length);
+    REQUIRE(d.internal.stats().writes == 16 * 3 + 1);
+}
+
+SCENARIO("flash_copy programs a mapped source directly", "[flash_copy]") {
+    Devices d(false, true);
+    const uint32_t length = SECTOR * 2;
+    std::vector<uint8_t> image = pattern(length);
+    d.serial.fill(SERIAL_BASE, image);
+
+    REQUIRE(flash_copy(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, nullptr, 0) == 0);
+
+    REQUIRE(d.internal.read(INTERNAL_BASE, length) == image);
+    REQUIRE(d.serial.stats().reads == 0);
+    REQUIRE(d.internal.stats().writes == 2);
+}
+
+SCENARIO("flash_copy reads the next block while the current one is programmed", "[flash_copy]") {
+    Devices d(true);
+    const uint32_t length = SECTOR * 2;
+    std::vector<uint8_t> image = pattern(length);
+    d.serial.fill(SERIAL_BASE, image);
+
+    uint8_t buffer[1024];
+    REQUIRE(flash_copy(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, buffer, sizeof(buffer)) == 0);
+
+    REQUIRE(d.internal.read(INTERNAL_BASE, length) == image);
+    unsigned reads = d.serial.stats().reads;
+    REQUIRE(reads == 16);
+    // all but the first read of each sector run alongside programming
+    REQUIRE(d.serial.stats().overlapped == reads - 2);
+}
+
+SCENARIO("flash_copy stops at the first error", "[flash_copy]") {
+    Devices d(true);
+    uint8_t buffer[512];
+
+    WHEN("the destination can't be written") {
+        uint32_t start = INTERNAL_BASE + SECTOR * 15;
+        int result = flash_copy(d.serial.io(), SERIAL_BASE, d.internal.io(), start, SECTOR * 2, buffer, sizeof(buffer));
+        THEN("the copy fails") {
+            REQUIRE(result == FLASH_COPY_ERROR_ERASE);
+            REQUIRE(d.internal.stats().erases == 1);
+        }
+    }
+
+    WHEN("the source can't be read") {
+        uint32_t start = SERIAL_BASE + SECTOR * 15;
+        int result = flash_copy(d.serial.io(), start, d.internal.io(), INTERNAL_BASE, SECTOR * 2, buffer, sizeof(buffer));
+        THEN("the copy fails") {
+            REQUIRE(result == FLASH_COPY_ERROR_READ);
+        }
+    }
+
+    WHEN("there is no buffer for a source that isn't mapped") {
+        int result = flash_copy(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, SECTOR, buffer, 4);
+        THEN("the copy is refused") {
+            REQUIRE(result == FLASH_COPY_ERROR_ARGUMENT);
+            REQUIRE(d.internal.stats().erases == 0);
+        }
+    }
+}
+
+SCENARIO("flash_compare compares devices a block at a time", "[flash_copy]") {
+    Devices d;
+    const uint32_t length = SECTOR + 10;
+    d.serial.fill(SERIAL_BASE, pattern(length));
+    d.internal.fill(INTERNAL_BASE, pattern(length));
+    uint8_t buffer[512];
+
+    REQUIRE(flash_compare(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, buffer, sizeof(buffer)) == 0);
+    REQUIRE(d.serial.stats().read_bytes == length);
+
+    *d.internal.at(INTERNAL_BASE + length - 1) ^= 1;
+    REQUIRE(flash_compare(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, buffer, sizeof(buffer)) == FLASH_COPY_MISMATCH);
+}
+
+SCENARIO("flash_copy_scan presents the source and finds the sectors that differ", "[flash_copy]") {
+    Devices d;
+    const uint32_t length = SECTOR * 4;
+    std::vector<uint8_t> image = pattern(length);
+    d.serial.fill(SERIAL_BASE, image);
+    d.internal.fill(INTERNAL_BASE, image);
+    d.internal.at(INTERNAL_BASE + SECTOR * 2 + 7)[0] ^= 0x10;
+    d.internal.at(INTERNAL_BASE + SECTOR * 3 + SECTOR - 1)[0] ^= 0x01;
+
+    std::vector<uint8_t> observed;
+    auto observe = [](void* context, uint32_t offset, const uint8_t* data, uint32_t length) {
+        std::vector<uint8_t>& observed = *static_cast<std::vector<uint8_t>*>(context);
+        REQUIRE(offset == observed.size());
+        observed.insert(observed.end(), data, data + length);
+    };
+    uint8_t buffer[512];
+    uint32_t changed = 0;
+    REQUIRE(flash_copy_scan(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, buffer, sizeof(buffer),
+            observe, &observed, &changed) == 0);
+
+    REQUIRE(changed == 0xC);
+    REQUIRE(observed == image);
+    REQUIRE(d.serial.stats().read_bytes == length);
+    REQUIRE(d.internal.stats().writes == 0);
+    REQUIRE(d.internal.stats().erases == 0);
+}
+
+SCENARIO("flash_copy_sectors only erases and programs changed sectors", "[flash_copy]") {
+    Devices d;
+    const uint32_t length = SECTOR * 8;
+    std::vector<uint8_t> previous = pattern(length, 1);
+    std::vector<uint8_t> image = previous;
+    // an update that changes a few bytes in two sectors
+    image[SECTOR * 1 + 100] ^= 0xFF;
+    image[SECTOR * 6 + 3] ^= 0x5A;
+    d.serial.fill(SERIAL_BASE, image);
+    d.internal.fill(INTERNAL_BASE, previous);
+
+    uint8_t buffer[512];
+    uint32_t changed = 0;
+    REQUIRE(flash_copy_scan(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, buffer, sizeof(buffer),
+            nullptr, nullptr, &changed) == 0);
+    REQUIRE(flash_copy_sectors(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, buffer, sizeof(buffer), changed) == 0);
+
+    REQUIRE(d.internal.read(INTERNAL_BASE, length) == image);
+    REQUIRE(d.internal.stats().erases == 2);
+    REQUIRE(d.internal.stats().written_bytes == SECTOR * 2);
+    REQUIRE(d.internal.stats().violations == 0);
+    // the scan reads the source once, the copy only the changed sectors
+    REQUIRE(d.serial.stats().read_bytes == length + SECTOR * 2);
+
+    WHEN("the destination already matches") {
+        d.reset_stats();
+        REQUIRE(flash_copy_scan(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, buffer, sizeof(buffer),
+                nullptr, nullptr, &changed) == 0);
+        REQUIRE(flash_copy_sectors(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, buffer, sizeof(buffer), changed) == 0);
+        THEN("nothing is erased or programmed") {
+            REQUIRE(changed == 0);
+            REQUIRE(d.internal.stats().erases == 0);
+            REQUIRE(d.internal.stats().writes == 0);
+        }
+    }
+}
+
+SCENARIO("sectors beyond those tracked by the scan are always copied", "[flash_copy]") {
+    FlashSimulator src(SERIAL_BASE, 256, FLASH_COPY_MAX_SECTORS + 4);
+    FlashSimulator dst(INTERNAL_BASE, 256, FLASH_COPY_MAX_SECTORS + 4, true);
+    const uint32_t length = src.length();
+    std::vector<uint8_t> image = pattern(length);
+    src.fill(SERIAL_BASE, image);
+    dst.fill(INTERNAL_BASE, image);
+
+    uint8_t buffer[64];
+    uint32_t changed = 0;
+    REQUIRE(flash_copy_scan(src.io(), SERIAL_BASE, dst.io(), INTERNAL_BASE, length, buffer, sizeof(buffer), nullptr, nullptr, &changed) == 0);
+    REQUIRE(changed == 0);
+    REQUIRE(flash_copy_sectors(src.io(), SERIAL_BASE, dst.io(), INTERNAL_BASE, length, buffer, sizeof(buffer), changed) == 0);
+    REQUIRE(dst.stats().erases == 4);
+    REQUIRE(dst.read(INTERNAL_BASE, length) == image);
+}
+
+SCENARIO("benchmark copying a module from serial flash", "[.][benchmark][flash_copy]") {
+    const uint32_t length = SECTOR * 16;
+    std::vector<uint8_t> image = pattern(length);
+
+    struct Run { const char* name; bool async; uint32_t buffer; };
+    const Run runs[] = {
+        { "word at a time", false, 8 },
+        { "512 byte buffer", false, 512 },
+        { "512 byte buffer, overlapped reads", true, 512 },
+    };
+    for (const Run& run : runs) {
+        Devices d(run.async);
+        // 30MHz SPI with a 4 byte command per read, internal flash programmed at 16us per word
+        d.serial.timing().transaction = 1500;
+        d.serial.timing().read_byte = 270;
+        d.internal.timing().transaction = 100;
+        d.internal.timing().write_byte = 4000;
+        d.serial.fill(SERIAL_BASE, image);
+        std::vector<uint8_t> buffer(run.buffer);
+
+        FlashSimulator::reset_clock();
+        REQUIRE(flash_copy(d.serial.io(), SERIAL_BASE, d.internal.io(), INTERNAL_BASE, length, buffer.data(), run.buffer) == 0);
+        uint64_t elapsed = FlashSimulator::now();
+        std::cout << run.name << ": " << d.serial.stats().reads << " reads, " << d.internal.stats().writes
+                << " writes, " << elapsed / 1000 << "us for " << length / 1024 << "KB" << std::endl;
+    }
+}
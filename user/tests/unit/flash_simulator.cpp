@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "flash_simulator.h"
+
+#include <algorithm>
+#include <cstring>
+
+uint64_t FlashSimulator::clock_ = 0;
+unsigned FlashSimulator::operations_ = 0;
+
+FlashSimulator::FlashSimulator(uint32_t base, uint32_t sector, unsigned sectors, bool mapped, bool async) :
+        base_(base), sector_(sector), data_(size_t(sector) * sectors, 0xFF)
+{
+    std::memset(&io_, 0, sizeof(io_));
+    io_.size = sizeof(io_);
+    io_.context = this;
+    io_.map = mapped ? io_map : nullptr;
+    io_.read = io_read;
+    io_.sync = async ? io_sync : nullptr;
+    io_.write = io_write;
+    io_.erase = io_erase;
+    io_.sector_end = io_sector_end;
+}
+
+void FlashSimulator::fill(uint32_t address, const std::vector<uint8_t>& data)
+{
+    std::copy(data.begin(), data.end(), at(address));
+}
+
+std::vector<uint8_t> FlashSimulator::read(uint32_t address, uint32_t length)
+{
+    return std::vector<uint8_t>(at(address), at(address) + length);
+}
+
+bool FlashSimulator::contains(uint32_t address, uint32_t length) const
+{
+    return address >= base_ && address - base_ + uint64_t(length) <= data_.size();
+}
+
+const uint8_t* FlashSimulator::io_map(const flash_io* io, uint32_t address)
+{
+    FlashSimulator& flash = self(io);
+    return flash.contains(address, 0) ? flash.at(address) : nullptr;
+}
+
+int FlashSimulator::io_read(const flash_io* io, uint32_t address, uint8_t* data, uint32_t length)
+{
+    FlashSimulator& flash = self(io);
+    if (!flash.contains(address, length) || flash.pending_)
+        return -1;
+    operations_++;
+    flash.stats_.reads++;
+    flash.stats_.read_bytes += length;
+    uint64_t cost = flash.timing_.transaction + uint64_t(flash.timing_.read_byte) * length;
+    if (io->sync)
+    {
+        flash.pending_ = data;
+        flash.pending_address_ = address;
+        flash.pending_length_ = length;
+        flash.pending_done_ = clock_ + cost;
+        flash.pending_mark_ = operations_;
+    }
+    else
+    {
+        std::memcpy(data, flash.at(address), length);
+        clock_ += cost;
+    }
+    return 0;
+}
+
+int FlashSimulator::io_sync(const flash_io* io)
+{
+    FlashSimulator& flash = self(io);
+    if (!flash.pending_)
+        return 0;
+    std::memcpy(flash.pending_, flash.at(flash.pending_address_), flash.pending_length_);
+    if (operations_ != flash.pending_mark_)
+        flash.stats_.overlapped++;
+    clock_ = std::max(clock_, flash.pending_done_);
+    flash.pending_ = nullptr;
+    return 0;
+}
+
+int FlashSimulator::io_write(const flash_io* io, uint32_t address, const uint8_t* data, uint32_t length)
+{
+    FlashSimulator& flash = self(io);
+    if (!flash.contains(address, length))
+        return -1;
+    operations_++;
+    flash.stats_.writes++;
+    flash.stats_.written_bytes += length;
+    clock_ += flash.timing_.transaction + uint64_t(flash.timing_.write_byte) * length;
+    uint8_t* target = flash.at(address);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (data[i] & ~target[i])
+            flash.stats_.violations++;
+        target[i] &= data[i];
+    }
+    return 0;
+}
+
+int FlashSimulator::io_erase(const flash_io* io, uint32_t address)
+{
+    FlashSimulator& flash = self(io);
+    if (!flash.contains(address, 1))
+        return -1;
+    operations_++;
+    flash.stats_.erases++;
+    clock_ += flash.timing_.erase;
+    uint32_t start = address - (address - flash.base_) % flash.sector_;
+    std::fill_n(flash.at(start), flash.sector_, 0xFF);
+    return 0;
+}
+
+uint32_t FlashSimulator::io_sector_end(const flash_io* io, uint32_t address)
+{
+    FlashSimulator& flash = self(io);
+    return address - (address - flash.base_) % flash.sector_ + flash.sector_;
+}
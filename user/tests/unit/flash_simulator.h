@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "flash_copy.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A RAM-backed flash device for the copy engine. It behaves as NOR flash:
+ * erasing sets a sector to 0xFF and programming can only clear bits.
+ *
+ * Each operation is charged to a simulated clock shared by all devices, so
+ * copies between devices can be timed. A device with asynchronous reads
+ * charges a read to its own bus, which runs while the clock moves on with other
+ * work, and the clock only waits for it at the sync.
+ */
+class FlashSimulator
+{
+public:
+    /**
+     * The cost of operations, in nanoseconds.
+     */
+    struct Timing
+    {
+        unsigned transaction = 0;       // the fixed cost of each read or write
+        unsigned read_byte = 0;
+        unsigned write_byte = 0;
+        unsigned erase = 0;             // per sector
+    };
+
+    struct Stats
+    {
+        unsigned reads = 0;
+        unsigned writes = 0;
+        unsigned erases = 0;
+        unsigned overlapped = 0;        // asynchronous reads still in progress when something else was done
+        uint64_t read_bytes = 0;
+        uint64_t written_bytes = 0;
+        unsigned violations = 0;        // writes that tried to set bits that were not erased
+    };
+
+    /**
+     * @param base      The address of the first sector.
+     * @param sector    The sector size.
+     * @param sectors   The number of sectors.
+     * @param mapped    The device is memory mapped, as the internal flash.
+     * @param async     Reads complete at the sync, as with DMA.
+     */
+    FlashSimulator(uint32_t base, uint32_t sector, unsigned sectors, bool mapped = false, bool async = false);
+
+    const flash_io* io() const { return &io_; }
+
+    Timing& timing() { return timing_; }
+    Stats& stats() { return stats_; }
+    void reset_stats() { stats_ = Stats(); }
+
+    uint32_t base() const { return base_; }
+    uint32_t length() const { return uint32_t(data_.size()); }
+    uint32_t sector_size() const { return sector_; }
+
+    /**
+     * Direct access to the contents, bypassing the statistics.
+     */
+    uint8_t* at(uint32_t address) { return &data_[address - base_]; }
+
+    /**
+     * Sets the contents of a range, bypassing the statistics.
+     */
+    void fill(uint32_t address, const std::vector<uint8_t>& data);
+
+    std::vector<uint8_t> read(uint32_t address, uint32_t length);
+
+    /**
+     * The simulated time in nanoseconds, shared by all devices.
+     */
+    static uint64_t now() { return clock_; }
+    static void reset_clock() { clock_ = 0; }
+
+private:
+    static FlashSimulator& self(const flash_io* io) { return *static_cast<FlashSimulator*>(io->context); }
+
+    static const uint8_t* io_map(const flash_io* io, uint32_t address);
+    static int io_read(const flash_io* io, uint32_t address, uint8_t* data, uint32_t length);
+    static int io_sync(const flash_io* io);
+    static int io_write(const flash_io* io, uint32_t address, const uint8_t* data, uint32_t length);
+    static int io_erase(const flash_io* io, uint32_t address);
+    static uint32_t io_sector_end(const flash_io* io, uint32_t address);
+
+    bool contains(uint32_t address, uint32_t length) const;
+
+    flash_io io_;
+    uint32_t base_;
+    uint32_t sector_;
+    std::vector<uint8_t> data_;
+    Timing timing_;
+    Stats stats_;
+
+    uint8_t* pending_ = nullptr;        // the destination of the asynchronous read in progress
+    uint32_t pending_address_ = 0;
+    uint32_t pending_length_ = 0;
+    uint64_t pending_done_ = 0;         // when the bus completes the read
+    unsigned pending_mark_ = 0;         // the operations count when the read started
+
+    static uint64_t clock_;
+    static unsigned operations_;        // by all devices
+};
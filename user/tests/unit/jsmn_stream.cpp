@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "jsmn_stream.h"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+// Supplies the JSON text in reads of at most `max_read` bytes
+struct StringSource {
+    std::string text;
+    size_t pos;
+    size_t max_read;
+    unsigned reads;
+
+    StringSource(const std::string& text, size_t max_read = 1024) :
+        text(text), pos(0), max_read(max_read), reads(0) {
+    }
+
+    static int read(void* state, char* buf, size_t length) {
+        StringSource* src = (StringSource*)state;
+        size_t n = std::min(std::min(length, src->max_read), src->text.size() - src->pos);
+        memcpy(buf, src->text.data() + src->pos, n);
+        src->pos += n;
+        src->reads++;
+        return n;
+    }
+};
+
+// Renders each token as a short string so a whole parse can be compared in one check
+std::string describe(const jsmn_stream_token& t, const char* value) {
+    std::ostringstream s;
+    s << (int)t.depth << ":";
+    switch (t.type) {
+        case JSMN_OBJECT: s << (t.end ? "}" : "{"); break;
+        case JSMN_ARRAY: s << (t.end ? "]" : "["); break;
+        case JSMN_STRING: s << (t.key ? "k" : "s") << "=" << value; break;
+        case JSMN_PRIMITIVE: s << "p=" << value; break;
+    }
+    if (t.truncated) {
+        s << "...";
+    }
+    return s.str();
+}
+
+int parse_all(const std::string& json, std::vector<std::string>& out, size_t max_read = 1024,
+        size_t chunk_size = 16, size_t value_size = 32) {
+    StringSource src(json, max_read);
+    std::vector<char> chunk(chunk_size);
+    std::vector<char> value(value_size);
+    jsmn_stream_parser parser;
+    jsmn_stream_init(&parser, chunk.data(), chunk.size(), value.data(), value.size(), StringSource::read, &src, nullptr);
+    jsmn_stream_token t;
+    int ret;
+    while ((ret = jsmn_stream_next(&parser, &t, nullptr)) > 0) {
+        out.push_back(describe(t, value.data()));
+    }
+    return ret;
+}
+
+const char* const NESTED = "{\"idx\":0, \"ssid\" : \"my \\\"net\\\"\", \"list\":[1, true, null, {\"a\":\"\\u00e9\"}], \"e\":{}, \"f\":[]}";
+
+const std::vector<std::string> NESTED_TOKENS = {
+    "0:{",
+    "1:k=idx", "1:p=0",
+    "1:k=ssid", "1:s=my \\\"net\\\"",
+    "1:k=list", "1:[", "2:p=1", "2:p=true", "2:p=null", "2:{", "3:k=a", "3:s=\\u00e9", "2:}", "1:]",
+    "1:k=e", "1:{", "1:}",
+    "1:k=f", "1:[", "1:]",
+    "0:}"
+};
+
+} // namespace
+
+SCENARIO("streaming parser produces tokens in document order", "[jsmn_stream]") {
+    std::vector<std::string> tokens;
+    REQUIRE(parse_all(NESTED, tokens) == 0);
+    REQUIRE(tokens == NESTED_TOKENS);
+}
+
+SCENARIO("streaming parser is independent of how the input is chunked", "[jsmn_stream]") {
+    for (size_t read = 1; read < 8; read++) {
+        for (size_t chunk = 1; chunk < 8; chunk++) {
+            std::vector<std::string> tokens;
+            REQUIRE(parse_all(NESTED, tokens, read, chunk) == 0);
+            REQUIRE(tokens == NESTED_TOKENS);
+        }
+    }
+}
+
+SCENARIO("streaming parser reads a top-level primitive", "[jsmn_stream]") {
+    std::vector<std::string> tokens;
+    REQUIRE(parse_all(" 1234 ", tokens) == 0);
+    REQUIRE(tokens == std::vector<std::string>({ "0:p=1234" }));
+}
+
+SCENARIO("streaming parser stops at a null terminator", "[jsmn_stream]") {
+    std::vector<std::string> tokens;
+    REQUIRE(parse_all(std::string("{\"a\":1}\0garbage", 15), tokens) == 0);
+    REQUIRE(tokens.size() == 4);
+}
+
+SCENARIO("values larger than the value buffer are truncated", "[jsmn_stream]") {
+    std::string json = "[\"" + std::string(100, 'x') + "\", 12345678]";
+    StringSource src(json);
+    char chunk[8];
+    char value[6];
+    jsmn_stream_parser parser;
+    jsmn_stream_init(&parser, chunk, sizeof(chunk), value, sizeof(value), StringSource::read, &src, nullptr);
+    jsmn_stream_token t;
+    REQUIRE(jsmn_stream_next(&parser, &t, nullptr) == 1);
+    REQUIRE(t.type == JSMN_ARRAY);
+
+    REQUIRE(jsmn_stream_next(&parser, &t, nullptr) == 1);
+    REQUIRE(t.type == JSMN_STRING);
+    REQUIRE(t.truncated);
+    REQUIRE(t.length == 100);
+    REQUIRE(std::string(value) == "xxxxx");
+
+    REQUIRE(jsmn_stream_next(&parser, &t, nullptr) == 1);
+    REQUIRE(t.type == JSMN_PRIMITIVE);
+    REQUIRE(t.truncated);
+    REQUIRE(t.length == 8);
+    REQUIRE(std::string(value) == "12345");
+
+    REQUIRE(jsmn_stream_next(&parser, &t, nullptr) == 1);
+    REQUIRE(t.end);
+    REQUIRE(jsmn_stream_next(&parser, &t, nullptr) == 0);
+}
+
+SCENARIO("incomplete input is reported as partial", "[jsmn_stream]") {
+    const char* const inputs[] = { "", "{", "{\"a\"", "{\"a\":", "{\"a\":1", "[1,", "\"abc", "\"\\u00" };
+    for (auto input : inputs) {
+        std::vector<std::string> tokens;
+        INFO(input);
+        REQUIRE(parse_all(input, tokens) == JSMN_ERROR_PART);
+    }
+}
+
+SCENARIO("malformed input is reported as invalid", "[jsmn_stream]") {
+    const char* const inputs[] = { "}", "[1}", "{1:2}", "{\"a\" 1}", "{\"a\":1,}", "[1 2]", "[,1]",
+        "\"\\x\"", "\"\\u00g0\"", "{} {}", "{\"a\"::1}" };
+    for (auto input : inputs) {
+        std::vector<std::string> tokens;
+        INFO(input);
+        REQUIRE(parse_all(input, tokens) == JSMN_ERROR_INVAL);
+    }
+}
+
+SCENARIO("nesting deeper than the maximum depth is rejected", "[jsmn_stream]") {
+    std::vector<std::string> tokens;
+    std::string ok = std::string(JSMN_STREAM_MAX_DEPTH, '[') + std::string(JSMN_STREAM_MAX_DEPTH, ']');
+    REQUIRE(parse_all(ok, tokens) == 0);
+    std::string deep = std::string(JSMN_STREAM_MAX_DEPTH + 1, '[') + std::string(JSMN_STREAM_MAX_DEPTH + 1, ']');
+    REQUIRE(parse_all(deep, tokens) == JSMN_ERROR_NOMEM);
+}
+
+namespace {
+
+// The original SoftAP approach: parse the whole buffer, growing the token array until it fits
+int tokenise_with_retry(const char* js, size_t len) {
+    unsigned n = 64;
+    std::vector<jsmntok_t> tokens(n);
+    jsmn_parser parser;
+    jsmn_init(&parser, nullptr);
+    int ret = jsmn_parse(&parser, js, len, tokens.data(), n, nullptr);
+    while (ret == JSMN_ERROR_NOMEM) {
+        n = n * 2 + 1;
+        tokens.resize(n);
+        ret = jsmn_parse(&parser, js, len, tokens.data(), n, nullptr);
+    }
+    return ret;
+}
+
+std::string make_request(unsigned entries) {
+    std::ostringstream s;
+    s << "{";
+    for (unsigned i = 0; i < entries; i++) {
+        s << (i ? "," : "") << "\"key" << i << "\":\"" << std::string(40, 'a' + i % 26) << "\"";
+    }
+    s << "}";
+    return s.str();
+}
+
+} // namespace
+
+SCENARIO("benchmark streaming parser against whole-buffer parsing", "[.][benchmark][jsmn_stream]") {
+    typedef std::chrono::high_resolution_clock clock;
+    const unsigned iterations = 200;
+    for (unsigned entries : { 5u, 50u, 500u }) {
+        const std::string json = make_request(entries);
+
+        auto start = clock::now();
+        for (unsigned i = 0; i < iterations; i++) {
+            // the old path also needed a copy of the full body
+            std::string body = json;
+            REQUIRE(tokenise_with_retry(body.c_str(), body.size()) > 0);
+        }
+        auto whole = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+
+        start = clock::now();
+        for (unsigned i = 0; i < iterations; i++) {
+            std::vector<std::string> tokens;
+            StringSource src(json);
+            char chunk[64];
+            char value[64];
+            jsmn_stream_parser parser;
+            jsmn_stream_init(&parser, chunk, sizeof(chunk), value, sizeof(value), StringSource::read, &src, nullptr);
+            jsmn_stream_token t;
+            int ret;
+            while ((ret = jsmn_stream_next(&parser, &t, nullptr)) > 0) {
+            }
+            REQUIRE(ret == 0);
+        }
+        auto streamed = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+
+        std::cout << json.size() << " bytes: jsmn_parse " << whole / iterations << "us ("
+                << (2 * entries + 1) * sizeof(jsmntok_t) + json.size() << "+ bytes), jsmn_stream "
+                << streamed / iterations << "us (" << 64 + 64 + sizeof(jsmn_stream_parser) << " bytes)" << std::endl;
+    }
+}
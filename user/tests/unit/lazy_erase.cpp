@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "lazy_erase.h"
+#include "flash_simulator.h"
+
+#include <vector>
+#include <iostream>
+
+namespace {
+
+const uint32_t BASE = 0x80C0000;
+const uint32_t SECTOR = 4096;
+const uint32_t CHUNK = 512;
+
+std::vector<uint8_t> pattern(size_t length, unsigned seed = 1) {
+    std::vector<uint8_t> data(length);
+    for (size_t i = 0; i < length; i++) {
+        data[i] = uint8_t((i * 13 + seed * 7) ^ (i >> 9));
+    }
+    return data;
+}
+
+/**
+ * Writes an image a chunk at a time, as an OTA update does.
+ */
+int write_image(lazy_erase& region, FlashSimulator& flash, uint32_t address, const std::vector<uint8_t>& image) {
+    for (uint32_t offset = 0; offset < image.size(); offset += CHUNK) {
+        uint32_t length = std::min<uint32_t>(CHUNK, image.size() - offset);
+        int error = lazy_erase_prepare(&region, flash.io(), address + offset, length);
+        if (!error)
+            error = flash.io()->write(flash.io(), address + offset, image.data() + offset, length);
+        if (error)
+            return error;
+    }
+    return 0;
+}
+
+} // namespace
+
+SCENARIO("sectors are erased as they are first written", "[lazy_erase]") {
+    FlashSimulator flash(BASE, SECTOR, 8);
+    std::vector<uint8_t> previous = pattern(SECTOR * 8, 2);
+    flash.fill(BASE, previous);
+    lazy_erase region;
+    REQUIRE(lazy_erase_begin(&region, flash.io(), BASE, SECTOR * 8) == 0);
+    REQUIRE(flash.stats().erases == 0);
+
+    // a small image only erases the sectors it needs
+    std::vector<uint8_t> image = pattern(SECTOR * 2 + 100);
+    REQUIRE(write_image(region, flash, BASE, image) == 0);
+    REQUIRE(flash.stats().erases == 3);
+    REQUIRE(flash.stats().violations == 0);
+    REQUIRE(flash.read(BASE, image.size()) == image);
+    // what follows the image is left as it was
+    REQUIRE(flash.read(BASE + SECTOR * 3, SECTOR) == std::vector<uint8_t>(previous.begin() + SECTOR * 3, previous.begin() + SECTOR * 4));
+}
+
+SCENARIO("a write spanning sectors erases each of them once", "[lazy_erase]") {
+    FlashSimulator flash(BASE, SECTOR, 4);
+    flash.fill(BASE, pattern(SECTOR * 4, 2));
+    lazy_erase region;
+    REQUIRE(lazy_erase_begin(&region, flash.io(), BASE, SECTOR * 4) == 0);
+
+    REQUIRE(lazy_erase_prepare(&region, flash.io(), BASE + SECTOR - 10, SECTOR + 20) == 0);
+    REQUIRE(flash.stats().erases == 3);
+    REQUIRE(lazy_erase_prepare(&region, flash.io(), BASE + SECTOR, SECTOR * 2) == 0);
+    REQUIRE(flash.stats().erases == 3);
+    // writes outside the region are left alone
+    REQUIRE(lazy_erase_prepare(&region, flash.io(), BASE + SECTOR * 4, SECTOR) == 0);
+    REQUIRE(flash.stats().erases == 3);
+}
+
+SCENARIO("blank sectors of a mapped device aren't erased", "[lazy_erase]") {
+    FlashSimulator flash(BASE, SECTOR, 4, true);
+    flash.fill(BASE + SECTOR, pattern(100));
+    lazy_erase region;
+    REQUIRE(lazy_erase_begin(&region, flash.io(), BASE, SECTOR * 4) == 0);
+
+    std::vector<uint8_t> image = pattern(SECTOR * 3, 3);
+    REQUIRE(write_image(region, flash, BASE, image) == 0);
+    REQUIRE(flash.stats().erases == 1);
+    REQUIRE(flash.stats().violations == 0);
+    REQUIRE(flash.read(BASE, image.size()) == image);
+}
+
+SCENARIO("the sectors erased are kept across an interruption", "[lazy_erase]") {
+    FlashSimulator flash(BASE, SECTOR, 8);
+    flash.fill(BASE, pattern(SECTOR * 8, 2));
+    std::vector<uint8_t> image = pattern(SECTOR * 6);
+    lazy_erase region;
+    REQUIRE(lazy_erase_begin(&region, flash.io(), BASE, image.size()) == 0);
+    REQUIRE(write_image(region, flash, BASE, std::vector<uint8_t>(image.begin(), image.begin() + SECTOR * 3 + CHUNK)) == 0);
+    REQUIRE(flash.stats().erases == 4);
+
+    // the state is restored from memory that outlived the reset
+    lazy_erase retained = region;
+    REQUIRE(lazy_erase_is_valid(&retained, BASE, image.size()));
+    REQUIRE_FALSE(lazy_erase_is_valid(&retained, BASE, image.size() + 1));
+    REQUIRE(write_image(retained, flash, BASE, image) == 0);
+    REQUIRE(flash.stats().erases == 6);
+    REQUIRE(flash.stats().violations == 0);
+    REQUIRE(flash.read(BASE, image.size()) == image);
+
+    lazy_erase_clear(&retained);
+    REQUIRE_FALSE(lazy_erase_is_valid(&retained, BASE, image.size()));
+}
+
+SCENARIO("state that isn't intact isn't used", "[lazy_erase]") {
+    FlashSimulator flash(BASE, SECTOR, 4);
+    lazy_erase region;
+    REQUIRE(lazy_erase_begin(&region, flash.io(), BASE, SECTOR * 4) == 0);
+    region.erased |= 2;
+    REQUIRE_FALSE(lazy_erase_is_valid(&region, BASE, SECTOR * 4));
+    REQUIRE(lazy_erase_prepare(&region, flash.io(), BASE, CHUNK) == FLASH_COPY_ERROR_ARGUMENT);
+    REQUIRE(flash.stats().erases == 0);
+}
+
+SCENARIO("sectors beyond those tracked are erased when the region is begun", "[lazy_erase]") {
+    const unsigned sectors = LAZY_ERASE_MAX_SECTORS + 3;
+    FlashSimulator flash(BASE, SECTOR, sectors);
+    flash.fill(BASE, pattern(SECTOR * sectors, 2));
+    lazy_erase region;
+    REQUIRE(lazy_erase_begin(&region, flash.io(), BASE, SECTOR * sectors) == 0);
+    REQUIRE(flash.stats().erases == 3);
+
+    std::vector<uint8_t> image = pattern(SECTOR * sectors);
+    REQUIRE(write_image(region, flash, BASE, image) == 0);
+    REQUIRE(flash.stats().erases == sectors);
+    REQUIRE(flash.stats().violations == 0);
+    REQUIRE(flash.read(BASE, image.size()) == image);
+}
+
+SCENARIO("benchmark erasing the OTA region up front and as it is written", "[.][benchmark][lazy_erase]") {
+    // 128K sectors taking a second each to erase, programmed at 16us per word
+    const uint32_t sector = 128 * 1024;
+    const unsigned sectors = 3;
+    std::vector<uint8_t> image = pattern(100 * 1024);
+
+    for (int lazy = 0; lazy < 2; lazy++) {
+        FlashSimulator flash(BASE, sector, sectors);
+        flash.fill(BASE, pattern(sector * sectors, 2));
+        flash.timing().erase = 1000000000;
+        flash.timing().write_byte = 4000;
+        FlashSimulator::reset_clock();
+
+        lazy_erase region;
+        REQUIRE(lazy_erase_begin(&region, flash.io(), BASE, sector * sectors) == 0);
+        if (!lazy) {
+            for (unsigned i = 0; i < sectors; i++) {
+                REQUIRE(flash.io()->erase(flash.io(), BASE + i * sector) == 0);
+                REQUIRE(lazy_erase_prepare(&region, flash.io(), BASE + i * sector, 1) == 0);
+            }
+        }
+        uint64_t begun = FlashSimulator::now();
+        REQUIRE(write_image(region, flash, BASE, image) == 0);
+        REQUIRE(flash.read(BASE, image.size()) == image);
+        std::cout << (lazy ? "erased as written: " : "erased up front: ") << begun / 1000 << "us before the first chunk, "
+                << FlashSimulator::now() / 1000 << "us for " << image.size() / 1024 << "KB, " << flash.stats().erases << " erases" << std::endl;
+    }
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "lzss.h"
+#include "lzss_encoder.h"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+uint32_t next_random(uint32_t& seed) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+// Stands in for a compiled module: instruction sequences that recur with different
+// operands, string constants and padding, so it compresses about as well as one
+std::vector<uint8_t> firmware(size_t length, uint32_t seed = 12345) {
+    std::vector<std::vector<uint8_t>> sequences(96);
+    for (auto& sequence : sequences) {
+        sequence.resize(4 + next_random(seed) % 12);
+        for (auto& b : sequence)
+            b = uint8_t(next_random(seed));
+    }
+    static const char* const strings[] = { "cloud connected", "unable to open socket", "spark/device/",
+            "firmware update", "%s: %d bytes" };
+
+    std::vector<uint8_t> data;
+    while (data.size() < length) {
+        uint32_t kind = next_random(seed) % 16;
+        if (kind < 11) {
+            const auto& sequence = sequences[next_random(seed) % sequences.size()];
+            data.insert(data.end(), sequence.begin(), sequence.end());
+        }
+        else if (kind < 14) {
+            for (int i = 0; i < 4; i++)
+                data.push_back(uint8_t(next_random(seed)));
+        }
+        else if (kind < 15) {
+            const char* s = strings[next_random(seed) % 5];
+            data.insert(data.end(), s, s + strlen(s) + 1);
+        }
+        else {
+            data.insert(data.end(), 4 + next_random(seed) % 16, 0);
+        }
+    }
+    data.resize(length);
+    return data;
+}
+
+std::vector<uint8_t> noise(size_t length, uint32_t seed = 99) {
+    std::vector<uint8_t> data(length);
+    for (auto& b : data)
+        b = uint8_t(next_random(seed));
+    return data;
+}
+
+std::vector<uint8_t> compress(const std::vector<uint8_t>& image, unsigned window_bits = 10) {
+    LzssEncoder::Options options;
+    options.window_bits = window_bits;
+    return LzssEncoder(options).encode(image);
+}
+
+// Expands an image received in chunks, as the device does during an OTA update
+struct Expander {
+    std::vector<uint8_t> window;
+    uint8_t buffer[512];
+    std::vector<uint8_t> image;
+    unsigned writes = 0;
+    bool fail = false;
+
+    Expander(unsigned window_bits = 10) : window(1 << window_bits) {}
+
+    static int write(void* context, uint32_t offset, const uint8_t* data, uint32_t length) {
+        Expander& expander = *static_cast<Expander*>(context);
+        if (expander.fail || offset != expander.image.size())
+            return -1;
+        expander.image.insert(expander.image.end(), data, data + length);
+        expander.writes++;
+        return 0;
+    }
+
+    int expand(const std::vector<uint8_t>& compressed, size_t chunk) {
+        lzss_decoder decoder;
+        lzss_decoder_init(&decoder, window.data(), window.size(), buffer, sizeof(buffer), write, this);
+        int result = 0;
+        for (size_t pos = 0; pos < compressed.size() && result == 0; pos += chunk) {
+            result = lzss_decoder_update(&decoder, compressed.data() + pos, std::min(chunk, compressed.size() - pos));
+        }
+        return result;
+    }
+};
+
+// A compressed image with the given items after the header
+std::vector<uint8_t> compressed_image(uint32_t length, std::initializer_list<uint8_t> items) {
+    std::vector<uint8_t> data = compress(std::vector<uint8_t>());
+    data[8] = length & 0xFF; data[9] = (length >> 8) & 0xFF;
+    data.insert(data.end(), items);
+    return data;
+}
+
+} // namespace
+
+SCENARIO("a compressed image is expanded as it is received", "[lzss]") {
+    std::vector<uint8_t> image = firmware(100000);
+    for (unsigned window_bits : { 8u, 10u, 12u }) {
+        std::vector<uint8_t> compressed = compress(image, window_bits);
+        // firmware typically compresses to a half to two thirds, given a window that spans its repetition
+        REQUIRE(compressed.size() < image.size() * (window_bits < 10 ? 10 : 7) / 10);
+
+        lzss_header header;
+        REQUIRE(lzss_is_compressed(compressed.data(), compressed.size()));
+        REQUIRE(lzss_parse_header(compressed.data(), compressed.size(), &header) == 0);
+        REQUIRE(header.window_bits == window_bits);
+        REQUIRE(header.length == image.size());
+
+        for (size_t chunk : { size_t(1), size_t(7), size_t(512), compressed.size() }) {
+            Expander expander(12);
+            REQUIRE(expander.expand(compressed, chunk) == LZSS_COMPLETE);
+            REQUIRE(expander.image == image);
+            // the image is written in whole buffers, as the flash is programmed
+            REQUIRE(expander.writes == (image.size() + 511) / 512);
+        }
+    }
+}
+
+SCENARIO("images that don't compress grow only by the flag bytes", "[lzss]") {
+    std::vector<uint8_t> image = noise(20000);
+    std::vector<uint8_t> compressed = compress(image);
+    REQUIRE(compressed.size() <= LZSS_HEADER_SIZE + image.size() + (image.size() + 7) / 8);
+
+    Expander expander;
+    REQUIRE(expander.expand(compressed, 512) == LZSS_COMPLETE);
+    REQUIRE(expander.image == image);
+}
+
+SCENARIO("runs and empty images are expanded", "[lzss]") {
+    Expander expander;
+
+    WHEN("the image is a run of one byte") {
+        std::vector<uint8_t> image(5000, 0xFF);
+        std::vector<uint8_t> compressed = compress(image);
+        REQUIRE(compressed.size() < 200);
+        REQUIRE(expander.expand(compressed, 64) == LZSS_COMPLETE);
+        REQUIRE(expander.image == image);
+    }
+
+    WHEN("the image is empty") {
+        std::vector<uint8_t> compressed = compress(std::vector<uint8_t>());
+        REQUIRE(compressed.size() == LZSS_HEADER_SIZE);
+        REQUIRE(expander.expand(compressed, 512) == LZSS_COMPLETE);
+        REQUIRE(expander.image.empty());
+    }
+}
+
+SCENARIO("malformed compressed images are rejected", "[lzss]") {
+    std::vector<uint8_t> image = firmware(30000);
+    std::vector<uint8_t> compressed = compress(image);
+    Expander expander;
+
+    WHEN("the image is cut short") {
+        compressed.resize(compressed.size() / 2);
+        THEN("the image is not completed") {
+            REQUIRE(expander.expand(compressed, 512) == 0);
+        }
+    }
+
+    WHEN("the window is larger than the device provides") {
+        THEN("the image is refused") {
+            REQUIRE(expander.expand(compress(image, 12), 512) == LZSS_ERROR_WINDOW);
+        }
+    }
+
+    WHEN("a match reaches before the start of the image") {
+        // a literal, then a match 2 back
+        std::vector<uint8_t> bad = compressed_image(10, { 0x01, 'a', 0x01, 0x00 });
+        THEN("the image fails") {
+            REQUIRE(expander.expand(bad, 512) == LZSS_ERROR_FORMAT);
+        }
+    }
+
+    WHEN("a match produces more than the image length") {
+        // a literal, then a match of 3+10 bytes
+        std::vector<uint8_t> bad = compressed_image(10, { 0x01, 'a', 0x00, 10 << 2 });
+        THEN("the image fails") {
+            REQUIRE(expander.expand(bad, 512) == LZSS_ERROR_LENGTH);
+        }
+    }
+
+    WHEN("the image can't be written") {
+        expander.fail = true;
+        THEN("the image fails") {
+            REQUIRE(expander.expand(compressed, 512) == LZSS_ERROR_WRITE);
+        }
+    }
+
+    WHEN("the data isn't compressed") {
+        THEN("it is not recognized") {
+            REQUIRE_FALSE(lzss_is_compressed(image.data(), image.size()));
+            REQUIRE(expander.expand(image, 512) == LZSS_ERROR_FORMAT);
+        }
+    }
+}
+
+SCENARIO("benchmark expanding a compressed module", "[.][benchmark][lzss]") {
+    std::vector<uint8_t> image = firmware(128 * 1024);
+    for (unsigned window_bits : { 8u, 10u, 12u }) {
+        std::vector<uint8_t> compressed = compress(image, window_bits);
+        const int runs = 20;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < runs; i++) {
+            Expander expander(window_bits);
+            REQUIRE(expander.expand(compressed, 512) == LZSS_COMPLETE);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << (1 << window_bits) << " byte window: " << compressed.size() * 100 / image.size()
+                << "% of " << image.size() / 1024 << "KB, expanded at "
+                << unsigned(image.size() * runs / elapsed / (1024 * 1024)) << "MB/s" << std::endl;
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "mapped_file.h"
+#include "device_context.h"
+#include "eeprom_hal.h"
+#include "eeprom_file.h"
+#include "filesystem.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+const char* const TEST_FILE = "mapped_file_test.bin";
+const char* const COPY_FILE = "mapped_file_copy.bin";
+
+std::vector<uint8_t> file_contents(const char* name) {
+    std::ifstream in(name, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+} // namespace
+
+SCENARIO("a mapped file is created and extended with the fill value", "[mapped_file]") {
+    std::remove(TEST_FILE);
+    {
+        MappedFile file;
+        REQUIRE(file.open(TEST_FILE, 16, 0xFF));
+        REQUIRE(file.size() == 16);
+        REQUIRE(file.data()[0] == 0xFF);
+        file.data()[3] = 42;
+    }
+    std::vector<uint8_t> contents = file_contents(TEST_FILE);
+    REQUIRE(contents.size() == 16);
+    REQUIRE(contents[3] == 42);
+    REQUIRE(contents[15] == 0xFF);
+
+    {
+        MappedFile file;
+        REQUIRE(file.open(TEST_FILE, 32, 0));
+        REQUIRE(file.data()[3] == 42);
+        REQUIRE(file.data()[15] == 0xFF);
+        REQUIRE(file.data()[16] == 0);
+    }
+    REQUIRE(file_contents(TEST_FILE).size() == 32);
+    std::remove(TEST_FILE);
+}
+
+SCENARIO("the virtual device eeprom persists to its file", "[mapped_file]") {
+    std::remove(TEST_FILE);
+    {
+        DeviceContext device;
+        DeviceScope scope(device);
+        HAL_EEPROM_Init();
+        HAL_EEPROM_Write(10, 0xAB);
+        write_file(TEST_FILE, "", 0);
+        GCC_EEPROM_Load(TEST_FILE);
+        REQUIRE(HAL_EEPROM_Read(0) == 0xFF);
+        HAL_EEPROM_Put(100, "abc", 3);
+    }
+    std::vector<uint8_t> contents = file_contents(TEST_FILE);
+    REQUIRE(contents.size() == HAL_EEPROM_Length());
+    REQUIRE(std::string((const char*)contents.data() + 100, 3) == "abc");
+    {
+        DeviceContext device;
+        DeviceScope scope(device);
+        GCC_EEPROM_Load(TEST_FILE);
+        HAL_EEPROM_Init();
+        char buf[3];
+        HAL_EEPROM_Get(100, buf, 3);
+        REQUIRE(std::string(buf, 3) == "abc");
+    }
+    std::remove(TEST_FILE);
+}
+
+SCENARIO("benchmark eeprom writes to a mapped file against rewriting the file", "[.][benchmark][mapped_file]") {
+    typedef std::chrono::high_resolution_clock clock;
+    const unsigned writes = 2000;
+    std::remove(TEST_FILE);
+    DeviceContext device;
+    DeviceScope scope(device);
+    write_file(TEST_FILE, "", 0);
+    GCC_EEPROM_Load(TEST_FILE);
+
+    auto start = clock::now();
+    for (unsigned i = 0; i < writes; i++) {
+        HAL_EEPROM_Write(i % HAL_EEPROM_Length(), i);
+    }
+    auto mapped = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+
+    // the previous implementation rewrote the whole file on every write
+    start = clock::now();
+    for (unsigned i = 0; i < writes; i++) {
+        HAL_EEPROM_Write(i % HAL_EEPROM_Length(), i);
+        GCC_EEPROM_Save(COPY_FILE);
+    }
+    auto rewritten = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+
+    std::cout << writes << " eeprom writes: mapped " << mapped << "us, rewriting the file " << rewritten << "us" << std::endl;
+    std::remove(TEST_FILE);
+    std::remove(COPY_FILE);
+}
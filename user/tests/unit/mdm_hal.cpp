@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Tests the Electron modem parser against the modem simulator.
+
+#include "catch.hpp"
+#include "mdm_hal.h"
+#include "modem_simulator.h"
+#include "delay_hal.h"
+
+#include <string>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <atomic>
+
+namespace {
+
+const int CLOUD_PORT = 5684;
+
+// A parser talking to a simulated modem. The parser is destroyed first,
+// since it powers the modem off.
+struct SimulatedModem
+{
+    ModemSimulator sim;
+    MDMElectronSerial modem;
+
+    SimulatedModem() {
+        sim.attach(modem);
+        modem.setDebug(0);
+    }
+
+    int open(IpProtocol protocol) {
+        REQUIRE(modem.connect());
+        int socket = modem.socketSocket(protocol, protocol == MDM_IPPROTO_UDP ? CLOUD_PORT : -1);
+        REQUIRE(socket >= 0);
+        if (protocol == MDM_IPPROTO_TCP)
+            REQUIRE(modem.socketConnect(socket, "device.spark.io", CLOUD_PORT));
+        return socket;
+    }
+
+    // lets time pass, as a caller polling the socket would
+    void wait(unsigned millis) {
+        HAL_Delay_Milliseconds(millis);
+    }
+
+    std::string receive(int socket, int len) {
+        std::string data(len, '\0');
+        int n = modem.socketRecv(socket, &data[0], len);
+        REQUIRE(n >= 0);
+        data.resize(n);
+        return data;
+    }
+};
+
+std::string pattern(size_t len) {
+    std::string data(len, '\0');
+    for (size_t i = 0; i < len; i++)
+        data[i] = char(i * 7);
+    return data;
+}
+
+} // namespace
+
+SCENARIO("the modem registers, activates the PDP context and connects a TCP socket", "[mdm_hal]") {
+    SimulatedModem device;
+    int socket = device.open(MDM_IPPROTO_TCP);
+    REQUIRE(device.modem.socketIsConnected(socket));
+    REQUIRE(device.sim.stats().by_command["+UPSDA"] == 1);
+    REQUIRE(device.sim.stats().by_command["+UDNSRN"] == 1);
+    REQUIRE(device.modem.socketClose(socket));
+    REQUIRE(device.modem.socketFree(socket));
+}
+
+SCENARIO("TCP data round trips through the simulated modem", "[mdm_hal]") {
+    SimulatedModem device;
+    int socket = device.open(MDM_IPPROTO_TCP);
+    int handle = device.sim.last_socket();
+
+    std::string data = pattern(3000);
+    REQUIRE(device.modem.socketSend(socket, data.data(), data.size()) == int(data.size()));
+    REQUIRE(device.sim.written(handle) == data);
+
+    device.sim.peer_send(handle, data);
+    REQUIRE(device.modem.socketReadable(socket) == 0);
+    device.wait(1000);
+    REQUIRE(device.modem.socketReadable(socket) == int(data.size()));
+    device.modem.socketSetBlocking(socket, 1000);
+    REQUIRE(device.receive(socket, data.size()) == data);
+    REQUIRE(device.modem.socketReadable(socket) == 0);
+}
+
+SCENARIO("announced data is prefetched, so receiving it costs no round trip", "[mdm_hal]") {
+    SimulatedModem device;
+    int socket = device.open(MDM_IPPROTO_TCP);
+    int handle = device.sim.last_socket();
+    device.modem.socketSetBlocking(socket, 0);
+
+    device.sim.peer_send(handle, "hello world");
+    device.wait(1000);
+    device.sim.reset_stats();
+    REQUIRE(device.modem.socketReadable(socket) == 11);
+    REQUIRE(device.sim.stats().by_command["+USORD"] == 1);
+
+    REQUIRE(device.receive(socket, 5) == "hello");
+    REQUIRE(device.modem.socketReadable(socket) == 6);
+    REQUIRE(device.receive(socket, 100) == " world");
+    REQUIRE(device.sim.stats().commands == 1);
+}
+
+SCENARIO("a block as large as the receive pipe is read with one command", "[mdm_hal]") {
+    SimulatedModem device;
+    int socket = device.open(MDM_IPPROTO_TCP);
+    int handle = device.sim.last_socket();
+    std::string data = pattern(1024);
+    device.sim.peer_send(handle, data);
+    device.wait(1000);
+    device.sim.reset_stats();
+    REQUIRE(device.modem.socketReadable(socket) == 1024);
+    REQUIRE(device.sim.stats().by_command["+USORD"] == 1);
+    REQUIRE(device.receive(socket, 1024) == data);
+}
+
+SCENARIO("UDP datagrams are received one at a time with the sender address", "[mdm_hal]") {
+    SimulatedModem device;
+    int socket = device.open(MDM_IPPROTO_UDP);
+    int handle = device.sim.last_socket();
+    MDM_IP server = device.modem.gethostbyname("device.spark.io");
+    REQUIRE(server != NOIP);
+
+    REQUIRE(device.modem.socketSendTo(socket, server, CLOUD_PORT, "ping", 4) == 4);
+    REQUIRE(device.sim.written(handle) == "ping");
+    device.sim.peer_send(handle, "first");
+    device.sim.peer_send(handle, "second", 10);
+    device.wait(1000);
+
+    REQUIRE(device.modem.socketReadable(socket) > 0);
+    char buf[32];
+    MDM_IP ip;
+    int port;
+    REQUIRE(device.modem.socketRecvFrom(socket, &ip, &port, buf, sizeof(buf)) == 5);
+    REQUIRE(std::string(buf, 5) == "first");
+    REQUIRE(ip == server);
+    REQUIRE(port == CLOUD_PORT);
+    REQUIRE(device.modem.socketRecvFrom(socket, &ip, &port, buf, 3) == 3);
+    REQUIRE(std::string(buf, 3) == "sec");
+    REQUIRE(device.modem.socketReadable(socket) == 0);
+}
+
+SCENARIO("a socket closed by the peer reads as closed", "[mdm_hal]") {
+    SimulatedModem device;
+    int socket = device.open(MDM_IPPROTO_TCP);
+    device.sim.peer_close(device.sim.last_socket());
+    device.wait(1000);
+    REQUIRE(device.modem.socketReadable(socket) < 0);
+    REQUIRE_FALSE(device.modem.socketIsConnected(socket));
+}
+
+SCENARIO("scripted responses and injected URCs reach the parser", "[mdm_hal]") {
+    SimulatedModem device;
+    device.sim.script("AT+CSQ", "\r\n+CSQ: 5,99\r\n\r\nOK\r\n");
+    REQUIRE(device.modem.connect());
+    NetStatus status = {};
+    REQUIRE(device.modem.getSignalStrength(status));
+    REQUIRE(status.rssi == -113 + 2*5);
+
+    // the PDP context is deactivated by the network, and reactivated for the next socket
+    device.sim.inject("+UUPSDD: 0", 100);
+    device.wait(1000);
+    REQUIRE(device.modem.getSignalStrength(status));
+    REQUIRE(device.sim.stats().by_command["+UPSDA"] == 1);
+    REQUIRE(device.modem.socketSocket(MDM_IPPROTO_TCP) >= 0);
+    REQUIRE(device.sim.stats().by_command["+UPSDA"] == 2);
+}
+
+SCENARIO("a cloud datagram goes out between the blocks of a long application write", "[mdm_hal]") {
+    SimulatedModem device;
+    int app = device.open(MDM_IPPROTO_TCP);
+    int app_handle = device.sim.last_socket();
+    int cloud = device.open(MDM_IPPROTO_UDP);
+    int cloud_handle = device.sim.last_socket();
+    MDM_IP server = device.modem.gethostbyname("device.spark.io");
+    std::atomic<int> app_blocks(0);
+    int app_blocks_before_cloud = -1;
+    device.sim.on_write([&](ModemSimulator& sim, int handle, const std::string& data) {
+        if (handle == app_handle)
+            app_blocks++;
+        else if (handle == cloud_handle)
+            app_blocks_before_cloud = app_blocks;
+    });
+
+    std::string data = pattern(64 * 1024);
+    int sent = 0;
+    std::thread application([&]() {
+        sent = device.modem.socketSend(app, data.data(), data.size());
+    });
+    while (!app_blocks)
+        std::this_thread::yield();
+    int requested = app_blocks;
+    REQUIRE(device.modem.socketSendTo(cloud, server, CLOUD_PORT, "ping", 4) == 4);
+    application.join();
+
+    REQUIRE(sent == int(data.size()));
+    REQUIRE(app_blocks == 64);
+    REQUIRE(app_blocks_before_cloud >= requested);
+    REQUIRE(app_blocks_before_cloud <= requested + 2);
+}
+
+SCENARIO("a blocking receive doesn't keep other sockets from the modem", "[mdm_hal]") {
+    SimulatedModem device;
+    int app = device.open(MDM_IPPROTO_TCP);
+    int app_handle = device.sim.last_socket();
+    int cloud = device.open(MDM_IPPROTO_UDP);
+    MDM_IP server = device.modem.gethostbyname("device.spark.io");
+    // the application data only arrives once the cloud datagram went out
+    device.sim.on_write([&](ModemSimulator& sim, int handle, const std::string& data) {
+        sim.peer_send(app_handle, "reply");
+    });
+    // long enough for the other thread to get a turn, however the host schedules them
+    device.modem.socketSetBlocking(app, 3600000);
+
+    uint64_t start = device.sim.millis();
+    char received[8];
+    int count = 0;
+    std::thread application([&]() {
+        count = device.modem.socketRecv(app, received, 5);
+    });
+    // only the waiting receive moves the clock
+    while (device.sim.millis() < start + 100)
+        std::this_thread::yield();
+    REQUIRE(device.modem.socketSendTo(cloud, server, CLOUD_PORT, "ping", 4) == 4);
+    application.join();
+
+    REQUIRE(std::string(received, count) == "reply");
+}
+
+SCENARIO("benchmark modem connect time", "[.][benchmark][mdm_hal]") {
+    SimulatedModem device;
+    device.open(MDM_IPPROTO_TCP);
+    std::cout << "connect: " << device.sim.millis() << "ms simulated, "
+            << device.sim.stats().commands << " AT commands" << std::endl;
+}
+
+SCENARIO("benchmark modem socket throughput", "[.][benchmark][mdm_hal]") {
+    const size_t total = 64 * 1024;
+    SimulatedModem device;
+    int socket = device.open(MDM_IPPROTO_TCP);
+    int handle = device.sim.last_socket();
+    std::string data = pattern(total);
+
+    device.sim.reset_stats();
+    uint64_t start = device.sim.millis();
+    auto wall = std::chrono::high_resolution_clock::now();
+    REQUIRE(device.modem.socketSend(socket, data.data(), data.size()) == int(total));
+    uint64_t elapsed = device.sim.millis() - start;
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - wall).count();
+    REQUIRE(device.sim.written(handle) == data);
+    std::cout << "socketSend: " << (total / 1024.0) / (elapsed / 1000.0) << " KB/s simulated, "
+            << device.sim.stats().commands << " AT commands, " << micros << "us host" << std::endl;
+
+    // the peer sends in segments as they arrive from the network
+    for (size_t offset = 0; offset < total; offset += 1400)
+        device.sim.peer_send(handle, data.substr(offset, 1400), offset / 1400 * 10);
+    device.sim.reset_stats();
+    device.modem.socketSetBlocking(socket, 0);
+    start = device.sim.millis();
+    wall = std::chrono::high_resolution_clock::now();
+    std::string received;
+    while (received.size() < total) {
+        // as socket_receive polls
+        int available = device.modem.socketReadable(socket);
+        REQUIRE(available >= 0);
+        if (available)
+            received += device.receive(socket, 1024);
+        else
+            device.wait(1);
+    }
+    elapsed = device.sim.millis() - start;
+    micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - wall).count();
+    REQUIRE(received == data);
+    std::cout << "socketRecv: " << (total / 1024.0) / (elapsed / 1000.0) << " KB/s simulated, "
+            << device.sim.stats().commands << " AT commands, " << micros << "us host" << std::endl;
+}
+
+SCENARIO("benchmark modem AT transactions per cloud message", "[.][benchmark][mdm_hal]") {
+    const unsigned messages = 100;
+    const size_t message_size = 120;
+    SimulatedModem device;
+    int socket = device.open(MDM_IPPROTO_UDP);
+    MDM_IP server = device.modem.gethostbyname("device.spark.io");
+    // the cloud acknowledges each message
+    device.sim.on_write([](ModemSimulator& sim, int handle, const std::string& data) {
+        sim.peer_send(handle, data.substr(0, 20), sim.timing().network);
+    });
+    std::string message = pattern(message_size);
+    char buf[1024];
+
+    device.sim.reset_stats();
+    uint64_t start = device.sim.millis();
+    for (unsigned i = 0; i < messages; i++) {
+        REQUIRE(device.modem.socketSendTo(socket, server, CLOUD_PORT, message.data(), message.size()) == int(message_size));
+        // as socket_receivefrom polls from the system loop
+        for (;;) {
+            if (device.modem.socketReadable(socket) > 0) {
+                MDM_IP ip;
+                int port;
+                REQUIRE(device.modem.socketRecvFrom(socket, &ip, &port, buf, sizeof(buf)) == 20);
+                break;
+            }
+            device.wait(5);
+        }
+    }
+    uint64_t elapsed = device.sim.millis() - start;
+    std::cout << "cloud message: " << double(device.sim.stats().commands) / messages << " AT commands, "
+            << double(elapsed) / messages << "ms simulated round trip" << std::endl;
+}
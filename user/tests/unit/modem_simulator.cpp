@@ -0,0 +1,559 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// A scripted u-blox modem, and the host side of the Electron HAL it talks to.
+
+#include "modem_simulator.h"
+#include "mdm_hal.h"
+#include "electronserialpipe_hal.h"
+#include "pinmap_impl.h"
+#include "gpio_hal.h"
+#include "net_hal.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+ModemSimulator* active_modem = nullptr;
+
+// the address of the peers the sockets talk to
+const uint32_t PEER_IP = (192u << 24) | 2 << 8 | 1;     // 192.0.2.1
+const char* const DEVICE_IP = "10.0.0.2";
+
+} // namespace
+
+ModemSimulator::ModemSimulator(const Timing& timing) :
+    timing_(timing),
+    adapter_(*this),
+    previous_clock_(device_clock())
+{
+    active_modem = this;
+    set_device_clock(adapter_);
+}
+
+ModemSimulator::~ModemSimulator()
+{
+    set_device_clock(previous_clock_);
+    active_modem = nullptr;
+}
+
+ModemSimulator* ModemSimulator::active()
+{
+    return active_modem;
+}
+
+void ModemSimulator::attach(ElectronSerialPipe& serial)
+{
+    serial_ = &serial;
+}
+
+uint64_t ModemSimulator::Clock::now_micros()
+{
+    std::lock_guard<std::recursive_mutex> lock(modem.mutex_);
+    modem.run_due();
+    return modem.clock_.now_micros();
+}
+
+void ModemSimulator::Clock::sleep_micros(uint64_t micros)
+{
+    std::lock_guard<std::recursive_mutex> lock(modem.mutex_);
+    // stop at each event on the way, so what it schedules is timed from when it happens
+    uint64_t deadline = modem.clock_.now_micros() + micros;
+    uint64_t due;
+    while ((due = modem.next_due()) && due <= deadline) {
+        uint64_t now = modem.clock_.now_micros();
+        if (due > now)
+            modem.clock_.sleep_micros(due - now);
+        modem.run_due();
+    }
+    uint64_t now = modem.clock_.now_micros();
+    if (deadline > now)
+        modem.clock_.sleep_micros(deadline - now);
+}
+
+void ModemSimulator::script(const std::string& prefix, const Script& script)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    scripts_[prefix] = script;
+}
+
+void ModemSimulator::script(const std::string& prefix, const std::string& response)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    scripts_[prefix] = [response](const std::string&) { return response; };
+}
+
+void ModemSimulator::schedule(uint64_t delay_micros, const std::function<void()>& action)
+{
+    events_.insert(std::make_pair(clock_.now_micros() + delay_micros, action));
+}
+
+void ModemSimulator::respond(const std::string& text, unsigned delay_ms)
+{
+    // output leaves the modem in order, at the speed of the serial line
+    uint64_t due = clock_.now_micros() + uint64_t(delay_ms) * 1000;
+    if (due < output_due_)
+        due = output_due_;
+    due += transfer_micros(text.size());
+    output_due_ = due;
+    events_.insert(std::make_pair(due, [this, text]() {
+        output_ += text;
+        stats_.rx_bytes += text.size();
+    }));
+}
+
+void ModemSimulator::inject(const std::string& urc, unsigned delay)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    respond(info(urc), delay);
+}
+
+uint64_t ModemSimulator::next_due()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    return events_.empty() ? 0 : events_.begin()->first;
+}
+
+void ModemSimulator::run_due()
+{
+    if (running_)
+        return;
+    running_ = true;
+    uint64_t now = clock_.now_micros();
+    while (!events_.empty() && events_.begin()->first <= now) {
+        std::function<void()> action = events_.begin()->second;
+        events_.erase(events_.begin());
+        action();
+    }
+    if (serial_ && !output_.empty())
+        serial_->rxIrqBuf();
+    running_ = false;
+}
+
+void ModemSimulator::transmit(const std::function<int(const char*, int)>& put)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    int n = put(output_.data(), output_.size());
+    output_.erase(0, n);
+}
+
+void ModemSimulator::receive(const char* data, int len)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    stats_.tx_bytes += len;
+    while (len > 0) {
+        if (skip_lf_) {
+            // the line feed terminating a write command isn't socket data
+            skip_lf_ = false;
+            if (*data == '\n') {
+                data++;
+                len--;
+                continue;
+            }
+        }
+        if (write_remaining_) {
+            size_t n = std::min(write_remaining_, size_t(len));
+            write_data_.append(data, n);
+            write_remaining_ -= n;
+            data += n;
+            len -= n;
+            if (!write_remaining_)
+                complete_write(write_data_);
+            continue;
+        }
+        char c = *data++;
+        len--;
+        if (c == '\r') {
+            if (!command_.empty())
+                execute(command_);
+            command_.clear();
+        }
+        else if (c != '\n') {
+            command_ += c;
+        }
+    }
+}
+
+ModemSimulator::Socket* ModemSimulator::socket(int handle)
+{
+    if (handle < 0 || handle >= int(sizeof(sockets_)/sizeof(*sockets_)) || !sockets_[handle].open)
+        return nullptr;
+    return &sockets_[handle];
+}
+
+std::string ModemSimulator::format_ip(uint32_t ip)
+{
+    char buf[16];
+    sprintf(buf, "%d.%d.%d.%d", (ip >> 24) & 0xFF, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF);
+    return buf;
+}
+
+void ModemSimulator::execute(const std::string& command)
+{
+    stats_.commands++;
+    size_t end = command.find_first_of("=?", 2);
+    std::string name = command.substr(2, end == std::string::npos ? std::string::npos : end - 2);
+    stats_.by_command[name]++;
+    const char* args = (end == std::string::npos) ? "" : command.c_str() + end + 1;
+    bool query = end != std::string::npos && command[end] == '?';
+
+    for (auto& script : scripts_) {
+        if (!command.compare(0, script.first.size(), script.first)) {
+            respond(script.second(command), timing_.command);
+            return;
+        }
+    }
+
+    unsigned delay = timing_.command;
+    std::string response;
+    int h = -1, len = 0, a, b, c, d, port;
+    if (name == "+CPIN" && query)
+        response = info("+CPIN: READY") + ok();
+    else if (name == "+CGSN")
+        response = info("352253060000000") + ok();
+    else if (name == "+CGMI")
+        response = info("u-blox") + ok();
+    else if (name == "+CGMM")
+        response = info("SARA-U260") + ok();
+    else if (name == "+CGMR")
+        response = info("23.20") + ok();
+    else if (name == "+CCID")
+        response = info("+CCID: 8934076500002587657") + ok();
+    else if (name == "+CIMI")
+        response = info("310410000000000") + ok();
+    else if ((name == "+CREG" || name == "+CGREG") && query) {
+        bool registered = millis() >= timing_.registration;
+        response = info(name + (registered ? ": 2,1,\"0001\",\"00000001\",2" : ": 2,2")) + ok();
+    }
+    else if (name == "+COPS" && query)
+        response = info("+COPS: 0,0,\"Simulated\",2") + ok();
+    else if (name == "+CSQ")
+        response = info("+CSQ: 20,99") + ok();
+    else if (name == "+CGATT") {
+        delay = timing_.attach;
+        response = ok();
+    }
+    else if (name == "+UPSND" && sscanf(args, "%*d,%d", &a) == 1) {
+        if (a == 8)
+            response = info(std::string("+UPSND: 0,8,") + (activated_ ? "1" : "0")) + ok();
+        else if (a == 0 && activated_)
+            response = info(std::string("+UPSND: 0,0,\"") + DEVICE_IP + "\"") + ok();
+        else
+            response = cme("Operation not allowed");
+    }
+    else if (name == "+UPSDA" && sscanf(args, "%*d,%d", &a) == 1) {
+        activated_ = (a == 3);
+        if (activated_)
+            delay = timing_.activation;
+        response = ok();
+    }
+    else if (name == "+UDNSRN") {
+        delay = timing_.dns;
+        response = info("+UDNSRN: \"" + format_ip(PEER_IP) + "\"") + ok();
+    }
+    else if (name == "+UGCNTRD") {
+        std::string counts = std::to_string(socket_tx_) + "," + std::to_string(socket_rx_);
+        response = info("+UGCNTRD: 1," + counts + "," + counts) + ok();
+    }
+    else if (name == "+CEER")
+        response = info("+CEER: \"No cause information available\"") + ok();
+    else if (name == "+USOCR") {
+        for (h = 0; h < int(sizeof(sockets_)/sizeof(*sockets_)) && sockets_[h].open; h++) {
+        }
+        if (h < int(sizeof(sockets_)/sizeof(*sockets_))) {
+            sockets_[h] = Socket();
+            sockets_[h].open = true;
+            sockets_[h].udp = (atoi(args) == 17);
+            sockets_[h].peer_ip = PEER_IP;
+            last_socket_ = h;
+            response = info("+USOCR: " + std::to_string(h)) + ok();
+        }
+        else
+            response = cme("Operation not allowed");
+    }
+    else if (name == "+USOCTL" && sscanf(args, "%d", &h) == 1) {
+        response = socket(h) ? info("+USOCTL: " + std::to_string(h) + ",1,4") + ok() : cme("Operation not allowed");
+    }
+    else if (name == "+USOCO" && sscanf(args, "%d,\"%d.%d.%d.%d\",%d", &h, &a, &b, &c, &d, &port) == 6 && socket(h)) {
+        socket(h)->peer_ip = uint32_t(a) << 24 | b << 16 | c << 8 | d;
+        socket(h)->peer_port = port;
+        delay = timing_.connect;
+        response = ok();
+    }
+    else if (name == "+USOWR" && sscanf(args, "%d,%d", &h, &len) == 2 && socket(h)) {
+        write_result_ = "+USOWR: " + std::to_string(h) + "," + std::to_string(len);
+    }
+    else if (name == "+USOST" && sscanf(args, "%d,\"%d.%d.%d.%d\",%d,%d", &h, &a, &b, &c, &d, &port, &len) == 7 && socket(h)) {
+        socket(h)->peer_ip = uint32_t(a) << 24 | b << 16 | c << 8 | d;
+        socket(h)->peer_port = port;
+        write_result_ = "+USOST: " + std::to_string(h) + "," + std::to_string(len);
+    }
+    else if (name == "+USORD" && sscanf(args, "%d,%d", &h, &len) == 2 && socket(h)) {
+        std::string& stream = socket(h)->stream;
+        if (len == 0)
+            response = info("+USORD: " + std::to_string(h) + "," + std::to_string(stream.size()));
+        else {
+            std::string data = stream.substr(0, len);
+            stream.erase(0, data.size());
+            response = info("+USORD: " + std::to_string(h) + "," + std::to_string(data.size()) + ",\"" + data + "\"");
+        }
+        response += ok();
+    }
+    else if (name == "+USORF" && sscanf(args, "%d,%d", &h, &len) == 2 && socket(h)) {
+        std::deque<Datagram>& datagrams = socket(h)->datagrams;
+        if (!datagrams.empty() && len > 0) {
+            // the rest of a datagram that doesn't fit is discarded
+            Datagram datagram = datagrams.front();
+            datagrams.pop_front();
+            std::string data = datagram.data.substr(0, len);
+            response = info("+USORF: " + std::to_string(h) + ",\"" + format_ip(datagram.ip) + "\"," +
+                    std::to_string(datagram.port) + "," + std::to_string(data.size()) + ",\"" + data + "\"");
+        }
+        response += ok();
+    }
+    else if (name == "+USOCL" && sscanf(args, "%d", &h) == 1 && socket(h)) {
+        socket(h)->open = false;
+        response = ok();
+    }
+    else if (name == "+USOWR" || name == "+USOST" || name == "+USORD" || name == "+USORF" ||
+             name == "+USOCL" || name == "+USOCO")
+        response = cme("Operation not allowed");
+    else if (name == "+UPSND" || name == "+UPSDA")
+        response = error();
+    else
+        // everything else is accepted as configuration
+        response = ok();
+
+    if (!write_result_.empty() && response.empty()) {
+        // the data follows the prompt
+        write_handle_ = h;
+        write_remaining_ = len;
+        write_data_.clear();
+        skip_lf_ = true;
+        respond("\r\n@", timing_.prompt);
+        if (!len)
+            complete_write(write_data_);
+        return;
+    }
+    respond(response, delay);
+}
+
+void ModemSimulator::complete_write(const std::string& data)
+{
+    Socket* s = socket(write_handle_);
+    if (s) {
+        socket_tx_ += data.size();
+        if (peer_)
+            peer_(*this, write_handle_, data);
+        else
+            s->written += data;
+    }
+    respond(info(write_result_) + ok(), timing_.command);
+    write_result_.clear();
+}
+
+void ModemSimulator::peer_send(int handle, const std::string& data, unsigned delay)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    schedule((uint64_t(timing_.network) + delay) * 1000, [this, handle, data]() {
+        deliver(handle, data);
+    });
+}
+
+void ModemSimulator::deliver(int handle, const std::string& data)
+{
+    Socket* s = socket(handle);
+    if (!s)
+        return;
+    socket_rx_ += data.size();
+    if (s->udp)
+        s->datagrams.push_back(Datagram{data, s->peer_ip, s->peer_port});
+    else
+        s->stream += data;
+    inject((s->udp ? "+UUSORF: " : "+UUSORD: ") + std::to_string(handle) + "," + std::to_string(pending(handle)));
+}
+
+void ModemSimulator::peer_close(int handle, unsigned delay)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    schedule((uint64_t(timing_.network) + delay) * 1000, [this, handle]() {
+        if (Socket* s = socket(handle)) {
+            s->open = false;
+            inject("+UUSOCL: " + std::to_string(handle));
+        }
+    });
+}
+
+std::string ModemSimulator::written(int handle)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::string data;
+    if (handle >= 0 && handle < int(sizeof(sockets_)/sizeof(*sockets_)))
+        data.swap(sockets_[handle].written);
+    return data;
+}
+
+size_t ModemSimulator::pending(int handle)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    Socket* s = socket(handle);
+    if (!s)
+        return 0;
+    if (!s->udp)
+        return s->stream.size();
+    size_t size = 0;
+    for (const Datagram& datagram : s->datagrams)
+        size += datagram.data.size();
+    return size;
+}
+
+// ----------------------------------------------------------------
+// The serial interface to the modem, with the simulator on the other end
+// of the line instead of USART3
+
+ElectronSerialPipe::ElectronSerialPipe(int rxSize, int txSize) :
+    _pipeRx(rxSize), _pipeTx(txSize), _rxSignal(nullptr), _rxWaiting(false)
+{
+}
+
+ElectronSerialPipe::~ElectronSerialPipe(void)
+{
+}
+
+void ElectronSerialPipe::begin(unsigned int baud)
+{
+}
+
+int ElectronSerialPipe::writeable(void)
+{
+    return _pipeTx.free();
+}
+
+int ElectronSerialPipe::putc(int c)
+{
+    char ch = c;
+    put(&ch, 1, true);
+    return c;
+}
+
+int ElectronSerialPipe::put(const void* buffer, int length, bool blocking)
+{
+    ModemSimulator* modem = ModemSimulator::active();
+    if (modem) {
+        device_clock().sleep_micros(uint64_t(length) * 10 * 1000000 / modem->timing().baud);
+        modem->receive((const char*)buffer, length);
+    }
+    return length;
+}
+
+int ElectronSerialPipe::readable(void)
+{
+    rxIrqBuf();
+    return _pipeRx.size();
+}
+
+int ElectronSerialPipe::getc(void)
+{
+    return _pipeRx.getc();
+}
+
+int ElectronSerialPipe::get(void* buffer, int length, bool blocking)
+{
+    return _pipeRx.get((char*)buffer, length, blocking);
+}
+
+bool ElectronSerialPipe::waitReadable(int size, system_tick_t timeout_ms)
+{
+    uint64_t deadline = device_clock().now_micros() + uint64_t(timeout_ms) * 1000;
+    for (;;) {
+        // reading the clock delivers whatever is due
+        uint64_t now = device_clock().now_micros();
+        if (_pipeRx.size() > size)
+            return true;
+        if (now >= deadline)
+            return false;
+        uint64_t wake = deadline;
+        ModemSimulator* modem = ModemSimulator::active();
+        uint64_t due = modem ? modem->next_due() : 0;
+        if (due > now && due < wake)
+            wake = due;
+        device_clock().sleep_micros(wake - now);
+    }
+}
+
+void ElectronSerialPipe::rxIrqBuf(void)
+{
+    ModemSimulator* modem = ModemSimulator::active();
+    if (modem) {
+        modem->transmit([this](const char* data, int len) {
+            return _pipeRx.put(data, len);
+        });
+    }
+}
+
+void ElectronSerialPipe::txIrqBuf(void)
+{
+}
+
+void ElectronSerialPipe::txStart(void)
+{
+}
+
+void ElectronSerialPipe::txCopy(void)
+{
+}
+
+// ----------------------------------------------------------------
+// The rest of the HAL used by the modem parser
+
+MDMElectronSerial electronMDM;
+
+namespace {
+
+GPIO_TypeDef gpio;
+
+STM32_Pin_Info pins[TOTAL_PINS];
+
+} // namespace
+
+STM32_Pin_Info* HAL_Pin_Map(void)
+{
+    for (STM32_Pin_Info& pin : pins)
+        pin.gpio_peripheral = &gpio;
+    return pins;
+}
+
+void HAL_Pin_Mode(pin_t pin, PinMode mode)
+{
+}
+
+void HAL_GPIO_Write(pin_t pin, uint8_t value)
+{
+}
+
+void HAL_NET_notify_connected()
+{
+}
+
+void HAL_NET_notify_disconnected()
+{
+}
+
+void HAL_NET_notify_dhcp(bool dhcp)
+{
+}
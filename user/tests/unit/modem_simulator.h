@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "device_clock.h"
+
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <map>
+#include <functional>
+#include <mutex>
+
+class ElectronSerialPipe;
+
+/**
+ * A scripted u-blox SARA modem, attached to the host implementation of the
+ * ElectronSerialPipe so the MDMParser can run off-target.
+ *
+ * The simulator runs in simulated time: it installs a FastForwardClock as the
+ * device clock, and responses are delivered to the serial pipe once the clock
+ * has reached the time they are due, as the receive interrupt would. Reading
+ * the clock stands in for the interrupt, so data becomes visible to the parser
+ * the next time it looks at the time.
+ *
+ * The parser may be used from several threads, as on the device; each
+ * of them moves the simulation along when it reads the clock.
+ *
+ * Only one simulator may exist at a time.
+ */
+class ModemSimulator
+{
+public:
+    /**
+     * How long the modem takes to do things, in milliseconds.
+     */
+    struct Timing
+    {
+        unsigned command = 10;          // until the final result of a simple command
+        unsigned prompt = 20;           // until the @ prompt of a socket write
+        unsigned registration = 3000;   // from power on until registered
+        unsigned attach = 500;          // GPRS attach
+        unsigned activation = 1500;     // PDP context activation
+        unsigned dns = 200;             // DNS lookup
+        unsigned connect = 300;         // TCP connect
+        unsigned network = 50;          // one way trip between the modem and a peer
+        unsigned baud = 115200;         // serial line speed, 10 bits per byte
+    };
+
+    /**
+     * Called with data the device wrote to a socket.
+     */
+    typedef std::function<void(ModemSimulator& modem, int handle, const std::string& data)> PeerHandler;
+
+    /**
+     * Replaces the response to the commands starting with a prefix, e.g. "AT+CSQ".
+     * Returns the complete response, including the final result.
+     */
+    typedef std::function<std::string(const std::string& command)> Script;
+
+    /**
+     * Counters for the traffic on the serial line.
+     */
+    struct Stats
+    {
+        unsigned commands = 0;          // AT commands received
+        uint64_t tx_bytes = 0;          // bytes written by the device, including socket data
+        uint64_t rx_bytes = 0;          // bytes sent to the device
+        std::map<std::string, unsigned> by_command;     // AT commands by name, e.g. "+USORD"
+    };
+
+    ModemSimulator(const Timing& timing);
+    ModemSimulator() : ModemSimulator(Timing()) {}
+    ~ModemSimulator();
+
+    /**
+     * Connects the modem to the serial interface of the parser.
+     */
+    void attach(ElectronSerialPipe& serial);
+
+    /**
+     * The simulator attached to the host serial pipe, if any.
+     */
+    static ModemSimulator* active();
+
+    Timing& timing() { return timing_; }
+    Stats& stats() { return stats_; }
+    void reset_stats() { std::lock_guard<std::recursive_mutex> lock(mutex_); stats_ = Stats(); }
+
+    /**
+     * The simulated time in milliseconds.
+     */
+    uint64_t millis() { return clock_.now_micros() / 1000; }
+
+    /**
+     * Overrides the default response for the commands starting with a prefix.
+     */
+    void script(const std::string& prefix, const Script& script);
+
+    /**
+     * Overrides the default response with a fixed response.
+     */
+    void script(const std::string& prefix, const std::string& response);
+
+    /**
+     * Sends an unsolicited result code, e.g. "+CIEV: 9,2", after a delay.
+     */
+    void inject(const std::string& urc, unsigned delay = 0);
+
+    /**
+     * Sets the handler called when the device writes to a socket. The default
+     * handler keeps the data, see #written.
+     */
+    void on_write(const PeerHandler& handler) { std::lock_guard<std::recursive_mutex> lock(mutex_); peer_ = handler; }
+
+    /**
+     * A peer sends data to a socket, which arrives after the network delay
+     * plus the given delay and is announced with +UUSORD/+UUSORF.
+     */
+    void peer_send(int handle, const std::string& data, unsigned delay = 0);
+
+    /**
+     * The peer closes a TCP socket, announced with +UUSOCL.
+     */
+    void peer_close(int handle, unsigned delay = 0);
+
+    /**
+     * The data written to a socket by the device and kept by the default handler.
+     */
+    std::string written(int handle);
+
+    /**
+     * The handle of the most recently created socket.
+     */
+    int last_socket() { return last_socket_; }
+
+    /**
+     * The number of bytes received for a socket and not read yet.
+     */
+    size_t pending(int handle);
+
+    // the serial line, used by the host ElectronSerialPipe
+
+    /**
+     * Receives bytes written by the device.
+     */
+    void receive(const char* data, int len);
+
+    /**
+     * Moves the output that is due to the device.
+     * @param put   writes bytes to the receive pipe and returns how many fit
+     */
+    void transmit(const std::function<int(const char*, int)>& put);
+
+    /**
+     * The time in microseconds when more output becomes due, 0 if nothing is scheduled.
+     */
+    uint64_t next_due();
+
+private:
+    struct Datagram
+    {
+        std::string data;
+        uint32_t ip;
+        int port;
+    };
+
+    struct Socket
+    {
+        bool open = false;
+        bool udp = false;
+        std::string stream;             // received on a TCP socket
+        std::deque<Datagram> datagrams; // received on a UDP socket
+        std::string written;
+        uint32_t peer_ip = 0;           // the address data is received from
+        int peer_port = 0;
+    };
+
+    /**
+     * Keeps the clock adapter separate, so reading the time can deliver output.
+     */
+    class Clock : public DeviceClock
+    {
+        ModemSimulator& modem;
+    public:
+        Clock(ModemSimulator& modem) : modem(modem) {}
+        uint64_t now_micros() override;
+        void sleep_micros(uint64_t micros) override;
+    };
+
+    void schedule(uint64_t delay_micros, const std::function<void()>& action);
+    void respond(const std::string& text, unsigned delay_ms);
+    void run_due();
+    void execute(const std::string& command);
+    void complete_write(const std::string& data);
+    std::string info(const std::string& line) { return "\r\n" + line + "\r\n"; }
+    std::string ok() { return "\r\nOK\r\n"; }
+    std::string error() { return "\r\nERROR\r\n"; }
+    std::string cme(const std::string& text) { return "\r\n+CME ERROR: " + text + "\r\n"; }
+    uint64_t transfer_micros(size_t bytes) { return uint64_t(bytes) * 10 * 1000000 / timing_.baud; }
+    Socket* socket(int handle);
+    void deliver(int handle, const std::string& data);
+    static std::string format_ip(uint32_t ip);
+
+    std::recursive_mutex mutex_;        // guards all of the state below
+    Timing timing_;
+    Stats stats_;
+    FastForwardClock clock_;
+    Clock adapter_;
+    DeviceClock& previous_clock_;
+    ElectronSerialPipe* serial_ = nullptr;
+
+    std::multimap<uint64_t, std::function<void()>> events_;
+    uint64_t output_due_ = 0;           // when the last scheduled output is complete
+    std::string output_;                // due but not yet taken by the receive pipe
+    bool running_ = false;
+
+    std::string command_;               // the command line being received
+    int write_handle_ = -1;             // the socket receiving data after a prompt
+    size_t write_remaining_ = 0;
+    bool skip_lf_ = false;
+    std::string write_data_;
+    std::string write_result_;
+
+    std::map<std::string, Script> scripts_;
+    PeerHandler peer_;
+    Socket sockets_[7];
+    int last_socket_ = -1;
+    bool activated_ = false;
+    uint64_t socket_tx_ = 0;            // socket payload, as reported by +UGCNTRD
+    uint64_t socket_rx_ = 0;
+};
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "module_registry.h"
+#include "flash_simulator.h"
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <cstring>
+
+namespace {
+
+const uint32_t BASE = 0x8000000;
+const uint32_t SECTOR = 16384;
+
+const module_bounds_t system_part = { 0x10000, 0x8000000, 0x8010000, MODULE_FUNCTION_SYSTEM_PART, 1, MODULE_STORE_MAIN };
+const module_bounds_t user_part = { 0x8000, 0x8010000, 0x8018000, MODULE_FUNCTION_USER_PART, 1, MODULE_STORE_MAIN };
+const module_bounds_t factory = { 0x8000, 0x8018000, 0x8020000, MODULE_FUNCTION_USER_PART, 1, MODULE_STORE_FACTORY };
+const module_bounds_t* const bounds[] = { &system_part, &user_part, &factory };
+const uint32_t OTA_ADDRESS = 0x8020000;
+
+FlashSimulator* flash;
+
+uint32_t read_u32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (uint32_t(data[3]) << 24);
+}
+
+/**
+ * Stands in for fetch_module(): a module is its length, the data and a checksum
+ * of the data, all read through the simulated flash so the reads are counted.
+ */
+bool fetch(hal_module_t* target, const module_bounds_t* bounds, bool userDepsOptional, uint16_t check_flags) {
+    std::memset(target, 0, sizeof(*target));
+    // let other threads run while the module is half fetched
+    std::this_thread::sleep_for(std::chrono::microseconds(10));
+    target->bounds = *bounds;
+    uint8_t header[4];
+    flash->io()->read(flash->io(), bounds->start_address, header, sizeof(header));
+    uint32_t length = read_u32(header);
+    if (length > bounds->maximum_size - 8)
+        return false;
+    target->info = (const module_info_t*)flash->at(bounds->start_address);
+    target->validity_checked = check_flags;
+    if (check_flags & MODULE_VALIDATION_INTEGRITY) {
+        std::vector<uint8_t> data(length + 4);
+        flash->io()->read(flash->io(), bounds->start_address + 4, data.data(), data.size());
+        uint32_t sum = std::accumulate(data.begin(), data.end() - 4, 0u);
+        if (sum == read_u32(&data[length]))
+            target->validity_result |= MODULE_VALIDATION_INTEGRITY;
+    }
+    return true;
+}
+
+std::vector<uint8_t> module(uint32_t length, uint8_t seed) {
+    std::vector<uint8_t> data(4 + length + 4);
+    data[0] = length & 0xFF; data[1] = length >> 8;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        data[4 + i] = uint8_t(i * seed);
+        sum += data[4 + i];
+    }
+    for (int i = 0; i < 4; i++)
+        data[4 + length + i] = uint8_t(sum >> (8 * i));
+    return data;
+}
+
+struct Device {
+    FlashSimulator internal;
+    ModuleRegistry registry;
+
+    Device() : internal(BASE, SECTOR, 10), registry(bounds, 3, fetch, MODULE_VALIDATION_INTEGRITY) {
+        flash = &internal;
+        internal.fill(system_part.start_address, module(60000, 3));
+        internal.fill(user_part.start_address, module(20000, 5));
+        internal.fill(factory.start_address, module(16000, 7));
+    }
+
+    // the modules fetched every time, as before the registry
+    void fetch_all(std::vector<hal_module_t>& modules) {
+        modules.resize(3);
+        for (unsigned i = 0; i < 3; i++)
+            fetch(&modules[i], bounds[i], false, MODULE_VALIDATION_INTEGRITY);
+    }
+};
+
+} // namespace
+
+SCENARIO("the module registry validates modules once", "[module_registry]") {
+    Device device;
+    const unsigned queries = 10;    // describe, module info JSON, OTA validation...
+
+    std::vector<hal_module_t> fetched;
+    for (unsigned i = 0; i < queries; i++)
+        device.fetch_all(fetched);
+    uint64_t uncached = device.internal.stats().read_bytes;
+    device.internal.reset_stats();
+
+    for (unsigned i = 0; i < queries; i++) {
+        hal_module_t modules[ModuleRegistry::MAX_MODULES];
+        REQUIRE(device.registry.copy(modules) == 3);
+        for (unsigned m = 0; m < 3; m++) {
+            REQUIRE(modules[m].info == fetched[m].info);
+            REQUIRE(modules[m].validity_result == MODULE_VALIDATION_INTEGRITY);
+        }
+    }
+    REQUIRE(device.internal.stats().reads == 3 * 2);
+    uint64_t cached = device.internal.stats().read_bytes * queries;
+    REQUIRE(cached == uncached);
+}
+
+SCENARIO("the module registry refreshes when a module is written", "[module_registry]") {
+    Device device;
+    device.registry.refresh();
+    device.internal.reset_stats();
+
+    WHEN("the OTA region is written") {
+        device.registry.invalidate(OTA_ADDRESS, SECTOR);
+        THEN("the modules are not fetched again") {
+            REQUIRE(device.registry.current());
+            device.registry.refresh();
+            REQUIRE(device.internal.stats().reads == 0);
+        }
+    }
+
+    WHEN("a module is corrupted") {
+        device.internal.at(user_part.start_address + 100)[0] ^= 0xFF;
+        device.registry.invalidate(user_part.start_address + 100, 1);
+        THEN("the modules are validated again") {
+            REQUIRE_FALSE(device.registry.current());
+            hal_module_t modules[ModuleRegistry::MAX_MODULES];
+            device.registry.copy(modules);
+            REQUIRE(device.internal.stats().reads == 3 * 2);
+            REQUIRE(modules[0].validity_result == MODULE_VALIDATION_INTEGRITY);
+            REQUIRE(modules[1].validity_result == 0);
+            REQUIRE(modules[2].validity_result == MODULE_VALIDATION_INTEGRITY);
+        }
+    }
+
+    WHEN("a write ends where a module starts") {
+        device.registry.invalidate(user_part.start_address - 16, 16);
+        THEN("the module that ends there is refreshed") {
+            REQUIRE_FALSE(device.registry.current());
+        }
+    }
+}
+
+SCENARIO("the modules are copied whole while other threads refresh them", "[module_registry]") {
+    Device device;
+    std::atomic<bool> done(false);
+    // the OTA writer invalidates the registry and another reader fetches it again
+    std::thread writer([&] {
+        while (!done)
+            device.registry.invalidate(user_part.start_address, SECTOR);
+    });
+    std::thread reader([&] {
+        hal_module_t modules[ModuleRegistry::MAX_MODULES];
+        while (!done)
+            device.registry.copy(modules);
+    });
+    bool whole = true;
+    for (int i = 0; i < 50 && whole; i++) {
+        // let the other threads run between the copies
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+        hal_module_t modules[ModuleRegistry::MAX_MODULES];
+        device.registry.copy(modules);
+        for (unsigned m = 0; m < 3; m++)
+            whole = whole && modules[m].info && modules[m].validity_result == MODULE_VALIDATION_INTEGRITY;
+    }
+    done = true;
+    writer.join();
+    reader.join();
+    REQUIRE(whole);
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "ota_chunk_writer.h"
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+
+namespace {
+
+const uint32_t CHUNK_SIZE = 512;
+
+/**
+ * Flash that takes a while to program.
+ */
+struct SlowFlash {
+    std::vector<uint8_t> data;
+    std::chrono::microseconds latency;
+    std::atomic<unsigned> writes;
+    int fail_at;        // the write that fails, or -1
+    std::thread::id writer;     // the thread that made the last write
+    std::atomic<unsigned> completed;    // writes reported by the writer
+
+    SlowFlash(size_t size, unsigned latency_us=0)
+        : data(size, 0xFF), latency(latency_us), writes(0), fail_at(-1), completed(0) {}
+
+    static int write(void* context, uint32_t address, const uint8_t* chunk, uint32_t length) {
+        SlowFlash& flash = *(SlowFlash*)context;
+        std::this_thread::sleep_for(flash.latency);
+        if (int(flash.writes.load())==flash.fail_at)
+            return 5;
+        std::copy(chunk, chunk+length, flash.data.begin()+address);
+        flash.writer = std::this_thread::get_id();
+        flash.writes++;
+        return 0;
+    }
+
+    static void written(void* context) {
+        ((SlowFlash*)context)->completed++;
+    }
+};
+
+std::vector<uint8_t> image(size_t length) {
+    std::vector<uint8_t> data(length);
+    for (size_t i=0; i<length; i++)
+        data[i] = uint8_t(i*13 + i/CHUNK_SIZE);
+    return data;
+}
+
+int write_image(ChunkWriter& writer, const std::vector<uint8_t>& file, uint32_t chunk_size=CHUNK_SIZE) {
+    int result = 0;
+    for (uint32_t offset=0; offset<file.size() && !result; offset+=chunk_size)
+        result = writer.write(offset, file.data()+offset, std::min<uint32_t>(chunk_size, file.size()-offset));
+    return result;
+}
+
+} // namespace
+
+SCENARIO("chunks queued to the writer are written in order", "[ota_chunk_writer]") {
+    std::vector<uint8_t> file = image(CHUNK_SIZE*20);
+    SlowFlash flash(file.size(), 200);
+    ChunkWriter writer(SlowFlash::write, &flash);
+    REQUIRE(writer.begin(4, CHUNK_SIZE));
+    REQUIRE(writer.is_active());
+
+    REQUIRE(write_image(writer, file)==0);
+    REQUIRE(writer.end()==0);
+    REQUIRE_FALSE(writer.is_active());
+    REQUIRE(flash.writes==20u);
+    REQUIRE(flash.data==file);
+}
+
+SCENARIO("a queued chunk is written after the writer returns", "[ota_chunk_writer]") {
+    std::vector<uint8_t> file = image(CHUNK_SIZE);
+    SlowFlash flash(file.size(), 50000);
+    ChunkWriter writer(SlowFlash::write, &flash);
+    REQUIRE(writer.begin(4, CHUNK_SIZE));
+
+    std::vector<uint8_t> chunk = file;
+    REQUIRE(writer.write(0, chunk.data(), CHUNK_SIZE)==0);
+    REQUIRE(flash.writes==0u);
+    // the chunk was copied, so the buffer can be reused straight away
+    std::fill(chunk.begin(), chunk.end(), 0);
+
+    REQUIRE(writer.flush()==0);
+    REQUIRE(flash.writes==1u);
+    REQUIRE(flash.data==file);
+}
+
+SCENARIO("the writer thread is kept for the updates that follow", "[ota_chunk_writer]") {
+    std::vector<uint8_t> file = image(CHUNK_SIZE*8);
+    SlowFlash flash(file.size(), 200);
+    ChunkWriter writer(SlowFlash::write, &flash);
+
+    REQUIRE(writer.begin(4, CHUNK_SIZE));
+    REQUIRE(write_image(writer, file)==0);
+    REQUIRE(writer.end()==0);
+    std::thread::id first = flash.writer;
+    REQUIRE(first!=std::this_thread::get_id());
+
+    REQUIRE(writer.begin(4, CHUNK_SIZE));
+    REQUIRE(write_image(writer, file)==0);
+    REQUIRE(writer.end()==0);
+    REQUIRE(flash.writer==first);
+    REQUIRE(flash.writes==16u);
+}
+
+SCENARIO("chunks waiting to be written aren't recorded as received", "[ota_chunk_writer]") {
+    std::vector<uint8_t> file = image(CHUNK_SIZE*6);
+    SlowFlash flash(file.size(), 200000);
+    ChunkWriter writer(SlowFlash::write, &flash, SlowFlash::written);
+    REQUIRE(writer.begin(4, CHUNK_SIZE));
+
+    // chunks 1 to 4 are received, and chunk 0 before an interruption
+    std::vector<uint8_t> bitmap = { 0x1F };
+    for (uint32_t i=1; i<5; i++)
+        REQUIRE(writer.write(i*CHUNK_SIZE, file.data()+i*CHUNK_SIZE, CHUNK_SIZE)==0);
+    std::vector<uint8_t> recorded = bitmap;
+    writer.clear_pending(0, CHUNK_SIZE, recorded.data(), recorded.size());
+    // the chunks queued last are still waiting, while chunk 0 was written before
+    REQUIRE(recorded[0]==0x01);
+
+    REQUIRE(writer.end()==0);
+    REQUIRE(flash.completed==4u);
+    recorded = bitmap;
+    writer.clear_pending(0, CHUNK_SIZE, recorded.data(), recorded.size());
+    REQUIRE(recorded==bitmap);
+}
+
+SCENARIO("a failed write is reported by the writes after it and when the writer ends", "[ota_chunk_writer]") {
+    std::vector<uint8_t> file = image(CHUNK_SIZE*20);
+    SlowFlash flash(file.size());
+    flash.fail_at = 3;
+    ChunkWriter writer(SlowFlash::write, &flash);
+    REQUIRE(writer.begin(4, CHUNK_SIZE));
+
+    REQUIRE(write_image(writer, file)==5);
+    REQUIRE(writer.end()==5);
+    // nothing is written after the failure
+    REQUIRE(flash.writes==3u);
+
+    // a new update starts afresh
+    flash.fail_at = -1;
+    REQUIRE(writer.begin(4, CHUNK_SIZE));
+    REQUIRE(write_image(writer, file)==0);
+    REQUIRE(writer.end()==0);
+    REQUIRE(flash.data==file);
+}
+
+SCENARIO("chunks larger than the queue's slots are written after those queued", "[ota_chunk_writer]") {
+    std::vector<uint8_t> file = image(CHUNK_SIZE*8);
+    SlowFlash flash(file.size(), 200);
+    ChunkWriter writer(SlowFlash::write, &flash);
+    REQUIRE(writer.begin(2, CHUNK_SIZE/2));
+
+    REQUIRE(writer.write(0, file.data(), CHUNK_SIZE/2)==0);
+    REQUIRE(writer.write(CHUNK_SIZE/2, file.data()+CHUNK_SIZE/2, CHUNK_SIZE/2)==0);
+    REQUIRE(writer.write(CHUNK_SIZE, file.data()+CHUNK_SIZE, CHUNK_SIZE*7)==0);
+    REQUIRE(writer.end()==0);
+    REQUIRE(flash.writes==3u);
+    REQUIRE(flash.data==file);
+}
+
+SCENARIO("chunks are written directly when the writer isn't active", "[ota_chunk_writer]") {
+    std::vector<uint8_t> file = image(CHUNK_SIZE*4);
+    SlowFlash flash(file.size());
+    ChunkWriter writer(SlowFlash::write, &flash);
+    REQUIRE_FALSE(writer.begin(0, CHUNK_SIZE));
+    REQUIRE_FALSE(writer.is_active());
+
+    REQUIRE(writer.write(0, file.data(), CHUNK_SIZE)==0);
+    REQUIRE(flash.writes==1u);
+    REQUIRE(writer.end()==0);
+}
+
+SCENARIO("benchmark OTA chunk writes with and without the writer", "[.][benchmark][ota_chunk_writer]") {
+    typedef std::chrono::steady_clock clock;
+    // each chunk takes about as long to receive as to program
+    const std::chrono::microseconds receive(2000);
+    const unsigned program_us = 2000;
+    std::vector<uint8_t> file = image(CHUNK_SIZE*100);
+
+    auto run = [&](bool pipelined) {
+        SlowFlash flash(file.size(), program_us);
+        ChunkWriter writer(SlowFlash::write, &flash);
+        if (pipelined)
+            writer.begin(4, CHUNK_SIZE);
+        auto start = clock::now();
+        for (uint32_t offset=0; offset<file.size(); offset+=CHUNK_SIZE) {
+            std::this_thread::sleep_for(receive);
+            REQUIRE(writer.write(offset, file.data()+offset, CHUNK_SIZE)==0);
+        }
+        REQUIRE(writer.end()==0);
+        REQUIRE(flash.data==file);
+        return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now()-start).count();
+    };
+
+    auto direct = run(false);
+    auto pipelined = run(true);
+    double kb = file.size()/1024.0;
+    std::cout << file.size() << " byte update, 2ms to receive and 2ms to program each chunk: written directly "
+            << int(kb*1000/direct) << "KB/s, written by the writer " << int(kb*1000/pipelined) << "KB/s" << std::endl;
+}
@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Tests the virtual device socket HAL over the loopback interface.
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "catch.hpp"
+#include "socket_hal.h"
+#include "device_context.h"
+
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+extern "C" void core_log(const char* msg, ...) {
+}
+
+namespace {
+
+const uint16_t TEST_SOCKET_COUNT = 256;
+
+struct ConfigureSockets {
+    ConfigureSockets() {
+        current_device().config.socket_count = TEST_SOCKET_COUNT;
+    }
+} configure_sockets;
+
+const uint16_t TEST_PORT = 19321;
+
+sockaddr_t loopback(uint16_t port) {
+    sockaddr_t addr = {};
+    addr.sa_family = AF_INET;
+    addr.sa_data[0] = port >> 8;
+    addr.sa_data[1] = port & 0xFF;
+    addr.sa_data[2] = 127;
+    addr.sa_data[5] = 1;
+    return addr;
+}
+
+sock_handle_t accept_one(sock_handle_t server) {
+    sock_handle_t ready;
+    for (int i = 0; i < 100; i++) {
+        sock_handle_t client = socket_accept(server);
+        if (socket_handle_valid(client)) {
+            return client;
+        }
+        socket_wait_readable(&ready, 1, 10, nullptr);
+    }
+    return socket_handle_invalid();
+}
+
+// Connects a client to the server and returns both ends of the connection
+void connect_pair(sock_handle_t server, uint16_t port, sock_handle_t& client, sock_handle_t& accepted) {
+    client = socket_create(AF_INET, SOCK_STREAM, IPPROTO_TCP, 0, 0);
+    REQUIRE(socket_handle_valid(client));
+    sockaddr_t addr = loopback(port);
+    REQUIRE(socket_connect(client, &addr, sizeof(addr)) == 0);
+    accepted = accept_one(server);
+    REQUIRE(socket_handle_valid(accepted));
+}
+
+int receive_all(sock_handle_t sd, char* buf, int len) {
+    int total = 0;
+    while (total < len) {
+        int n = socket_receive(sd, buf + total, len - total, 1000);
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+} // namespace
+
+SCENARIO("TCP data round trips over the loopback interface", "[socket_hal]") {
+    sock_handle_t server = socket_create_tcp_server(TEST_PORT, 0);
+    REQUIRE(socket_handle_valid(server));
+    sock_handle_t client, accepted;
+    connect_pair(server, TEST_PORT, client, accepted);
+
+    char buf[32] = {};
+    // nothing to read yet and the call doesn't block
+    REQUIRE(socket_receive(accepted, buf, sizeof(buf), 0) == 0);
+
+    REQUIRE(socket_send(client, "hello", 5) == 5);
+    REQUIRE(receive_all(accepted, buf, 5) == 5);
+    REQUIRE(std::string(buf, 5) == "hello");
+
+    sock_iovec_t iov[] = { { "abc", 3 }, { "", 0 }, { "defgh", 5 } };
+    REQUIRE(socket_sendv(accepted, iov, 3, nullptr) == 8);
+    REQUIRE(receive_all(client, buf, 8) == 8);
+    REQUIRE(std::string(buf, 8) == "abcdefgh");
+
+    sock_peer_t peer = {};
+    REQUIRE(socket_peer(accepted, &peer, nullptr) == 0);
+    REQUIRE(peer.address.ipv4 == 0x7F000001);
+
+    socket_close(client);
+    REQUIRE(socket_receive(accepted, buf, sizeof(buf), 1000) < 0);
+    REQUIRE(socket_active_status(accepted) == SOCKET_STATUS_INACTIVE);
+    socket_close(accepted);
+    socket_close(server);
+}
+
+SCENARIO("readable sockets are reported by socket_wait_readable", "[socket_hal]") {
+    sock_handle_t server = socket_create_tcp_server(TEST_PORT + 1, 0);
+    REQUIRE(socket_handle_valid(server));
+    sock_handle_t client, accepted;
+    connect_pair(server, TEST_PORT + 1, client, accepted);
+
+    sock_handle_t ready[8];
+    REQUIRE(socket_wait_readable(ready, 8, 0, nullptr) == 0);
+
+    REQUIRE(socket_send(client, "x", 1) == 1);
+    REQUIRE(socket_wait_readable(ready, 8, 1000, nullptr) == 1);
+    REQUIRE(ready[0] == accepted);
+
+    char c;
+    REQUIRE(socket_receive(accepted, &c, 1, 0) == 1);
+    REQUIRE(socket_wait_readable(ready, 8, 0, nullptr) == 0);
+
+    socket_close(client);
+    socket_close(accepted);
+    socket_close(server);
+}
+
+SCENARIO("UDP datagrams round trip with the sender address", "[socket_hal]") {
+    sock_handle_t a = socket_create(AF_INET, SOCK_DGRAM, IPPROTO_UDP, TEST_PORT + 2, 0);
+    sock_handle_t b = socket_create(AF_INET, SOCK_DGRAM, IPPROTO_UDP, TEST_PORT + 3, 0);
+    REQUIRE(socket_handle_valid(a));
+    REQUIRE(socket_handle_valid(b));
+
+    char buf[16];
+    sockaddr_t from = {};
+    socklen_t from_len = sizeof(from);
+    REQUIRE(socket_receivefrom(b, buf, sizeof(buf), 0, &from, &from_len) == 0);
+
+    sockaddr_t to = loopback(TEST_PORT + 3);
+    REQUIRE(socket_sendto(a, "ping", 4, 0, &to, sizeof(to)) == 4);
+    sock_handle_t ready;
+    REQUIRE(socket_wait_readable(&ready, 1, 1000, nullptr) == 1);
+    REQUIRE(ready == b);
+    REQUIRE(socket_receivefrom(b, buf, sizeof(buf), 0, &from, &from_len) == 4);
+    REQUIRE(std::string(buf, 4) == "ping");
+    REQUIRE(((from.sa_data[0] << 8) | from.sa_data[1]) == TEST_PORT + 2);
+
+    socket_close(a);
+    socket_close(b);
+}
+
+SCENARIO("the socket table is bounded by the configured socket count", "[socket_hal]") {
+    std::vector<sock_handle_t> handles;
+    for (;;) {
+        sock_handle_t h = socket_create(AF_INET, SOCK_STREAM, IPPROTO_TCP, 0, 0);
+        if (!socket_handle_valid(h)) {
+            break;
+        }
+        handles.push_back(h);
+        REQUIRE(handles.size() <= TEST_SOCKET_COUNT);
+    }
+    REQUIRE(handles.size() == TEST_SOCKET_COUNT);
+    for (auto h : handles) {
+        socket_close(h);
+    }
+    sock_handle_t h = socket_create(AF_INET, SOCK_STREAM, IPPROTO_TCP, 0, 0);
+    REQUIRE(socket_handle_valid(h));
+    socket_close(h);
+}
+
+SCENARIO("each device has its own socket table", "[socket_hal]") {
+    sock_handle_t h = socket_create(AF_INET, SOCK_STREAM, IPPROTO_TCP, 0, 0);
+    REQUIRE(socket_handle_valid(h));
+    {
+        DeviceContext device;
+        device.config.socket_count = 1;
+        DeviceScope scope(device);
+        REQUIRE(socket_active_status(h) == SOCKET_STATUS_INACTIVE);
+        sock_handle_t other = socket_create(AF_INET, SOCK_STREAM, IPPROTO_TCP, 0, 0);
+        REQUIRE(other == 0);
+        REQUIRE_FALSE(socket_handle_valid(socket_create(AF_INET, SOCK_STREAM, IPPROTO_TCP, 0, 0)));
+    }
+    REQUIRE(socket_active_status(h) == SOCKET_STATUS_ACTIVE);
+    socket_close(h);
+}
+
+SCENARIO("socket traffic is accounted to the socket and its subsystem", "[socket_hal]") {
+    socket_usage_stats_t before = {}, after = {}, stats = {};
+    before.size = after.size = stats.size = sizeof(stats);
+    REQUIRE(socket_usage_total(SOCKET_USAGE_CLOUD_PING, &before, nullptr) == 0);
+
+    sock_handle_t a = socket_create(AF_INET, SOCK_DGRAM, IPPROTO_UDP, TEST_PORT + 5, 0);
+    sock_handle_t b = socket_create(AF_INET, SOCK_DGRAM, IPPROTO_UDP, TEST_PORT + 6, 0);
+    REQUIRE(socket_set_usage(a, SOCKET_USAGE_CLOUD_PING, nullptr) == 0);
+    REQUIRE(socket_set_usage(a, SOCKET_USAGE_COUNT, nullptr) < 0);
+    sockaddr_t to = loopback(TEST_PORT + 6);
+    REQUIRE(socket_sendto(a, "ping", 4, 0, &to, sizeof(to)) == 4);
+    REQUIRE(socket_sendto(a, "ping!", 5, 0, &to, sizeof(to)) == 5);
+    // the reply is accounted to the subsystem of the receiving socket
+    sockaddr_t reply = loopback(TEST_PORT + 5);
+    REQUIRE(socket_sendto(b, "ack", 3, 0, &reply, sizeof(reply)) == 3);
+    char buf[16];
+    sockaddr_t from;
+    socklen_t size = sizeof(from);
+    int received = 0;
+    for (int i = 0; i < 100 && received <= 0; i++) {
+        socket_wait_readable(nullptr, 0, 10, nullptr);
+        received = socket_receivefrom(a, buf, sizeof(buf), 0, &from, &size);
+    }
+    REQUIRE(received == 3);
+
+    REQUIRE(socket_usage(a, &stats, nullptr) == 0);
+    REQUIRE(stats.tx_bytes == 9);
+    REQUIRE(stats.tx_packets == 2);
+    REQUIRE(stats.rx_bytes == 3);
+    REQUIRE(stats.rx_packets == 1);
+    REQUIRE(socket_usage_total(SOCKET_USAGE_CLOUD_PING, &after, nullptr) == 0);
+    REQUIRE(after.tx_bytes == before.tx_bytes + 9);
+    REQUIRE(after.rx_bytes == before.rx_bytes + 3);
+
+    // a caller compiled against a smaller structure only gets what fits
+    socket_usage_stats_t partial = {};
+    partial.size = offsetof(socket_usage_stats_t, tx_packets);
+    REQUIRE(socket_usage(a, &partial, nullptr) == 0);
+    REQUIRE(partial.rx_bytes == 3);
+    REQUIRE(partial.tx_packets == 0);
+
+    socket_close(a);
+    socket_close(b);
+    REQUIRE(socket_usage(a, &stats, nullptr) < 0);
+}
+
+SCENARIO("benchmark echo throughput across many connections", "[.][benchmark][socket_hal]") {
+    const unsigned connections = 100;
+    const size_t message_size = 512;
+    const unsigned rounds = 200;
+
+    sock_handle_t server = socket_create_tcp_server(TEST_PORT + 4, 0);
+    REQUIRE(socket_handle_valid(server));
+    std::vector<sock_handle_t> clients(connections), accepted(connections);
+    for (unsigned i = 0; i < connections; i++) {
+        connect_pair(server, TEST_PORT + 4, clients[i], accepted[i]);
+    }
+
+    std::vector<char> message(message_size, 'm');
+    std::vector<char> buf(message_size);
+    std::vector<sock_handle_t> ready(connections * 2);
+    size_t bytes = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned r = 0; r < rounds; r++) {
+        for (auto c : clients) {
+            REQUIRE(socket_send(c, message.data(), message.size()) == (int)message.size());
+        }
+        // echo everything back, driven by readiness
+        size_t pending = connections * message_size * 2;
+        while (pending) {
+            int n = socket_wait_readable(ready.data(), ready.size(), 1000, nullptr);
+            REQUIRE(n > 0);
+            for (int i = 0; i < n; i++) {
+                int len = socket_receive(ready[i], buf.data(), buf.size(), 0);
+                REQUIRE(len >= 0);
+                pending -= len;
+                bytes += len;
+                if (std::find(accepted.begin(), accepted.end(), ready[i]) != accepted.end()) {
+                    REQUIRE(socket_send(ready[i], buf.data(), len) == len);
+                }
+            }
+        }
+    }
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << connections << " connections: " << bytes << " bytes in " << micros << "us, "
+            << (bytes / 1024.0) / (micros / 1e6) << " KB/s" << std::endl;
+
+    for (unsigned i = 0; i < connections; i++) {
+        socket_close(clients[i]);
+        socket_close(accepted[i]);
+    }
+    socket_close(server);
+}
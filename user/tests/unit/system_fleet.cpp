@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs a fleet of two devices against a loopback server. The cloud protocol is
+// replaced by a fake whose handshake sends the device ID, so the server can tell
+// which device each connection or datagram came from.
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include "system_fleet.h"
+#include "device_context.h"
+#include "socket_hal.h"
+#include "inet_hal.h"
+#include "ota_flash_hal.h"
+#include "core_hal.h"
+#include "deviceid_hal.h"
+#undef WARN
+#undef INFO
+
+#include "catch.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+const uint16_t TEST_PORT = 19341;
+
+const char* DEVICE_A = "0123456789abcdef01234567";
+const char* DEVICE_B = "76543210fedcba9876543210";
+
+struct FakeProtocol
+{
+    ProtocolFactory factory;
+    SparkCallbacks callbacks;
+    std::string id;
+    std::string id_at_handshake;
+    int handshakes = 0;
+    int loops = 0;
+};
+
+std::vector<std::unique_ptr<FakeProtocol>> protocols;
+
+uint16_t server_port = 0;
+
+FakeProtocol& fake(ProtocolFacade* protocol)
+{
+    return *reinterpret_cast<FakeProtocol*>(protocol);
+}
+
+std::string make_fleet()
+{
+    char dir[] = "/tmp/fleetXXXXXX";
+    REQUIRE(mkdtemp(dir));
+    for (const char* id : { DEVICE_A, DEVICE_B, "not_a_device" }) {
+        std::string device = std::string(dir) + "/" + id;
+        mkdir(device.c_str(), 0700);
+        std::ofstream(device + "/device_key.der") << "key " << id;
+    }
+    return dir;
+}
+
+/**
+ * Configures this process's device with a protocol for the fleet's devices to copy.
+ */
+struct ProcessProtocol
+{
+    ProtocolFactory previous;
+
+    ProcessProtocol(ProtocolFactory protocol) : previous(current_device().config.protocol)
+    {
+        current_device().config.protocol = protocol;
+    }
+
+    ~ProcessProtocol()
+    {
+        current_device().config.protocol = previous;
+    }
+};
+
+std::string device_id(const uint8_t* id)
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string result;
+    for (int i=0; i<12; i++) {
+        result += hex[id[i] >> 4];
+        result += hex[id[i] & 0xF];
+    }
+    return result;
+}
+
+// Polls the fleet until both devices have completed a handshake
+void connect_fleet(Fleet& fleet)
+{
+    for (int i=0; i<1000 && protocols.size()==2 && !(protocols[0]->loops && protocols[1]->loops); i++) {
+        fleet.poll();
+    }
+}
+
+} // namespace
+
+// The cloud protocol and the HAL functions the fleet uses that the runner doesn't link.
+
+ProtocolFacade* create_protocol(ProtocolFactory factory)
+{
+    protocols.emplace_back(new FakeProtocol());
+    protocols.back()->factory = factory;
+    return reinterpret_cast<ProtocolFacade*>(protocols.back().get());
+}
+
+void spark_protocol_init(ProtocolFacade* protocol, const char* id, const SparkKeys& keys,
+        const SparkCallbacks& callbacks, const SparkDescriptor& descriptor, void* reserved)
+{
+    fake(protocol).id = device_id((const uint8_t*)id);
+    fake(protocol).callbacks = callbacks;
+}
+
+int spark_protocol_handshake(ProtocolFacade* protocol, void* reserved)
+{
+    FakeProtocol& p = fake(protocol);
+    p.handshakes++;
+    p.id_at_handshake = device_id(current_device().config.device_id);
+    return p.callbacks.send((const unsigned char*)p.id.c_str(), p.id.length(), nullptr)==int(p.id.length()) ? 0 : -1;
+}
+
+bool spark_protocol_event_loop(ProtocolFacade* protocol, void* reserved)
+{
+    fake(protocol).loops++;
+    return true;
+}
+
+unsigned HAL_device_ID(uint8_t* dest, unsigned destLen)
+{
+    return current_device().config.fetchDeviceID(dest, destLen);
+}
+
+bool HAL_Feature_Get(HAL_Feature feature)
+{
+    return feature==FEATURE_CLOUD_UDP && current_device().config.get_protocol()==PROTOCOL_DTLS;
+}
+
+void HAL_FLASH_Read_ServerAddress(ServerAddress* server_addr)
+{
+    memset(server_addr, 0, sizeof(ServerAddress));
+    server_addr->addr_type = IP_ADDRESS;
+    server_addr->ip = 0x7F000001;
+    server_addr->port = server_port;
+}
+
+void HAL_FLASH_Read_ServerPublicKey(uint8_t* keyBuffer)
+{
+}
+
+int HAL_FLASH_Read_CorePrivateKey(uint8_t* keyBuffer, private_key_generation_t* generation)
+{
+    return 0;
+}
+
+bool HAL_OTA_Flashed_GetStatus(void)
+{
+    return false;
+}
+
+void HAL_OTA_Flashed_ResetStatus(void)
+{
+}
+
+uint32_t HAL_Core_Compute_CRC32(const uint8_t* pBuffer, uint32_t bufferSize)
+{
+    return 0;
+}
+
+int inet_gethostbyname(const char* hostname, uint16_t hostnameLen, HAL_IPAddress* out_ip_addr,
+        network_interface_t nif, void* reserved)
+{
+    return -1;
+}
+
+// device_config.cpp needs boost::program_options, which the runner doesn't link.
+size_t DeviceConfig::hex2bin(const std::string& hex, uint8_t* dest, size_t destLen)
+{
+    size_t len = std::min(hex.length()/2, destLen);
+    for (size_t i=0; i<len; i++) {
+        dest[i] = std::strtoul(hex.substr(i*2, 2).c_str(), nullptr, 16);
+    }
+    return len;
+}
+
+SCENARIO("a fleet runs two devices, each with its own TCP session", "[fleet]") {
+    protocols.clear();
+    server_port = TEST_PORT;
+    sock_handle_t server = socket_create_tcp_server(server_port, 0);
+    REQUIRE(socket_handle_valid(server));
+
+    ProcessProtocol process(PROTOCOL_LIGHTSSL);
+    Fleet fleet;
+    REQUIRE(fleet.load(make_fleet()) == 2);
+    REQUIRE(protocols.size() == 2);
+    connect_fleet(fleet);
+
+    std::set<std::string> ids;
+    for (auto& protocol : protocols) {
+        REQUIRE(protocol->factory == PROTOCOL_LIGHTSSL);
+        REQUIRE(protocol->handshakes == 1);
+        REQUIRE(protocol->loops > 0);
+        // the device's own HAL state is current while its protocol runs
+        REQUIRE(protocol->id_at_handshake == protocol->id);
+        ids.insert(protocol->id);
+    }
+    REQUIRE(ids == std::set<std::string>({ DEVICE_A, DEVICE_B }));
+
+    // each device connected separately and identified itself
+    std::set<std::string> received;
+    for (int i=0; i<2; i++) {
+        sock_handle_t accepted = socket_accept(server);
+        REQUIRE(socket_handle_valid(accepted));
+        char buf[24];
+        REQUIRE(socket_receive(accepted, buf, sizeof(buf), 1000) == int(sizeof(buf)));
+        received.insert(std::string(buf, sizeof(buf)));
+        socket_close(accepted);
+    }
+    REQUIRE(received == ids);
+    socket_close(server);
+}
+
+SCENARIO("fleet devices use the configured protocol", "[fleet]") {
+    protocols.clear();
+    server_port = TEST_PORT + 1;
+    sock_handle_t server = socket_create(AF_INET, SOCK_DGRAM, IPPROTO_UDP, server_port, 0);
+    REQUIRE(socket_handle_valid(server));
+
+    ProcessProtocol process(PROTOCOL_DTLS);
+    Fleet fleet;
+    REQUIRE(fleet.load(make_fleet()) == 2);
+    REQUIRE(protocols.size() == 2);
+    connect_fleet(fleet);
+
+    std::set<std::string> ids;
+    for (auto& protocol : protocols) {
+        REQUIRE(protocol->factory == PROTOCOL_DTLS);
+        REQUIRE(protocol->handshakes == 1);
+        REQUIRE(protocol->loops > 0);
+        ids.insert(protocol->id);
+    }
+
+    std::set<std::string> received;
+    for (int i=0; i<2; i++) {
+        char buf[64];
+        sockaddr_t from = {};
+        socklen_t from_len = sizeof(from);
+        sock_handle_t ready;
+        REQUIRE(socket_wait_readable(&ready, 1, 1000, nullptr) == 1);
+        REQUIRE(socket_receivefrom(server, buf, sizeof(buf), 0, &from, &from_len) == 24);
+        received.insert(std::string(buf, 24));
+    }
+    REQUIRE(received == ids);
+    socket_close(server);
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "system_info_json.h"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+// The module info functions are linked into each module from module_info.inc
+extern "C" module_function_t module_function(const module_info_t* mi) {
+    return mi ? module_function_t(mi->module_function) : MODULE_FUNCTION_NONE;
+}
+
+extern "C" uint8_t module_index(const module_info_t* mi) {
+    return mi ? mi->module_index : 0xFF;
+}
+
+namespace {
+
+// The modules of a photon: bootloader, two system parts, user part and factory image
+struct System {
+    module_info_t infos[4];
+    module_info_suffix_t suffix;
+    hal_module_t modules[5];
+    key_value key_values[2];
+    hal_system_info_t info;
+
+    System() {
+        std::memset(this, 0, sizeof(*this));
+        const uint8_t functions[] = { MODULE_FUNCTION_BOOTLOADER, MODULE_FUNCTION_SYSTEM_PART, MODULE_FUNCTION_SYSTEM_PART, MODULE_FUNCTION_USER_PART };
+        const uint8_t indices[] = { 0, 1, 2, 1 };
+        for (unsigned i = 0; i < 4; i++) {
+            infos[i].module_version = 90 + i;
+            infos[i].platform_id = 6;
+            infos[i].module_function = functions[i];
+            infos[i].module_index = indices[i];
+            if (i) {
+                infos[i].dependency.module_function = MODULE_FUNCTION_SYSTEM_PART;
+                infos[i].dependency.module_index = i == 3 ? 2 : i - 1;
+                infos[i].dependency.module_version = 90 + i;
+            }
+        }
+        for (unsigned i = 0; i < 32; i++)
+            suffix.sha[i] = uint8_t(i * 7);
+        for (unsigned i = 0; i < 5; i++) {
+            modules[i].bounds.maximum_size = 0x20000 << (i % 2);
+            modules[i].bounds.store = i == 4 ? MODULE_STORE_FACTORY : MODULE_STORE_MAIN;
+            modules[i].info = i < 4 ? &infos[i] : nullptr;
+            modules[i].suffix = i == 3 ? &suffix : nullptr;
+            modules[i].validity_checked = MODULE_VALIDATION_RANGE | MODULE_VALIDATION_PLATFORM | MODULE_VALIDATION_INTEGRITY;
+            modules[i].validity_result = modules[i].validity_checked;
+        }
+        set_key_value(&key_values[0], "imei", "353162070000000");
+        set_key_value(&key_values[1], "iccid", "89314404000000000000");
+        info.size = sizeof(info);
+        info.platform_id = 6;
+        info.modules = modules;
+        info.module_count = 5;
+        info.key_values = key_values;
+        info.key_value_count = 2;
+    }
+
+    static void set_key_value(key_value* kv, const char* key, const char* value) {
+        kv->key = key;
+        std::strncpy(kv->value, value, sizeof(kv->value) - 1);
+    }
+};
+
+struct Output {
+    std::string text;
+    unsigned calls = 0;
+
+    static bool append(void* appender, const uint8_t* data, size_t length) {
+        Output& output = *static_cast<Output*>(appender);
+        output.text.append((const char*)data, length);
+        output.calls++;
+        return true;
+    }
+};
+
+// the output one token at a time, as before the writer was buffered
+std::string unbuffered(const hal_system_info_t& system, unsigned* calls = nullptr) {
+    Output output;
+    AppendJson json(Output::append, &output);
+    REQUIRE(system_info_to_json(json, system));
+    REQUIRE(json.flush());
+    if (calls)
+        *calls = output.calls;
+    return output.text;
+}
+
+} // namespace
+
+SCENARIO("the system info JSON is written a buffer at a time", "[system_info_json]") {
+    System system;
+    unsigned token_calls = 0;
+    std::string expected = unbuffered(system.info, &token_calls);
+    REQUIRE(expected.find("\"p\":6,\"imei\":\"353162070000000\"") == 0);
+    REQUIRE(expected.find("\"u\":\"00070E15") != std::string::npos);
+
+    Output output;
+    REQUIRE(system_info_to_json(Output::append, &output, system.info));
+    REQUIRE(output.text == expected);
+    REQUIRE(output.calls == (expected.size() + SYSTEM_INFO_JSON_BUFFER_SIZE - 1) / SYSTEM_INFO_JSON_BUFFER_SIZE);
+    REQUIRE(token_calls > 10 * output.calls);
+}
+
+SCENARIO("the buffered JSON writer keeps the bounds of the appender", "[system_info_json]") {
+    System system;
+    std::string expected = unbuffered(system.info);
+    std::vector<uint8_t> buffer(expected.size() + 1, 0);
+
+    WHEN("the JSON fits exactly") {
+        BufferAppender appender(buffer.data(), expected.size());
+        THEN("it is written") {
+            REQUIRE(system_info_to_json(append_instance, &appender, system.info));
+            REQUIRE(std::string((const char*)buffer.data()) == expected);
+            REQUIRE(appender.next() == buffer.data() + expected.size());
+        }
+    }
+
+    WHEN("the JSON doesn't fit") {
+        BufferAppender appender(buffer.data(), expected.size() - 1);
+        THEN("writing fails and nothing is written past the end") {
+            REQUIRE_FALSE(system_info_to_json(append_instance, &appender, system.info));
+            REQUIRE(buffer[expected.size() - 1] == 0);
+        }
+    }
+
+    WHEN("a string is larger than the buffer") {
+        Output output;
+        char small[8];
+        AppendJson json(Output::append, &output, small, sizeof(small));
+        REQUIRE(json.write("ab"));
+        REQUIRE(json.write("a string longer than the buffer"));
+        REQUIRE(json.write('c'));
+        REQUIRE(json.flush());
+        THEN("it is passed on directly, in order") {
+            REQUIRE(output.text == "aba string longer than the bufferc");
+            REQUIRE(output.calls == 3);
+        }
+    }
+}
+
+SCENARIO("benchmark writing the system info JSON", "[.][benchmark][system_info_json]") {
+    System system;
+    const unsigned runs = 20000;
+    std::vector<uint8_t> message(1024);
+
+    for (bool buffered : { false, true }) {
+        size_t length = 0;
+        unsigned calls = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < runs; i++) {
+            // the describe message, as written into the CoAP message
+            struct Counted : BufferAppender {
+                unsigned calls = 0;
+                Counted(uint8_t* start, size_t length) : BufferAppender(start, length) {}
+                bool append(const uint8_t* data, size_t length) { calls++; return BufferAppender::append(data, length); }
+            } appender(message.data(), message.size());
+            if (buffered) {
+                REQUIRE(system_info_to_json(append_instance, &appender, system.info));
+            }
+            else {
+                AppendJson json(append_instance, &appender);
+                REQUIRE(system_info_to_json(json, system.info));
+            }
+            length = appender.next() - message.data();
+            calls = appender.calls;
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << (buffered ? "buffered: " : "token at a time: ") << calls << " calls for " << length
+                << " bytes, " << unsigned(elapsed * 1e9 / runs) << "ns" << std::endl;
+    }
+}
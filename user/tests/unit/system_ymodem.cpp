@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2016 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "system_ymodem.h"
+#include "system_update.h"
+
+#include <deque>
+#include <set>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <iostream>
+
+namespace {
+
+/**
+ * The device's flash, written by the firmware update functions below.
+ */
+struct Flash {
+    std::vector<uint8_t> data;
+    unsigned prepared = 0;
+    unsigned writes = 0;
+
+    void reset(size_t size) {
+        data.assign(size, 0xFF);
+        prepared = writes = 0;
+    }
+} flash;
+
+/**
+ * Plays the sender's side of a YMODEM session, answering what the device writes
+ * with the packets of a single file.
+ */
+class Sender : public Stream {
+    enum State { START, HEADER_SENT, DATA_SENT, EOT_SENT, EOT_ACKED, END_SENT, DONE };
+
+    std::deque<uint8_t> line;   // on the way to the device
+    State state = START;
+    unsigned block = 1;         // the data block last sent
+
+    void send_packet(uint8_t seqno, const uint8_t* data, size_t length, size_t packet_size) {
+        std::vector<uint8_t> payload(data, data+length);
+        payload.resize(packet_size, seqno ? 0x1A : 0);
+        uint16_t crc = YModem::crc16(payload.data(), payload.size());
+        if (corrupt.erase(seqno))
+            payload[packet_size/2] ^= 0x55;
+        line.push_back(packet_size==YModem::PACKET_1K_SIZE ? YModem::STX : YModem::SOH);
+        line.push_back(seqno);
+        line.push_back(~seqno);
+        line.insert(line.end(), payload.begin(), payload.end());
+        line.push_back(crc >> 8);
+        line.push_back(crc & 0xFF);
+        packets++;
+    }
+
+    void send_header() {
+        std::string header = name + '\0' + std::to_string(file.size()) + ' ';
+        send_packet(0, (const uint8_t*)header.data(), header.size(), YModem::PACKET_SIZE);
+    }
+
+    unsigned blocks() {
+        return (file.size() + YModem::PACKET_1K_SIZE - 1) / YModem::PACKET_1K_SIZE;
+    }
+
+    void send_block(unsigned index) {
+        size_t offset = (index-1) * YModem::PACKET_1K_SIZE;
+        send_packet(index, file.data()+offset, std::min<size_t>(YModem::PACKET_1K_SIZE, file.size()-offset), YModem::PACKET_1K_SIZE);
+    }
+
+    void send_eot() {
+        line.push_back(YModem::EOT);
+    }
+
+    void respond(uint8_t c) {
+        if (c==YModem::CA) {
+            aborted = true;
+            state = DONE;
+            return;
+        }
+        std::this_thread::sleep_for(turnaround);
+        bool request = (c==YModem::CRC16 || (c==YModem::STREAM && streams));
+        switch (state) {
+        case START:
+            if (request) {
+                streaming = (c==YModem::STREAM);
+                send_header();
+                state = HEADER_SENT;
+            }
+            break;
+        case HEADER_SENT:
+            if (c==YModem::NAK)
+                send_header();
+            else if (request) {
+                block = 1;
+                send_block(block);
+                if (streaming) {
+                    while (block<blocks())
+                        send_block(++block);
+                    send_eot();
+                    state = EOT_SENT;
+                }
+                else
+                    state = DATA_SENT;
+            }
+            break;
+        case DATA_SENT:
+            if (c==YModem::NAK || (c==YModem::ACK && lost_acks.erase(block))) {
+                send_block(block);
+                resent++;
+            }
+            else if (c==YModem::ACK) {
+                if (block<blocks())
+                    send_block(++block);
+                else {
+                    send_eot();
+                    state = EOT_SENT;
+                }
+            }
+            break;
+        case EOT_SENT:
+            if (c==YModem::NAK)
+                send_eot();
+            else if (c==YModem::ACK)
+                state = EOT_ACKED;
+            break;
+        case EOT_ACKED:
+            if (request) {
+                // an empty header ends the session
+                send_packet(0, nullptr, 0, YModem::PACKET_SIZE);
+                state = END_SENT;
+            }
+            break;
+        case END_SENT:
+            if (c==YModem::ACK)
+                state = DONE;
+            break;
+        case DONE:
+            break;
+        }
+    }
+
+public:
+    std::vector<uint8_t> file;
+    std::string name = "firmware.bin";
+    bool streams = true;                // the sender can stream (YMODEM-G)
+    size_t burst = 64;                  // the most bytes available to the device at once
+    std::chrono::microseconds turnaround = std::chrono::microseconds(0);
+    std::set<unsigned> corrupt;         // blocks that are corrupted when first sent
+    std::set<unsigned> lost_acks;       // blocks the sender sends again as if the ACK was lost
+
+    std::vector<uint8_t> written;       // by the device
+    bool streaming = false;
+    bool aborted = false;
+    unsigned packets = 0;
+    unsigned resent = 0;
+
+    Sender(const std::vector<uint8_t>& file_) : file(file_) {}
+
+    /**
+     * Sends the file header before the device asks for it.
+     */
+    void begin() {
+        send_header();
+        state = HEADER_SENT;
+    }
+
+    bool done() const { return state==DONE && !aborted; }
+
+    int available() override { return std::min(line.size(), burst); }
+
+    int read() override {
+        if (line.empty())
+            return -1;
+        uint8_t c = line.front();
+        line.pop_front();
+        return c;
+    }
+
+    int peek() override { return line.empty() ? -1 : line.front(); }
+
+    void flush() override {}
+
+    size_t write(uint8_t c) override {
+        written.push_back(c);
+        respond(c);
+        return 1;
+    }
+};
+
+std::vector<uint8_t> image(size_t length) {
+    std::vector<uint8_t> data(length);
+    for (size_t i=0; i<length; i++)
+        data[i] = uint8_t(i*7 + i/1024);
+    return data;
+}
+
+/**
+ * Receives the sender's file, and returns the result of YModem::receive_file().
+ */
+int32_t receive(Sender& sender, bool streaming, YModem::file_desc_t& desc) {
+    flash.reset(sender.file.size() + YModem::PACKET_1K_SIZE);
+    FileTransfer::Descriptor tx;
+    YModem ymodem(sender, streaming);
+    int32_t result = ymodem.receive_file(tx, desc);
+    REQUIRE(ymodem.is_streamed()==sender.streaming);
+    return result;
+}
+
+bool received(const Sender& sender) {
+    return std::equal(sender.file.begin(), sender.file.end(), flash.data.begin());
+}
+
+} // namespace
+
+int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags, void*) {
+    file.file_address = 0;
+    flash.prepared++;
+    return 0;
+}
+
+int Spark_Save_Firmware_Chunk(FileTransfer::Descriptor& file, const uint8_t* chunk, void*) {
+    if (file.chunk_address+file.chunk_size>flash.data.size())
+        return 1;
+    std::copy(chunk, chunk+file.chunk_size, flash.data.begin()+file.chunk_address);
+    flash.writes++;
+    return 0;
+}
+
+int Spark_Finish_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags, void*) {
+    return 0;
+}
+
+SCENARIO("the YMODEM CRC is CRC-16/XMODEM", "[ymodem]") {
+    const char* check = "123456789";
+    REQUIRE(YModem::crc16((const uint8_t*)check, 9)==0x31C3);
+    REQUIRE(YModem::crc16((const uint8_t*)check+4, 5, YModem::crc16((const uint8_t*)check, 4))==0x31C3);
+}
+
+SCENARIO("a file is received one packet at a time", "[ymodem]") {
+    Sender sender(image(10*1024+300));
+    YModem::file_desc_t desc;
+    REQUIRE(receive(sender, false, desc)==int32_t(sender.file.size()));
+    REQUIRE(sender.done());
+    REQUIRE(std::string(desc.file_name)=="firmware.bin");
+    REQUIRE(std::string(desc.file_size)=="10540");
+    REQUIRE(flash.prepared==1);
+    REQUIRE(flash.writes==11);
+    REQUIRE(received(sender));
+    // the file is asked for straight away
+    REQUIRE(sender.written.front()==YModem::CRC16);
+}
+
+SCENARIO("a file is streamed when the sender can stream", "[ymodem]") {
+    Sender sender(image(10*1024+300));
+    YModem::file_desc_t desc;
+    REQUIRE(receive(sender, true, desc)==int32_t(sender.file.size()));
+    REQUIRE(sender.done());
+    REQUIRE(sender.streaming);
+    REQUIRE(flash.writes==11);
+    REQUIRE(received(sender));
+    // only the header, the end of the file and the end of the session are acknowledged
+    REQUIRE(std::count(sender.written.begin(), sender.written.end(), YModem::ACK)==3);
+}
+
+SCENARIO("a corrupt packet is sent again", "[ymodem]") {
+    Sender sender(image(8*1024));
+    sender.corrupt = { 3 };
+    YModem::file_desc_t desc;
+    REQUIRE(receive(sender, false, desc)==int32_t(sender.file.size()));
+    REQUIRE(sender.resent==1);
+    REQUIRE(flash.writes==8);
+    REQUIRE(received(sender));
+}
+
+SCENARIO("a packet sent again after a lost ACK is acknowledged without being saved again", "[ymodem]") {
+    Sender sender(image(8*1024));
+    sender.lost_acks = { 2, 5 };
+    YModem::file_desc_t desc;
+    REQUIRE(receive(sender, false, desc)==int32_t(sender.file.size()));
+    REQUIRE(sender.done());
+    REQUIRE(sender.resent==2);
+    REQUIRE(flash.writes==8);
+    REQUIRE(received(sender));
+}
+
+SCENARIO("a corrupt packet aborts a streamed file", "[ymodem]") {
+    Sender sender(image(8*1024));
+    sender.corrupt = { 3 };
+    YModem::file_desc_t desc;
+    REQUIRE(receive(sender, true, desc)==0);
+    REQUIRE(sender.aborted);
+    REQUIRE(flash.writes==2);
+}
+
+SCENARIO("a packet arriving in bytes at a time is received", "[ymodem]") {
+    Sender sender(image(4*1024+1));
+    sender.burst = 7;
+    YModem::file_desc_t desc;
+    REQUIRE(receive(sender, true, desc)==int32_t(sender.file.size()));
+    REQUIRE(received(sender));
+}
+
+SCENARIO("a file the sender has begun sending is received", "[ymodem]") {
+    Sender sender(image(4*1024));
+    sender.begin();
+    YModem::file_desc_t desc;
+    REQUIRE(receive(sender, true, desc)==int32_t(sender.file.size()));
+    REQUIRE(sender.done());
+    REQUIRE(received(sender));
+    // the header is acknowledged without asking for it
+    REQUIRE(sender.written.front()==YModem::ACK);
+}
+
+SCENARIO("benchmark YMODEM throughput with and without streaming", "[.][benchmark][ymodem]") {
+    typedef std::chrono::steady_clock clock;
+    // the time taken for a response to reach the sender and the sender to reply, as over USB
+    const std::chrono::microseconds turnaround(1000);
+    std::vector<uint8_t> file = image(128*1024);
+
+    auto run = [&](bool streaming) {
+        Sender sender(file);
+        sender.turnaround = turnaround;
+        sender.burst = 64;
+        YModem::file_desc_t desc;
+        auto start = clock::now();
+        REQUIRE(receive(sender, streaming, desc)==int32_t(file.size()));
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(clock::now()-start).count();
+        REQUIRE(received(sender));
+        return file.size()/1024.0 * 1000000 / elapsed;
+    };
+
+    double acknowledged = run(false);
+    double streamed = run(true);
+    std::cout << file.size() << " byte file, 1ms turnaround: packet by packet " << int(acknowledged)
+            << "KB/s, streamed " << int(streamed) << "KB/s" << std::endl;
+}
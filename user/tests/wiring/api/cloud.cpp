@@ -188,6 +188,8 @@ test(api_spark_connection) {
 
 #if HAL_PLATFORM_CLOUD_UDP
     API_COMPILE(Particle.keepAlive(20 * 60));
+    API_COMPILE(Particle.keepAlive(20 * 60, 120 * 60));
+    API_COMPILE(Particle.fastResume());
 #endif
 }
 
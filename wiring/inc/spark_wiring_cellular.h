@@ -85,6 +85,7 @@ public:
     bool getDataUsage(CellularData &data_get);
     bool setDataUsage(CellularData &data_set);
     bool resetDataUsage(void);
+    bool getDataUsage(socket_usage_t subsystem, CellularSubsystemData &data_get);
 
     bool setBandSelect(const char* band);
     bool setBandSelect(CellularBand &data_set);
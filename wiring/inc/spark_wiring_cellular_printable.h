@@ -28,6 +28,7 @@
 #if Wiring_Cellular
 
 #include "cellular_hal.h"
+#include "socket_hal.h"
 #include "modem/enums_hal.h"
 
 /*
@@ -81,6 +82,26 @@ bool operator==(const CellularData& lhs,const T& rhs) {
     return false;
 }
 
+/*
+ * CellularSubsystemData
+ *
+ * The data used by the sockets of a subsystem since the device started,
+ * see socket_usage_t.
+ */
+class CellularSubsystemData : public Printable {
+public:
+    /* false when constructed, used to indicate whether
+     * last operation on object was successful or not. */
+    bool ok = false;
+
+    unsigned tx_bytes = 0;
+    unsigned rx_bytes = 0;
+    unsigned tx_packets = 0;
+    unsigned rx_packets = 0;
+
+    virtual size_t printTo(Print& p) const;
+};
+
 /*
  * CellularBand
  */
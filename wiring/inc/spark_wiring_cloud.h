@@ -308,6 +308,32 @@ public:
                                                         sec * 1000, nullptr, nullptr),
                  (void)0);
     }
+
+    /**
+     * Adaptive keep-alive: starts pinging every {@code sec} seconds and probes
+     * longer intervals, up to {@code max_sec}, until the longest interval that keeps
+     * the cloud session on the current network is found. The result is retained.
+     */
+    static void keepAlive(unsigned sec, unsigned max_sec)
+    {
+        keepAlive(sec);
+        CLOUD_FN(spark_protocol_set_connection_property(sp(), particle::protocol::Connection::PING_MAX,
+                                                        max_sec * 1000, nullptr, nullptr),
+                 (void)0);
+    }
+
+    /**
+     * Resumes a retained cloud session, e.g. after waking from deep sleep, without
+     * a round trip to the cloud, so the first publish is sent straight away.
+     * Describe and subscriptions are only resent when they changed, once the
+     * cloud has answered.
+     */
+    static void fastResume(bool enable=true)
+    {
+        CLOUD_FN(spark_protocol_set_connection_property(sp(), particle::protocol::Connection::FAST_RESUME,
+                                                        enable, nullptr, nullptr),
+                 (void)0);
+    }
 #endif
 
 private:
@@ -61,6 +61,19 @@ namespace spark {
         return data_get.ok;
     }
 
+    bool CellularClass::getDataUsage(socket_usage_t subsystem, CellularSubsystemData &data_get) {
+        socket_usage_stats_t stats;
+        stats.size = sizeof(stats);
+        data_get.ok = (socket_usage_total(subsystem, &stats, NULL) == 0);
+        if (data_get.ok) {
+            data_get.tx_bytes = stats.tx_bytes;
+            data_get.rx_bytes = stats.rx_bytes;
+            data_get.tx_packets = stats.tx_packets;
+            data_get.rx_packets = stats.rx_packets;
+        }
+        return data_get.ok;
+    }
+
     bool CellularClass::setDataUsage(CellularData &data_set) {
         data_hal.tx_session = data_set.tx_session;
         data_hal.rx_session = data_set.rx_session;
@@ -47,6 +47,19 @@ size_t CellularData::printTo(Print& p) const
     return n;
 }
 
+size_t CellularSubsystemData::printTo(Print& p) const
+{
+    size_t n = 0;
+    n += p.print((*this).tx_bytes, DEC);
+    n += p.print(',');
+    n += p.print((*this).rx_bytes, DEC);
+    n += p.print(',');
+    n += p.print((*this).tx_packets, DEC);
+    n += p.print(',');
+    n += p.print((*this).rx_packets, DEC);
+    return n;
+}
+
 size_t CellularBand::printTo(Print& p) const
 {
     size_t n = 0;